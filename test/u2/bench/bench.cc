@@ -0,0 +1,172 @@
+// Copyright (c) 2022 PaddlePaddle Authors. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "bench/bench.h"
+
+#include <algorithm>
+#include <cmath>
+#include <iomanip>
+#include <iostream>
+#include <regex>
+#include <sstream>
+#include <utility>
+
+namespace ppspeech {
+namespace bench {
+
+State::State(const std::vector<int64_t>& args, double min_time_s)
+    : args_(args), min_time_ns_(min_time_s * 1e9) {}
+
+bool State::KeepRunning() {
+  if (!started_) {
+    started_ = true;
+    ResumeTiming();
+    return true;
+  }
+  ++iterations_;
+  if (elapsed_ns() < min_time_ns_) return true;
+  PauseTiming();
+  return false;
+}
+
+void State::PauseTiming() {
+  if (paused_) return;
+  accumulated_ns_ +=
+      std::chrono::duration<double, std::nano>(Clock::now() - start_).count();
+  paused_ = true;
+}
+
+void State::ResumeTiming() {
+  if (!paused_) return;
+  start_ = Clock::now();
+  paused_ = false;
+}
+
+double State::elapsed_ns() const {
+  if (paused_) return accumulated_ns_;
+  return accumulated_ns_ +
+         std::chrono::duration<double, std::nano>(Clock::now() - start_)
+             .count();
+}
+
+namespace {
+
+struct Benchmark {
+  std::string name;
+  BenchFunc func;
+  std::vector<int64_t> args;
+};
+
+std::vector<Benchmark>* Registry() {
+  static std::vector<Benchmark> benchmarks;
+  return &benchmarks;
+}
+
+}  // namespace
+
+void RegisterBenchmark(const std::string& name,
+                       BenchFunc func,
+                       const std::vector<int64_t>& args) {
+  std::string full_name = name;
+  for (int64_t arg : args) {
+    full_name += "/" + std::to_string(arg);
+  }
+  Registry()->push_back({full_name, std::move(func), args});
+}
+
+int RunBenchmarks(const std::string& filter,
+                  double min_time_s,
+                  std::vector<Result>* results) {
+  std::regex pattern(filter);
+  int num_run = 0;
+  std::cout << std::left << std::setw(48) << "Benchmark" << std::right
+            << std::setw(14) << "Time(ns)" << std::setw(12) << "Iterations"
+            << std::setw(16) << "Items/s" << std::endl;
+  for (const Benchmark& benchmark : *Registry()) {
+    if (!std::regex_search(benchmark.name, pattern)) continue;
+    State state(benchmark.args, min_time_s);
+    benchmark.func(&state);
+    int64_t iterations = std::max<int64_t>(state.iterations(), 1);
+    double ns_per_iter = state.elapsed_ns() / iterations;
+
+    double items_per_second = state.items_per_iteration() * 1e9 / ns_per_iter;
+    std::ostringstream items;
+    if (items_per_second > 0) items << std::setprecision(4) << items_per_second;
+    std::cout << std::left << std::setw(48) << benchmark.name << std::right
+              << std::setw(14) << std::fixed << std::setprecision(1)
+              << ns_per_iter << std::setw(12) << state.iterations()
+              << std::setw(16) << items.str();
+    for (const auto& counter : state.counters()) {
+      std::cout << " " << counter.first << "=" << std::setprecision(4)
+                << counter.second;
+    }
+    std::cout << std::endl;
+    ++num_run;
+
+    if (results == nullptr) continue;
+    Result result;
+    result.name = benchmark.name;
+    result.iterations = state.iterations();
+    result.ns_per_iteration = ns_per_iter;
+    result.items_per_second = items_per_second;
+    result.counters = state.counters();
+    results->push_back(std::move(result));
+  }
+  return num_run;
+}
+
+static std::string JsonString(const std::string& str) {
+  std::string quoted = "\"";
+  for (char c : str) {
+    if (c == '"' || c == '\\') quoted.push_back('\\');
+    quoted.push_back(c);
+  }
+  return quoted + "\"";
+}
+
+// JSON has no NaN nor infinity, e.g. of a counter divided by zero
+static std::string JsonNumber(double value) {
+  if (!std::isfinite(value)) return "null";
+  std::ostringstream number;
+  number << std::setprecision(10) << value;
+  return number.str();
+}
+
+std::string ResultsToJson(const std::string& label,
+                          const std::vector<Result>& results) {
+  std::ostringstream json;
+  json << "{\n\"label\": " << JsonString(label) << ",\n\"benchmarks\": [";
+  for (size_t i = 0; i < results.size(); ++i) {
+    const Result& result = results[i];
+    json << (i == 0 ? "\n" : ",\n") << "  {\"name\": "
+         << JsonString(result.name)
+         << ", \"iterations\": " << result.iterations
+         << ", \"ns_per_iteration\": " << JsonNumber(result.ns_per_iteration)
+         << ", \"items_per_second\": "
+         << JsonNumber(result.items_per_second)
+         << ", \"counters\": {";
+    bool first = true;
+    for (const auto& counter : result.counters) {
+      json << (first ? "" : ", ") << JsonString(counter.first) << ": "
+           << JsonNumber(counter.second);
+      first = false;
+    }
+    json << "}}";
+  }
+  json << "\n]\n}\n";
+  return json.str();
+}
+
+}  // namespace bench
+}  // namespace ppspeech
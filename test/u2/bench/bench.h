@@ -0,0 +1,110 @@
+// Copyright (c) 2022 PaddlePaddle Authors. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#pragma once
+
+#include <chrono>
+#include <cstdint>
+#include <functional>
+#include <map>
+#include <string>
+#include <vector>
+
+namespace ppspeech {
+namespace bench {
+
+// State of one benchmark run. The body of a benchmark loops on KeepRunning(),
+// work before the loop is not timed:
+//
+//   void BM_Foo(State* state) {
+//     auto data = MakeData(state->arg(0));
+//     while (state->KeepRunning()) {
+//       Foo(data);
+//     }
+//     state->set_items_per_iteration(data.size());
+//   }
+//   U2_BENCHMARK(BM_Foo);
+class State {
+ public:
+  State(const std::vector<int64_t>& args, double min_time_s);
+
+  bool KeepRunning();
+
+  // exclude work inside the loop from timing
+  void PauseTiming();
+  void ResumeTiming();
+
+  int64_t arg(size_t i) const { return args_.at(i); }
+  int64_t iterations() const { return iterations_; }
+  double elapsed_ns() const;
+
+  // items (e.g. frames) processed by one iteration, reported as items/s
+  void set_items_per_iteration(double items) { items_per_iteration_ = items; }
+  double items_per_iteration() const { return items_per_iteration_; }
+
+  // user counters are reported as is
+  void SetCounter(const std::string& name, double value) {
+    counters_[name] = value;
+  }
+  const std::map<std::string, double>& counters() const { return counters_; }
+
+ private:
+  using Clock = std::chrono::steady_clock;
+
+  std::vector<int64_t> args_;
+  double min_time_ns_;
+  int64_t iterations_ = 0;
+  bool started_ = false;
+  bool paused_ = true;
+  Clock::time_point start_;
+  double accumulated_ns_ = 0.0;
+  double items_per_iteration_ = 0.0;
+  std::map<std::string, double> counters_;
+};
+
+using BenchFunc = std::function<void(State*)>;
+
+// Measurements of one benchmark, items_per_second is 0 if not set.
+struct Result {
+  std::string name;
+  int64_t iterations = 0;
+  double ns_per_iteration = 0.0;
+  double items_per_second = 0.0;
+  std::map<std::string, double> counters;
+};
+
+// name is suffixed with the args, e.g. BM_TopK/5000/10
+void RegisterBenchmark(const std::string& name,
+                       BenchFunc func,
+                       const std::vector<int64_t>& args = {});
+
+// Run benchmarks whose name matches the regex filter, return the number of
+// benchmarks run. Their results are appended to results if not nullptr.
+int RunBenchmarks(const std::string& filter,
+                  double min_time_s,
+                  std::vector<Result>* results = nullptr);
+
+// Results as json, label names the run, e.g. a commit:
+//   {"label": ..., "benchmarks": [{"name": ..., "iterations": ...,
+//    "ns_per_iteration": ..., "items_per_second": ..., "counters": {...}}]}
+// A value which is NaN or infinite is written as null.
+std::string ResultsToJson(const std::string& label,
+                          const std::vector<Result>& results);
+
+}  // namespace bench
+}  // namespace ppspeech
+
+#define U2_BENCHMARK(func)                                    \
+  static const int func##_registered =                        \
+      (ppspeech::bench::RegisterBenchmark(#func, func), 0)
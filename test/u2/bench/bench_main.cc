@@ -0,0 +1,44 @@
+// Copyright (c) 2022 PaddlePaddle Authors. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include <fstream>
+#include <vector>
+
+#include "bench/bench.h"
+#include "utils/flags.h"
+#include "utils/log.h"
+
+DEFINE_string(bench_filter, ".", "regex of the benchmarks to run");
+DEFINE_double(bench_min_time, 0.5, "min seconds each benchmark runs");
+DEFINE_string(bench_json, "", "json file of the results, to track them");
+DEFINE_string(bench_label, "", "label of the run in the json, e.g. a commit");
+
+int main(int argc, char* argv[]) {
+  gflags::ParseCommandLineFlags(&argc, &argv, false);
+  google::InitGoogleLogging(argv[0]);
+  FLAGS_logtostderr = 1;
+
+  std::vector<ppspeech::bench::Result> results;
+  int num_run = ppspeech::bench::RunBenchmarks(
+      FLAGS_bench_filter, FLAGS_bench_min_time, &results);
+  if (num_run == 0) {
+    LOG(WARNING) << "No benchmark matches " << FLAGS_bench_filter;
+  }
+  if (!FLAGS_bench_json.empty()) {
+    std::ofstream json(FLAGS_bench_json);
+    json << ppspeech::bench::ResultsToJson(FLAGS_bench_label, results);
+    LOG(INFO) << "Results written to " << FLAGS_bench_json;
+  }
+  return 0;
+}
@@ -0,0 +1,60 @@
+// Copyright (c) 2022 PaddlePaddle Authors. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include <algorithm>
+#include <vector>
+
+#include "bench/bench.h"
+#include "bench/posteriors.h"
+#include "decoder/ctc_endpoint.h"
+
+namespace ppspeech {
+namespace bench {
+namespace {
+
+// keeps the compiler from dropping the benchmarked work
+volatile bool g_sink = false;
+
+// the endpoint check of each chunk of a streamed utterance
+void BM_CtcEndpoint(State* state) {
+  const int chunk_size = state->arg(0);
+  Posteriors utt = SyntheticPosteriors(250, 5537, 0.7f, 0);
+  std::vector<std::vector<std::vector<float>>> chunks;
+  for (size_t t = 0; t < utt.logp.size(); t += chunk_size) {
+    size_t end = std::min(utt.logp.size(), t + chunk_size);
+    chunks.emplace_back(utt.logp.begin() + t, utt.logp.begin() + end);
+  }
+
+  CtcEndpoint endpoint{CtcEndpointConfig()};
+  // 40ms frames of a model subsampling by 4
+  endpoint.frame_shift_in_ms(40);
+  while (state->KeepRunning()) {
+    endpoint.Reset();
+    for (const auto& chunk : chunks) {
+      g_sink = endpoint.IsEndpoint(chunk, true);
+    }
+  }
+  state->set_items_per_iteration(utt.logp.size());
+}
+
+const int kCtcEndpointRegistered = [] {
+  for (int chunk_size : {1, 16}) {
+    RegisterBenchmark("BM_CtcEndpoint", BM_CtcEndpoint, {chunk_size});
+  }
+  return 0;
+}();
+
+}  // namespace
+}  // namespace bench
+}  // namespace ppspeech
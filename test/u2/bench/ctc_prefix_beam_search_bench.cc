@@ -0,0 +1,288 @@
+// Copyright (c) 2022 PaddlePaddle Authors. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include <algorithm>
+#include <atomic>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "bench/bench.h"
+#include "bench/posteriors.h"
+#include "decoder/batch_ctc_prefix_beam_search.h"
+#include "decoder/ctc_prefix_beam_search.h"
+#include "utils/flags.h"
+#include "utils/io.h"
+#include "utils/log.h"
+#include "utils/utils.h"
+
+DEFINE_string(posterior_scp,
+              "",
+              "recorded ctc posteriors (key path per line) for search "
+              "benchmarks, synthetic posteriors are used if empty");
+DEFINE_int32(bench_num_utts, 20, "num of synthetic utterances");
+DEFINE_int32(bench_num_frames, 250, "num of frames of synthetic utterances");
+DEFINE_int32(bench_vocab_size, 5537, "vocab size of synthetic utterances");
+DEFINE_int32(bench_chunk_size, 16, "num of frames searched per call");
+
+namespace ppspeech {
+namespace bench {
+namespace {
+
+const std::vector<Posteriors>& BenchPosteriors() {
+  static const std::vector<Posteriors> utts =
+      LoadPosteriors(FLAGS_posterior_scp,
+                     FLAGS_bench_num_utts,
+                     FLAGS_bench_num_frames,
+                     FLAGS_bench_vocab_size);
+  return utts;
+}
+
+// streaming search of one utterance, return the best hypothesis
+std::vector<int> Decode(CtcPrefixBeamSearch* searcher,
+                        const std::vector<std::vector<float>>& logp) {
+  searcher->Reset();
+  std::vector<std::vector<float>> chunk;
+  for (size_t t = 0; t < logp.size(); t += FLAGS_bench_chunk_size) {
+    size_t end = std::min(logp.size(), t + FLAGS_bench_chunk_size);
+    chunk.assign(logp.begin() + t, logp.begin() + end);
+    searcher->Search(chunk);
+  }
+  searcher->FinalizeSearch();
+  return searcher->Inputs()[0];
+}
+
+void BM_CtcPrefixBeamSearch(State* state, bool adaptive, bool timestamp) {
+  const std::vector<Posteriors>& utts = BenchPosteriors();
+  CtcPrefixBeamSearchOptions fixed_opts;
+  CtcPrefixBeamSearchOptions opts;
+  opts.adaptive_beam = adaptive;
+  CtcPrefixBeamSearch searcher(opts, nullptr, timestamp);
+
+  int num_frames = 0;
+  for (const Posteriors& utt : utts) {
+    num_frames += utt.logp.size();
+  }
+
+  while (state->KeepRunning()) {
+    for (const Posteriors& utt : utts) {
+      Decode(&searcher, utt.logp);
+    }
+  }
+  state->set_items_per_iteration(num_frames);
+
+  // accuracy, against the reference tokens of synthetic posteriors and
+  // against the fixed beam result
+  CtcPrefixBeamSearch fixed_searcher(fixed_opts);
+  int num_ref_tokens = 0, num_errors = 0;
+  int num_fixed_tokens = 0, num_diffs = 0;
+  for (const Posteriors& utt : utts) {
+    std::vector<int> hyp = Decode(&searcher, utt.logp);
+    std::vector<int> fixed_hyp = Decode(&fixed_searcher, utt.logp);
+    num_ref_tokens += utt.ref.size();
+    num_errors += utt.ref.empty() ? 0 : EditDistance(utt.ref, hyp);
+    num_fixed_tokens += fixed_hyp.size();
+    num_diffs += EditDistance(fixed_hyp, hyp);
+  }
+  if (num_ref_tokens > 0) {
+    state->SetCounter("wer%", 100.0 * num_errors / num_ref_tokens);
+  }
+  state->SetCounter("diff_vs_fixed%",
+                    100.0 * num_diffs / std::max(num_fixed_tokens, 1));
+}
+
+void BM_CtcPrefixBeamSearchFixed(State* state) {
+  BM_CtcPrefixBeamSearch(state, false, true);
+}
+U2_BENCHMARK(BM_CtcPrefixBeamSearchFixed);
+
+void BM_CtcPrefixBeamSearchNoTimestamp(State* state) {
+  BM_CtcPrefixBeamSearch(state, false, false);
+}
+U2_BENCHMARK(BM_CtcPrefixBeamSearchNoTimestamp);
+
+void BM_CtcPrefixBeamSearchAdaptive(State* state) {
+  BM_CtcPrefixBeamSearch(state, true, true);
+}
+U2_BENCHMARK(BM_CtcPrefixBeamSearchAdaptive);
+
+// snapshot and restore of the search state halfway through each utterance,
+// as a stream migrated to another session
+void BM_CtcPrefixBeamSearchSnapshot(State* state) {
+  const std::vector<Posteriors>& utts = BenchPosteriors();
+  CtcPrefixBeamSearchOptions opts;
+  std::vector<std::unique_ptr<CtcPrefixBeamSearch>> searchers;
+  for (const Posteriors& utt : utts) {
+    searchers.emplace_back(new CtcPrefixBeamSearch(opts));
+    std::vector<std::vector<float>> half(
+        utt.logp.begin(), utt.logp.begin() + utt.logp.size() / 2);
+    searchers.back()->Search(half);
+  }
+  CtcPrefixBeamSearch restored(opts);
+
+  std::string snapshot;
+  int64_t num_bytes = 0;
+  while (state->KeepRunning()) {
+    num_bytes = 0;
+    for (const auto& searcher : searchers) {
+      snapshot.clear();
+      BinaryWriter writer(&snapshot);
+      searcher->SaveState(&writer);
+      BinaryReader reader(snapshot);
+      CHECK(restored.LoadState(&reader));
+      num_bytes += snapshot.size();
+    }
+  }
+  state->set_items_per_iteration(searchers.size());
+  state->SetCounter("snapshot_bytes",
+                    static_cast<double>(num_bytes) / searchers.size());
+}
+U2_BENCHMARK(BM_CtcPrefixBeamSearchSnapshot);
+
+// N streams decoded chunk by chunk on one core, each by its own searcher
+void BM_CtcPrefixBeamSearchStreams(State* state) {
+  const std::vector<Posteriors>& utts = BenchPosteriors();
+  const int num_streams = state->arg(0);
+  CtcPrefixBeamSearchOptions opts;
+  std::vector<std::unique_ptr<CtcPrefixBeamSearch>> searchers;
+  for (int i = 0; i < num_streams; ++i) {
+    searchers.emplace_back(new CtcPrefixBeamSearch(opts));
+  }
+
+  const int chunk_size = FLAGS_bench_chunk_size;
+  std::vector<std::vector<float>> chunk;
+  int num_frames = 0;
+  while (state->KeepRunning()) {
+    num_frames = 0;
+    for (auto& searcher : searchers) searcher->Reset();
+    for (int t = 0; t < FLAGS_bench_num_frames; t += chunk_size) {
+      for (int i = 0; i < num_streams; ++i) {
+        const auto& logp = utts[i % utts.size()].logp;
+        if (t >= logp.size()) continue;
+        int end = std::min<int>(logp.size(), t + chunk_size);
+        chunk.assign(logp.begin() + t, logp.begin() + end);
+        searchers[i]->Search(chunk);
+        num_frames += end - t;
+      }
+    }
+  }
+  state->set_items_per_iteration(num_frames);
+}
+
+// N streams decoded chunk by chunk on one core by one batch search
+void BM_BatchCtcPrefixBeamSearch(State* state) {
+  const std::vector<Posteriors>& utts = BenchPosteriors();
+  const int num_streams = state->arg(0);
+  CtcPrefixBeamSearchOptions opts;
+  BatchCtcPrefixBeamSearch batch_search(opts);
+  std::vector<std::unique_ptr<BatchSearchStream>> streams;
+  for (int i = 0; i < num_streams; ++i) {
+    streams.emplace_back(batch_search.NewStream());
+  }
+
+  const int chunk_size = FLAGS_bench_chunk_size;
+  std::vector<std::vector<std::vector<float>>> chunks(num_streams);
+  std::vector<BatchSearchStream*> batch;
+  std::vector<const std::vector<std::vector<float>>*> batch_logps;
+  int num_frames = 0;
+  while (state->KeepRunning()) {
+    num_frames = 0;
+    for (auto& stream : streams) stream->Reset();
+    for (int t = 0; t < FLAGS_bench_num_frames; t += chunk_size) {
+      batch.clear();
+      batch_logps.clear();
+      for (int i = 0; i < num_streams; ++i) {
+        const auto& logp = utts[i % utts.size()].logp;
+        if (t >= logp.size()) continue;
+        int end = std::min<int>(logp.size(), t + chunk_size);
+        chunks[i].assign(logp.begin() + t, logp.begin() + end);
+        batch.push_back(streams[i].get());
+        batch_logps.push_back(&chunks[i]);
+        num_frames += end - t;
+      }
+      batch_search.Search(batch, batch_logps);
+    }
+  }
+  state->set_items_per_iteration(num_frames);
+}
+
+// N sessions decoded chunk by chunk concurrently, by a thread per core.
+// Each session is a new stream with a new searcher, as on a server where
+// streams come and go, so the buffers of the search are allocated while
+// the other threads allocate too. arg 1 selects the arena of the searcher
+// over the heap.
+void BM_CtcPrefixBeamSearchSessions(State* state) {
+  const std::vector<Posteriors>& utts = BenchPosteriors();
+  const int num_sessions = state->arg(0);
+  CtcPrefixBeamSearchOptions opts;
+  opts.use_arena = state->arg(1) != 0;
+  const int num_threads =
+      std::max<int>(1, std::min<int>(std::thread::hardware_concurrency(),
+                                     num_sessions));
+
+  const int chunk_size = FLAGS_bench_chunk_size;
+  std::atomic<int64_t> num_frames(0);
+  auto worker = [&](int thread) {
+    std::vector<std::unique_ptr<CtcPrefixBeamSearch>> searchers;
+    std::vector<int> sessions;
+    for (int i = thread; i < num_sessions; i += num_threads) {
+      searchers.emplace_back(new CtcPrefixBeamSearch(opts));
+      sessions.push_back(i);
+    }
+    std::vector<std::vector<float>> chunk;
+    int64_t frames = 0;
+    for (int t = 0; t < FLAGS_bench_num_frames; t += chunk_size) {
+      for (size_t j = 0; j < searchers.size(); ++j) {
+        const auto& logp = utts[sessions[j] % utts.size()].logp;
+        if (t >= logp.size()) continue;
+        int end = std::min<int>(logp.size(), t + chunk_size);
+        chunk.assign(logp.begin() + t, logp.begin() + end);
+        searchers[j]->Search(chunk);
+        frames += end - t;
+      }
+    }
+    num_frames += frames;
+  };
+
+  while (state->KeepRunning()) {
+    num_frames = 0;
+    std::vector<std::thread> threads;
+    for (int i = 0; i < num_threads; ++i) threads.emplace_back(worker, i);
+    for (auto& thread : threads) thread.join();
+  }
+  state->set_items_per_iteration(num_frames);
+  state->SetCounter("threads", num_threads);
+}
+
+const int kStreamsRegistered = [] {
+  for (int num_streams : {1, 8, 32, 64}) {
+    RegisterBenchmark("BM_CtcPrefixBeamSearchStreams",
+                      BM_CtcPrefixBeamSearchStreams,
+                      {num_streams});
+    RegisterBenchmark("BM_BatchCtcPrefixBeamSearch",
+                      BM_BatchCtcPrefixBeamSearch,
+                      {num_streams});
+  }
+  for (int use_arena : {0, 1}) {
+    RegisterBenchmark("BM_CtcPrefixBeamSearchSessions",
+                      BM_CtcPrefixBeamSearchSessions,
+                      {64, use_arena});
+  }
+  return 0;
+}();
+
+}  // namespace
+}  // namespace bench
+}  // namespace ppspeech
@@ -0,0 +1,133 @@
+// Copyright (c) 2022 PaddlePaddle Authors. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include <unistd.h>
+
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <random>
+#include <string>
+#include <vector>
+
+#include "bench/bench.h"
+#include "frontend/cmvn.h"
+#include "frontend/fbank.h"
+#include "frontend/fft.h"
+#include "utils/log.h"
+
+namespace ppspeech {
+namespace bench {
+namespace {
+
+const int kSampleRate = 16000;
+
+// keeps the compiler from dropping the benchmarked work
+volatile float g_sink = 0.0f;
+
+// a tone in noise at the int16 scale the pipeline is fed with
+std::vector<float> SyntheticWave(int num_samples) {
+  std::mt19937 rng(num_samples);
+  std::normal_distribution<float> noise(0.0f, 300.0f);
+  std::vector<float> wave(num_samples);
+  for (int i = 0; i < num_samples; ++i) {
+    wave[i] = 3000.0f * std::sin(2 * M_PI * 440.0 * i / kSampleRate) +
+              noise(rng);
+  }
+  return wave;
+}
+
+// 1s of audio, 25ms frames shifted by 10ms
+void BM_Fbank(State* state) {
+  const int num_bins = state->arg(0);
+  Fbank fbank(num_bins, kSampleRate, kSampleRate / 1000 * 25,
+              kSampleRate / 1000 * 10);
+  std::vector<float> wave = SyntheticWave(kSampleRate);
+  std::vector<std::vector<float>> feats;
+  int num_frames = 0;
+  while (state->KeepRunning()) {
+    num_frames = fbank.Compute(wave, &feats);
+    g_sink = feats[0][0];
+  }
+  state->set_items_per_iteration(num_frames);
+}
+
+void BM_Fft(State* state) {
+  const int n = state->arg(0);
+  std::vector<float> sintbl(n + n / 4);
+  std::vector<int> bitrev(n);
+  make_sintbl(n, sintbl.data());
+  make_bitrev(n, bitrev.data());
+  std::vector<float> wave = SyntheticWave(n);
+  std::vector<float> real(n), imag(n);
+  while (state->KeepRunning()) {
+    // in place, the copy of the input is timed as well as in Fbank
+    std::memcpy(real.data(), wave.data(), sizeof(float) * n);
+    std::memset(imag.data(), 0, sizeof(float) * n);
+    fft(bitrev.data(), sintbl.data(), real.data(), imag.data(), n);
+    g_sink = real[1];
+  }
+  state->set_items_per_iteration(1);
+}
+
+// 1s of features, normalized in place by stats of zero mean and unit
+// variance, so they stay the same over the iterations
+void BM_Cmvn(State* state) {
+  const int dim = state->arg(0);
+  const int num_frames = 100;
+  char path[] = "/tmp/u2_bench_cmvn_XXXXXX";
+  int fd = mkstemp(path);
+  CHECK_GE(fd, 0);
+  close(fd);
+  {
+    std::ofstream stats(path);
+    stats << "{\"frame_num\": " << num_frames << ", \"mean_stat\": [";
+    for (int i = 0; i < dim; ++i) stats << (i == 0 ? "" : ", ") << 0.0;
+    stats << "], \"var_stat\": [";
+    for (int i = 0; i < dim; ++i) {
+      stats << (i == 0 ? "" : ", ") << num_frames;
+    }
+    stats << "]}";
+  }
+  Cmvn cmvn(path);
+  std::remove(path);
+
+  std::mt19937 rng(dim);
+  std::normal_distribution<float> feat(10.0f, 3.0f);
+  std::vector<std::vector<float>> feats(num_frames, std::vector<float>(dim));
+  for (auto& frame : feats) {
+    for (float& value : frame) value = feat(rng);
+  }
+  while (state->KeepRunning()) {
+    cmvn.Compute(feats);
+    g_sink = feats[0][0];
+  }
+  state->set_items_per_iteration(num_frames);
+}
+
+const int kFrontendRegistered = [] {
+  for (int num_bins : {40, 80}) {
+    RegisterBenchmark("BM_Fbank", BM_Fbank, {num_bins});
+    RegisterBenchmark("BM_Cmvn", BM_Cmvn, {num_bins});
+  }
+  for (int n : {256, 512, 1024}) {
+    RegisterBenchmark("BM_Fft", BM_Fft, {n});
+  }
+  return 0;
+}();
+
+}  // namespace
+}  // namespace bench
+}  // namespace ppspeech
@@ -0,0 +1,127 @@
+// Copyright (c) 2022 PaddlePaddle Authors. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "bench/posteriors.h"
+
+#include <algorithm>
+#include <cmath>
+#include <fstream>
+#include <random>
+
+#include "utils/log.h"
+#include "utils/string.h"
+
+namespace ppspeech {
+namespace bench {
+
+Posteriors SyntheticPosteriors(int num_frames,
+                               int vocab_size,
+                               float blank_ratio,
+                               unsigned int seed) {
+  CHECK_GT(vocab_size, 1);
+  const int blank = 0;
+  const int num_competitors = 4;
+  std::mt19937 rng(seed);
+  std::uniform_real_distribution<float> uniform(0.0f, 1.0f);
+  std::uniform_int_distribution<int> token_dist(1, vocab_size - 1);
+
+  Posteriors posteriors;
+  posteriors.key = "synthetic_" + std::to_string(seed);
+  posteriors.logp.resize(num_frames);
+  int last_token = blank;
+  for (int t = 0; t < num_frames; ++t) {
+    int peak = blank;
+    if (uniform(rng) >= blank_ratio) {
+      peak = token_dist(rng);
+      // consecutive same tokens must be separated by blank in ctc
+      if (peak != last_token) {
+        posteriors.ref.push_back(peak);
+      }
+    }
+    last_token = peak;
+
+    // most frames are confident, some are ambiguous
+    float peak_prob = uniform(rng) < 0.8f ? 0.9f + 0.09f * uniform(rng)
+                                          : 0.3f + 0.5f * uniform(rng);
+    // below 0.5% of the mass all together, so rest stays positive
+    const float floor_prob = std::min(1e-6f, 0.005f / vocab_size);
+    std::vector<float> prob(vocab_size, floor_prob);
+    float rest = 1.0f - peak_prob - floor_prob * vocab_size;
+    for (int i = 0; i < num_competitors; ++i) {
+      int id = i == 0 && peak != blank ? blank : token_dist(rng);
+      float share = i + 1 < num_competitors ? rest * 0.5f : rest;
+      prob[id] += share;
+      rest -= share;
+    }
+    prob[peak] += peak_prob;
+
+    std::vector<float>& logp_t = posteriors.logp[t];
+    logp_t.resize(vocab_size);
+    float sum = 0.0f;
+    for (float p : prob) sum += p;
+    for (int i = 0; i < vocab_size; ++i) {
+      logp_t[i] = std::log(prob[i] / sum);
+    }
+  }
+  return posteriors;
+}
+
+bool ReadPosteriors(const std::string& path, Posteriors* posteriors) {
+  std::ifstream is(path);
+  if (!is.is_open()) return false;
+  int batch = 0, num_frames = 0, dim = 0;
+  is >> batch >> num_frames >> dim;
+  if (!is || batch != 1) return false;
+  posteriors->logp.resize(num_frames);
+  for (int t = 0; t < num_frames; ++t) {
+    posteriors->logp[t].resize(dim);
+    for (int i = 0; i < dim; ++i) {
+      is >> posteriors->logp[t][i];
+    }
+  }
+  posteriors->ref.clear();
+  return static_cast<bool>(is);
+}
+
+std::vector<Posteriors> LoadPosteriors(const std::string& posterior_scp,
+                                       int num_synthetic,
+                                       int num_frames,
+                                       int vocab_size) {
+  std::vector<Posteriors> utts;
+  if (posterior_scp.empty()) {
+    const float blank_ratio = 0.7f;
+    for (int i = 0; i < num_synthetic; ++i) {
+      utts.emplace_back(
+          SyntheticPosteriors(num_frames, vocab_size, blank_ratio, i));
+    }
+    return utts;
+  }
+
+  std::ifstream scp(posterior_scp);
+  CHECK(scp.is_open()) << posterior_scp;
+  std::string line;
+  while (getline(scp, line)) {
+    std::vector<std::string> strs;
+    SplitString(line, &strs);
+    if (strs.size() < 2) continue;
+    Posteriors posteriors;
+    posteriors.key = strs[0];
+    CHECK(ReadPosteriors(strs[1], &posteriors)) << strs[1];
+    utts.emplace_back(std::move(posteriors));
+  }
+  return utts;
+}
+
+}  // namespace bench
+}  // namespace ppspeech
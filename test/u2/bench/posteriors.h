@@ -0,0 +1,52 @@
+// Copyright (c) 2022 PaddlePaddle Authors. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#pragma once
+
+#include <string>
+#include <vector>
+
+namespace ppspeech {
+namespace bench {
+
+// CTC log posteriors of one utterance, ref is the token sequence the
+// posteriors were generated from, empty for recorded posteriors.
+struct Posteriors {
+  std::string key;
+  std::vector<std::vector<float>> logp;
+  std::vector<int> ref;
+};
+
+// Deterministic posteriors which look like a CTC model output: each frame
+// peaks on blank (with prob blank_ratio) or on the next token of the
+// reference, the peak prob varies per frame and the rest of the mass is
+// spread over a few competitors and a small floor.
+Posteriors SyntheticPosteriors(int num_frames,
+                               int vocab_size,
+                               float blank_ratio,
+                               unsigned int seed);
+
+// Read posteriors dumped by PaddleAsrModel in DEUBG mode (encoder_logprob*):
+// a "B T D" header followed by B*T*D values, B must be 1.
+bool ReadPosteriors(const std::string& path, Posteriors* posteriors);
+
+// Posteriors listed in `posterior_scp` (key path per line), or
+// `num_synthetic` synthetic utterances when the scp is empty.
+std::vector<Posteriors> LoadPosteriors(const std::string& posterior_scp,
+                                       int num_synthetic,
+                                       int num_frames,
+                                       int vocab_size);
+
+}  // namespace bench
+}  // namespace ppspeech
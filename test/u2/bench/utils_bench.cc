@@ -0,0 +1,435 @@
+// Copyright (c) 2022 PaddlePaddle Authors. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include <atomic>
+#include <condition_variable>
+#include <functional>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <queue>
+#include <random>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#include "bench/bench.h"
+#include "bench/posteriors.h"
+#include "utils/block_queue.h"
+#include "utils/fp16.h"
+#include "utils/spsc_channel.h"
+#include "utils/string.h"
+#include "utils/thread_pool.h"
+#include "utils/utils.h"
+
+namespace ppspeech {
+namespace bench {
+namespace {
+
+// keeps the compiler from dropping the benchmarked work
+volatile float g_sink = 0.0f;
+
+// prefix scores and frame log probs as they meet in the search
+void MakeLogAddInputs(int n, std::vector<float>* x, std::vector<float>* y) {
+  std::mt19937 rng(n);
+  std::uniform_real_distribution<float> score(-60.0f, -5.0f);
+  std::uniform_real_distribution<float> diff(-20.0f, 20.0f);
+  x->resize(n);
+  y->resize(n);
+  for (int i = 0; i < n; ++i) {
+    (*x)[i] = score(rng);
+    (*y)[i] = (*x)[i] + diff(rng);
+  }
+}
+
+void BM_LogSumExp(State* state) {
+  std::vector<float> x, y;
+  MakeLogAddInputs(state->arg(0), &x, &y);
+  while (state->KeepRunning()) {
+    float sum = 0.0f;
+    for (size_t i = 0; i < x.size(); ++i) {
+      sum += LogSumExp(x[i], y[i]);
+    }
+    g_sink = sum;
+  }
+  state->set_items_per_iteration(x.size());
+}
+
+void BM_FastLogSumExp(State* state) {
+  std::vector<float> x, y;
+  MakeLogAddInputs(state->arg(0), &x, &y);
+  while (state->KeepRunning()) {
+    float sum = 0.0f;
+    for (size_t i = 0; i < x.size(); ++i) {
+      sum += FastLogSumExp(x[i], y[i]);
+    }
+    g_sink = sum;
+  }
+  state->set_items_per_iteration(x.size());
+}
+
+void BM_BatchLogSumExp(State* state) {
+  std::vector<float> x, y;
+  MakeLogAddInputs(state->arg(0), &x, &y);
+  std::vector<float> out(x.size());
+  while (state->KeepRunning()) {
+    LogSumExp(x.data(), y.data(), out.data(), out.size());
+    g_sink = out[0];
+  }
+  state->set_items_per_iteration(x.size());
+}
+
+const int kLogSumExpRegistered = [] {
+  for (int n : {10, 100, 4096}) {
+    RegisterBenchmark("BM_LogSumExp", BM_LogSumExp, {n});
+    RegisterBenchmark("BM_FastLogSumExp", BM_FastLogSumExp, {n});
+    RegisterBenchmark("BM_BatchLogSumExp", BM_BatchLogSumExp, {n});
+  }
+  return 0;
+}();
+
+// the former priority queue TopK, as the baseline
+void HeapTopK(const std::vector<float>& data,
+              int k,
+              std::vector<float>* values,
+              std::vector<int>* indices) {
+  using Item = std::pair<float, int>;
+  auto comp = [](const Item& lhs, const Item& rhs) {
+    return lhs.first > rhs.first ||
+           (lhs.first == rhs.first && lhs.second < rhs.second);
+  };
+  std::vector<Item> heap_data;
+  int n = data.size();
+  for (int i = 0; i < k && i < n; ++i) {
+    heap_data.emplace_back(data[i], i);
+  }
+  std::priority_queue<Item, std::vector<Item>, decltype(comp)> pq(
+      comp, std::move(heap_data));
+  for (int i = k; i < n; ++i) {
+    if (pq.top().first < data[i]) {
+      pq.pop();
+      pq.emplace(data[i], i);
+    }
+  }
+  values->resize(std::min(k, n));
+  indices->resize(std::min(k, n));
+  for (int cur = values->size() - 1; !pq.empty(); --cur) {
+    (*values)[cur] = pq.top().first;
+    (*indices)[cur] = pq.top().second;
+    pq.pop();
+  }
+}
+
+// frames of ctc like posteriors, the realistic input of TopK
+const int kTopKFrames = 32;
+
+std::vector<std::vector<float>> TopKFrames(int vocab_size) {
+  return SyntheticPosteriors(kTopKFrames, vocab_size, 0.7, vocab_size).logp;
+}
+
+void BM_TopKHeap(State* state) {
+  auto frames = TopKFrames(state->arg(0));
+  const int k = state->arg(1);
+  std::vector<float> values;
+  std::vector<int> indices;
+  while (state->KeepRunning()) {
+    for (const auto& frame : frames) {
+      HeapTopK(frame, k, &values, &indices);
+    }
+    g_sink = values[0];
+  }
+  state->set_items_per_iteration(frames.size());
+}
+
+void BM_TopK(State* state) {
+  auto frames = TopKFrames(state->arg(0));
+  const int k = state->arg(1);
+  std::vector<float> values(k);
+  std::vector<int> indices(k);
+  while (state->KeepRunning()) {
+    for (const auto& frame : frames) {
+      TopK(frame.data(), frame.size(), k, values.data(), indices.data());
+    }
+    g_sink = values[0];
+  }
+  state->set_items_per_iteration(frames.size());
+}
+
+void BM_TopKFp16(State* state) {
+  auto frames = TopKFrames(state->arg(0));
+  std::vector<std::vector<float16>> frames_fp16;
+  for (const auto& frame : frames) {
+    frames_fp16.emplace_back(frame.size());
+    for (size_t i = 0; i < frame.size(); ++i) {
+      frames_fp16.back()[i] = float16(frame[i]);
+    }
+  }
+  const int k = state->arg(1);
+  std::vector<float> values(k);
+  std::vector<int> indices(k);
+  while (state->KeepRunning()) {
+    for (const auto& frame : frames_fp16) {
+      TopK(frame.data(), frame.size(), k, values.data(), indices.data());
+    }
+    g_sink = values[0];
+  }
+  state->set_items_per_iteration(frames.size());
+}
+
+const int kTopKRegistered = [] {
+  for (int vocab_size : {5000, 10000, 30000}) {
+    for (int k : {1, 4, 10, 32}) {
+      RegisterBenchmark("BM_TopKHeap", BM_TopKHeap, {vocab_size, k});
+      RegisterBenchmark("BM_TopK", BM_TopK, {vocab_size, k});
+      RegisterBenchmark("BM_TopKFp16", BM_TopKFp16, {vocab_size, k});
+    }
+  }
+  return 0;
+}();
+
+// feature frames through the queue of the feature pipeline, moved in and
+// out so nothing is allocated
+void BM_BlockingQueue(State* state) {
+  const int num_frames = state->arg(0);
+  BlockingQueue<std::vector<float>> queue;
+  std::vector<std::vector<float>> frames(num_frames, std::vector<float>(80));
+  while (state->KeepRunning()) {
+    for (auto& frame : frames) queue.Push(std::move(frame));
+    for (auto& frame : frames) frame = queue.Pop();
+  }
+  g_sink = frames[0].size();
+  state->set_items_per_iteration(num_frames);
+}
+
+// a producer thread pushes, this one pops, through a queue of capacity
+// frames
+void BM_BlockingQueueThreads(State* state) {
+  const int num_frames = 4096;
+  const int capacity = state->arg(0);
+  BlockingQueue<std::vector<float>> queue(capacity);
+  std::vector<std::vector<float>> frames(num_frames, std::vector<float>(80));
+  while (state->KeepRunning()) {
+    std::thread producer([&queue, &frames]() {
+      for (auto& frame : frames) queue.Push(std::move(frame));
+    });
+    for (auto& frame : frames) frame = queue.Pop();
+    producer.join();
+  }
+  g_sink = frames[0].size();
+  state->set_items_per_iteration(num_frames);
+}
+
+// As the feature pipeline reads, a producer thread pushes frames one by
+// one and this one reads them by chunks of arg(0) frames.
+const int kChunkFrames = 4096;
+
+void BM_BlockingQueueChunks(State* state) {
+  const size_t chunk = state->arg(0);
+  BlockingQueue<std::vector<float>> queue;
+  std::vector<std::vector<float>> frames(kChunkFrames, std::vector<float>(80));
+  std::vector<std::vector<float>> chunk_frames;
+  while (state->KeepRunning()) {
+    std::thread producer([&queue, &frames]() {
+      for (auto& frame : frames) queue.Push(std::move(frame));
+    });
+    for (size_t read = 0; read < frames.size(); read += chunk) {
+      queue.Pop(chunk, &chunk_frames);
+      for (size_t i = 0; i < chunk; ++i) {
+        frames[read + i] = std::move(chunk_frames[i]);
+      }
+      chunk_frames.clear();
+    }
+    producer.join();
+  }
+  g_sink = frames[0].size();
+  state->set_items_per_iteration(kChunkFrames);
+}
+
+void BM_SpscChannelChunks(State* state) {
+  const size_t chunk = state->arg(0);
+  SpscChannel<std::vector<float>> channel;
+  std::vector<std::vector<float>> frames(kChunkFrames, std::vector<float>(80));
+  std::vector<std::vector<float>> chunk_frames;
+  while (state->KeepRunning()) {
+    std::thread producer([&channel, &frames]() {
+      for (auto& frame : frames) channel.Push(std::move(frame));
+    });
+    for (size_t read = 0; read < frames.size(); read += chunk) {
+      channel.Wait(chunk);
+      channel.Pop(chunk, &chunk_frames);
+      for (size_t i = 0; i < chunk; ++i) {
+        frames[read + i] = std::move(chunk_frames[i]);
+      }
+      chunk_frames.clear();
+    }
+    producer.join();
+  }
+  g_sink = frames[0].size();
+  state->set_items_per_iteration(kChunkFrames);
+}
+
+// as BM_BlockingQueue, on a single thread
+void BM_SpscChannel(State* state) {
+  const int num_frames = state->arg(0);
+  SpscChannel<std::vector<float>> channel;
+  std::vector<std::vector<float>> frames(num_frames, std::vector<float>(80));
+  while (state->KeepRunning()) {
+    for (auto& frame : frames) channel.Push(std::move(frame));
+    for (auto& frame : frames) frame = channel.Pop();
+  }
+  g_sink = frames[0].size();
+  state->set_items_per_iteration(num_frames);
+}
+
+// the former ThreadPool, a single queue under a mutex, as the baseline
+class LockedThreadPool {
+ public:
+  explicit LockedThreadPool(size_t threads) {
+    for (size_t i = 0; i < threads; ++i) {
+      workers_.emplace_back([this] {
+        for (;;) {
+          std::function<void()> task;
+          {
+            std::unique_lock<std::mutex> lock(mutex_);
+            condition_.wait(lock,
+                            [this] { return stop_ || !tasks_.empty(); });
+            if (stop_ && tasks_.empty()) return;
+            task = std::move(tasks_.front());
+            tasks_.pop();
+          }
+          task();
+        }
+      });
+    }
+  }
+
+  ~LockedThreadPool() {
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      stop_ = true;
+    }
+    condition_.notify_all();
+    for (auto& worker : workers_) worker.join();
+  }
+
+  template <class F>
+  std::future<void> enqueue(F&& f) {
+    auto task = std::make_shared<std::packaged_task<void()>>(
+        std::forward<F>(f));
+    std::future<void> res = task->get_future();
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      tasks_.emplace([task]() { (*task)(); });
+    }
+    condition_.notify_one();
+    return res;
+  }
+
+ private:
+  std::vector<std::thread> workers_;
+  std::queue<std::function<void()>> tasks_;
+  std::mutex mutex_;
+  std::condition_variable condition_;
+  bool stop_ = false;
+};
+
+// tasks submitted by each producer per iteration
+const int kPoolTasks = 4096;
+
+// arg(0) producers submit tiny tasks as fast as they can to a pool of
+// arg(1) workers, items are tasks run
+template <class Pool>
+void PoolContention(State* state,
+                    void (*push)(Pool* pool, std::atomic<int>* done)) {
+  const int num_producers = state->arg(0);
+  const int num_tasks = num_producers * kPoolTasks;
+  Pool pool(state->arg(1));
+  std::atomic<int> done(0);
+  while (state->KeepRunning()) {
+    done = 0;
+    std::vector<std::thread> producers;
+    for (int p = 0; p < num_producers; ++p) {
+      producers.emplace_back([&pool, &done, push]() {
+        for (int i = 0; i < kPoolTasks; ++i) push(&pool, &done);
+      });
+    }
+    for (auto& producer : producers) producer.join();
+    while (done.load() < num_tasks) std::this_thread::yield();
+  }
+  state->set_items_per_iteration(num_tasks);
+}
+
+void BM_ThreadPoolLocked(State* state) {
+  PoolContention<LockedThreadPool>(
+      state, [](LockedThreadPool* pool, std::atomic<int>* done) {
+        pool->enqueue([done]() { ++*done; });
+      });
+}
+
+void BM_ThreadPoolEnqueue(State* state) {
+  PoolContention<ThreadPool>(state,
+                             [](ThreadPool* pool, std::atomic<int>* done) {
+                               pool->enqueue([done]() { ++*done; });
+                             });
+}
+
+void BM_ThreadPoolSubmit(State* state) {
+  PoolContention<ThreadPool>(state,
+                             [](ThreadPool* pool, std::atomic<int>* done) {
+                               pool->Submit([done]() { ++*done; });
+                             });
+}
+
+// a transcript of mixed chinese and english, items are bytes
+void BM_SplitUTF8StringToChars(State* state) {
+  std::string text;
+  for (int i = 0; i < 50; ++i) text += "今天天气不错 let's go 出去走走吧";
+  std::vector<std::string> chars;
+  while (state->KeepRunning()) {
+    SplitUTF8StringToChars(text, &chars);
+    g_sink = chars.size();
+  }
+  state->set_items_per_iteration(text.size());
+}
+
+const int kUtilsRegistered = [] {
+  for (int num_frames : {16, 256}) {
+    RegisterBenchmark("BM_BlockingQueue", BM_BlockingQueue, {num_frames});
+    RegisterBenchmark("BM_SpscChannel", BM_SpscChannel, {num_frames});
+  }
+  for (int capacity : {16, 1024}) {
+    RegisterBenchmark(
+        "BM_BlockingQueueThreads", BM_BlockingQueueThreads, {capacity});
+  }
+  for (int chunk : {1, 16, 64}) {
+    RegisterBenchmark(
+        "BM_BlockingQueueChunks", BM_BlockingQueueChunks, {chunk});
+    RegisterBenchmark("BM_SpscChannelChunks", BM_SpscChannelChunks, {chunk});
+  }
+  for (int num_producers : {1, 4}) {
+    for (int num_workers : {1, 4}) {
+      std::vector<int64_t> args = {num_producers, num_workers};
+      RegisterBenchmark("BM_ThreadPoolLocked", BM_ThreadPoolLocked, args);
+      RegisterBenchmark("BM_ThreadPoolEnqueue", BM_ThreadPoolEnqueue, args);
+      RegisterBenchmark("BM_ThreadPoolSubmit", BM_ThreadPoolSubmit, args);
+    }
+  }
+  RegisterBenchmark("BM_SplitUTF8StringToChars", BM_SplitUTF8StringToChars);
+  return 0;
+}();
+
+}  // namespace
+}  // namespace bench
+}  // namespace ppspeech
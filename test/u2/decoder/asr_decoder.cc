@@ -18,9 +18,14 @@
 #include <ctype.h>
 
 #include <algorithm>
+#include <iomanip>
 #include <limits>
+#include <sstream>
 #include <utility>
 
+#include "decoder/decode_latency.h"
+#include "utils/tracer.h"
+
 namespace ppspeech {
 
 AsrDecoder::AsrDecoder(std::shared_ptr<FeaturePipeline> feature_pipeline,
@@ -41,9 +46,10 @@ AsrDecoder::AsrDecoder(std::shared_ptr<FeaturePipeline> feature_pipeline,
     // CHECK(model_->is_bidecoder());
   }
   if (nullptr == fst_) {
-    // ctc prefix beam search
+    // ctc prefix beam search, timestamps are only needed with a unit table
     searcher_.reset(new CtcPrefixBeamSearch(opts.ctc_prefix_search_opts,
-                                            resource->context_graph));
+                                            resource->context_graph,
+                                            unit_table_ != nullptr));
   } else {
     // wfst
     // searcher_.reset(new CtcWfstBeamSearch(*fst_, opts.ctc_wfst_search_opts,
@@ -51,12 +57,16 @@ AsrDecoder::AsrDecoder(std::shared_ptr<FeaturePipeline> feature_pipeline,
   }
 
   ctc_endpointer_->frame_shift_in_ms(frame_shift_in_ms());
+  model_->set_chunk_size(opts_.chunk_size);
+  model_->set_num_left_chunks(opts_.num_left_chunks);
+  model_->set_frame_reduction(opts_.frame_reduction);
 }
 
 void AsrDecoder::Reset() {
   global_frame_offset_ = 0;
   start_ = false;
-  result_.clear();
+  ResizeReusing(&result_, 0, &spare_results_);
+  search_finalized_ = false;
   num_frames_ = 0;
 
   feature_pipeline_->Reset();
@@ -68,13 +78,95 @@ void AsrDecoder::Reset() {
 void AsrDecoder::ResetContinuousDecoding() {
   global_frame_offset_ = num_frames_;
   start_ = false;
-  result_.clear();
+  ResizeReusing(&result_, 0, &spare_results_);
+  search_finalized_ = false;
 
   model_->Reset();
   searcher_->Reset();
   ctc_endpointer_->Reset();
 }
 
+MemoryUsage AsrDecoder::memory_usage() const {
+  MemoryUsage usage;
+  model_->GetMemoryUsage(&usage);
+  usage.feature_queue = feature_pipeline_->MemoryBytes();
+  usage.hypotheses = searcher_->MemoryBytes();
+  for (const DecodeResult& result : result_) {
+    usage.hypotheses += sizeof(result) + result.sentence.capacity();
+  }
+  return usage;
+}
+
+bool AsrDecoder::SaveState(BinaryWriter* writer) const {
+  writer->Write(start_);
+  writer->Write(num_frames_);
+  writer->Write(global_frame_offset_);
+  writer->Write(num_frames_in_current_chunk_);
+  writer->Write<uint64_t>(result_.size());
+  for (const DecodeResult& result : result_) {
+    writer->Write(result.score);
+    writer->Write(result.sentence);
+    writer->Write<uint64_t>(result.word_pieces.size());
+    for (const WordPiece& word_piece : result.word_pieces) {
+      writer->Write(word_piece.word);
+      writer->Write(word_piece.start);
+      writer->Write(word_piece.end);
+    }
+  }
+  feature_pipeline_->SaveState(writer);
+  ctc_endpointer_->SaveState(writer);
+  return model_->SaveState(writer) && searcher_->SaveState(writer);
+}
+
+static bool ReadResult(BinaryReader* reader, DecodeResult* result) {
+  uint64_t num_word_pieces = 0;
+  if (!reader->Read(&result->score) || !reader->Read(&result->sentence) ||
+      !reader->Read(&num_word_pieces)) {
+    return false;
+  }
+  for (uint64_t i = 0; i < num_word_pieces; ++i) {
+    WordPiece word_piece("", -1, -1);
+    if (!reader->Read(&word_piece.word) || !reader->Read(&word_piece.start) ||
+        !reader->Read(&word_piece.end)) {
+      return false;
+    }
+    result->word_pieces.push_back(std::move(word_piece));
+  }
+  return true;
+}
+
+bool AsrDecoder::LoadState(BinaryReader* reader) {
+  Reset();
+  uint64_t num_results = 0;
+  bool ok = reader->Read(&start_) && reader->Read(&num_frames_) &&
+            reader->Read(&global_frame_offset_) &&
+            reader->Read(&num_frames_in_current_chunk_) &&
+            reader->Read(&num_results);
+  for (uint64_t i = 0; ok && i < num_results; ++i) {
+    result_.emplace_back();
+    ok = ReadResult(reader, &result_.back());
+  }
+  ok = ok && feature_pipeline_->LoadState(reader) &&
+       ctc_endpointer_->LoadState(reader) && model_->LoadState(reader) &&
+       searcher_->LoadState(reader);
+  if (!ok) {
+    Reset();
+    return false;
+  }
+  return true;
+}
+
+bool AsrDecoder::ChunkReady() const {
+  return feature_pipeline_->input_finished() ||
+         feature_pipeline_->NumQueuedFrames() >=
+             model_->num_frames_for_chunk(start_);
+}
+
+bool AsrDecoder::NotifyWhenChunkReady() {
+  return feature_pipeline_->NotifyWhenReady(
+      model_->num_frames_for_chunk(start_));
+}
+
 DecodeState AsrDecoder::Decode(bool block) {
   return this->AdvanceDecoding(block);
 }
@@ -87,16 +179,16 @@ void AsrDecoder::Rescoring() {
 }
 
 DecodeState AsrDecoder::AdvanceDecoding(bool block) {
+  TRACE_SCOPE("AsrDecoder::AdvanceDecoding");
   DecodeState state = DecodeState::kEndBatch;
   model_->set_chunk_size(opts_.chunk_size);
   model_->set_num_left_chunks(opts_.num_left_chunks);
 
   // compute frames need for chunk forward
   int num_requied_frames = model_->num_frames_for_chunk(start_);
-  std::vector<std::vector<float>> chunk_feats;
+  std::vector<std::vector<float>>& chunk_feats = chunk_feats_;
   // Return immediately if we do not want to block
-  if (!block && !feature_pipeline_->input_finished() &&
-      feature_pipeline_->NumQueuedFrames() < num_requied_frames) {
+  if (!block && !ChunkReady()) {
     return DecodeState::kWaitFeats;
   }
 
@@ -109,18 +201,25 @@ DecodeState AsrDecoder::AdvanceDecoding(bool block) {
   VLOG(1) << "Requied " << num_requied_frames << " get " << chunk_feats.size();
 
   Timer timer;
-  std::vector<std::vector<float>> ctc_log_probs;
+  std::vector<std::vector<float>>& ctc_log_probs = ctc_log_probs_;
   model_->ForwardEncoderChunk(chunk_feats, &ctc_log_probs);
   int forward_time = timer.Elapsed();
 
   timer.Reset();
-  searcher_->Search(ctc_log_probs);
+  {
+    LatencyStats::ScopedTimer stage(&DecodeLatency(), kStageSearch);
+    searcher_->Search(ctc_log_probs);
+  }
   int search_time = timer.Elapsed();
   VLOG(1) << "forward takes " << forward_time << " ms, search takes "
           << search_time << " ms";
-  UpdateResult(false);
+  {
+    LatencyStats::ScopedTimer stage(&DecodeLatency(), kStageResult);
+    UpdateResult(false);
+  }
 
   if (state != DecodeState::kEndFeats) {
+    LatencyStats::ScopedTimer stage(&DecodeLatency(), kStageEndpoint);
     if (ctc_endpointer_->IsEndpoint(ctc_log_probs, DecodedSomething())) {
       VLOG(1) << "Endpoint is detected at " << num_frames_;
       state = DecodeState::kEndpoint;
@@ -136,23 +235,26 @@ void AsrDecoder::UpdateResult(bool finish) {
   const auto& inputs = searcher_->Inputs();
   const auto& likelihood = searcher_->Likelihood();
   const auto& times = searcher_->Times();
-  result_.clear();
 
   CHECK_EQ(hypotheses.size(), likelihood.size());
+  // the results are rebuilt in place, so the strings of the last ones are
+  // reused
+  ResizeReusing(&result_, hypotheses.size(), &spare_results_);
   for (size_t i = 0; i < hypotheses.size(); i++) {
     const std::vector<int>& hypothesis = hypotheses[i];
 
-    DecodeResult path;
+    DecodeResult& path = result_[i];
     path.score = likelihood[i];
+    path.sentence.clear();
+    path.word_pieces.clear();
     for (size_t j = 0; j < hypothesis.size(); j++) {
       std::string word = symbol_table_->Find(hypothesis[j]);
       // A detailed explanation of this if-else branch can be found in
       // https://github.com/wenet-e2e/wenet/issues/583#issuecomment-907994058
       if (searcher_->Type() == kWfstBeamSearch) {
-        path.sentence += (" " + word);
-      } else {
-        path.sentence += (word);
+        path.sentence += ' ';
       }
+      path.sentence += word;
     }
 
     // TimeStamp is only supported in final result
@@ -165,7 +267,7 @@ void AsrDecoder::UpdateResult(bool finish) {
       int offset = global_frame_offset_ * feature_frame_shift_in_ms();
 
       const std::vector<int>& input = inputs[i];
-      const std::vector<int> time_stamp = times[i];
+      const std::vector<int>& time_stamp = times[i];
       CHECK_EQ(input.size(), time_stamp.size());
 
       for (size_t j = 0; j < input.size(); j++) {
@@ -191,16 +293,13 @@ void AsrDecoder::UpdateResult(bool finish) {
                     : end;
         }
 
-        WordPiece word_piece(word, offset + start, offset + end);
-        path.word_pieces.emplace_back(word_piece);
+        path.word_pieces.emplace_back(word, offset + start, offset + end);
       }
     }
 
     if (post_processor_ != nullptr) {
       // path.sentence = post_processor_->Process(path.sentence, finish);
     }
-
-    result_.emplace_back(path);
   }
 
   if (DecodedSomething()) {
@@ -208,8 +307,94 @@ void AsrDecoder::UpdateResult(bool finish) {
   }
 }
 
-void AsrDecoder::AttentionRescoring() {
+// combine ctc score and rescoring score, and sort by the combined score.
+// The hyps past rescoring_score are not rescored and keep their ctc scores
+// and order, after the rescored ones.
+static void CombineRescoringScore(const std::vector<float>& rescoring_score,
+                                  float rescoring_weight,
+                                  float ctc_weight,
+                                  std::vector<DecodeResult>* result) {
+  CHECK_LE(rescoring_score.size(), result->size());
+  for (size_t i = 0; i < rescoring_score.size(); i++) {
+    VLOG(1) << "hyp " << i << " rescoring_score: " << rescoring_score[i]
+            << " ctc_score: " << (*result)[i].score;
+    (*result)[i].score =
+        rescoring_weight * rescoring_score[i] + ctc_weight * (*result)[i].score;
+  }
+
+  std::sort(result->begin(),
+            result->begin() + rescoring_score.size(),
+            DecodeResult::CompareFunc);
+  VLOG(1) << "result: " << (*result)[0].sentence
+          << " score: " << (*result)[0].score;
+}
+
+RescoringGateStats& RescoringGateStats::Global() {
+  static RescoringGateStats stats;
+  return stats;
+}
+
+std::string RescoringGateStats::Report() const {
+  int64_t num_skipped = num_skip_empty + num_skip_single + num_skip_margin;
+  std::ostringstream os;
+  os << "rescoring gate: " << num_rescorings << " rescorings, skipped "
+     << num_skipped << " (empty " << num_skip_empty << ", single "
+     << num_skip_single << ", margin " << num_skip_margin << "), top k "
+     << num_top_k << ", rescored tokens " << num_rescored_tokens << "/"
+     << num_tokens << " ("
+     << std::setprecision(3)
+     << 100.0 * (num_tokens - num_rescored_tokens) /
+            std::max<int64_t>(num_tokens, 1)
+     << "% saved)";
+  return os.str();
+}
+
+void AsrDecoder::FinalizeSearch() {
+  if (search_finalized_) return;
   searcher_->FinalizeSearch();
+  search_finalized_ = true;
+}
+
+int AsrDecoder::GateRescoring() {
+  // the counts of a rescoring not recorded go to a scratch stats
+  RescoringGateStats unrecorded;
+  RescoringGateStats& stats =
+      record_stats_ ? RescoringGateStats::Global() : unrecorded;
+  const auto& hypotheses = searcher_->Inputs();
+  int num_hyps = hypotheses.size();
+  ++stats.num_rescorings;
+  for (const auto& hyp : hypotheses) {
+    stats.num_tokens += hyp.size() + 1;  // eos
+  }
+
+  // result_ is in the ctc score order of the searcher
+  int num_rescored = num_hyps;
+  if (num_hyps == 0) {
+    num_rescored = 0;
+  } else if (opts_.rescoring_skip_empty && hypotheses[0].empty()) {
+    ++stats.num_skip_empty;
+    num_rescored = 0;
+  } else if (opts_.rescoring_skip_single && num_hyps == 1) {
+    ++stats.num_skip_single;
+    num_rescored = 0;
+  } else if (opts_.rescoring_skip_margin > 0 && num_hyps > 1 &&
+             result_[0].score - result_[1].score >=
+                 opts_.rescoring_skip_margin) {
+    ++stats.num_skip_margin;
+    num_rescored = 0;
+  } else if (opts_.rescoring_top_k > 0 && opts_.rescoring_top_k < num_hyps) {
+    ++stats.num_top_k;
+    num_rescored = opts_.rescoring_top_k;
+  }
+
+  for (int i = 0; i < num_rescored; ++i) {
+    stats.num_rescored_tokens += hypotheses[i].size() + 1;
+  }
+  return num_rescored;
+}
+
+void AsrDecoder::AttentionRescoring() {
+  FinalizeSearch();
   UpdateResult(true);
   // No need to do rescoring
   if (0.0 == opts_.rescoring_weight) {
@@ -218,31 +403,58 @@ void AsrDecoder::AttentionRescoring() {
   }
   LOG_EVERY_N(WARNING, 3) << "Do AttentionRescoring!";
 
-  // Inputs() returns N-best input ids, which is the basic unit for rescoring
-  // In CtcPrefixBeamSearch, inputs are the same to outputs
-  const auto& hypotheses = searcher_->Inputs();
-  int num_hyps = hypotheses.size();
+  int num_hyps = GateRescoring();
   if (num_hyps <= 0) {
     return;
   }
 
+  // Inputs() returns N-best input ids, which is the basic unit for rescoring
+  // In CtcPrefixBeamSearch, inputs are the same to outputs
+  const auto& inputs = searcher_->Inputs();
+  std::vector<std::vector<int>> hypotheses(inputs.begin(),
+                                           inputs.begin() + num_hyps);
+
   Timer timer;
   std::vector<float> rescoring_score;
-  model_->AttentionRescoring(
-      hypotheses, opts_.reverse_weight, &rescoring_score);
+  {
+    LatencyStats::ScopedPause pause(!record_stats_);
+    model_->AttentionRescoring(
+        hypotheses, opts_.reverse_weight, &rescoring_score);
+  }
   VLOG(1) << "Attention Rescoring takes " << timer.Elapsed();
 
-  // combine ctc score and rescoring score
-  for (size_t i = 0; i < num_hyps; i++) {
-    VLOG(1) << "hyp " << i << " rescoring_score: " << rescoring_score[i]
-            << " ctc_score: " << result_[i].score;
-    result_[i].score = opts_.rescoring_weight * rescoring_score[i] +
-                       opts_.ctc_weight * result_[i].score;
+  CombineRescoringScore(
+      rescoring_score, opts_.rescoring_weight, opts_.ctc_weight, &result_);
+}
+
+void AsrDecoder::RescoringAsync(
+    RescoringExecutor* executor,
+    std::function<void(std::vector<DecodeResult>)> done) {
+  FinalizeSearch();
+  UpdateResult(true);
+  int num_hyps = 0.0 == opts_.rescoring_weight ? 0 : GateRescoring();
+  std::vector<DecodeResult> result = result_;
+  if (num_hyps <= 0) {
+    done(std::move(result));
+    return;
   }
 
-  std::sort(result_.begin(), result_.end(), DecodeResult::CompareFunc);
-  VLOG(1) << "result: " << result_[0].sentence
-          << " score: " << result_[0].score;
+  const auto& inputs = searcher_->Inputs();
+  std::vector<std::vector<int>> hypotheses(inputs.begin(),
+                                           inputs.begin() + num_hyps);
+  // the weights are copied, the decoder may be gone when it is done
+  float rescoring_weight = opts_.rescoring_weight;
+  float ctc_weight = opts_.ctc_weight;
+  executor->Submit(
+      model_->CopyForRescoring(),
+      std::move(hypotheses),
+      opts_.reverse_weight,
+      [rescoring_weight, ctc_weight, result, done](
+          std::vector<float> rescoring_score) mutable {
+        CombineRescoringScore(
+            rescoring_score, rescoring_weight, ctc_weight, &result);
+        done(std::move(result));
+      });
 }
 
-}  // namespace ppspeech
\ No newline at end of file
+}  // namespace ppspeech
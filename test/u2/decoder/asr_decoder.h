@@ -15,6 +15,9 @@
 
 #pragma once
 
+#include <atomic>
+#include <cstdint>
+#include <functional>
 #include <memory>
 #include <string>
 #include <utility>
@@ -26,6 +29,7 @@
 #include "decoder/asr_itf.h"
 #include "decoder/ctc_endpoint.h"
 #include "decoder/ctc_prefix_beam_search.h"
+#include "decoder/rescoring_executor.h"
 #include "decoder/search_itf.h"
 #include "frontend/feature_pipeline.h"
 #include "utils/log.h"
@@ -53,6 +57,21 @@ struct DecodeOptions {
   float ctc_weight = 0.5;
   float rescoring_weight = 1.0;
   float reverse_weight = 0.0;
+  // Rescoring gate, the second pass is skipped when the ctc result is
+  // decisive: the best hyp is empty (rescoring_skip_empty), the n-best has a
+  // single hyp (rescoring_skip_single), or the ctc score of the best hyp is
+  // above the second one by rescoring_skip_margin (<= 0 disables it).
+  // Otherwise only the top rescoring_top_k hyps are rescored (<= 0 for all),
+  // the others stay in the n-best with their ctc scores, ranked after the
+  // rescored ones. All off by default, as the skips keep the ctc scores in
+  // the results.
+  bool rescoring_skip_empty = false;
+  bool rescoring_skip_single = false;
+  float rescoring_skip_margin = 0.0;
+  int rescoring_top_k = 0;
+  FrameReductionOptions frame_reduction;
+  // shapes the model is warmed up with when it is loaded
+  std::vector<WarmupShape> warmup_shapes;
   CtcEndpointConfig ctc_endpoint_config;
   CtcPrefixBeamSearchOptions ctc_prefix_search_opts;
   // CtcWfstBeamSearchOptions ctc_wfst_search_opts;
@@ -77,6 +96,21 @@ struct DecodeResult {
   }
 };
 
+// How often each branch of the rescoring gate fires, over all decoders.
+// The tokens of the hyps measure the attention decoder compute.
+struct RescoringGateStats {
+  std::atomic<int64_t> num_rescorings{0};
+  std::atomic<int64_t> num_skip_empty{0};
+  std::atomic<int64_t> num_skip_single{0};
+  std::atomic<int64_t> num_skip_margin{0};
+  std::atomic<int64_t> num_top_k{0};  // only a top k subset is rescored
+  std::atomic<int64_t> num_tokens{0};
+  std::atomic<int64_t> num_rescored_tokens{0};
+
+  static RescoringGateStats& Global();
+  std::string Report() const;
+};
+
 // e.g. if subsample rate is 4 and chunk_size = 16, the frames in
 // one chunk are 67=16*4 + 3, stride is 64=16*4
 enum DecodeState {
@@ -107,13 +141,37 @@ class AsrDecoder {
   //               inference. Otherwise, return kWaitFeats.
   DecodeState Decode(bool block = true);
 
+  // True if Decode(false) will not return kWaitFeats, i.e. the features of
+  // one chunk are queued or the input is finished.
+  bool ChunkReady() const;
+  // Asks the feature pipeline to call its ready callback once ChunkReady(),
+  // see FeaturePipeline::NotifyWhenReady(). False if it is already.
+  bool NotifyWhenChunkReady();
+
   void Rescoring();
+  // Override opts.frame_reduction for the next rescorings, e.g. to compare
+  // the rescoring with and without the blank frames.
+  void set_frame_reduction(const FrameReductionOptions& opts) {
+    model_->set_frame_reduction(opts);
+  }
+  // false to keep the next rescorings out of RescoringGateStats and the
+  // latencies of the calling thread, e.g. the rescoring compared against.
+  void set_record_stats(bool record_stats) { record_stats_ = record_stats; }
+  // Rescoring on an executor thread. The n-best and the encoder outputs so
+  // far are handed to executor, so the decoder can go on at once, e.g. by
+  // ResetContinuousDecoding(). done is called with the rescored results,
+  // result() is not updated.
+  void RescoringAsync(RescoringExecutor* executor,
+                      std::function<void(std::vector<DecodeResult>)> done);
   void Reset();
   void ResetContinuousDecoding();
   bool DecodedSomething() const {
     return !result_.empty() && !result_[0].sentence.empty();
   }
 
+  // feature frames decoded since Reset(), over all the segments
+  int num_frames() const { return num_frames_; }
+
   // This method is used for time benchmark
   int num_frames_in_current_chunk() const {
     return num_frames_in_current_chunk_;
@@ -131,9 +189,24 @@ class AsrDecoder {
 
   const std::vector<DecodeResult>& result() const { return result_; }
 
+  // Bytes held by the model caches, the features queued and the search.
+  // Call it on the decoding thread.
+  MemoryUsage memory_usage() const;
+
+  // Snapshot of the stream between two Decode() calls: the features not
+  // decoded yet, the model caches and encoder outs, the hypotheses and the
+  // endpoint. False if the searcher has no snapshot, e.g. the wfst search.
+  // On a failed LoadState() the decoder is Reset().
+  bool SaveState(BinaryWriter* writer) const;
+  bool LoadState(BinaryReader* reader);
+
  private:
   DecodeState AdvanceDecoding(bool block = true);
   void AttentionRescoring();
+  // once per segment, so rescoring again keeps the final hyps
+  void FinalizeSearch();
+  // Number of the top hyps of result_ to rescore, 0 to skip rescoring.
+  int GateRescoring();
 
   void UpdateResult(bool finish = false);
 
@@ -161,6 +234,14 @@ class AsrDecoder {
 
   int num_frames_in_current_chunk_ = 0;
   std::vector<DecodeResult> result_;
+  bool search_finalized_ = false;
+  bool record_stats_ = true;
+
+  // buffers kept over the chunks, so the steady state decode loop does not
+  // allocate
+  std::vector<std::vector<float>> chunk_feats_;
+  std::vector<std::vector<float>> ctc_log_probs_;
+  std::vector<DecodeResult> spare_results_;
 
  public:
   DISALLOW_COPY_AND_ASSIGN(AsrDecoder);
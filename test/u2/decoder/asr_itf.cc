@@ -47,15 +47,41 @@ void AsrModelItf::CacheFeature(
 void AsrModelItf::ForwardEncoderChunk(
     const std::vector<std::vector<float>>& chunk_feats,
     std::vector<std::vector<float>>* ctc_probs) {
-  ctc_probs->clear();
   int num_frames = cached_feats_.size() + chunk_feats.size();
   VLOG(3) << "foward encoder chunk: " << num_frames << " frames";
   VLOG(3) << "context: " << this->context() << " frames";
   if (num_frames >= this->context()) {
+    // ctc_probs is resized by the impl, the frames it holds are reused
     this->ForwardEncoderChunkImpl(chunk_feats, ctc_probs);
     VLOG(3) << "after forward chunk";
     this->CacheFeature(chunk_feats);
+  } else {
+    ctc_probs->clear();
+  }
+}
+
+bool AsrModelItf::SaveState(BinaryWriter* writer) const {
+  writer->Write(offset_);
+  writer->Write(cached_feats_);
+  return true;
+}
+
+bool AsrModelItf::LoadState(BinaryReader* reader) {
+  return reader->Read(&offset_) && reader->Read(&cached_feats_);
+}
+
+void AsrModelItf::BatchAttentionRescoring(
+    const std::vector<AsrModelItf*>& models,
+    const std::vector<const std::vector<std::vector<int>>*>& hyps,
+    const std::vector<float>& reverse_weights,
+    std::vector<std::vector<float>>* rescoring_scores) {
+  CHECK_EQ(models.size(), hyps.size());
+  CHECK_EQ(models.size(), reverse_weights.size());
+  rescoring_scores->resize(models.size());
+  for (size_t i = 0; i < models.size(); ++i) {
+    models[i]->AttentionRescoring(
+        *hyps[i], reverse_weights[i], &(*rescoring_scores)[i]);
   }
 }
 
-}  // namespace ppspeech
\ No newline at end of file
+}  // namespace ppspeech
@@ -3,12 +3,41 @@
 
 #pragma once
 
+#include <cstdint>
 #include <memory>
 #include <string>
 #include <vector>
 
+#include "decoder/rescoring_batch.h"
+#include "utils/io.h"
+
 namespace ppspeech {
 
+// Bytes held by one stream.
+struct MemoryUsage {
+  int64_t att_cache = 0;
+  int64_t cnn_cache = 0;
+  int64_t encoder_outs = 0;
+  int64_t feature_queue = 0;
+  int64_t hypotheses = 0;
+
+  int64_t total() const {
+    return att_cache + cnn_cache + encoder_outs + feature_queue + hypotheses;
+  }
+};
+
+// Shapes a model is run with before the first request, so the kernels,
+// allocations and caches of the streams are not set up by the first one.
+struct WarmupShape {
+  int chunk_size = 16;
+  int num_left_chunks = -1;
+  // n-best size and the length of the longest hyp of the rescoring
+  int nbest = 10;
+  int max_hyp_len = 32;
+  // encoder frames fed chunk by chunk, and rescored
+  int encoder_len = 256;
+};
+
 class AsrModelItf {
  public:
   virtual int context() const { return right_context_ + 1; }
@@ -26,6 +55,29 @@ class AsrModelItf {
     num_left_chunks_ = num_left_chunks;
   }
 
+  // intra-op threads of each forward of this model, on the calling thread,
+  // <= 0 keeps the threads of the calling thread
+  virtual void set_num_threads(int num_threads) { num_threads_ = num_threads; }
+
+  // fills the caches and the encoder outs of usage
+  virtual void GetMemoryUsage(MemoryUsage* usage) const {}
+
+  virtual void set_frame_reduction(const FrameReductionOptions& opts) {
+    frame_reduction_ = opts;
+  }
+
+  // Run the model with each shape on a copy of it, num_threads shapes at
+  // a time, and log the time of each.
+  virtual void Warmup(const std::vector<WarmupShape>& shapes,
+                      int feature_dim,
+                      int num_threads) {}
+
+  // Snapshot of the stream state, the offset and the cached features here,
+  // the caches and the encoder outs by the models. Restored into a copy of
+  // the same model.
+  virtual bool SaveState(BinaryWriter* writer) const;
+  virtual bool LoadState(BinaryReader* reader);
+
   // start: false, it is the start chunk of one sentence, else true
   virtual int num_frames_for_chunk(bool start) const;
 
@@ -41,7 +93,21 @@ class AsrModelItf {
 
   virtual std::shared_ptr<AsrModelItf> Copy() const = 0;
 
+  // A copy holding the encoder outputs so far, for AttentionRescoring() on
+  // another thread while this model goes on decoding or is reset.
+  virtual std::shared_ptr<AsrModelItf> CopyForRescoring() const = 0;
+
+  // Rescore the n-best of several models, e.g. CopyForRescoring() of
+  // different sessions, in one call. The default rescores them one by one.
+  virtual void BatchAttentionRescoring(
+      const std::vector<AsrModelItf*>& models,
+      const std::vector<const std::vector<std::vector<int>>*>& hyps,
+      const std::vector<float>& reverse_weights,
+      std::vector<std::vector<float>>* rescoring_scores);
+
  protected:
+  // ctc_probs holds the frames of the last chunk, it is resized to those of
+  // this chunk, so their buffers are reused.
   virtual void ForwardEncoderChunkImpl(
       const std::vector<std::vector<float>>& chunk_feats,
       std::vector<std::vector<float>>* ctc_probs) = 0;
@@ -61,6 +127,9 @@ class AsrModelItf {
   int chunk_size_{16};  // num of decoder frames. If chunk_size > 0, streaming
                          // case. Otherwise, none streaming case
   int num_left_chunks_{-1};  // -1 means all left chunks
+  int num_threads_{0};
+  // blank frames dropped from the encoder output for rescoring
+  FrameReductionOptions frame_reduction_;
 
   // asr decoder state
   int offset_{0};  // current offset in encoder output time stamp. Used by
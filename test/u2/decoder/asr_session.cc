@@ -0,0 +1,254 @@
+// Copyright (c) 2022 PaddlePaddle Authors. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "decoder/asr_session.h"
+
+#include <utility>
+
+#include "decoder/decode_latency.h"
+#include "decoder/session_engine.h"
+#include "utils/timer.h"
+#include "utils/tracer.h"
+
+namespace ppspeech {
+
+static int64_t NextTraceId() {
+  static std::atomic<int64_t> next_id{0};
+  return next_id.fetch_add(1);
+}
+
+AsrSession::AsrSession(const std::string& key,
+                       const FeaturePipelineConfig& feature_config,
+                       std::shared_ptr<DecodeResource> resource,
+                       const DecodeOptions& opts,
+                       bool continuous_decoding)
+    : key_(key),
+      trace_id_(NextTraceId()),
+      continuous_decoding_(continuous_decoding),
+      feature_pipeline_(std::make_shared<FeaturePipeline>(feature_config)) {
+  decoder_.reset(new AsrDecoder(feature_pipeline_, std::move(resource), opts));
+  feature_pipeline_->set_ready_callback([this]() { Schedule(); });
+}
+
+void AsrSession::Reset(const std::string& key) {
+  key_ = key;
+  trace_id_ = NextTraceId();
+  // the feature pipeline is reset by the decoder
+  decoder_->Reset();
+  partial_callback_ = nullptr;
+  final_callback_ = nullptr;
+  rescoring_executor_ = nullptr;
+  engine_ = nullptr;
+  finished_ = false;
+  evicted_ = false;
+  partial_reported_ = false;
+  first_partial_latency_ = -1;
+  final_latency_ = -1;
+  decode_time_ = 0;
+  num_samples_ = 0;
+
+  std::lock_guard<std::mutex> lock(segment_mutex_);
+  segments_.clear();
+  num_pending_segments_ = 0;
+  final_result_.clear();
+  final_nbest_.clear();
+}
+
+static const uint32_t kSnapshotMagic = 0x50535353;  // "SSSP"
+// 2: the prefix beam search keeps its hyps in insertion order, no buckets
+static const uint32_t kSnapshotVersion = 2;
+
+bool AsrSession::SaveState(std::string* snapshot) const {
+  snapshot->clear();
+  BinaryWriter writer(snapshot);
+  writer.Write(kSnapshotMagic);
+  writer.Write(kSnapshotVersion);
+  writer.Write(key_);
+  writer.Write(decode_time_);
+  writer.Write(num_samples_);
+  {
+    std::lock_guard<std::mutex> lock(segment_mutex_);
+    if (finished_ || evicted_ || num_pending_segments_ > 0) return false;
+    writer.Write(segments_);
+  }
+  return decoder_->SaveState(&writer);
+}
+
+bool AsrSession::LoadState(const std::string& snapshot) {
+  Reset("");
+  BinaryReader reader(snapshot);
+  uint32_t magic = 0;
+  uint32_t version = 0;
+  bool ok = reader.Read(&magic) && magic == kSnapshotMagic &&
+            reader.Read(&version) && version == kSnapshotVersion &&
+            reader.Read(&key_) && reader.Read(&decode_time_) &&
+            reader.Read(&num_samples_);
+  if (ok) {
+    std::lock_guard<std::mutex> lock(segment_mutex_);
+    ok = reader.Read(&segments_);
+  }
+  ok = ok && decoder_->LoadState(&reader) && reader.done();
+  if (!ok) {
+    LOG(WARNING) << "bad session snapshot of " << snapshot.size() << " bytes";
+    Reset("");
+    return false;
+  }
+  // the latencies of a restored stream start over, without its first
+  // partial result
+  partial_reported_ = true;
+  OnFirstSamples();
+  input_finished_time_ = start_time_;
+  return true;
+}
+
+void AsrSession::AcceptWaveform(const float* pcm, int size) {
+  if (evicted_) return;
+  if (num_samples_ == 0) OnFirstSamples();
+  TRACE_SCOPE_ID("AsrSession::AcceptWaveform", trace_id_);
+  {
+    LatencyStats::ScopedTimer stage(&DecodeLatency(), kStageFeature);
+    feature_pipeline_->AcceptWaveform(pcm, size);
+  }
+  num_samples_ += size;
+}
+
+void AsrSession::AcceptWaveform(const int16_t* pcm, int size) {
+  if (evicted_) return;
+  if (num_samples_ == 0) OnFirstSamples();
+  TRACE_SCOPE_ID("AsrSession::AcceptWaveform", trace_id_);
+  {
+    LatencyStats::ScopedTimer stage(&DecodeLatency(), kStageFeature);
+    feature_pipeline_->AcceptWaveform(pcm, size);
+  }
+  num_samples_ += size;
+}
+
+void AsrSession::OnFirstSamples() {
+  start_time_ = std::chrono::steady_clock::now();
+  Tracer& tracer = GlobalTracer();
+  if (tracer.enabled()) tracer.SetIdName(trace_id_, key_);
+}
+
+void AsrSession::SetInputFinished() {
+  if (evicted_) return;
+  input_finished_time_ = std::chrono::steady_clock::now();
+  feature_pipeline_->SetInputFinished();
+}
+
+static int64_t MicrosSince(std::chrono::steady_clock::time_point start) {
+  return std::chrono::duration_cast<std::chrono::microseconds>(
+             std::chrono::steady_clock::now() - start)
+      .count();
+}
+
+void AsrSession::Schedule() {
+  if (engine_ != nullptr) engine_->Schedule(this);
+}
+
+int AsrSession::wave_dur() const {
+  return static_cast<int>(static_cast<float>(num_samples_) /
+                          feature_pipeline_->config().sample_rate * 1000);
+}
+
+DecodeState AsrSession::Step() {
+  if (finished_) return DecodeState::kEndFeats;
+  TRACE_SCOPE_ID("AsrSession::Step", trace_id_);
+
+  Timer timer;
+  DecodeState state = decoder_->Decode(false);
+  if (state == DecodeState::kWaitFeats) return state;
+  decode_time_ += timer.Elapsed();
+
+  if (state == DecodeState::kEndFeats) {
+    FinishSegment(true);
+  } else {
+    if (decoder_->DecodedSomething() && !partial_reported_) {
+      partial_reported_ = true;
+      first_partial_latency_ = MicrosSince(start_time_);
+      DecodeLatency().Record(kStageFirstPartial, first_partial_latency_);
+    }
+    if (decoder_->DecodedSomething() && partial_callback_) {
+      partial_callback_(this);
+    }
+    if (continuous_decoding_ && state == DecodeState::kEndpoint) {
+      if (decoder_->DecodedSomething()) FinishSegment(false);
+      decoder_->ResetContinuousDecoding();
+    }
+  }
+  return state;
+}
+
+void AsrSession::Evict() {
+  if (finished_) return;
+  LOG(WARNING) << key_ << ": evicted by the memory limit after "
+               << decode_time_ << "ms decoding";
+  evicted_ = true;
+  FinishSegment(true);
+  // the rescoring has its own copy of the encoder outs
+  decoder_->ResetContinuousDecoding();
+}
+
+void AsrSession::FinishSegment(bool last) {
+  int segment = 0;
+  {
+    std::lock_guard<std::mutex> lock(segment_mutex_);
+    segment = segments_.size();
+    segments_.emplace_back();
+    ++num_pending_segments_;
+    // set before the rescoring may finish on another thread
+    if (last) finished_ = true;
+  }
+
+  if (rescoring_executor_ == nullptr) {
+    Timer timer;
+    decoder_->Rescoring();
+    decode_time_ += timer.Elapsed();
+    OnSegmentRescored(segment, last, decoder_->result());
+    return;
+  }
+  // hold the session until the rescoring is done
+  std::shared_ptr<AsrSession> self = shared_from_this();
+  decoder_->RescoringAsync(
+      rescoring_executor_,
+      [self, segment, last](std::vector<DecodeResult> result) {
+        self->OnSegmentRescored(segment, last, std::move(result));
+      });
+}
+
+void AsrSession::OnSegmentRescored(int segment,
+                                   bool last,
+                                   std::vector<DecodeResult> result) {
+  {
+    std::lock_guard<std::mutex> lock(segment_mutex_);
+    if (!result.empty() && !result[0].sentence.empty()) {
+      VLOG(1) << key_ << ": Final result of segment " << segment << ": "
+              << result[0].sentence;
+      segments_[segment] = result[0].sentence;
+    }
+    if (last) final_nbest_ = std::move(result);
+    --num_pending_segments_;
+    if (!finished_ || num_pending_segments_ > 0) return;
+    for (const std::string& sentence : segments_) {
+      final_result_.append(sentence);
+    }
+  }
+  // an evicted stream may not have its input finished
+  if (!evicted_) {
+    final_latency_ = MicrosSince(input_finished_time_);
+    DecodeLatency().Record(kStageFinal, final_latency_);
+  }
+  if (final_callback_) final_callback_(this);
+}
+
+}  // namespace ppspeech
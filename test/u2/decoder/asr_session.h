@@ -0,0 +1,178 @@
+// Copyright (c) 2022 PaddlePaddle Authors. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include "decoder/asr_decoder.h"
+#include "decoder/rescoring_executor.h"
+#include "frontend/feature_pipeline.h"
+#include "utils/utils.h"
+
+namespace ppspeech {
+
+class SessionEngine;
+
+// One live stream, i.e. its feature pipeline and decoder, decoded chunk by
+// chunk as a state machine by Step() instead of owning a blocked thread.
+//
+// Audio is fed by AcceptWaveform() and SetInputFinished() from any one
+// producer thread, Step() is called by one decoding thread at a time. When
+// the session is added to a SessionEngine, the engine calls Step() on its
+// workers whenever a chunk is ready. Never feed audio after
+// SetInputFinished().
+//
+// With a RescoringExecutor, the rescoring of each endpoint runs on the
+// executor and the decoding goes on meanwhile, the final callback is called
+// once the rescoring of the last segment is done. The session must be
+// owned by a shared_ptr then.
+//
+// A session is reusable by Reset(), see SessionPool.
+class AsrSession : public std::enable_shared_from_this<AsrSession> {
+ public:
+  // partial results are read by result() on the decoding thread, the final
+  // ones by final_result() and final_nbest() on the decoding or rescoring
+  // thread
+  using Callback = std::function<void(AsrSession* session)>;
+
+  AsrSession(const std::string& key,
+             const FeaturePipelineConfig& feature_config,
+             std::shared_ptr<DecodeResource> resource,
+             const DecodeOptions& opts,
+             bool continuous_decoding = false);
+
+  void set_partial_callback(Callback callback) {
+    partial_callback_ = std::move(callback);
+  }
+  void set_final_callback(Callback callback) {
+    final_callback_ = std::move(callback);
+  }
+  // nullptr for rescoring on the decoding thread
+  void set_rescoring_executor(RescoringExecutor* executor) {
+    rescoring_executor_ = executor;
+  }
+  RescoringExecutor* rescoring_executor() const { return rescoring_executor_; }
+
+  // Ready for a new stream, keeping the feature pipeline, the decoder and
+  // the capacity of their buffers. The callbacks and the executor are
+  // cleared. Never call it while the session is decoded or rescored.
+  void Reset(const std::string& key);
+
+  void AcceptWaveform(const float* pcm, int size);
+  void AcceptWaveform(const int16_t* pcm, int size);
+  void SetInputFinished();
+
+  // Decode at most one chunk without blocking. Returns kWaitFeats if no
+  // chunk is ready, kEndFeats once all the features are decoded.
+  DecodeState Step();
+
+  bool ChunkReady() const { return decoder_->ChunkReady(); }
+  // Once a chunk is ready, the engine of the session, if any, is told so
+  // from the thread feeding the audio. False if it is ready already.
+  bool NotifyWhenChunkReady() { return decoder_->NotifyWhenChunkReady(); }
+  // all the features are decoded, the final result may still be rescored
+  bool finished() const { return finished_; }
+  // finished early by the memory limit of the SessionEngine, the audio fed
+  // since is dropped
+  bool evicted() const { return evicted_; }
+
+  // call it when the session is not stepped, e.g. between Step() calls
+  MemoryUsage memory_usage() const { return decoder_->memory_usage(); }
+
+  // Snapshot of the stream to pause it or to go on with it in another
+  // session, e.g. of another process with the same model and options. Call
+  // it when the session is not stepped nor fed. False once the session is
+  // finished or while a segment is rescored.
+  bool SaveState(std::string* snapshot) const;
+  // The session is Reset() to the stream of snapshot, the callbacks and the
+  // executor are set again by the caller. On failure it is left Reset().
+  bool LoadState(const std::string& snapshot);
+
+  const std::string& key() const { return key_; }
+  const std::vector<DecodeResult>& result() const { return decoder_->result(); }
+  // the text of all the segments once the final callback is called
+  const std::string& final_result() const { return final_result_; }
+  // n-best of the last segment once the final callback is called
+  const std::vector<DecodeResult>& final_nbest() const { return final_nbest_; }
+  // in ms
+  int decode_time() const { return decode_time_; }
+  // in us, from the first audio to the first partial result and from the
+  // end of input to the final result, -1 if not reached
+  int64_t first_partial_latency() const { return first_partial_latency_; }
+  int64_t final_latency() const { return final_latency_; }
+  int wave_dur() const;
+  // the id of the session in the traces, new for each stream
+  int64_t trace_id() const { return trace_id_; }
+
+  // to drive the decoder directly instead of by Step()
+  FeaturePipeline* feature_pipeline() { return feature_pipeline_.get(); }
+  AsrDecoder* decoder() { return decoder_.get(); }
+
+ private:
+  void Schedule();
+  // the start of the latencies and of the traces of a stream
+  void OnFirstSamples();
+  // finish with the result so far and free the model caches
+  void Evict();
+  // rescore the current segment, sync or on the executor
+  void FinishSegment(bool last);
+  void OnSegmentRescored(int segment,
+                         bool last,
+                         std::vector<DecodeResult> result);
+
+  std::string key_;
+  int64_t trace_id_;
+  bool continuous_decoding_;
+  std::shared_ptr<FeaturePipeline> feature_pipeline_;
+  std::unique_ptr<AsrDecoder> decoder_;
+
+  Callback partial_callback_;
+  Callback final_callback_;
+  RescoringExecutor* rescoring_executor_ = nullptr;
+
+  // set by SessionEngine::AddSession
+  SessionEngine* engine_ = nullptr;
+
+  bool finished_ = false;
+  std::atomic<bool> evicted_{false};
+  // for the first partial and the final latency
+  std::chrono::steady_clock::time_point start_time_;
+  std::chrono::steady_clock::time_point input_finished_time_;
+  bool partial_reported_ = false;
+  int64_t first_partial_latency_ = -1;
+  int64_t final_latency_ = -1;
+  int decode_time_ = 0;
+  int num_samples_ = 0;
+
+  // the rescored text of each segment, filled in by the rescoring threads
+  mutable std::mutex segment_mutex_;
+  std::vector<std::string> segments_;
+  int num_pending_segments_ = 0;
+  std::string final_result_;
+  std::vector<DecodeResult> final_nbest_;
+
+  friend class SessionEngine;
+
+ public:
+  DISALLOW_COPY_AND_ASSIGN(AsrSession);
+};
+
+}  // namespace ppspeech
@@ -0,0 +1,343 @@
+// Copyright (c) 2022 PaddlePaddle Authors. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "decoder/batch_ctc_prefix_beam_search.h"
+
+#include <algorithm>
+#include <numeric>
+#include <utility>
+
+#include "utils/log.h"
+
+namespace ppspeech {
+
+// compact the prefix tree of a stream when it grows over this size
+static const int kMinCompactTrieSize = 4096;
+
+BatchSearchStream::~BatchSearchStream() { engine_->ReleaseStream(id_); }
+
+void BatchSearchStream::Search(const std::vector<std::vector<float>>& logp) {
+  engine_->Search({this}, {&logp});
+}
+
+void BatchSearchStream::Reset() {
+  engine_->ResetStream(id_);
+  engine_->UpdateResult(this);
+}
+
+BatchCtcPrefixBeamSearch::BatchCtcPrefixBeamSearch(
+    const CtcPrefixBeamSearchOptions& opts)
+    : opts_(opts), beam_(opts.second_beam_size) {
+  CHECK_GT(beam_, 0);
+}
+
+std::unique_ptr<BatchSearchStream> BatchCtcPrefixBeamSearch::NewStream() {
+  int id = std::find(in_use_.begin(), in_use_.end(), false) - in_use_.begin();
+  if (id == static_cast<int>(in_use_.size())) {
+    int num_slots = (id + 1) * beam_;
+    b_.resize(num_slots);
+    nb_.resize(num_slots);
+    v_b_.resize(num_slots);
+    v_nb_.resize(num_slots);
+    node_.resize(num_slots);
+    score_.resize(num_slots);
+    num_hyps_.push_back(0);
+    abs_time_step_.push_back(0);
+    compact_trie_size_.push_back(kMinCompactTrieSize);
+    in_use_.push_back(false);
+    tries_.emplace_back();
+  }
+  in_use_[id] = true;
+  ++num_streams_;
+
+  std::unique_ptr<BatchSearchStream> stream(new BatchSearchStream(this, id));
+  stream->Reset();
+  return stream;
+}
+
+void BatchCtcPrefixBeamSearch::ReleaseStream(int id) {
+  CHECK(in_use_[id]);
+  in_use_[id] = false;
+  num_hyps_[id] = 0;
+  tries_[id].clear();
+  --num_streams_;
+}
+
+void BatchCtcPrefixBeamSearch::ResetStream(int id) {
+  std::vector<Node>& trie = tries_[id];
+  trie.clear();
+  trie.emplace_back(-1, -1);  // root, the empty prefix
+
+  // empty hyp
+  int slot = id * beam_;
+  b_[slot] = 0.0f;         // log(1)
+  nb_[slot] = -kFloatMax;  // log(0)
+  v_b_[slot] = 0.0f;       // log(1)
+  v_nb_[slot] = 0.0f;      // log(1)
+  node_[slot] = 0;
+  num_hyps_[id] = 1;
+  abs_time_step_[id] = 0;
+  compact_trie_size_[id] = kMinCompactTrieSize;
+}
+
+void BatchCtcPrefixBeamSearch::Search(
+    const std::vector<BatchSearchStream*>& streams,
+    const std::vector<const std::vector<std::vector<float>>*>& logps) {
+  CHECK_EQ(streams.size(), logps.size());
+  int batch_size = streams.size();
+  size_t max_frames = 0;
+  for (int i = 0; i < batch_size; ++i) {
+    CHECK(streams[i]->engine_ == this);
+    max_frames = std::max(max_frames, logps[i]->size());
+  }
+
+  next_offset_.resize(batch_size);
+  num_next_.resize(batch_size);
+  // streams are advanced in lock step, a stream leaves the batch when its
+  // frames run out
+  for (size_t t = 0; t < max_frames; ++t) {
+    // 1. log-add(b, nb) of the current hypotheses of all streams
+    int max_num_next = 0;
+    for (int i = 0; i < batch_size; ++i) {
+      if (t >= logps[i]->size()) continue;
+      int id = streams[i]->id_;
+      int slot = id * beam_;
+      LogSumExp(&b_[slot], &nb_[slot], &score_[slot], num_hyps_[id]);
+      int num_tokens = std::min(static_cast<int>((*logps[i])[t].size()),
+                                opts_.first_beam_size);
+      max_num_next += num_hyps_[id] * (num_tokens + 1);
+    }
+    if (static_cast<int>(next_b_.size()) < max_num_next) {
+      next_b_.resize(max_num_next);
+      next_nb_.resize(max_num_next);
+      next_v_b_.resize(max_num_next);
+      next_v_nb_.resize(max_num_next);
+      next_score_.resize(max_num_next);
+      next_node_.resize(max_num_next);
+    }
+
+    // 2. first beam prune and token passing, stream by stream
+    int offset = 0;
+    for (int i = 0; i < batch_size; ++i) {
+      if (t >= logps[i]->size()) continue;
+      next_offset_[i] = offset;
+      num_next_[i] = ExpandFrame(streams[i]->id_, (*logps[i])[t], offset);
+      offset += num_next_[i];
+    }
+
+    // 3. log-add(b, nb) of the next hypotheses of all streams
+    LogSumExp(next_b_.data(), next_nb_.data(), next_score_.data(), offset);
+
+    // 4. second beam prune
+    for (int i = 0; i < batch_size; ++i) {
+      if (t >= logps[i]->size()) continue;
+      int id = streams[i]->id_;
+      PruneFrame(id, next_offset_[i], num_next_[i]);
+      ++abs_time_step_[id];
+    }
+  }
+
+  for (BatchSearchStream* stream : streams) {
+    if (static_cast<int>(tries_[stream->id_].size()) >
+        compact_trie_size_[stream->id_]) {
+      CompactTrie(stream->id_);
+    }
+    UpdateResult(stream);
+  }
+}
+
+int BatchCtcPrefixBeamSearch::ExpandFrame(int id,
+                                          const std::vector<float>& logp_t,
+                                          int offset) {
+  int first_beam_size =
+      std::min(static_cast<int>(logp_t.size()), opts_.first_beam_size);
+  TopK(logp_t, first_beam_size, &topk_score_, &topk_index_);
+
+  const int slot = id * beam_;
+  const int num_hyps = num_hyps_[id];
+  const int time = abs_time_step_[id];
+  if (next_of_node_.size() < tries_[id].size()) {
+    next_of_node_.resize(tries_[id].size(), -1);
+  }
+  int num_next = 0;
+  for (size_t i = 0; i < topk_index_.size(); ++i) {
+    int token = topk_index_[i];
+    float prob = topk_score_[i];
+    for (int h = slot; h < slot + num_hyps; ++h) {
+      int node = node_[h];
+      float viterbi_score = std::max(v_b_[h], v_nb_[h]);
+      if (token == opts_.blank) {
+        // case 0: *a + <blank> => *a, *a<blank> + <blank> => *a
+        int k = FindNext(node, offset, &num_next);
+        next_b_[k] = FastLogSumExp(next_b_[k], score_[h] + prob);
+        next_v_b_[k] = std::max(next_v_b_[k], viterbi_score + prob);
+      } else if (node != 0 && token == tries_[id][node].token) {
+        // case 1: *a + a => *a
+        int k = FindNext(node, offset, &num_next);
+        next_nb_[k] = FastLogSumExp(next_nb_[k], nb_[h] + prob);
+        next_v_nb_[k] = std::max(next_v_nb_[k], v_nb_[h] + prob);
+        UpdateTime(id, node, prob, time);
+
+        // case 2: *a<blank> + a => *aa
+        int child = GetChild(id, node, token);
+        k = FindNext(child, offset, &num_next);
+        next_nb_[k] = FastLogSumExp(next_nb_[k], b_[h] + prob);
+        next_v_nb_[k] = std::max(next_v_nb_[k], v_b_[h] + prob);
+        UpdateTime(id, child, prob, time);
+      } else {
+        // case 3: *a + b => *ab, *a<blank> + b => *ab
+        int child = GetChild(id, node, token);
+        int k = FindNext(child, offset, &num_next);
+        next_nb_[k] = FastLogSumExp(next_nb_[k], score_[h] + prob);
+        next_v_nb_[k] = std::max(next_v_nb_[k], viterbi_score + prob);
+        UpdateTime(id, child, prob, time);
+      }
+    }
+  }
+
+  // clear the node -> next hypothesis map for the next stream
+  for (int k = offset; k < offset + num_next; ++k) {
+    next_of_node_[next_node_[k]] = -1;
+  }
+  return num_next;
+}
+
+int BatchCtcPrefixBeamSearch::FindNext(int node, int offset, int* num_next) {
+  int& k = next_of_node_[node];
+  if (k < 0) {
+    k = offset + (*num_next)++;
+    next_b_[k] = -kFloatMax;
+    next_nb_[k] = -kFloatMax;
+    next_v_b_[k] = -kFloatMax;
+    next_v_nb_[k] = -kFloatMax;
+    next_node_[k] = node;
+  }
+  return k;
+}
+
+int BatchCtcPrefixBeamSearch::GetChild(int id, int node, int token) {
+  std::vector<Node>& trie = tries_[id];
+  for (int child = trie[node].first_child; child >= 0;
+       child = trie[child].next_sibling) {
+    if (trie[child].token == token) return child;
+  }
+  int child = trie.size();
+  trie.emplace_back(node, token);
+  trie[child].next_sibling = trie[node].first_child;
+  trie[node].first_child = child;
+  if (next_of_node_.size() < trie.size()) {
+    next_of_node_.resize(trie.size() * 2, -1);
+  }
+  return child;
+}
+
+void BatchCtcPrefixBeamSearch::UpdateTime(int id,
+                                          int node,
+                                          float prob,
+                                          int time) {
+  Node& n = tries_[id][node];
+  if (n.token_prob < prob) {
+    n.token_prob = prob;
+    n.time = time;
+  }
+}
+
+void BatchCtcPrefixBeamSearch::PruneFrame(int id, int offset, int num_next) {
+  int second_beam_size = std::min(num_next, beam_);
+  order_.resize(num_next);
+  std::iota(order_.begin(), order_.end(), offset);
+  auto compare = [this](int a, int b) {
+    return next_score_[a] > next_score_[b];
+  };
+  std::nth_element(order_.begin(),
+                   order_.begin() + second_beam_size,
+                   order_.end(),
+                   compare);
+  std::sort(order_.begin(), order_.begin() + second_beam_size, compare);
+
+  int slot = id * beam_;
+  for (int i = 0; i < second_beam_size; ++i) {
+    int k = order_[i];
+    b_[slot + i] = next_b_[k];
+    nb_[slot + i] = next_nb_[k];
+    v_b_[slot + i] = next_v_b_[k];
+    v_nb_[slot + i] = next_v_nb_[k];
+    node_[slot + i] = next_node_[k];
+  }
+  num_hyps_[id] = second_beam_size;
+}
+
+void BatchCtcPrefixBeamSearch::CompactTrie(int id) {
+  std::vector<Node>& trie = tries_[id];
+  // mark the prefixes of live hypotheses, a parent is always created before
+  // its children, so it has a smaller index
+  remap_.assign(trie.size(), -1);
+  remap_[0] = 0;
+  int slot = id * beam_;
+  for (int h = slot; h < slot + num_hyps_[id]; ++h) {
+    for (int node = node_[h]; node > 0 && remap_[node] < 0;
+         node = trie[node].parent) {
+      remap_[node] = 0;
+    }
+  }
+
+  int size = 0;
+  for (size_t node = 0; node < trie.size(); ++node) {
+    if (remap_[node] < 0) continue;
+    int new_node = size++;
+    remap_[node] = new_node;
+    trie[new_node] = trie[node];
+    trie[new_node].first_child = -1;
+    trie[new_node].next_sibling = -1;
+    if (new_node > 0) {
+      Node& parent = trie[remap_[trie[new_node].parent]];
+      trie[new_node].parent = remap_[trie[new_node].parent];
+      trie[new_node].next_sibling = parent.first_child;
+      parent.first_child = new_node;
+    }
+  }
+  trie.erase(trie.begin() + size, trie.end());
+
+  for (int h = slot; h < slot + num_hyps_[id]; ++h) {
+    node_[h] = remap_[node_[h]];
+  }
+  compact_trie_size_[id] = std::max(kMinCompactTrieSize, 2 * size);
+}
+
+void BatchCtcPrefixBeamSearch::UpdateResult(BatchSearchStream* stream) {
+  const int id = stream->id_;
+  const std::vector<Node>& trie = tries_[id];
+  const int slot = id * beam_;
+  const int num_hyps = num_hyps_[id];
+  stream->hypotheses_.resize(num_hyps);
+  stream->times_.resize(num_hyps);
+  stream->likelihood_.resize(num_hyps);
+  stream->viterbi_likelihood_.resize(num_hyps);
+  for (int i = 0; i < num_hyps; ++i) {
+    std::vector<int>& hyp = stream->hypotheses_[i];
+    std::vector<int>& times = stream->times_[i];
+    hyp.clear();
+    times.clear();
+    for (int node = node_[slot + i]; node > 0; node = trie[node].parent) {
+      hyp.push_back(trie[node].token);
+      times.push_back(trie[node].time);
+    }
+    std::reverse(hyp.begin(), hyp.end());
+    std::reverse(times.begin(), times.end());
+    stream->likelihood_[i] = FastLogSumExp(b_[slot + i], nb_[slot + i]);
+    stream->viterbi_likelihood_[i] = std::max(v_b_[slot + i], v_nb_[slot + i]);
+  }
+}
+
+}  // namespace ppspeech
@@ -0,0 +1,163 @@
+// Copyright (c) 2022 PaddlePaddle Authors. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#pragma once
+
+#include <memory>
+#include <vector>
+
+#include "decoder/ctc_prefix_beam_search.h"
+#include "decoder/search_itf.h"
+#include "utils/utils.h"
+
+namespace ppspeech {
+
+class BatchCtcPrefixBeamSearch;
+
+// One stream of a BatchCtcPrefixBeamSearch. Search() advances this stream
+// only, use BatchCtcPrefixBeamSearch::Search() to advance many streams in one
+// call. The stream must not outlive its engine.
+class BatchSearchStream : public SearchInterface {
+ public:
+  ~BatchSearchStream() override;
+
+  void Search(const std::vector<std::vector<float>>& logp) override;
+  void Reset() override;
+  // results are updated by every Search(), nothing to finalize since there
+  // is no context graph in batch search
+  void FinalizeSearch() override {}
+  SearchType Type() const override { return SearchType::kPrefixBeamSearch; }
+
+  const std::vector<std::vector<int>>& Inputs() const override {
+    return hypotheses_;
+  }
+  const std::vector<std::vector<int>>& Outputs() const override {
+    return hypotheses_;
+  }
+  const std::vector<float>& Likelihood() const override { return likelihood_; }
+  const std::vector<std::vector<int>>& Times() const override { return times_; }
+  const std::vector<float>& viterbi_likelihood() const {
+    return viterbi_likelihood_;
+  }
+
+  int id() const { return id_; }
+
+ private:
+  friend class BatchCtcPrefixBeamSearch;
+  BatchSearchStream(BatchCtcPrefixBeamSearch* engine, int id)
+      : engine_(engine), id_(id) {}
+
+  BatchCtcPrefixBeamSearch* engine_;
+  int id_;
+
+  // n-best list and corresponding likelihood, in sorted order
+  std::vector<std::vector<int>> hypotheses_;
+  std::vector<float> likelihood_;
+  std::vector<float> viterbi_likelihood_;
+  std::vector<std::vector<int>> times_;
+
+ public:
+  DISALLOW_COPY_AND_ASSIGN(BatchSearchStream);
+};
+
+// CTC prefix beam search of many streams on one core. Hypotheses of all
+// streams are kept in structure-of-arrays form, each stream owns
+// `second_beam_size` slots of the arrays. Prefixes are nodes of a per stream
+// prefix tree, so extending or merging a prefix never copies token vectors.
+// Scratch buffers are shared by all streams, and the log-adds of all streams
+// of one frame are done in one pass over contiguous arrays.
+//
+// The timestamp of a token is the frame where the token has the max prob in
+// its spike. Context graph and adaptive beam are not supported.
+//
+// Not thread safe, the engine and its streams must be used by one thread.
+// It is a standalone component for now: AsrDecoder and the SessionEngine
+// search each stream on its own, only the bench and the tests batch them.
+class BatchCtcPrefixBeamSearch {
+ public:
+  explicit BatchCtcPrefixBeamSearch(const CtcPrefixBeamSearchOptions& opts);
+
+  std::unique_ptr<BatchSearchStream> NewStream();
+
+  // Advance streams[i] by logps[i], streams may have different num frames.
+  void Search(const std::vector<BatchSearchStream*>& streams,
+              const std::vector<const std::vector<std::vector<float>>*>& logps);
+
+  int num_streams() const { return num_streams_; }
+
+ private:
+  friend class BatchSearchStream;
+
+  struct Node {
+    int parent;
+    int token;
+    int first_child = -1;
+    int next_sibling = -1;
+    int time = -1;
+    float token_prob = -kFloatMax;
+
+    Node(int parent, int token) : parent(parent), token(token) {}
+  };
+
+  void ResetStream(int id);
+  void ReleaseStream(int id);
+
+  // expand the hypotheses of stream `id` by one frame into scratch [offset, )
+  // return the number of next hypotheses
+  int ExpandFrame(int id, const std::vector<float>& logp_t, int offset);
+  // keep the best next hypotheses of stream `id`
+  void PruneFrame(int id, int offset, int num_next);
+  int FindNext(int node, int offset, int* num_next);
+  int GetChild(int id, int node, int token);
+  void UpdateTime(int id, int node, float prob, int time);
+  void CompactTrie(int id);
+  void UpdateResult(BatchSearchStream* stream);
+
+  const CtcPrefixBeamSearchOptions& opts_;
+  int beam_;
+  int num_streams_ = 0;
+
+  // hypotheses of all streams, stream i owns slots [i * beam_, (i+1) * beam_)
+  std::vector<float> b_;     // blank ending score
+  std::vector<float> nb_;    // none blank ending score
+  std::vector<float> v_b_;   // viterbi blank ending score
+  std::vector<float> v_nb_;  // viterbi none blank ending score
+  std::vector<int> node_;    // prefix of the hypothesis
+  std::vector<int> num_hyps_;
+  std::vector<int> abs_time_step_;
+  std::vector<int> compact_trie_size_;
+  std::vector<bool> in_use_;
+  std::vector<std::vector<Node>> tries_;
+
+  // scratch shared by all streams
+  std::vector<float> score_;  // log-add(b, nb) of current hypotheses
+  std::vector<float> next_b_;
+  std::vector<float> next_nb_;
+  std::vector<float> next_v_b_;
+  std::vector<float> next_v_nb_;
+  std::vector<float> next_score_;
+  std::vector<int> next_node_;
+  std::vector<int> next_of_node_;  // trie node -> next hypothesis, -1 if none
+  std::vector<int> order_;
+  std::vector<int> remap_;
+  std::vector<int> next_offset_;  // per batch entry
+  std::vector<int> num_next_;     // per batch entry
+  std::vector<float> topk_score_;
+  std::vector<int> topk_index_;
+
+ public:
+  DISALLOW_COPY_AND_ASSIGN(BatchCtcPrefixBeamSearch);
+};
+
+}  // namespace ppspeech
@@ -32,6 +32,16 @@ void CtcEndpoint::Reset() {
   num_frames_trailing_blank_ = 0;
 }
 
+void CtcEndpoint::SaveState(BinaryWriter* writer) const {
+  writer->Write(num_frames_decoded_);
+  writer->Write(num_frames_trailing_blank_);
+}
+
+bool CtcEndpoint::LoadState(BinaryReader* reader) {
+  return reader->Read(&num_frames_decoded_) &&
+         reader->Read(&num_frames_trailing_blank_);
+}
+
 static bool RuleActivated(const CtcEndpointRule& rule,
                           const std::string& rule_name,
                           bool decoded_sth,
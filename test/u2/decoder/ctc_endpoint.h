@@ -16,6 +16,8 @@
 
 #include <vector>
 
+#include "utils/io.h"
+
 namespace ppspeech {
 
 struct CtcEndpointRule {
@@ -57,6 +59,10 @@ class CtcEndpoint {
   explicit CtcEndpoint(const CtcEndpointConfig& config);
 
   void Reset();
+
+  void SaveState(BinaryWriter* writer) const;
+  bool LoadState(BinaryReader* reader);
+
   /// This function returns true if this set of endpointing rules thinks we
   /// should terminate decoding.
   bool IsEndpoint(const std::vector<std::vector<float>>& ctc_log_probs,
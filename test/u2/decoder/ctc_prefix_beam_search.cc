@@ -16,250 +16,469 @@
 
 #include <algorithm>
 #include <cassert>
+#include <cmath>
+#include <numeric>
 #include <tuple>
-#include <unordered_map>
 #include <utility>
 
+#include "utils/tracer.h"
 #include "utils/utils.h"
 
-#ifdef USE_PROFILING
-#include "paddle/fluid/platform/profiler.h"
-using paddle::platform::RecordEvent;
-using paddle::platform::TracerEventType;
-#endif
-
 namespace ppspeech {
 
 CtcPrefixBeamSearch::CtcPrefixBeamSearch(
     const CtcPrefixBeamSearchOptions& opts,
-    const std::shared_ptr<ContextGraph>& context_graph)
-    : opts_(opts), context_graph_(context_graph) {
+    const std::shared_ptr<ContextGraph>& context_graph,
+    bool enable_timestamp)
+    : opts_(opts),
+      enable_timestamp_(enable_timestamp),
+      cur_hyps_(opts.use_arena),
+      next_hyps_(opts.use_arena),
+      context_graph_(context_graph) {
+  // select the instantiation once, features unused by this session are
+  // compiled out of the per token loop
+  using Self = CtcPrefixBeamSearch;
+  if (enable_timestamp_ && context_graph_) {
+    search_frame_ = &Self::SearchFrame<true, true>;
+  } else if (enable_timestamp_) {
+    search_frame_ = &Self::SearchFrame<true, false>;
+  } else if (context_graph_) {
+    search_frame_ = &Self::SearchFrame<false, true>;
+  } else {
+    search_frame_ = &Self::SearchFrame<false, false>;
+  }
   Reset();
 }
 
-void CtcPrefixBeamSearch::Reset() {
-  cur_hyps_.clear();
+template <typename T>
+static int64_t VectorBytes(const std::vector<T>& v) {
+  return sizeof(v) + v.capacity() * sizeof(T);
+}
+
+template <typename T>
+static int64_t NestedVectorBytes(const std::vector<std::vector<T>>& v) {
+  int64_t bytes = VectorBytes(v);
+  for (const auto& item : v) {
+    bytes += item.capacity() * sizeof(T);
+  }
+  return bytes;
+}
+
+PrefixTable::PrefixTable(bool use_arena) {
+  if (use_arena) arena_.reset(new Arena());
+}
+
+void PrefixTable::Clear() {
+  if (size_ == 0) return;
+  std::fill(buckets_.begin(), buckets_.end(), 0);
+  if (arena_ != nullptr) {
+    // the buffers of the slots are dropped, and released by the arena
+    ArenaAllocator<int> allocator(arena_.get());
+    for (int slot = 0; slot < size_; ++slot) {
+      prefixes_[slot] = ArenaVector<int>(allocator);
+      scores_[slot].times_b = ArenaVector<int>(allocator);
+      scores_[slot].times_nb = ArenaVector<int>(allocator);
+    }
+    arena_->Reset();
+  }
+  size_ = 0;
+}
+
+// spreads the hash of PrefixHash over the bits of the bucket index
+static size_t BucketOf(size_t hash, size_t mask) {
+  return (hash * 0x9e3779b97f4a7c15ULL >> 17) & mask;
+}
+
+void PrefixTable::Rehash(size_t num_buckets) {
+  buckets_.assign(num_buckets, 0);
+  size_t mask = num_buckets - 1;
+  for (int slot = 0; slot < size_; ++slot) {
+    size_t bucket = BucketOf(hashes_[slot], mask);
+    while (buckets_[bucket] != 0) bucket = (bucket + 1) & mask;
+    buckets_[bucket] = slot + 1;
+  }
+}
+
+PrefixScore& PrefixTable::Find(const int* prefix, size_t length, int token) {
+  // as PrefixHash of the prefix with token
+  size_t hash = 0;
+  for (size_t i = 0; i < length; ++i) hash = prefix[i] + 31 * hash;
+  if (token >= 0) hash = token + 31 * hash;
+  size_t slot_length = length + (token >= 0 ? 1 : 0);
+  // at most half full
+  if (2 * (static_cast<size_t>(size_) + 1) > buckets_.size()) {
+    Rehash(std::max<size_t>(16, 2 * buckets_.size()));
+  }
+
+  size_t mask = buckets_.size() - 1;
+  size_t bucket = BucketOf(hash, mask);
+  for (; buckets_[bucket] != 0; bucket = (bucket + 1) & mask) {
+    int slot = buckets_[bucket] - 1;
+    const ArenaVector<int>& other = prefixes_[slot];
+    if (hashes_[slot] == hash && other.size() == slot_length &&
+        std::equal(prefix, prefix + length, other.begin()) &&
+        (token < 0 || other.back() == token)) {
+      return scores_[slot];
+    }
+  }
+
+  if (size_ == static_cast<int>(prefixes_.size())) {
+    prefixes_.emplace_back(ArenaAllocator<int>(arena_.get()));
+    scores_.emplace_back(arena_.get());
+    hashes_.push_back(0);
+  }
+  ArenaVector<int>& slot_prefix = prefixes_[size_];
+  slot_prefix.reserve(slot_length);
+  slot_prefix.assign(prefix, prefix + length);
+  if (token >= 0) slot_prefix.push_back(token);
+  scores_[size_].Reset();
+  hashes_[size_] = hash;
+  buckets_[bucket] = ++size_;
+  return scores_[size_ - 1];
+}
+
+int64_t PrefixTable::MemoryBytes() const {
+  int64_t bytes = VectorBytes(prefixes_) + VectorBytes(hashes_) +
+                  VectorBytes(buckets_) + VectorBytes(scores_);
+  if (arena_ != nullptr) bytes += arena_->MemoryBytes();
+  for (size_t slot = 0; slot < scores_.size(); ++slot) {
+    const PrefixScore& score = scores_[slot];
+    bytes += (score.start_boundaries.capacity() +
+              score.end_boundaries.capacity()) *
+             sizeof(int);
+    if (arena_ == nullptr) {
+      bytes += (prefixes_[slot].capacity() + score.times_b.capacity() +
+                score.times_nb.capacity()) *
+               sizeof(int);
+    }
+  }
+  return bytes;
+}
+
+int64_t CtcPrefixBeamSearch::MemoryBytes() const {
+  return NestedVectorBytes(hypotheses_) + VectorBytes(likelihood_) +
+         VectorBytes(viterbi_likelihood_) + NestedVectorBytes(times_) +
+         NestedVectorBytes(outputs_) + VectorBytes(topk_score_) +
+         VectorBytes(topk_index_) + VectorBytes(order_) +
+         NestedVectorBytes(spare_) + cur_hyps_.MemoryBytes() +
+         next_hyps_.MemoryBytes();
+}
+
+static void WritePrefixScore(const PrefixScore& score, BinaryWriter* writer) {
+  writer->Write(score.b);
+  writer->Write(score.nb);
+  writer->Write(score.v_b);
+  writer->Write(score.v_nb);
+  writer->Write(score.cur_token_prob);
+  writer->Write(score.times_b);
+  writer->Write(score.times_nb);
+  writer->Write(score.has_context);
+  writer->Write(score.context_state);
+  writer->Write(score.context_score);
+  writer->Write(score.start_boundaries);
+  writer->Write(score.end_boundaries);
+}
+
+static bool ReadPrefixScore(BinaryReader* reader, PrefixScore* score) {
+  return reader->Read(&score->b) && reader->Read(&score->nb) &&
+         reader->Read(&score->v_b) && reader->Read(&score->v_nb) &&
+         reader->Read(&score->cur_token_prob) &&
+         reader->Read(&score->times_b) && reader->Read(&score->times_nb) &&
+         reader->Read(&score->has_context) &&
+         reader->Read(&score->context_state) &&
+         reader->Read(&score->context_score) &&
+         reader->Read(&score->start_boundaries) &&
+         reader->Read(&score->end_boundaries);
+}
+
+bool CtcPrefixBeamSearch::SaveState(BinaryWriter* writer) const {
+  writer->Write(abs_time_step_);
+  writer->Write(hypotheses_);
+  writer->Write(likelihood_);
+  writer->Write(viterbi_likelihood_);
+  writer->Write(times_);
+  writer->Write(outputs_);
+  // in the order of hypotheses_, which is the order the scores of the next
+  // frame are summed in
+  assert(cur_hyps_.size() == hypotheses_.size());
+  for (int i = 0; i < cur_hyps_.size(); ++i) {
+    WritePrefixScore(cur_hyps_.score(i), writer);
+  }
+  return true;
+}
+
+bool CtcPrefixBeamSearch::LoadState(BinaryReader* reader) {
+  bool ok = reader->Read(&abs_time_step_) && reader->Read(&hypotheses_) &&
+            reader->Read(&likelihood_) &&
+            reader->Read(&viterbi_likelihood_) && reader->Read(&times_) &&
+            reader->Read(&outputs_);
+  // cur_hyps_ is built in the same order as by UpdateHypotheses()
+  cur_hyps_.Clear();
+  for (size_t i = 0; ok && i < hypotheses_.size(); ++i) {
+    ok = ReadPrefixScore(reader, &cur_hyps_.Find(hypotheses_[i]));
+  }
+  if (!ok) {
+    Reset();
+    return false;
+  }
+  return true;
+}
 
-  hypotheses_.clear();
+void CtcPrefixBeamSearch::Reset() {
+  cur_hyps_.Clear();
+
+  // the vectors of the former hypotheses are kept for the next ones
+  ResizeReusing(&hypotheses_, 1, &spare_);
+  ResizeReusing(&outputs_, 1, &spare_);
+  ResizeReusing(&times_, 1, &spare_);
+  hypotheses_[0].clear();
+  outputs_[0].clear();
+  times_[0].clear();
   likelihood_.clear();
   viterbi_likelihood_.clear();
-  times_.clear();
-  outputs_.clear();
 
   abs_time_step_ = 0;
 
   // empty cur hyps
-  PrefixScore prefix_score;
+  PrefixScore& prefix_score = cur_hyps_.Find(hypotheses_[0]);
   prefix_score.b = 0.0f;         // log(1)
   prefix_score.nb = -kFloatMax;  // log(0)
   prefix_score.v_b = 0.0f;       // log(1)
   prefix_score.v_nb = 0.0f;      // log(1)
 
-  std::vector<int> empty;
-  cur_hyps_[empty] = prefix_score;
-
-  outputs_.emplace_back(empty);
-  hypotheses_.emplace_back(empty);
   likelihood_.emplace_back(prefix_score.total_score());
-  times_.emplace_back(empty);
 }
 
-void CtcPrefixBeamSearch::UpdateHypotheses(
-    const std::vector<PrefixWithScoreType>& hyps) {
-  cur_hyps_.clear();
+void CtcPrefixBeamSearch::UpdateHypotheses(const PrefixTable& hyps,
+                                           const std::vector<int>& order) {
+  cur_hyps_.Clear();
+
+  size_t num_hyps = order.size();
+  ResizeReusing(&outputs_, num_hyps, &spare_);
+  ResizeReusing(&hypotheses_, num_hyps, &spare_);
+  ResizeReusing(&times_, num_hyps, &spare_);
+  likelihood_.resize(num_hyps);
+  viterbi_likelihood_.resize(num_hyps);
+
+  for (size_t i = 0; i < num_hyps; ++i) {
+    const ArenaVector<int>& prefix = hyps.prefix(order[i]);
+    const PrefixScore& score = hyps.score(order[i]);
+    cur_hyps_.Find(prefix) = score;
+
+    UpdateOutputs(prefix, score, &outputs_[i]);
+    hypotheses_[i].assign(prefix.begin(), prefix.end());
+    likelihood_[i] = score.total_score();
+    viterbi_likelihood_[i] = score.viterbi_score();
+    times_[i].assign(score.times().begin(), score.times().end());
+  }
+}
 
-  outputs_.clear();
-  hypotheses_.clear();
-  likelihood_.clear();
-  viterbi_likelihood_.clear();
-  times_.clear();
+// orders the slots of a PrefixTable by descending total score, log domain
+struct PrefixScoreCompare {
+  const PrefixTable* hyps;
+  bool operator()(int a, int b) const {
+    return hyps->score(a).total_score() > hyps->score(b).total_score();
+  }
+};
 
-  for (auto& item : hyps) {
-    cur_hyps_[item.first] = item.second;
+void CtcPrefixBeamSearch::Search(const std::vector<std::vector<float>>& logp) {
+  TRACE_SCOPE("CtcPrefixBeamSearch::Search");
 
-    UpdateOutputs(item);
-    hypotheses_.emplace_back(std::move(item.first));
-    likelihood_.emplace_back(item.second.total_score());
-    viterbi_likelihood_.emplace_back(item.second.viterbi_score());
-    times_.emplace_back(item.second.times());
+  for (int t = 0; t < logp.size(); ++t, ++abs_time_step_) {
+    (this->*search_frame_)(logp[t]);
   }
 }
 
-static bool PrefixScoreCompare(
-    const std::pair<std::vector<int>, PrefixScore>& a,
-    const std::pair<std::vector<int>, PrefixScore>& b) {
-  // log domain
-  return a.second.total_score() > b.second.total_score();
-}
+template <bool kTimestamp, bool kContext>
+void CtcPrefixBeamSearch::SearchFrame(const std::vector<float>& logp_t) {
+  int first_beam_size =
+      std::min(static_cast<int>(logp_t.size()), opts_.first_beam_size);
+  next_hyps_.Clear();
+
+  // 1. first beam prune, only select topk candidates
+  TopK(logp_t, first_beam_size, &topk_score_, &topk_index_);
+  int num_candidates = topk_index_.size();
+  if (opts_.adaptive_beam) {
+    num_candidates = AdaptiveFirstBeamSize(topk_score_);
+  }
 
-void CtcPrefixBeamSearch::Search(const std::vector<std::vector<float>>& logp) {
-#ifdef USE_PROFILING
-  RecordEvent event(
-      "CtcPrefixBeamSearch::Search", TracerEventType::UserDefined, 1);
-#endif
+  // 2. token passing
+  for (int i = 0; i < num_candidates; ++i) {
+    int id = topk_index_[i];
+    auto prob = topk_score_[i];
 
-  if (logp.size() == 0) return;
+    for (int h = 0; h < cur_hyps_.size(); ++h) {
+      const ArenaVector<int>& prefix = cur_hyps_.prefix(h);
+      const PrefixScore& prefix_score = cur_hyps_.score(h);
 
-  int first_beam_size =
-      std::min(static_cast<int>(logp[0].size()), opts_.first_beam_size);
+      // If prefix doesn't exist in next_hyps_, next_hyps_.Find(prefix) will
+      // insert PrefixScore(-inf, -inf) by default, since PrefixScore::Reset()
+      // will set fields b(blank ending score) and nb(none blank ending
+      // score) to -inf, respectively.
 
-  for (int t = 0; t < logp.size(); ++t, ++abs_time_step_) {
-    const std::vector<float>& logp_t = logp[t];
-    std::unordered_map<std::vector<int>, PrefixScore, PrefixHash> next_hyps;
-
-    // 1. first beam prune, only select topk candidates
-    std::vector<float> topk_score;
-    std::vector<int32_t> topk_index;
-    TopK(logp_t, first_beam_size, &topk_score, &topk_index);
-
-    // 2. token passing
-    for (int i = 0; i < topk_index.size(); ++i) {
-      int id = topk_index[i];
-      auto prob = topk_score[i];
-
-      for (const auto& it : cur_hyps_) {
-        const std::vector<int>& prefix = it.first;
-        const PrefixScore& prefix_score = it.second;
-
-        // If prefix doesn't exist in next_hyps, next_hyps[prefix] will insert
-        // PrefixScore(-inf, -inf) by default, since the default constructor
-        // of PrefixScore will set fields b(blank ending score) and
-        // nb(none blank ending score) to -inf, respectively.
-
-        if (id == opts_.blank) {
-          // case 0: *a + <blank> => *a, *a<blank> + <blank> => *a, prefix not
-          // change
-          PrefixScore& next_score = next_hyps[prefix];
-          next_score.b = LogSumExp(next_score.b, prefix_score.score() + prob);
-
-          // timestamp, blank is slince, not effact timestamp
+      if (id == opts_.blank) {
+        // case 0: *a + <blank> => *a, *a<blank> + <blank> => *a, prefix not
+        // change
+        PrefixScore& next_score = next_hyps_.Find(prefix);
+        next_score.b = FastLogSumExp(next_score.b, prefix_score.score() + prob);
+
+        // timestamp, blank is slince, not effact timestamp
+        if (kTimestamp) {
           next_score.v_b = prefix_score.viterbi_score() + prob;
           next_score.times_b = prefix_score.times();
+        }
 
-          // Prefix not changed, copy the context from pefix
-          if (context_graph_ && !next_score.has_context) {
-            next_score.CopyContext(prefix_score);
-            next_score.has_context = true;
-          }
-        } else if (!prefix.empty() && id == prefix.back()) {
-          // case 1: *a + a => *a, prefix not changed
-          PrefixScore& next_score1 = next_hyps[prefix];
-          next_score1.nb = LogSumExp(next_score1.nb, prefix_score.nb + prob);
-
-          // timestamp, non-blank symbol effact timestamp
-          if (next_score1.v_nb < prefix_score.v_nb + prob) {
-            // compute viterbi score
-            next_score1.v_nb = prefix_score.v_nb + prob;
-            if (next_score1.cur_token_prob < prob) {
-              // store max token prob
-              next_score1.cur_token_prob = prob;
-              // update this timestamp as token appeared here.
-              next_score1.times_nb = prefix_score.times_nb;
-              assert(next_score1.times_nb.size() > 0);
-              next_score1.times_nb.back() = abs_time_step_;
-            }
+        // Prefix not changed, copy the context from pefix
+        if (kContext && !next_score.has_context) {
+          next_score.CopyContext(prefix_score);
+          next_score.has_context = true;
+        }
+      } else if (!prefix.empty() && id == prefix.back()) {
+        // case 1: *a + a => *a, prefix not changed
+        PrefixScore& next_score1 = next_hyps_.Find(prefix);
+        next_score1.nb = FastLogSumExp(next_score1.nb, prefix_score.nb + prob);
+
+        // timestamp, non-blank symbol effact timestamp
+        if (kTimestamp && next_score1.v_nb < prefix_score.v_nb + prob) {
+          // compute viterbi score
+          next_score1.v_nb = prefix_score.v_nb + prob;
+          if (next_score1.cur_token_prob < prob) {
+            // store max token prob
+            next_score1.cur_token_prob = prob;
+            // update this timestamp as token appeared here.
+            next_score1.times_nb = prefix_score.times_nb;
+            assert(next_score1.times_nb.size() > 0);
+            next_score1.times_nb.back() = abs_time_step_;
           }
+        }
 
-          // Prefix not changed, copy the context from pefix
-          if (context_graph_ && !next_score1.has_context) {
-            next_score1.CopyContext(prefix_score);
-            next_score1.has_context = true;
-          }
+        // Prefix not changed, copy the context from pefix
+        if (kContext && !next_score1.has_context) {
+          next_score1.CopyContext(prefix_score);
+          next_score1.has_context = true;
+        }
 
-          // case 2: *a<blank> + a => *aa, prefix changed.
-          std::vector<int> new_prefix(prefix);
-          new_prefix.emplace_back(id);
-          PrefixScore& next_score2 = next_hyps[new_prefix];
-          next_score2.nb = LogSumExp(next_score2.nb, prefix_score.b + prob);
-
-          // timestamp, non-blank symbol effact timestamp
-          if (next_score2.v_nb < prefix_score.v_b + prob) {
-            // compute viterbi score
-            next_score2.v_nb = prefix_score.v_b + prob;
-            // new token added
-            next_score2.cur_token_prob = prob;
-            next_score2.times_nb = prefix_score.times_b;
-            next_score2.times_nb.emplace_back(abs_time_step_);
-          }
+        // case 2: *a<blank> + a => *aa, prefix changed.
+        PrefixScore& next_score2 = next_hyps_.Find(prefix, id);
+        next_score2.nb = FastLogSumExp(next_score2.nb, prefix_score.b + prob);
+
+        // timestamp, non-blank symbol effact timestamp
+        if (kTimestamp && next_score2.v_nb < prefix_score.v_b + prob) {
+          // compute viterbi score
+          next_score2.v_nb = prefix_score.v_b + prob;
+          // new token added
+          next_score2.cur_token_prob = prob;
+          next_score2.times_nb = prefix_score.times_b;
+          next_score2.times_nb.emplace_back(abs_time_step_);
+        }
 
-          // Prefix changed, calculate the context score.
-          if (context_graph_ && !next_score2.has_context) {
-            next_score2.UpdateContext(
-                context_graph_, prefix_score, id, prefix.size());
-            next_score2.has_context = true;
-          }
+        // Prefix changed, calculate the context score.
+        if (kContext && !next_score2.has_context) {
+          next_score2.UpdateContext(
+              context_graph_, prefix_score, id, prefix.size());
+          next_score2.has_context = true;
+        }
 
-        } else {
-          // id != prefix.back()
-          // case 3: *a + b => *ab, *a<blank> +b => *ab
-          std::vector<int> new_prefix(prefix);
-          new_prefix.emplace_back(id);
-          PrefixScore& next_score = next_hyps[new_prefix];
-          next_score.nb = LogSumExp(next_score.nb, prefix_score.score() + prob);
-
-          // timetamp, non-blank symbol effact timestamp
-          if (next_score.v_nb < prefix_score.viterbi_score() + prob) {
-            next_score.v_nb = prefix_score.viterbi_score() + prob;
-
-            next_score.cur_token_prob = prob;
-            next_score.times_nb = prefix_score.times();
-            next_score.times_nb.emplace_back(abs_time_step_);
-          }
+      } else {
+        // id != prefix.back()
+        // case 3: *a + b => *ab, *a<blank> +b => *ab
+        PrefixScore& next_score = next_hyps_.Find(prefix, id);
+        next_score.nb =
+            FastLogSumExp(next_score.nb, prefix_score.score() + prob);
+
+        // timetamp, non-blank symbol effact timestamp
+        if (kTimestamp &&
+            next_score.v_nb < prefix_score.viterbi_score() + prob) {
+          next_score.v_nb = prefix_score.viterbi_score() + prob;
+
+          next_score.cur_token_prob = prob;
+          next_score.times_nb = prefix_score.times();
+          next_score.times_nb.emplace_back(abs_time_step_);
+        }
 
-          // Prefix changed, calculate the context score.
-          if (context_graph_ && !next_score.has_context) {
-            next_score.UpdateContext(
-                context_graph_, prefix_score, id, prefix.size());
-            next_score.has_context = true;
-          }
+        // Prefix changed, calculate the context score.
+        if (kContext && !next_score.has_context) {
+          next_score.UpdateContext(
+              context_graph_, prefix_score, id, prefix.size());
+          next_score.has_context = true;
         }
-      }  // end for (const auto& it : cur_hyps_)
-    }    // end for (int i = 0; i < topk_index.size(); ++i)
-
-    // 3. second beam prune, only keep top n best paths
-    std::vector<std::pair<std::vector<int>, PrefixScore>> arr(next_hyps.begin(),
-                                                              next_hyps.end());
-    int second_beam_size =
-        std::min(static_cast<int>(arr.size()), opts_.second_beam_size);
-    std::nth_element(arr.begin(),
-                     arr.begin() + second_beam_size,
-                     arr.end(),
-                     PrefixScoreCompare);
-    arr.resize(second_beam_size);
-    std::sort(arr.begin(), arr.end(), PrefixScoreCompare);
-
-    // 4. update cur_hyps by next_hyps, and get new result
-    UpdateHypotheses(arr);
-
-  }  // end for (int t = 0; t < logp.size(); ++t, ++abs_time_step_)
+      }
+    }  // end for (const auto& it : cur_hyps_)
+  }    // end for (int i = 0; i < num_candidates; ++i)
+
+  // 3. second beam prune, only keep top n best paths
+  order_.resize(next_hyps_.size());
+  std::iota(order_.begin(), order_.end(), 0);
+  int second_beam_size =
+      std::min(static_cast<int>(order_.size()), opts_.second_beam_size);
+  PrefixScoreCompare compare{&next_hyps_};
+  std::nth_element(
+      order_.begin(), order_.begin() + second_beam_size, order_.end(), compare);
+  order_.resize(second_beam_size);
+  std::sort(order_.begin(), order_.end(), compare);
+  if (opts_.adaptive_beam) {
+    order_.resize(AdaptiveSecondBeamSize(next_hyps_, order_));
+  }
+
+  // 4. update cur_hyps by next_hyps, and get new result
+  UpdateHypotheses(next_hyps_, order_);
+}
+
+int CtcPrefixBeamSearch::AdaptiveFirstBeamSize(
+    const std::vector<float>& topk_score) const {
+  // topk_score is in descending order
+  int num_tokens = topk_score.size();
+  int min_size = std::min(std::max(opts_.min_first_beam_size, 1), num_tokens);
+  float cum_prob = 0.0f;
+  int i = 0;
+  for (; i < num_tokens; ++i) {
+    if (i >= min_size && (cum_prob >= opts_.token_prob_threshold ||
+                          topk_score[i] < opts_.token_logp_floor)) {
+      break;
+    }
+    cum_prob += std::exp(topk_score[i]);
+  }
+  return i;
 }
 
-void CtcPrefixBeamSearch::UpdateOutputs(
-    const std::pair<std::vector<int>, PrefixScore>& prefix) {
-  const std::vector<int>& input = prefix.first;
-  const std::vector<int>& start_boundaries = prefix.second.start_boundaries;
-  const std::vector<int>& end_boundaries = prefix.second.end_boundaries;
+int CtcPrefixBeamSearch::AdaptiveSecondBeamSize(
+    const PrefixTable& hyps, const std::vector<int>& order) const {
+  // order is sorted by total_score in descending order
+  int num_hyps = order.size();
+  if (num_hyps == 0) return 0;
+  int min_size = std::min(std::max(opts_.min_second_beam_size, 1), num_hyps);
+  float threshold = hyps.score(order[0]).total_score() - opts_.hyp_logp_beam;
+  int i = min_size;
+  while (i < num_hyps && hyps.score(order[i]).total_score() >= threshold) {
+    ++i;
+  }
+  return i;
+}
 
-  std::vector<int> output;
+void CtcPrefixBeamSearch::UpdateOutputs(const ArenaVector<int>& prefix,
+                                        const PrefixScore& score,
+                                        std::vector<int>* output) const {
+  const std::vector<int>& start_boundaries = score.start_boundaries;
+  const std::vector<int>& end_boundaries = score.end_boundaries;
+
+  output->clear();
   int s = 0;
   int e = 0;
-  for (int i = 0; i < input.size(); ++i) {
+  for (int i = 0; i < prefix.size(); ++i) {
     // if (s < start_boundaries.size() && i == start_boundaries[s]){
     //     // <context>
-    //     output.emplace_back(context_graph_->start_tag_id());
+    //     output->emplace_back(context_graph_->start_tag_id());
     //     ++s;
     // }
 
-    output.emplace_back(input[i]);
+    output->emplace_back(prefix[i]);
 
     // if (e < end_boundaries.size() && i == end_boundaries[e]){
     //     // </context>
-    //     output.emplace_back(context_graph_->end_tag_id());
+    //     output->emplace_back(context_graph_->end_tag_id());
     //     ++e;
     // }
   }
-
-  outputs_.emplace_back(output);
 }
 
 void CtcPrefixBeamSearch::FinalizeSearch() { UpdateFinalContext(); }
@@ -271,19 +490,21 @@ void CtcPrefixBeamSearch::UpdateFinalContext() {
 
   // We should backoff the context score/state when the context is
   // not fully matched at the last time.
-  for (const auto& prefix : hypotheses_) {
-    PrefixScore& prefix_score = cur_hyps_[prefix];
+  for (int i = 0; i < cur_hyps_.size(); ++i) {
+    PrefixScore& prefix_score = cur_hyps_.score(i);
     if (prefix_score.context_score != 0) {
       //  prefix_score.UpdateContext(context_graph_, prefix_score, 0,
       //                      prefix.size());
     }
   }
-  std::vector<std::pair<std::vector<int>, PrefixScore>> arr(cur_hyps_.begin(),
-                                                            cur_hyps_.end());
-  std::sort(arr.begin(), arr.end(), PrefixScoreCompare);
+  // the hypotheses are rebuilt from a copy
+  std::swap(cur_hyps_, next_hyps_);
+  order_.resize(next_hyps_.size());
+  std::iota(order_.begin(), order_.end(), 0);
+  std::sort(order_.begin(), order_.end(), PrefixScoreCompare{&next_hyps_});
 
   // Update cur_hyps_ and get new result
-  UpdateHypotheses(arr);
+  UpdateHypotheses(next_hyps_, order_);
 }
 
 }  // namespace ppspeech
\ No newline at end of file
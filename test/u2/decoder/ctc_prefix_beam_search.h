@@ -17,11 +17,11 @@
 #pragma once
 
 #include <memory>
-#include <unordered_map>
 #include <utility>
 #include <vector>
 
 #include "decoder/search_itf.h"
+#include "utils/arena.h"
 #include "utils/utils.h"
 
 namespace ppspeech {
@@ -32,9 +32,33 @@ struct CtcPrefixBeamSearchOptions {
   int blank = 0;
   int first_beam_size = 10;
   int second_beam_size = 10;
+
+  // Adaptive beam, first_beam_size and second_beam_size become upper bounds.
+  // Per frame, candidate tokens are taken by descending prob until their
+  // cumulative prob reaches token_prob_threshold, and tokens whose log prob is
+  // below token_logp_floor are pruned. Hypotheses whose score is more than
+  // hyp_logp_beam below the best one are pruned, so the beam shrinks when the
+  // top hypothesis dominates.
+  bool adaptive_beam = false;
+  float token_prob_threshold = 0.99;
+  float token_logp_floor = -10.0;
+  float hyp_logp_beam = 10.0;
+  int min_first_beam_size = 1;
+  int min_second_beam_size = 1;
+
+  // The prefixes and times of the hypotheses of a frame are allocated from
+  // an arena of the searcher, released at once by the next frame, instead
+  // of the heap shared by all the worker threads.
+  bool use_arena = true;
 };
 
 struct PrefixScore {
+  PrefixScore() = default;
+  // the times are allocated from arena, the heap if nullptr
+  explicit PrefixScore(Arena* arena)
+      : times_b(ArenaAllocator<int>(arena)),
+        times_nb(ArenaAllocator<int>(arena)) {}
+
   // decoding, unit in log scale
   float b = -kFloatMax;   // blank ending score
   float nb = -kFloatMax;  // none blank ending score
@@ -43,16 +67,28 @@ struct PrefixScore {
   float v_b = -kFloatMax;             // viterbi blank ending score
   float v_nb = -kFloatMax;            // viterbi none blank ending score
   float cur_token_prob = -kFloatMax;  // prob of current token
-  std::vector<int> times_b;           // times of viterbi blank path
-  std::vector<int> times_nb;          // times of viterbi none blank path
+  ArenaVector<int> times_b;           // times of viterbi blank path
+  ArenaVector<int> times_nb;          // times of viterbi none blank path
+
+  // back to the default scores, the vectors keep their capacity
+  void Reset() {
+    b = nb = v_b = v_nb = cur_token_prob = -kFloatMax;
+    times_b.clear();
+    times_nb.clear();
+    has_context = false;
+    context_state = 0;
+    context_score = 0;
+    start_boundaries.clear();
+    end_boundaries.clear();
+  }
 
   // sum
-  float score() const { return LogSumExp(b, nb); }
+  float score() const { return FastLogSumExp(b, nb); }
 
   // max
   float viterbi_score() const { return v_b > v_nb ? v_b : v_nb; }
 
-  const std::vector<int>& times() const {
+  const ArenaVector<int>& times() const {
     return v_b > v_nb ? times_b : times_nb;
   }
 
@@ -91,24 +127,80 @@ struct PrefixHash {
   }
 };
 
-using PrefixWithScoreType = std::pair<std::vector<int>, PrefixScore>;
+// The hypotheses of a frame by their prefixes, in the order they are
+// inserted. The slots, with the buffers of their prefixes and scores, are
+// reused after Clear(), so the hypotheses of a frame allocate nothing once
+// the slots have grown to the beam. With use_arena, the prefixes and times
+// of the slots are allocated from an arena of the table, which Clear()
+// releases, so they are frame scoped.
+class PrefixTable {
+ public:
+  explicit PrefixTable(bool use_arena = false);
+  PrefixTable(PrefixTable&&) = default;
+  PrefixTable& operator=(PrefixTable&&) = default;
+
+  void Clear();
+  // The score of prefix, or of prefix + token if token >= 0, inserted with
+  // the default scores if missing. The reference is valid until the next
+  // insertion, prefix must not be one of this table.
+  PrefixScore& Find(const int* prefix, size_t length, int token);
+  template <typename Prefix>
+  PrefixScore& Find(const Prefix& prefix, int token = -1) {
+    return Find(prefix.data(), prefix.size(), token);
+  }
+
+  int size() const { return size_; }
+  // of slot i in [0, size()), in the order inserted
+  const ArenaVector<int>& prefix(int i) const { return prefixes_[i]; }
+  const PrefixScore& score(int i) const { return scores_[i]; }
+  PrefixScore& score(int i) { return scores_[i]; }
+
+  int64_t MemoryBytes() const;
+
+ private:
+  void Rehash(size_t num_buckets);
+
+  // by pointer, as the allocators of the slots refer to it
+  std::unique_ptr<Arena> arena_;
+  std::vector<ArenaVector<int>> prefixes_;
+  std::vector<PrefixScore> scores_;
+  std::vector<size_t> hashes_;
+  // slot + 1 of each bucket, 0 for none, open addressing over a power of 2
+  std::vector<int> buckets_;
+  int size_ = 0;
+
+ public:
+  DISALLOW_COPY_AND_ASSIGN(PrefixTable);
+};
 
 class CtcPrefixBeamSearch : public SearchInterface {
  public:
+  // Viterbi scores and times are only tracked when enable_timestamp is set,
+  // otherwise Times() are empty.
   explicit CtcPrefixBeamSearch(
       const CtcPrefixBeamSearchOptions& opts,
-      const std::shared_ptr<ContextGraph>& context_graph = nullptr);
+      const std::shared_ptr<ContextGraph>& context_graph = nullptr,
+      bool enable_timestamp = true);
 
   void Search(const std::vector<std::vector<float>>& logp) override;
   void Reset() override;
   void FinalizeSearch() override;
   SearchType Type() const override { return SearchType::kPrefixBeamSearch; }
 
-  void UpdateOutputs(const std::pair<std::vector<int>, PrefixScore>& prefix);
-  void UpdateHypotheses(
-      const std::vector<std::pair<std::vector<int>, PrefixScore>>& prefix);
+  void UpdateOutputs(const ArenaVector<int>& prefix,
+                     const PrefixScore& score,
+                     std::vector<int>* output) const;
+  // the hypotheses become the slots of hyps in order
+  void UpdateHypotheses(const PrefixTable& hyps, const std::vector<int>& order);
   void UpdateFinalContext();
 
+  // number of topk candidates used for token passing in adaptive beam mode
+  int AdaptiveFirstBeamSize(const std::vector<float>& topk_score) const;
+  // number of hypotheses kept in adaptive beam mode, of the slots of hyps
+  // in order, sorted by descending total score
+  int AdaptiveSecondBeamSize(const PrefixTable& hyps,
+                             const std::vector<int>& order) const;
+
   const std::vector<float>& viterbi_likelihood() const {
     return viterbi_likelihood_;
   }
@@ -124,8 +216,20 @@ class CtcPrefixBeamSearch : public SearchInterface {
   const std::vector<float>& Likelihood() const override { return likelihood_; }
   const std::vector<std::vector<int>>& Times() const override { return times_; }
 
+  int64_t MemoryBytes() const override;
+
+  bool SaveState(BinaryWriter* writer) const override;
+  bool LoadState(BinaryReader* reader) override;
+
  private:
+  // search one frame, specialized on whether timestamps and context biasing
+  // are tracked
+  template <bool kTimestamp, bool kContext>
+  void SearchFrame(const std::vector<float>& logp_t);
+
   const CtcPrefixBeamSearchOptions& opts_;
+  bool enable_timestamp_;
+  void (CtcPrefixBeamSearch::*search_frame_)(const std::vector<float>& logp_t);
   int abs_time_step_ = 0;
 
   // n-best list and corresponding likelihood, in sorted order
@@ -134,7 +238,17 @@ class CtcPrefixBeamSearch : public SearchInterface {
   std::vector<float> viterbi_likelihood_;
   std::vector<std::vector<int>> times_;
 
-  std::unordered_map<std::vector<int>, PrefixScore, PrefixHash> cur_hyps_;
+  // the hypotheses of the current frame and of the next one, in the order
+  // of hypotheses_ for cur_hyps_
+  PrefixTable cur_hyps_;
+  PrefixTable next_hyps_;
+  // buffers of the current frame, reused across frames
+  std::vector<float> topk_score_;
+  std::vector<int> topk_index_;
+  std::vector<int> order_;
+  // the vectors dropped from hypotheses_, outputs_ and times_, reused when
+  // they grow again
+  std::vector<std::vector<int>> spare_;
   std::shared_ptr<ContextGraph> context_graph_ = nullptr;
 
   // Outputs contain the hypotheses_ and tags like: <context> and </context>
@@ -0,0 +1,39 @@
+// Copyright (c) 2022 PaddlePaddle Authors. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#pragma once
+
+#include "utils/latency_stats.h"
+
+namespace ppspeech {
+
+// Stages timed by DecodeLatency(), per chunk unless noted.
+enum DecodeStage {
+  kStageFeature = 0,    // fbank and cmvn of the audio fed
+  kStageEncoder,        // encoder forward
+  kStageCtc,            // ctc activation
+  kStageSearch,         // ctc prefix beam search
+  kStageEndpoint,       // endpoint detection
+  kStageResult,         // building the partial result
+  kStageRescoring,      // attention rescoring of one n-best
+  kStageFirstPartial,   // per stream, first audio to first partial result
+  kStageFinal,          // per stream, end of input to the final result
+  kNumDecodeStages,
+};
+
+// The latencies of all the decoders of the process, disabled until
+// set_enabled(true), e.g. by decoder_main --latency_report.
+LatencyStats& DecodeLatency();
+
+}  // namespace ppspeech
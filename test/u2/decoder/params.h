@@ -22,16 +22,37 @@
 
 #include "decoder/asr_decoder.h"
 #include "decoder/pd_asr_model.h"
+#include "decoder/synthetic_asr_model.h"
 #include "frontend/feature_pipeline.h"
 
 #include "utils/flags.h"
 #include "utils/string.h"
 
-DEFINE_int32(num_threads, 1, "num threads for ASR model");
+DEFINE_int32(num_threads,
+             1,
+             "intra-op threads of each forward of the ASR model, <= 0 for "
+             "the default of the inference runtime");
 
 // PaddleAsrModel flags
 DEFINE_string(model_path, "", "paddle exported model path with suffix");
 
+// SyntheticAsrModel flags
+DEFINE_bool(synthetic_model,
+            false,
+            "decode by synthetic posteriors and simulated compute instead of "
+            "--model_path, to load test the runtime without a model");
+DEFINE_int32(synthetic_vocab_size,
+             5537,
+             "units of the synthetic model, of --unit_path if given");
+DEFINE_double(synthetic_blank_ratio, 0.7, "frames peaking on blank");
+DEFINE_double(synthetic_token_rate, 4.0, "new tokens per second of audio");
+DEFINE_double(synthetic_encoder_us,
+              0.0,
+              "simulated encoder compute per output frame in us");
+DEFINE_double(synthetic_decoder_us,
+              0.0,
+              "simulated attention decoder compute per rescored token in us");
+
 // OnnxAsrModel flags
 DEFINE_string(onnx_dir, "", "directory where the onnx model is saved");
 
@@ -61,7 +82,60 @@ DEFINE_double(reverse_weight,
               "used for bitransformer rescoring. it must be 0.0 if decoder is"
               "conventional transformer decoder, and only reverse_weight > 0.0"
               "dose the right to left decoder will be calculated and used");
+DEFINE_bool(rescoring_skip_empty,
+            false,
+            "skip rescoring when the best hyp by ctc score is empty");
+DEFINE_bool(rescoring_skip_single,
+            false,
+            "skip rescoring when the n-best has a single hyp");
+DEFINE_double(rescoring_skip_margin,
+              0.0,
+              "skip rescoring when the ctc score of the best hyp is above "
+              "the second one by this margin, <= 0 never skips by margin");
+DEFINE_int32(rescoring_top_k,
+             0,
+             "rescore only the top k hyps by ctc score, <= 0 rescores all");
+DEFINE_int32(rescoring_bucket_padding,
+             -1,
+             "rescore the n-best by one attention decoder forward per bucket "
+             "of hyps within this many tokens of its longest, < 0 for one");
+DEFINE_bool(rescoring_drop_blank_frames,
+            false,
+            "drop the encoder frames far from any ctc spike before rescoring");
+DEFINE_double(rescoring_blank_threshold,
+              0.99,
+              "a frame is blank when its ctc blank prob is at least this");
+DEFINE_int32(rescoring_blank_context,
+             2,
+             "frames kept on each side of a non-blank frame");
 DEFINE_int32(nbest, 10, "nbest for ctc wfst or prefix search");
+DEFINE_bool(warmup, true, "warm the model up before the first request");
+DEFINE_string(warmup_shapes,
+              "",
+              "comma separated shapes the model is warmed up with, each "
+              "chunk_size:num_left_chunks:nbest:max_hyp_len:encoder_len, "
+              "one shape of the decode options if empty");
+DEFINE_int32(warmup_threads, 1, "num of shapes warmed up in parallel");
+// adaptive prefix beam search
+DEFINE_bool(adaptive_beam,
+            false,
+            "adapt the per-frame beams of ctc prefix search, nbest is used "
+            "as the upper bound of both beams");
+DEFINE_double(token_prob_threshold,
+              0.99,
+              "cumulative prob of the candidate tokens kept per frame");
+DEFINE_double(token_logp_floor,
+              -10.0,
+              "candidate tokens with log prob below it are pruned");
+DEFINE_double(hyp_logp_beam,
+              10.0,
+              "hypotheses with score below best score - hyp_logp_beam are "
+              "pruned");
+DEFINE_int32(min_nbest, 1, "lower bound of the adaptive beams");
+DEFINE_bool(ctc_search_arena,
+            true,
+            "allocate the per frame hypotheses of ctc prefix search from an "
+            "arena of the session instead of the heap");
 // wfst
 DEFINE_int32(max_active, 7000, "max active states in ctc wfst search");
 DEFINE_int32(min_active, 200, "min active states in ctc wfst search");
@@ -110,6 +184,36 @@ std::shared_ptr<FeaturePipelineConfig> InitFeaturePipelineConfigFromFlags() {
   return feature_config;
 }
 
+// --warmup_shapes, the shape of chunk_size, num_left_chunks and nbest if
+// it is empty
+std::vector<WarmupShape> InitWarmupShapesFromFlags() {
+  std::vector<WarmupShape> shapes;
+  if (!FLAGS_warmup) return shapes;
+  if (FLAGS_warmup_shapes.empty()) {
+    WarmupShape shape;
+    shape.chunk_size = FLAGS_chunk_size;
+    shape.num_left_chunks = FLAGS_num_left_chunks;
+    shape.nbest = FLAGS_nbest;
+    shapes.push_back(shape);
+    return shapes;
+  }
+  std::vector<std::string> items;
+  SplitStringToVector(FLAGS_warmup_shapes, ",", true, &items);
+  for (const std::string& item : items) {
+    std::vector<std::string> dims;
+    SplitStringToVector(item, ":", false, &dims);
+    CHECK_EQ(dims.size(), 5) << "bad warmup shape " << item;
+    WarmupShape shape;
+    shape.chunk_size = std::stoi(dims[0]);
+    shape.num_left_chunks = std::stoi(dims[1]);
+    shape.nbest = std::stoi(dims[2]);
+    shape.max_hyp_len = std::stoi(dims[3]);
+    shape.encoder_len = std::stoi(dims[4]);
+    shapes.push_back(shape);
+  }
+  return shapes;
+}
+
 std::shared_ptr<DecodeOptions> InitDecodeOptionsFromFlags() {
   auto decode_config = std::make_shared<DecodeOptions>();
   decode_config->chunk_size = FLAGS_chunk_size;
@@ -117,9 +221,27 @@ std::shared_ptr<DecodeOptions> InitDecodeOptionsFromFlags() {
   decode_config->ctc_weight = FLAGS_ctc_weight;
   decode_config->reverse_weight = FLAGS_reverse_weight;
   decode_config->rescoring_weight = FLAGS_rescoring_weight;
+  decode_config->rescoring_skip_empty = FLAGS_rescoring_skip_empty;
+  decode_config->rescoring_skip_single = FLAGS_rescoring_skip_single;
+  decode_config->rescoring_skip_margin = FLAGS_rescoring_skip_margin;
+  decode_config->rescoring_top_k = FLAGS_rescoring_top_k;
+  decode_config->frame_reduction.enable = FLAGS_rescoring_drop_blank_frames;
+  decode_config->frame_reduction.blank_threshold =
+      FLAGS_rescoring_blank_threshold;
+  decode_config->frame_reduction.context = FLAGS_rescoring_blank_context;
+  decode_config->warmup_shapes = InitWarmupShapesFromFlags();
   // ctc prefix beam search
   decode_config->ctc_prefix_search_opts.first_beam_size = FLAGS_nbest;
   decode_config->ctc_prefix_search_opts.second_beam_size = FLAGS_nbest;
+  decode_config->ctc_prefix_search_opts.adaptive_beam = FLAGS_adaptive_beam;
+  decode_config->ctc_prefix_search_opts.token_prob_threshold =
+      FLAGS_token_prob_threshold;
+  decode_config->ctc_prefix_search_opts.token_logp_floor =
+      FLAGS_token_logp_floor;
+  decode_config->ctc_prefix_search_opts.hyp_logp_beam = FLAGS_hyp_logp_beam;
+  decode_config->ctc_prefix_search_opts.min_first_beam_size = FLAGS_min_nbest;
+  decode_config->ctc_prefix_search_opts.min_second_beam_size = FLAGS_min_nbest;
+  decode_config->ctc_prefix_search_opts.use_arena = FLAGS_ctc_search_arena;
   // ctc wfst
   // decode_config->ctc_wfst_search_opts.max_active = FLAGS_max_active;
   // decode_config->ctc_wfst_search_opts.min_active = FLAGS_min_active;
@@ -134,24 +256,57 @@ std::shared_ptr<DecodeOptions> InitDecodeOptionsFromFlags() {
   return decode_config;
 }
 
-std::shared_ptr<DecodeResource> InitDecodeResourceFromFlags() {
+SyntheticModelOptions InitSyntheticModelOptionsFromFlags() {
+  SyntheticModelOptions opts;
+  opts.vocab_size = FLAGS_synthetic_vocab_size;
+  opts.blank_ratio = FLAGS_synthetic_blank_ratio;
+  opts.token_rate = FLAGS_synthetic_token_rate;
+  opts.encoder_us_per_frame = FLAGS_synthetic_encoder_us;
+  opts.decoder_us_per_token = FLAGS_synthetic_decoder_us;
+  return opts;
+}
+
+// the model is warmed up with opts.warmup_shapes
+std::shared_ptr<DecodeResource> InitDecodeResourceFromFlags(
+    const DecodeOptions& opts) {
   auto resource = std::make_shared<DecodeResource>();
 
-  if (!FLAGS_onnx_dir.empty()) {
+  if (FLAGS_synthetic_model) {
+    LOG(INFO) << "Synthetic model of " << FLAGS_synthetic_vocab_size
+              << " units";
+    SyntheticModelOptions synthetic_opts = InitSyntheticModelOptionsFromFlags();
+    auto model = std::make_shared<SyntheticAsrModel>(synthetic_opts);
+    model->set_num_threads(FLAGS_num_threads);
+    // the compute is calibrated before the first request
+    if (FLAGS_warmup) SyntheticAsrModel::GemmsPerMicrosecond();
+    resource->model = model;
+  } else if (!FLAGS_onnx_dir.empty()) {
     LOG(FATAL) << "Not impl onnx.";
   } else {
     LOG(INFO) << "Reading paddle model " << FLAGS_model_path;
     CHECK(!FLAGS_model_path.empty());
-    // PaddleAsrModel::InitEngineThreads(FLAGS_num_threads);
     auto model = std::make_shared<PaddleAsrModel>();
     model->Read(FLAGS_model_path);
+    model->set_num_threads(FLAGS_num_threads);
+    model->set_rescoring_bucket_padding(FLAGS_rescoring_bucket_padding);
+    model->set_frame_reduction(opts.frame_reduction);
+    model->Warmup(opts.warmup_shapes, FLAGS_num_bins, FLAGS_warmup_threads);
     resource->model = model;
   }
 
-  LOG(INFO) << "Reading unit table " << FLAGS_unit_path;
-  auto unit_table = std::shared_ptr<fst::SymbolTable>(
-      fst::SymbolTable::ReadText(FLAGS_unit_path));
-  CHECK(unit_table != nullptr);
+  std::shared_ptr<fst::SymbolTable> unit_table;
+  if (FLAGS_synthetic_model && FLAGS_unit_path.empty()) {
+    unit_table = SyntheticAsrModel::MakeUnitTable(FLAGS_synthetic_vocab_size);
+  } else {
+    LOG(INFO) << "Reading unit table " << FLAGS_unit_path;
+    unit_table = std::shared_ptr<fst::SymbolTable>(
+        fst::SymbolTable::ReadText(FLAGS_unit_path));
+    CHECK(unit_table != nullptr);
+  }
+  if (FLAGS_synthetic_model) {
+    CHECK_EQ(unit_table->NumSymbols(), FLAGS_synthetic_vocab_size)
+        << "units of " << FLAGS_unit_path;
+  }
   resource->unit_table = unit_table;
 
   if (!FLAGS_fst_path.empty()) {
@@ -18,19 +18,21 @@
 #include <algorithm>
 #include <cstring>
 #include <fstream>
+#include <future>
 #include <iomanip>
 #include <iostream>
 #include <memory>
 #include <sstream>
 #include <stdexcept>
 
+#include "decoder/decode_latency.h"
+#include "decoder/rescoring_batch.h"
+#include "utils/cpu_affinity.h"
 #include "utils/log.h"
+#include "utils/thread_pool.h"
+#include "utils/timer.h"
+#include "utils/tracer.h"
 
-#ifdef USE_PROFILING
-#include "paddle/fluid/platform/profiler.h"
-using paddle::platform::RecordEvent;
-using paddle::platform::TracerEventType;
-#endif
 
 namespace ppspeech {
 
@@ -59,7 +61,6 @@ void PaddleAsrModel::Read(const std::string& model_path_w_prefix) {
   CHECK(forward_encoder_chunk_.IsValid());
   CHECK(forward_attention_decoder_.IsValid());
   CHECK(ctc_activation_.IsValid());
-  Warmup();
 
   std::cout << "Paddle Model Info: " << std::endl;
   std::cout << "\tsubsampling_rate " << subsampling_rate_ << std::endl;
@@ -69,54 +70,73 @@ void PaddleAsrModel::Read(const std::string& model_path_w_prefix) {
   std::cout << "\tis bidecoder " << is_bidecoder_ << std::endl;
 }
 
-void PaddleAsrModel::Warmup() {
-#ifdef USE_PROFILING
-  RecordEvent event("warmup", TracerEventType::UserDefined, 1);
-#endif
-
+void PaddleAsrModel::Warmup(const std::vector<WarmupShape>& shapes,
+                            int feature_dim,
+                            int num_threads) {
+  TRACE_SCOPE("PaddleAsrModel::Warmup");
+  Timer timer;
+  // the copies share the functions, which the streams also call from
+  // several threads
+  std::vector<std::future<void>> jobs;
   {
-#ifdef USE_PROFILING
-    RecordEvent event("warmup-encoder-ctc", TracerEventType::UserDefined, 1);
-#endif
-    int feature_dim = 80;
-    int frame_num = 16 * 4 + 3;  // chunk_size * downsample_rate +
-                                 // (receptive_field - downsample_rate)
-    paddle::Tensor feats = paddle::full(
-        {1, frame_num, feature_dim}, 0.12f, paddle::DataType::FLOAT32);
-    paddle::Tensor offset = paddle::zeros({1}, paddle::DataType::INT32);
-    paddle::Tensor att_cache =
-        paddle::zeros({0, 0, 0, 0}, paddle::DataType::FLOAT32);
-    paddle::Tensor cnn_cache =
-        paddle::zeros({0, 0, 0, 0}, paddle::DataType::FLOAT32);
-    std::vector<paddle::Tensor> inputs = {
-        feats, offset, /*required_cache_size, */ att_cache, cnn_cache};
-    std::vector<paddle::Tensor> outputs = forward_encoder_chunk_(inputs);
-
-    auto chunk_out = outputs[0];
-    inputs = std::move(std::vector<paddle::Tensor>({chunk_out}));
-    outputs = ctc_activation_(inputs);
+    ThreadPool pool(std::max(1, num_threads));
+    for (const WarmupShape& shape : shapes) {
+      std::shared_ptr<PaddleAsrModel> model =
+          std::make_shared<PaddleAsrModel>(*this);
+      jobs.push_back(pool.enqueue([model, shape, feature_dim]() {
+        model->WarmupOne(shape, feature_dim);
+      }));
+    }
   }
+  for (auto& job : jobs) job.get();
+  LOG(INFO) << "Warmup of " << shapes.size() << " shapes took "
+            << timer.Elapsed() << "ms.";
+}
 
-  {
-#ifdef USE_PROFILING
-    RecordEvent event("warmup-decoder", TracerEventType::UserDefined, 1);
-#endif
-
-    auto hyps =
-        paddle::full({10, 8}, 10, paddle::DataType::INT64, phi::CPUPlace());
-    auto hyps_lens =
-        paddle::full({10}, 8, paddle::DataType::INT64, phi::CPUPlace());
-    auto encoder_out =
-        paddle::ones({1, 20, 512}, paddle::DataType::FLOAT32, phi::CPUPlace());
-
-    std::vector<paddle::experimental::Tensor> inputs{
-        hyps, hyps_lens, encoder_out};
+void PaddleAsrModel::WarmupOne(const WarmupShape& shape, int feature_dim) {
+  chunk_size_ = shape.chunk_size;
+  num_left_chunks_ = shape.num_left_chunks;
+  Reset();
 
-    std::vector<paddle::experimental::Tensor> outputs =
-        forward_attention_decoder_(inputs);
+  Timer timer;
+  int first_chunk_ms = 0;
+  std::vector<std::vector<float>> ctc_probs;
+  bool start = false;
+  // one chunk of encoder_len frames when not streaming
+  while (offset_ < shape.encoder_len) {
+    int num_frames =
+        chunk_size_ > 0
+            ? num_frames_for_chunk(start)
+            : (shape.encoder_len - 1) * subsampling_rate_ + context();
+    std::vector<std::vector<float>> chunk_feats(
+        num_frames, std::vector<float>(feature_dim, 0.12f));
+    int before = offset_;
+    ForwardEncoderChunk(chunk_feats, &ctc_probs);
+    if (!start) first_chunk_ms = timer.Elapsed();
+    start = true;
+    if (offset_ == before) break;
   }
+  int encoder_ms = timer.Elapsed();
 
+  // hyps of different lengths, as the buckets of a real n-best
+  timer.Reset();
+  std::vector<std::vector<int>> hyps(shape.nbest);
+  for (int i = 0; i < shape.nbest; ++i) {
+    hyps[i].assign(std::max(1, shape.max_hyp_len - i), 10);
+  }
+  std::vector<float> scores;
+  if (!hyps.empty() && !encoder_outs_.empty()) {
+    AttentionRescoring(hyps, is_bidecoder_ ? 0.3 : 0.0, &scores);
+  }
+  int rescoring_ms = timer.Elapsed();
   Reset();
+
+  LOG(INFO) << "Warmup chunk_size " << shape.chunk_size << " left_chunks "
+            << shape.num_left_chunks << " nbest " << shape.nbest
+            << " max_hyp_len " << shape.max_hyp_len << " encoder_len "
+            << shape.encoder_len << ": encoder " << encoder_ms
+            << "ms (first chunk " << first_chunk_ms << "ms), rescoring "
+            << rescoring_ms << "ms.";
 }
 
 // shallow copy
@@ -131,8 +151,11 @@ PaddleAsrModel::PaddleAsrModel(const PaddleAsrModel& other) {
   sos_ = other.sos_;
   eos_ = other.eos_;
   is_bidecoder_ = other.is_bidecoder_;
+  rescoring_bucket_padding_ = other.rescoring_bucket_padding_;
   chunk_size_ = other.chunk_size_;
   num_left_chunks_ = other.num_left_chunks_;
+  num_threads_ = other.num_threads_;
+  frame_reduction_ = other.frame_reduction_;
 
   offset_ = other.offset_;
 
@@ -149,6 +172,109 @@ std::shared_ptr<AsrModelItf> PaddleAsrModel::Copy() const {
   return asr_model;
 }
 
+std::shared_ptr<AsrModelItf> PaddleAsrModel::CopyForRescoring() const {
+  auto asr_model = std::make_shared<PaddleAsrModel>(*this);
+  // chunks are appended to encoder_outs_ and never modified, so sharing
+  // the tensors is safe
+  asr_model->encoder_outs_ = encoder_outs_;
+  asr_model->blank_logps_ = blank_logps_;
+  return asr_model;
+}
+
+static int64_t TensorBytes(const paddle::Tensor& tensor) {
+  // all float32
+  return tensor.initialized() ? tensor.numel() * sizeof(float) : 0;
+}
+
+void PaddleAsrModel::GetMemoryUsage(MemoryUsage* usage) const {
+  // the current cache and the spare window
+  usage->att_cache = TensorBytes(att_cache_) +
+                     TensorBytes(att_cache_windows_[att_cache_window_]);
+  usage->cnn_cache = TensorBytes(cnn_cache_);
+  usage->encoder_outs = 0;
+  for (const paddle::Tensor& encoder_out : encoder_outs_) {
+    usage->encoder_outs += TensorBytes(encoder_out);
+  }
+}
+
+// shape and float32 data of a cpu tensor
+static void WriteTensor(const paddle::Tensor& tensor, BinaryWriter* writer) {
+  writer->Write(tensor.shape());
+  writer->WriteBytes(tensor.data<float>(), tensor.numel() * sizeof(float));
+}
+
+static bool ReadTensor(BinaryReader* reader, paddle::Tensor* tensor) {
+  std::vector<int64_t> shape;
+  if (!reader->Read(&shape)) return false;
+  // a corrupted shape fails before the tensor is allocated
+  int64_t max_numel = reader->remaining() / sizeof(float);
+  int64_t numel = 1;
+  for (int64_t dim : shape) {
+    if (dim < 0 || (dim > 0 && numel > max_numel / dim)) return false;
+    numel *= dim;
+  }
+  *tensor = paddle::zeros(shape, paddle::DataType::FLOAT32);
+  return reader->ReadBytes(tensor->mutable_data<float>(),
+                           numel * sizeof(float));
+}
+
+bool PaddleAsrModel::SaveState(BinaryWriter* writer) const {
+  AsrModelItf::SaveState(writer);
+  WriteTensor(att_cache_, writer);
+  WriteTensor(cnn_cache_, writer);
+  writer->Write<uint64_t>(encoder_outs_.size());
+  for (const paddle::Tensor& encoder_out : encoder_outs_) {
+    WriteTensor(encoder_out, writer);
+  }
+  writer->Write(blank_logps_);
+  return true;
+}
+
+bool PaddleAsrModel::LoadState(BinaryReader* reader) {
+  Reset();
+  uint64_t num_encoder_outs = 0;
+  bool ok = AsrModelItf::LoadState(reader) &&
+            ReadTensor(reader, &att_cache_) &&
+            ReadTensor(reader, &cnn_cache_) && reader->Read(&num_encoder_outs);
+  for (uint64_t i = 0; ok && i < num_encoder_outs; ++i) {
+    paddle::Tensor encoder_out;
+    ok = ReadTensor(reader, &encoder_out);
+    encoder_outs_.push_back(encoder_out);
+  }
+  ok = ok && reader->Read(&blank_logps_);
+  if (!ok) {
+    Reset();
+    return false;
+  }
+  return true;
+}
+
+void PaddleAsrModel::TrimAttCache() {
+  if (num_left_chunks_ <= 0 || chunk_size_ <= 0) return;
+  int64_t max_frames = static_cast<int64_t>(num_left_chunks_) * chunk_size_;
+  // (elayers, head, cache_t, d_k * 2)
+  std::vector<int64_t> dims = att_cache_.shape();
+  if (dims.size() != 4 || dims[2] <= max_frames) return;
+  int64_t num_blocks = dims[0] * dims[1];
+  int64_t num_frames = dims[2];
+  int64_t dim = dims[3];
+
+  paddle::Tensor& window = att_cache_windows_[att_cache_window_];
+  att_cache_window_ = 1 - att_cache_window_;
+  std::vector<int64_t> window_dims = {dims[0], dims[1], max_frames, dim};
+  if (!window.initialized() || window.shape() != window_dims) {
+    window = paddle::zeros(window_dims, paddle::DataType::FLOAT32);
+  }
+  float* dst_ptr = window.mutable_data<float>();
+  const float* src_ptr = att_cache_.data<float>();
+  for (int64_t i = 0; i < num_blocks; ++i) {
+    std::memcpy(dst_ptr + i * max_frames * dim,
+                src_ptr + (i * num_frames + num_frames - max_frames) * dim,
+                max_frames * dim * sizeof(float));
+  }
+  att_cache_ = window;
+}
+
 void PaddleAsrModel::Reset() {
   offset_ = 0;
   cached_feats_.clear();
@@ -159,14 +285,14 @@ void PaddleAsrModel::Reset() {
       std::move(paddle::zeros({0, 0, 0, 0}, paddle::DataType::FLOAT32));
 
   encoder_outs_.clear();
+  blank_logps_.clear();
 }
 
 void PaddleAsrModel::ForwardEncoderChunkImpl(
     const std::vector<std::vector<float>>& chunk_feats,
     std::vector<std::vector<float>>* out_prob) {
-#ifdef USE_PROFILING
-  RecordEvent event("ForwardEncoderChunkImpl", TracerEventType::UserDefined, 1);
-#endif
+  TRACE_SCOPE("PaddleAsrModel::ForwardEncoderChunk");
+  SetIntraOpThreads(num_threads_);
 
   // 1. splice cached_feature, and chunk_feats
   //  First dimension is B, which is 1.
@@ -176,9 +302,15 @@ void PaddleAsrModel::ForwardEncoderChunkImpl(
   VLOG(3) << "num_frames: " << num_frames;
   VLOG(3) << "feature_dim: " << feature_dim;
 
-  // feats (B=1,T,D)
-  paddle::Tensor feats =
-      paddle::zeros({1, num_frames, feature_dim}, paddle::DataType::FLOAT32);
+  // feats (B=1,T,D), the tensor of the last chunk is refilled when the
+  // shape is the same, as it is for every chunk but the first and last
+  if (num_frames != feats_frames_ || feature_dim != feats_dim_) {
+    feats_ =
+        paddle::zeros({1, num_frames, feature_dim}, paddle::DataType::FLOAT32);
+    feats_frames_ = num_frames;
+    feats_dim_ = feature_dim;
+  }
+  paddle::Tensor feats = feats_;
   float* feats_ptr = feats.mutable_data<float>();
 
   for (size_t i = 0; i < cached_feats_.size(); ++i) {
@@ -218,11 +350,23 @@ void PaddleAsrModel::ForwardEncoderChunkImpl(
 
   int required_cache_size = num_left_chunks_ * chunk_size_;  // -1 * 16
   // must be scalar, but paddle do not have scalar.
-  paddle::Tensor offset = paddle::full({1}, offset_, paddle::DataType::INT32);
+  if (!offset_tensor_.initialized()) {
+    offset_tensor_ = paddle::full({1}, 0, paddle::DataType::INT32);
+  }
+  offset_tensor_.mutable_data<int32_t>()[0] = offset_;
   // freeze `required_cache_size` in graph, so not specific it in function call.
-  std::vector<paddle::Tensor> inputs = {
-      feats, offset, /*required_cache_size, */ att_cache_, cnn_cache_};
-  std::vector<paddle::Tensor> outputs = forward_encoder_chunk_(inputs);
+  std::vector<paddle::Tensor>& inputs = inputs_;
+  inputs.clear();
+  inputs.push_back(feats);
+  inputs.push_back(offset_tensor_);
+  // inputs.push_back(required_cache_size);
+  inputs.push_back(att_cache_);
+  inputs.push_back(cnn_cache_);
+  std::vector<paddle::Tensor> outputs;
+  {
+    LatencyStats::ScopedTimer stage(&DecodeLatency(), kStageEncoder);
+    outputs = forward_encoder_chunk_(inputs);
+  }
   VLOG(3) << "inputs size: " << inputs.size();
   VLOG(3) << "outputs size: " << outputs.size();
   CHECK(outputs.size() == 3);
@@ -236,6 +380,7 @@ void PaddleAsrModel::ForwardEncoderChunkImpl(
   att_cache_ = outputs[1];
   cnn_cache_ = outputs[2];
 #endif
+  TrimAttCache();
 
 #ifdef DEUBG
   path.str("encoder_logits");
@@ -284,7 +429,10 @@ void PaddleAsrModel::ForwardEncoderChunkImpl(
   outputs.clear();
   inputs.push_back(chunk_out);
 
-  outputs = ctc_activation_(inputs);
+  {
+    LatencyStats::ScopedTimer stage(&DecodeLatency(), kStageCtc);
+    outputs = ctc_activation_(inputs);
+  }
   paddle::Tensor ctc_log_probs = outputs[0];
 
 #ifdef DEUBG
@@ -321,6 +469,8 @@ void PaddleAsrModel::ForwardEncoderChunkImpl(
     float* dst_ptr = (*out_prob)[i].data();
     float* src_ptr = ctc_log_probs_ptr + (i * D);
     std::memcpy(dst_ptr, src_ptr, D * sizeof(float));
+    // blank is 0
+    blank_logps_.push_back(src_ptr[0]);
   }
 
 #ifdef DEUBG
@@ -352,36 +502,43 @@ void PaddleAsrModel::FeedEncoderOuts(paddle::Tensor& encoder_out) {
   encoder_outs_.push_back(encoder_out);
 }
 
-float PaddleAsrModel::ComputePathScore(const paddle::Tensor& prob,
-                                       const std::vector<int>& hyp,
-                                       int eos) {
-  // sum `hyp` path scores in `prob`
-  // prob (1, Umax, V)
-  // hyp (U,)
-  float score = 0.0f;
-  std::vector<int64_t> dims = prob.shape();
+paddle::Tensor PaddleAsrModel::ReduceFrames(
+    const paddle::Tensor& encoder_out) const {
+  std::vector<int64_t> dims = encoder_out.shape();
   CHECK(dims.size() == 3);
-  VLOG(2) << "prob shape: " << dims[0] << ", " << dims[1] << ", " << dims[2];
-  CHECK(dims[0] == 1);
-  int vocab_dim = static_cast<int>(dims[2]);
-
-  const float* prob_ptr = prob.data<float>();
-  for (size_t i = 0; i < hyp.size(); ++i) {
-    const float* row = prob_ptr + i * vocab_dim;
-    score += row[hyp[i]];
+  int num_frames = static_cast<int>(dims[1]);
+  int dim = static_cast<int>(dims[2]);
+  CHECK_EQ(num_frames, static_cast<int>(blank_logps_.size()));
+
+  std::vector<int> frames;
+  SelectRescoringFrames(blank_logps_, frame_reduction_, &frames);
+  VLOG(1) << "rescoring on " << frames.size() << " of " << num_frames
+          << " frames";
+  // all blank, nothing to attend to, keep the frames
+  if (frames.empty() || static_cast<int>(frames.size()) == num_frames) {
+    return encoder_out;
+  }
+
+  int num_kept = frames.size();
+  paddle::Tensor reduced =
+      paddle::zeros({1, num_kept, dim}, paddle::DataType::FLOAT32);
+  float* dst_ptr = reduced.mutable_data<float>();
+  const float* src_ptr = encoder_out.data<float>();
+  for (int i = 0; i < num_kept; ++i) {
+    std::memcpy(dst_ptr + static_cast<int64_t>(i) * dim,
+                src_ptr + static_cast<int64_t>(frames[i]) * dim,
+                dim * sizeof(float));
   }
-  const float* row = prob_ptr + hyp.size() * vocab_dim;
-  score += row[eos];
-  return score;
+  return reduced;
 }
 
 void PaddleAsrModel::AttentionRescoring(
     const std::vector<std::vector<int>>& hyps,
     float reverse_weight,
     std::vector<float>* rescoring_score) {
-#ifdef USE_PROFILING
-  RecordEvent event("AttentionRescoring", TracerEventType::UserDefined, 1);
-#endif
+  TRACE_SCOPE("PaddleAsrModel::AttentionRescoring");
+  LatencyStats::ScopedTimer stage(&DecodeLatency(), kStageRescoring);
+  SetIntraOpThreads(num_threads_);
 
   CHECK(rescoring_score != nullptr);
 
@@ -397,28 +554,6 @@ void PaddleAsrModel::AttentionRescoring(
     return;
   }
 
-  // prepare input
-  paddle::Tensor hyps_lens = paddle::zeros({num_hyps}, paddle::DataType::INT64);
-  int64_t* hyps_len_ptr = hyps_lens.mutable_data<int64_t>();
-  int max_hyps_len = 0;
-  for (size_t i = 0; i < num_hyps; ++i) {
-    int len = hyps[i].size() + 1;  // eos
-    max_hyps_len = std::max(max_hyps_len, len);
-    hyps_len_ptr[i] = static_cast<int64_t>(len);
-  }
-
-  paddle::Tensor hyps_tensor =
-      paddle::full({num_hyps, max_hyps_len}, eos_, paddle::DataType::INT64);
-  int64_t* hyps_ptr = hyps_tensor.mutable_data<int64_t>();
-  for (size_t i = 0; i < num_hyps; ++i) {
-    const std::vector<int>& hyp = hyps[i];
-    int64_t* row = hyps_ptr + max_hyps_len * i;
-    row[0] = sos_;
-    for (size_t j = 0; j < hyp.size(); ++j) {
-      row[j + 1] = hyp[j];
-    }
-  }
-
 #ifdef DEUBG
   std::stringstream path("encoder_logits_concat",
                          std::ios_base::app | std::ios_base::out);
@@ -437,9 +572,14 @@ void PaddleAsrModel::AttentionRescoring(
   }
 #endif  // end DEUBG
 
-  // forward attention decoder by hyps and correspoinding encoder_outs_
+  // forward attention decoder by hyps and correspoinding encoder_outs_,
+  // one forward for each bucket of hyps of about the same length
+  RescoringBatch batch(hyps, sos_, eos_, rescoring_bucket_padding_);
   paddle::Tensor encoder_out = paddle::concat(encoder_outs_, 1);
   VLOG(2) << "encoder_outs_ size: " << encoder_outs_.size();
+  if (frame_reduction_.enable) {
+    encoder_out = ReduceFrames(encoder_out);
+  }
 
 #ifdef DEUBG
   {
@@ -478,119 +618,104 @@ void PaddleAsrModel::AttentionRescoring(
   }
 #endif  // end DEUBG
 
-  std::vector<paddle::experimental::Tensor> inputs{
-      hyps_tensor, hyps_lens, encoder_out};
-  std::vector<paddle::Tensor> outputs = forward_attention_decoder_(inputs);
-  CHECK(outputs.size() == 2);
+  bool use_reverse = is_bidecoder_ && reverse_weight > 0;
+  for (const RescoringBatch::Bucket& bucket : batch.buckets()) {
+    int num_rows = bucket.num_rows();
+    int max_hyps_len = bucket.max_len;
+    paddle::Tensor hyps_lens =
+        paddle::zeros({num_rows}, paddle::DataType::INT64);
+    paddle::Tensor hyps_tensor =
+        paddle::full({num_rows, max_hyps_len}, eos_, paddle::DataType::INT64);
+    batch.FillBucket(bucket,
+                     hyps_tensor.mutable_data<int64_t>(),
+                     hyps_lens.mutable_data<int64_t>());
 
-  // (B, Umax, V)
-  paddle::Tensor probs = outputs[0];
-  std::vector<int64_t> probs_shape = probs.shape();
-  CHECK(probs_shape.size() == 3);
-  CHECK(probs_shape[0] == num_hyps);
-  CHECK(probs_shape[1] == max_hyps_len);
+    std::vector<paddle::experimental::Tensor> inputs{
+        hyps_tensor, hyps_lens, encoder_out};
+    std::vector<paddle::Tensor> outputs = forward_attention_decoder_(inputs);
+    CHECK(outputs.size() == 2);
+
+    // (B, Umax, V)
+    paddle::Tensor probs = outputs[0];
+    std::vector<int64_t> probs_shape = probs.shape();
+    CHECK(probs_shape.size() == 3);
+    CHECK(probs_shape[0] == num_rows);
+    CHECK(probs_shape[1] == max_hyps_len);
+    int vocab_dim = static_cast<int>(probs_shape[2]);
 
 #ifdef DEUBG
-  {
-    std::stringstream path("decoder_logprob",
-                           std::ios_base::app | std::ios_base::out);
-    std::ofstream dec_logprob_fobj(path.str().c_str(), std::ios::out);
-    CHECK(dec_logprob_fobj.is_open());
-
-    dec_logprob_fobj << probs.shape()[0] << " " << probs.shape()[1] << " "
-                     << probs.shape()[2] << "\n";
-    const float* dec_logprob_ptr = probs.data<float>();
-
-    size_t size = probs.numel();
-    for (int i = 0; i < size; i++) {
-      dec_logprob_fobj << dec_logprob_ptr[i] << "\n";
+    {
+      std::stringstream path("decoder_logprob",
+                             std::ios_base::app | std::ios_base::out);
+      std::ofstream dec_logprob_fobj(path.str().c_str(), std::ios::out);
+      CHECK(dec_logprob_fobj.is_open());
+
+      dec_logprob_fobj << probs.shape()[0] << " " << probs.shape()[1] << " "
+                       << probs.shape()[2] << "\n";
+      const float* dec_logprob_ptr = probs.data<float>();
+
+      size_t size = probs.numel();
+      for (int i = 0; i < size; i++) {
+        dec_logprob_fobj << dec_logprob_ptr[i] << "\n";
+      }
     }
-  }
 #endif  // end DEUBG
 
 #ifdef DEUBG
-  {
-    std::stringstream path("hyps_lens",
-                           std::ios_base::app | std::ios_base::out);
-    std::ofstream hyps_len_fobj(path.str().c_str(), std::ios::out);
-    CHECK(hyps_len_fobj.is_open());
-
-    const int64_t* hyps_lens_ptr = hyps_lens.data<int64_t>();
-
-    size_t size = hyps_lens.numel();
-    for (int i = 0; i < size; i++) {
-      hyps_len_fobj << hyps_lens_ptr[i] << "\n";
+    {
+      std::stringstream path("hyps_lens",
+                             std::ios_base::app | std::ios_base::out);
+      std::ofstream hyps_len_fobj(path.str().c_str(), std::ios::out);
+      CHECK(hyps_len_fobj.is_open());
+
+      const int64_t* hyps_lens_ptr = hyps_lens.data<int64_t>();
+
+      size_t size = hyps_lens.numel();
+      for (int i = 0; i < size; i++) {
+        hyps_len_fobj << hyps_lens_ptr[i] << "\n";
+      }
     }
-  }
 #endif  // end DEUBG
 
 #ifdef DEUBG
-  {
-    std::stringstream path("hyps_tensor",
-                           std::ios_base::app | std::ios_base::out);
-    std::ofstream hyps_tensor_fobj(path.str().c_str(), std::ios::out);
-    CHECK(hyps_tensor_fobj.is_open());
-
-    const int64_t* hyps_tensor_ptr = hyps_tensor.data<int64_t>();
-
-    size_t size = hyps_tensor.numel();
-    for (int i = 0; i < size; i++) {
-      hyps_tensor_fobj << hyps_tensor_ptr[i] << "\n";
+    {
+      std::stringstream path("hyps_tensor",
+                             std::ios_base::app | std::ios_base::out);
+      std::ofstream hyps_tensor_fobj(path.str().c_str(), std::ios::out);
+      CHECK(hyps_tensor_fobj.is_open());
+
+      const int64_t* hyps_tensor_ptr = hyps_tensor.data<int64_t>();
+
+      size_t size = hyps_tensor.numel();
+      for (int i = 0; i < size; i++) {
+        hyps_tensor_fobj << hyps_tensor_ptr[i] << "\n";
+      }
     }
-  }
 #endif  // end DEUBG
 
-  paddle::Tensor r_probs = outputs[1];
-  std::vector<int64_t> r_probs_shape = r_probs.shape();
-  if (is_bidecoder_ && reverse_weight > 0) {
-    CHECK(r_probs_shape.size() == 3);
-    CHECK(r_probs_shape[0] == num_hyps);
-    CHECK(r_probs_shape[1] == max_hyps_len);
-  } else {
-    //dump r_probs
-    CHECK(r_probs_shape.size() == 1);
-    CHECK(r_probs_shape[0] == 1) << r_probs_shape[0];
-  }
-
-  // compute rescoring score
-  using IntArray = paddle::experimental::IntArray;
-  std::vector<paddle::Tensor> probs_v =
-      paddle::experimental::split_with_num(probs, num_hyps, 0);
-  VLOG(2) << "split prob: " << probs_v.size() << " "
-          << probs_v[0].shape().size() << " 0: " << probs_v[0].shape()[0]
-          << ", " << probs_v[0].shape()[1] << ", " << probs_v[0].shape()[2];
-  CHECK(probs_v.size() == num_hyps)
-      << ": is " << probs_v.size() << " expect: " << num_hyps;
-
-  std::vector<paddle::Tensor> r_probs_v;
-  if (is_bidecoder_ && reverse_weight > 0) {
-    r_probs_v =
-        paddle::experimental::split_with_num(r_probs, num_hyps, 0);
-    CHECK(r_probs_v.size() == num_hyps)
-        << "r_probs_v size: is " << r_probs_v.size() << " expect: " << num_hyps;
-  }
-
-  for (size_t i = 0; i < num_hyps; ++i) {
-    const std::vector<int>& hyp = hyps[i];
-
-    // left-to-right decoder score
-    float score = 0.0f;
-    score = ComputePathScore(probs_v[i], hyp, eos_);
-
-    // right-to-left decoder score
-    float r_score = 0.0f;
-    if (is_bidecoder_ && reverse_weight > 0) {
-      std::vector<int> r_hyp(hyp.size());
-      std::reverse_copy(hyp.begin(), hyp.end(), r_hyp.begin());
-      r_score = ComputePathScore(r_probs_v[i], r_hyp, eos_);
+    paddle::Tensor r_probs = outputs[1];
+    std::vector<int64_t> r_probs_shape = r_probs.shape();
+    if (use_reverse) {
+      CHECK(r_probs_shape.size() == 3);
+      CHECK(r_probs_shape[0] == num_rows);
+      CHECK(r_probs_shape[1] == max_hyps_len);
+    } else {
+      CHECK(r_probs_shape.size() == 1);
+      CHECK(r_probs_shape[0] == 1) << r_probs_shape[0];
     }
 
-    // combinded left-to-right and right-to-lfet score
-    (*rescoring_score)[i] =
-        score * (1 - reverse_weight) + r_score * reverse_weight;
-    VLOG(1) << "hyp " << i << " score: " << score << " r_score: " << r_score
-            << " reverse_weight: " << reverse_weight;
+    // read the path scores from (B, Umax, V) by index, no split
+    batch.ScoreBucket(bucket, probs.data<float>(), vocab_dim, false);
+    if (use_reverse) {
+      batch.ScoreBucket(bucket, r_probs.data<float>(), vocab_dim, true);
+    }
   }
+
+  // combinded left-to-right and right-to-lfet score
+  batch.GetScores(reverse_weight, rescoring_score);
+  VLOG(1) << "rescored " << num_hyps << " hyps as " << batch.num_rows()
+          << " rows in " << batch.buckets().size() << " buckets, "
+          << batch.num_padded_tokens() << " padded tokens";
 }
 
 }  // namespace ppspeech
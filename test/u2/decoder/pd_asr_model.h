@@ -45,6 +45,21 @@ class PaddleAsrModel : public AsrModelItf {
 
   std::shared_ptr<AsrModelItf> Copy() const override;
 
+  // see RescoringBatch, < 0 rescores the n-best in one forward
+  void set_rescoring_bucket_padding(int padding) {
+    rescoring_bucket_padding_ = padding;
+  }
+
+  // The exported forward_attention_decoder repeats one encoder_out over
+  // the hyps, so n-best lists of different sessions can not share a call
+  // and BatchAttentionRescoring keeps the one by one default.
+  std::shared_ptr<AsrModelItf> CopyForRescoring() const override;
+
+  void GetMemoryUsage(MemoryUsage* usage) const override;
+
+  bool SaveState(BinaryWriter* writer) const override;
+  bool LoadState(BinaryReader* reader) override;
+
   // debug
   void FeedEncoderOuts(paddle::Tensor& encoder_out);
 
@@ -54,20 +69,42 @@ class PaddleAsrModel : public AsrModelItf {
       const std::vector<std::vector<float>>& chunk_feats,
       std::vector<std::vector<float>>* ctc_probs) override;
 
-  float ComputePathScore(const paddle::Tensor& prob,
-                         const std::vector<int>& hyp,
-                         int eos);
-
-  void Warmup();
+  // Read() does not warm the model up, the shapes depend on the decode
+  // options.
+  void Warmup(const std::vector<WarmupShape>& shapes,
+              int feature_dim,
+              int num_threads) override;
 
  private:
+  // encoder chunks and the rescoring of one shape, on this copy
+  void WarmupOne(const WarmupShape& shape, int feature_dim);
+  // encoder_out (1, T, D) without the frames dropped by frame_reduction_
+  paddle::Tensor ReduceFrames(const paddle::Tensor& encoder_out) const;
+  // The exported model keeps the att cache of all the left chunks when it
+  // is exported with num_left_chunks = -1, so the cache is cut to the last
+  // num_left_chunks_ * chunk_size_ frames here. The two windows are
+  // written in turn, one is the input of the next chunk.
+  void TrimAttCache();
+
   phi::Place dev_;
   std::shared_ptr<PaddleLayer> model_ = nullptr;
   std::vector<paddle::Tensor> encoder_outs_{};
+  // ctc log prob of blank of each frame of encoder_outs_
+  std::vector<float> blank_logps_;
+  int rescoring_bucket_padding_ = -1;
   // transformer/conformer attention cache
   paddle::Tensor att_cache_ = paddle::full({0, 0, 0, 0}, 0.0);
+  paddle::Tensor att_cache_windows_[2];
+  int att_cache_window_ = 0;  // the one written next
   // conformer-only conv_module cache
   paddle::Tensor cnn_cache_ = paddle::full({0, 0, 0, 0}, 0.0);
+  // inputs of the encoder kept over the chunks, so a chunk of the same
+  // shape as the last one does not allocate them
+  paddle::Tensor feats_;
+  int feats_frames_ = 0;
+  int feats_dim_ = 0;
+  paddle::Tensor offset_tensor_;
+  std::vector<paddle::Tensor> inputs_;
 
   paddle::jit::Function forward_encoder_chunk_;
   paddle::jit::Function forward_attention_decoder_;
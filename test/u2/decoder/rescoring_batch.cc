@@ -0,0 +1,151 @@
+// Copyright (c) 2022 PaddlePaddle Authors. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "decoder/rescoring_batch.h"
+
+#include <algorithm>
+#include <cmath>
+#include <map>
+#include <numeric>
+
+#include "utils/log.h"
+
+namespace ppspeech {
+
+void SelectRescoringFrames(const std::vector<float>& blank_logps,
+                           const FrameReductionOptions& opts,
+                           std::vector<int>* frames) {
+  frames->clear();
+  int num_frames = blank_logps.size();
+  float blank_logp_threshold = std::log(opts.blank_threshold);
+  // end of the frames kept so far, a spike keeps [t - context, t + context]
+  int kept_end = 0;
+  for (int t = 0; t < num_frames; ++t) {
+    if (blank_logps[t] >= blank_logp_threshold) continue;
+    int begin = std::max(kept_end, t - opts.context);
+    int end = std::min(num_frames, t + opts.context + 1);
+    for (int i = begin; i < end; ++i) {
+      frames->push_back(i);
+    }
+    kept_end = std::max(kept_end, end);
+  }
+}
+
+RescoringBatch::RescoringBatch(const std::vector<std::vector<int>>& hyps,
+                               int sos,
+                               int eos,
+                               int max_bucket_padding)
+    : eos_(eos), sos_(sos) {
+  // collapse the duplicates, the first one stands for all
+  int num_hyps = hyps.size();
+  std::map<std::vector<int>, int> first_of_hyp;
+  std::vector<int> unique_hyps;
+  std::vector<int> unique_of_hyp(num_hyps);
+  for (int i = 0; i < num_hyps; ++i) {
+    auto it = first_of_hyp.emplace(hyps[i], unique_hyps.size()).first;
+    if (it->second == static_cast<int>(unique_hyps.size())) {
+      unique_hyps.push_back(i);
+    }
+    unique_of_hyp[i] = it->second;
+  }
+
+  // longest first, ties in the n-best order
+  std::vector<int> order(unique_hyps.size());
+  std::iota(order.begin(), order.end(), 0);
+  std::stable_sort(order.begin(), order.end(), [&](int a, int b) {
+    return hyps[unique_hyps[a]].size() > hyps[unique_hyps[b]].size();
+  });
+  std::vector<int> row_of_unique(unique_hyps.size());
+  rows_.reserve(order.size());
+  for (size_t row = 0; row < order.size(); ++row) {
+    row_of_unique[order[row]] = row;
+    rows_.push_back(&hyps[unique_hyps[order[row]]]);
+  }
+  row_of_hyp_.resize(num_hyps);
+  for (int i = 0; i < num_hyps; ++i) {
+    row_of_hyp_[i] = row_of_unique[unique_of_hyp[i]];
+  }
+
+  int num_rows = rows_.size();
+  for (int row = 0; row < num_rows; ++row) {
+    int len = rows_[row]->size() + 1;
+    if (buckets_.empty() ||
+        (max_bucket_padding >= 0 &&
+         buckets_.back().max_len - len > max_bucket_padding)) {
+      buckets_.push_back({row, row, len});
+    }
+    buckets_.back().end = row + 1;
+  }
+  scores_.assign(num_rows, 0.0f);
+  r_scores_.assign(num_rows, 0.0f);
+  VLOG(2) << "rescoring batch: " << num_hyps << " hyps, " << num_rows
+          << " unique in " << buckets_.size() << " buckets";
+}
+
+int RescoringBatch::num_padded_tokens() const {
+  int num_tokens = 0;
+  for (const Bucket& bucket : buckets_) {
+    num_tokens += bucket.num_rows() * bucket.max_len;
+  }
+  return num_tokens;
+}
+
+void RescoringBatch::FillBucket(const Bucket& bucket,
+                                int64_t* tokens,
+                                int64_t* lens) const {
+  for (int row = bucket.begin; row < bucket.end; ++row) {
+    const std::vector<int>& hyp = *rows_[row];
+    int64_t* tokens_row = tokens + (row - bucket.begin) * bucket.max_len;
+    tokens_row[0] = sos_;
+    std::copy(hyp.begin(), hyp.end(), tokens_row + 1);
+    std::fill(tokens_row + hyp.size() + 1,
+              tokens_row + bucket.max_len,
+              static_cast<int64_t>(eos_));
+    lens[row - bucket.begin] = hyp.size() + 1;  // eos
+  }
+}
+
+void RescoringBatch::ScoreBucket(const Bucket& bucket,
+                                 const float* probs,
+                                 int vocab_size,
+                                 bool reverse) {
+  std::vector<float>& scores = reverse ? r_scores_ : scores_;
+  for (int row = bucket.begin; row < bucket.end; ++row) {
+    const std::vector<int>& hyp = *rows_[row];
+    int size = hyp.size();
+    const float* prob = probs + static_cast<int64_t>(row - bucket.begin) *
+                                    bucket.max_len * vocab_size;
+    // sum the hyp tokens and eos, in the order of the one by one scoring
+    float score = 0.0f;
+    for (int i = 0; i < size; ++i) {
+      int token = reverse ? hyp[size - 1 - i] : hyp[i];
+      score += prob[i * vocab_size + token];
+    }
+    score += prob[size * vocab_size + eos_];
+    scores[row] = score;
+  }
+}
+
+void RescoringBatch::GetScores(float reverse_weight,
+                               std::vector<float>* scores) const {
+  int num_hyps = row_of_hyp_.size();
+  scores->resize(num_hyps);
+  for (int i = 0; i < num_hyps; ++i) {
+    int row = row_of_hyp_[i];
+    (*scores)[i] =
+        scores_[row] * (1 - reverse_weight) + r_scores_[row] * reverse_weight;
+  }
+}
+
+}  // namespace ppspeech
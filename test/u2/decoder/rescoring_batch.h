@@ -0,0 +1,100 @@
+// Copyright (c) 2022 PaddlePaddle Authors. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#pragma once
+
+#include <cstdint>
+#include <vector>
+
+#include "utils/utils.h"
+
+namespace ppspeech {
+
+// Dropping the encoder frames far from any ctc spike before rescoring, the
+// attention decoder then cross-attends over the frames that carry tokens.
+struct FrameReductionOptions {
+  bool enable = false;
+  // a frame is blank when its ctc blank prob is at least this
+  float blank_threshold = 0.99;
+  // the frames within this many of a non-blank frame are kept too
+  int context = 2;
+};
+
+// Indices of the encoder frames kept by opts, in order, from the ctc log
+// prob of blank of each frame. Empty when no frame is non-blank.
+void SelectRescoringFrames(const std::vector<float>& blank_logps,
+                           const FrameReductionOptions& opts,
+                           std::vector<int>* frames);
+
+// The attention decoder input of one n-best list.
+//
+// Duplicate hyps are collapsed into one row, the rows are sorted by length,
+// longest first, and cut into buckets. Each bucket is one forward of the
+// decoder, padded to its own longest row instead of the longest hyp of the
+// n-best. The scores are read from the (rows, max_len, vocab) output of
+// each bucket by index and scattered back to the order of the hyps.
+class RescoringBatch {
+ public:
+  // rows [begin, end), padded to max_len = longest hyp + 1 (sos or eos)
+  struct Bucket {
+    int begin;
+    int end;
+    int max_len;
+    int num_rows() const { return end - begin; }
+  };
+
+  // A row starts a new bucket when it is shorter than the first row of the
+  // bucket by more than max_bucket_padding, < 0 for a single bucket. The
+  // hyps must outlive the batch.
+  RescoringBatch(const std::vector<std::vector<int>>& hyps,
+                 int sos,
+                 int eos,
+                 int max_bucket_padding = -1);
+
+  const std::vector<Bucket>& buckets() const { return buckets_; }
+  int num_hyps() const { return row_of_hyp_.size(); }
+  int num_rows() const { return rows_.size(); }
+  // padded tokens of all the buckets, the decoder compute is about this
+  int num_padded_tokens() const;
+
+  // tokens (num_rows, max_len): sos, the hyp and eos padding, lens
+  // (num_rows): length of the hyp + 1
+  void FillBucket(const Bucket& bucket, int64_t* tokens, int64_t* lens) const;
+
+  // Sum the path scores of the rows of the bucket in the log probs
+  // (num_rows, max_len, vocab_size) of the left-to-right decoder, or of the
+  // right-to-left one with reverse, which reads the reversed hyps.
+  void ScoreBucket(const Bucket& bucket,
+                   const float* probs,
+                   int vocab_size,
+                   bool reverse);
+
+  // score * (1 - reverse_weight) + r_score * reverse_weight of each hyp
+  void GetScores(float reverse_weight, std::vector<float>* scores) const;
+
+ private:
+  int eos_;
+  int sos_;
+  // unique hyps, longest first
+  std::vector<const std::vector<int>*> rows_;
+  std::vector<int> row_of_hyp_;
+  std::vector<Bucket> buckets_;
+  std::vector<float> scores_;
+  std::vector<float> r_scores_;
+
+ public:
+  DISALLOW_COPY_AND_ASSIGN(RescoringBatch);
+};
+
+}  // namespace ppspeech
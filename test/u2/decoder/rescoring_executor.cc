@@ -0,0 +1,171 @@
+// Copyright (c) 2022 PaddlePaddle Authors. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "decoder/rescoring_executor.h"
+
+#include <algorithm>
+#include <string>
+#include <utility>
+
+#include "utils/log.h"
+#include "utils/tracer.h"
+
+
+namespace ppspeech {
+
+RescoringExecutor::RescoringExecutor(const RescoringExecutorOptions& opts)
+    : opts_(opts) {
+  CHECK_GT(opts_.num_threads, 0);
+  CHECK_GT(opts_.max_batch_size, 0);
+  for (int i = 0; i < opts_.num_threads; ++i) {
+    threads_.emplace_back([this, i]() {
+      Tracer::SetThreadName("rescoring " + std::to_string(i));
+      Loop();
+    });
+  }
+}
+
+RescoringExecutor::~RescoringExecutor() {
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    stop_ = true;
+  }
+  queue_condition_.notify_all();
+  for (std::thread& thread : threads_) {
+    thread.join();
+  }
+}
+
+void RescoringExecutor::Submit(std::shared_ptr<AsrModelItf> model,
+                               std::vector<std::vector<int>> hyps,
+                               float reverse_weight,
+                               Callback done) {
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    CHECK(!stop_);
+    queue_.push_back({std::move(model),
+                      std::move(hyps),
+                      reverse_weight,
+                      std::move(done),
+                      Clock::now()});
+    ++num_requests_;
+    TRACE_COUNTER("rescoring queue", queue_.size());
+  }
+  queue_condition_.notify_one();
+}
+
+std::future<std::vector<float>> RescoringExecutor::Submit(
+    std::shared_ptr<AsrModelItf> model,
+    std::vector<std::vector<int>> hyps,
+    float reverse_weight) {
+  auto promise = std::make_shared<std::promise<std::vector<float>>>();
+  std::future<std::vector<float>> future = promise->get_future();
+  Submit(std::move(model),
+         std::move(hyps),
+         reverse_weight,
+         [promise](std::vector<float> rescoring_score) {
+           promise->set_value(std::move(rescoring_score));
+         });
+  return future;
+}
+
+void RescoringExecutor::Loop() {
+  std::vector<Request> batch;
+  while (true) {
+    int batch_size = 0;
+    {
+      std::unique_lock<std::mutex> lock(mutex_);
+      queue_condition_.wait(lock,
+                            [this]() { return stop_ || !queue_.empty(); });
+      if (queue_.empty()) return;  // stop_
+
+      // give the other sessions some time to fill the batch
+      if (opts_.max_wait_ms > 0 && !stop_) {
+        auto deadline = queue_.front().submit_time +
+                        std::chrono::milliseconds(opts_.max_wait_ms);
+        queue_condition_.wait_until(lock, deadline, [this]() {
+          return stop_ || queue_.empty() ||
+                 queue_.size() >= static_cast<size_t>(opts_.max_batch_size);
+        });
+        if (queue_.empty()) continue;  // taken by another thread
+      }
+
+      batch_size =
+          std::min(static_cast<int>(queue_.size()), opts_.max_batch_size);
+      batch.clear();
+      for (int i = 0; i < batch_size; ++i) {
+        batch.push_back(std::move(queue_.front()));
+        queue_.pop_front();
+      }
+      num_running_ += batch_size;
+      ++num_batches_;
+      TRACE_COUNTER("rescoring queue", queue_.size());
+    }
+
+    RunBatch(&batch);
+
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      num_running_ -= batch_size;
+      if (num_running_ == 0 && queue_.empty()) idle_condition_.notify_all();
+    }
+  }
+}
+
+void RescoringExecutor::RunBatch(std::vector<Request>* batch) {
+  TRACE_SCOPE("RescoringExecutor::RunBatch");
+  // sessions of similar length next to each other, so the model pads less
+  std::sort(batch->begin(),
+            batch->end(),
+            [](const Request& a, const Request& b) {
+              return a.model->offset() < b.model->offset();
+            });
+
+  std::vector<AsrModelItf*> models;
+  std::vector<const std::vector<std::vector<int>>*> hyps;
+  std::vector<float> reverse_weights;
+  for (Request& request : *batch) {
+    models.push_back(request.model.get());
+    hyps.push_back(&request.hyps);
+    reverse_weights.push_back(request.reverse_weight);
+  }
+  std::vector<std::vector<float>> rescoring_scores;
+  models[0]->BatchAttentionRescoring(
+      models, hyps, reverse_weights, &rescoring_scores);
+  CHECK_EQ(rescoring_scores.size(), batch->size());
+
+  for (size_t i = 0; i < batch->size(); ++i) {
+    (*batch)[i].done(std::move(rescoring_scores[i]));
+  }
+  // release the encoder outputs before waiting for the next batch
+  batch->clear();
+}
+
+void RescoringExecutor::WaitIdle() {
+  std::unique_lock<std::mutex> lock(mutex_);
+  idle_condition_.wait(
+      lock, [this]() { return num_running_ == 0 && queue_.empty(); });
+}
+
+int64_t RescoringExecutor::num_requests() const {
+  std::lock_guard<std::mutex> lock(mutex_);
+  return num_requests_;
+}
+
+int64_t RescoringExecutor::num_batches() const {
+  std::lock_guard<std::mutex> lock(mutex_);
+  return num_batches_;
+}
+
+}  // namespace ppspeech
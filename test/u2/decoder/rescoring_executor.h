@@ -0,0 +1,102 @@
+// Copyright (c) 2022 PaddlePaddle Authors. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#pragma once
+
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "decoder/asr_itf.h"
+#include "utils/utils.h"
+
+namespace ppspeech {
+
+struct RescoringExecutorOptions {
+  int num_threads = 1;
+  // max num of n-best lists, i.e. sessions, rescored by one model call
+  int max_batch_size = 8;
+  // how long a request may wait for others to fill the batch, 0 means
+  // only the requests already queued are batched
+  int max_wait_ms = 0;
+};
+
+// Second pass executor: attention rescoring requests of many sessions are
+// queued here instead of running on their decoding threads, and the
+// requests queued together are rescored by one
+// AsrModelItf::BatchAttentionRescoring() call, sorted by encoder length so
+// that the padding inside the batch stays small.
+class RescoringExecutor {
+ public:
+  using Callback = std::function<void(std::vector<float> rescoring_score)>;
+
+  explicit RescoringExecutor(const RescoringExecutorOptions& opts);
+  // rescore the queued requests and join the threads
+  ~RescoringExecutor();
+
+  // model is a AsrModelItf::CopyForRescoring() of the session, done is
+  // called on an executor thread with the score of each hyp
+  void Submit(std::shared_ptr<AsrModelItf> model,
+              std::vector<std::vector<int>> hyps,
+              float reverse_weight,
+              Callback done);
+  std::future<std::vector<float>> Submit(std::shared_ptr<AsrModelItf> model,
+                                         std::vector<std::vector<int>> hyps,
+                                         float reverse_weight);
+
+  // wait until all the submitted requests are done
+  void WaitIdle();
+
+  int64_t num_requests() const;
+  int64_t num_batches() const;
+
+ private:
+  using Clock = std::chrono::steady_clock;
+
+  struct Request {
+    std::shared_ptr<AsrModelItf> model;
+    std::vector<std::vector<int>> hyps;
+    float reverse_weight;
+    Callback done;
+    Clock::time_point submit_time;
+  };
+
+  void Loop();
+  void RunBatch(std::vector<Request>* batch);
+
+  RescoringExecutorOptions opts_;
+
+  mutable std::mutex mutex_;
+  std::condition_variable queue_condition_;
+  std::condition_variable idle_condition_;
+  std::deque<Request> queue_;
+  int num_running_ = 0;
+  bool stop_ = false;
+  int64_t num_requests_ = 0;
+  int64_t num_batches_ = 0;
+
+  std::vector<std::thread> threads_;
+
+ public:
+  DISALLOW_COPY_AND_ASSIGN(RescoringExecutor);
+};
+
+}  // namespace ppspeech
@@ -14,8 +14,11 @@
 
 #pragma once
 
+#include <cstdint>
 #include <vector>
 
+#include "utils/io.h"
+
 namespace ppspeech {
 
 enum SearchType {
@@ -39,6 +42,13 @@ class SearchInterface {
   virtual const std::vector<float>& Likelihood() const = 0;
   // n-best timestamp
   virtual const std::vector<std::vector<int>>& Times() const = 0;
+  // approximate bytes held by the hypotheses
+  virtual int64_t MemoryBytes() const { return 0; }
+
+  // snapshot of the search state, false if the search does not support it
+  // or the snapshot is corrupted
+  virtual bool SaveState(BinaryWriter* /*writer*/) const { return false; }
+  virtual bool LoadState(BinaryReader* /*reader*/) { return false; }
 };
 
 }  // namespace ppspeech
\ No newline at end of file
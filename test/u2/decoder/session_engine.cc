@@ -0,0 +1,238 @@
+// Copyright (c) 2022 PaddlePaddle Authors. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "decoder/session_engine.h"
+
+#include <algorithm>
+#include <utility>
+#include <vector>
+
+#include "utils/log.h"
+#include "utils/tracer.h"
+
+namespace ppspeech {
+
+SessionEngine::SessionEngine(int num_workers,
+                             RescoringExecutor* rescoring_executor,
+                             std::function<void(size_t)> worker_init)
+    : rescoring_executor_(rescoring_executor),
+      pool_(num_workers, std::move(worker_init)) {
+  CHECK_GT(num_workers, 0);
+}
+
+SessionEngine::~SessionEngine() { WaitAll(); }
+
+void SessionEngine::AddSession(const std::shared_ptr<AsrSession>& session) {
+  bool queued = false;
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    CHECK(session->engine_ == nullptr) << "session is already added";
+    session->engine_ = this;
+    if (session->rescoring_executor() == nullptr) {
+      session->set_rescoring_executor(rescoring_executor_);
+    }
+    SessionSlot& slot = sessions_[session.get()];
+    slot.session = session;
+    slot.last_active = std::chrono::steady_clock::now();
+    // audio may be fed before the session is added
+    queued = ScheduleLocked(&slot);
+  }
+  if (queued) SubmitRun(session.get());
+}
+
+void SessionEngine::Schedule(AsrSession* session) {
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    auto it = sessions_.find(session);
+    // an evicted session is queued already, a running one is scheduled
+    // again after its step
+    if (it == sessions_.end() || it->second.queued || it->second.running) {
+      return;
+    }
+    QueueLocked(&it->second);
+  }
+  SubmitRun(session);
+}
+
+bool SessionEngine::ScheduleLocked(SessionSlot* slot) {
+  // a running session is scheduled again by its worker when the step is
+  // done, under this lock, so the audio fed meanwhile is not missed
+  if (slot->queued || slot->running) return false;
+  // the callback takes this lock, so it waits until the slot is updated
+  if (slot->session->NotifyWhenChunkReady()) return false;
+  QueueLocked(slot);
+  return true;
+}
+
+void SessionEngine::QueueLocked(SessionSlot* slot) {
+  slot->queued = true;
+  TRACE_COUNTER("session queue", ++num_queued_);
+}
+
+void SessionEngine::SubmitRun(AsrSession* session) {
+  // a queued session is neither erased nor evicted until it has run
+  pool_.Submit([this, session]() { Run(session); });
+}
+
+void SessionEngine::Run(AsrSession* session) {
+  TRACE_SCOPE_ID("SessionEngine::Run", session->trace_id());
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    SessionSlot& slot = sessions_.at(session);
+    slot.queued = false;
+    slot.running = true;
+    TRACE_COUNTER("session queue", --num_queued_);
+  }
+
+  // one chunk per turn, so a session with a backlog does not starve the
+  // others queued behind it
+  session->Step();
+  int64_t memory_bytes = session->memory_usage().total();
+
+  // released after the lock, the last reference may return the session to
+  // a SessionPool
+  std::shared_ptr<AsrSession> finished;
+  bool queued = false;
+  std::vector<AsrSession*> evicted;
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    SessionSlot& slot = sessions_.at(session);
+    slot.running = false;
+    slot.last_active = std::chrono::steady_clock::now();
+    UpdateMemoryLocked(&slot, memory_bytes);
+    if (session->finished()) {
+      finished = EraseLocked(session);
+      return;
+    }
+    queued = ScheduleLocked(&slot);
+    EvictLocked(&evicted);
+  }
+  if (queued) SubmitRun(session);
+  SubmitEvict(evicted);
+}
+
+void SessionEngine::SubmitEvict(const std::vector<AsrSession*>& sessions) {
+  for (AsrSession* session : sessions) {
+    pool_.Submit([this, session]() { Evict(session); });
+  }
+}
+
+void SessionEngine::Evict(AsrSession* session) {
+  TRACE_SCOPE_ID("SessionEngine::Evict", session->trace_id());
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    SessionSlot& slot = sessions_.at(session);
+    slot.queued = false;
+    slot.running = true;
+    TRACE_COUNTER("session queue", --num_queued_);
+  }
+
+  session->Evict();
+
+  std::shared_ptr<AsrSession> finished;
+  std::lock_guard<std::mutex> lock(mutex_);
+  evicting_bytes_ -= sessions_.at(session).memory_bytes;
+  finished = EraseLocked(session);
+}
+
+void SessionEngine::UpdateMemoryLocked(SessionSlot* slot,
+                                       int64_t memory_bytes) {
+  memory_bytes_ += memory_bytes - slot->memory_bytes;
+  slot->memory_bytes = memory_bytes;
+  peak_memory_bytes_ = std::max(peak_memory_bytes_, memory_bytes_);
+}
+
+void SessionEngine::EvictLocked(std::vector<AsrSession*>* evicted) {
+  if (memory_limit_ <= 0 || memory_bytes_ - evicting_bytes_ <= memory_limit_) {
+    return;
+  }
+  std::vector<SessionSlot*> idle;
+  for (auto& item : sessions_) {
+    SessionSlot& slot = item.second;
+    if (!slot.queued && !slot.running && slot.memory_bytes > 0) {
+      idle.push_back(&slot);
+    }
+  }
+  std::sort(idle.begin(), idle.end(), [](SessionSlot* a, SessionSlot* b) {
+    return a->last_active < b->last_active;
+  });
+  for (SessionSlot* slot : idle) {
+    if (memory_bytes_ - evicting_bytes_ <= memory_limit_) break;
+    // queued, so it is not scheduled any more
+    slot->queued = true;
+    evicting_bytes_ += slot->memory_bytes;
+    ++num_evicted_;
+    TRACE_COUNTER("session queue", ++num_queued_);
+    evicted->push_back(slot->session.get());
+  }
+}
+
+std::shared_ptr<AsrSession> SessionEngine::EraseLocked(AsrSession* session) {
+  auto it = sessions_.find(session);
+  memory_bytes_ -= it->second.memory_bytes;
+  std::shared_ptr<AsrSession> erased = std::move(it->second.session);
+  sessions_.erase(it);
+  if (sessions_.empty()) all_finished_.notify_all();
+  return erased;
+}
+
+void SessionEngine::WaitAll() {
+  {
+    std::unique_lock<std::mutex> lock(mutex_);
+    all_finished_.wait(lock, [this]() { return sessions_.empty(); });
+  }
+  // the last segments may still be rescored
+  if (rescoring_executor_ != nullptr) rescoring_executor_->WaitIdle();
+}
+
+int SessionEngine::num_live_sessions() const {
+  std::lock_guard<std::mutex> lock(mutex_);
+  return sessions_.size();
+}
+
+int SessionEngine::num_idle_sessions() const {
+  std::lock_guard<std::mutex> lock(mutex_);
+  int num_idle = 0;
+  for (const auto& item : sessions_) {
+    if (!item.second.queued && !item.second.running) ++num_idle;
+  }
+  return num_idle;
+}
+
+void SessionEngine::set_memory_limit(int64_t max_bytes) {
+  std::vector<AsrSession*> evicted;
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    memory_limit_ = max_bytes;
+    EvictLocked(&evicted);
+  }
+  SubmitEvict(evicted);
+}
+
+int64_t SessionEngine::memory_bytes() const {
+  std::lock_guard<std::mutex> lock(mutex_);
+  return memory_bytes_;
+}
+
+int64_t SessionEngine::peak_memory_bytes() const {
+  std::lock_guard<std::mutex> lock(mutex_);
+  return peak_memory_bytes_;
+}
+
+int SessionEngine::num_evicted() const {
+  std::lock_guard<std::mutex> lock(mutex_);
+  return num_evicted_;
+}
+
+}  // namespace ppspeech
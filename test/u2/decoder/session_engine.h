@@ -0,0 +1,137 @@
+// Copyright (c) 2022 PaddlePaddle Authors. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#pragma once
+
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <unordered_map>
+#include <vector>
+
+#include "decoder/asr_session.h"
+#include "decoder/rescoring_executor.h"
+#include "utils/thread_pool.h"
+#include "utils/utils.h"
+
+namespace ppspeech {
+
+// SessionEngine multiplexes live AsrSessions onto a fixed pool of workers.
+// A session is queued when its audio makes a chunk ready, a worker steps it
+// by one chunk and queues it again if another chunk is ready, so sessions
+// waiting for audio hold no thread and the streams served are not bounded
+// by the number of threads. A session is run by at most one worker at a
+// time. An idle session is not polled, its feature pipeline calls back the
+// engine once the frames of its next chunk are fed.
+//
+//   SessionEngine engine(num_workers);
+//   auto session = std::make_shared<AsrSession>(key, ...);
+//   session->set_final_callback(...);
+//   engine.AddSession(session);
+//   session->AcceptWaveform(pcm, size);  // from the producer, repeatedly
+//   session->SetInputFinished();
+//   engine.WaitAll();
+//
+// The memory of each session is measured after each of its steps. With a
+// memory limit, idle sessions, i.e. waiting for audio, are evicted, least
+// recently decoded first, while the sessions hold more than the limit.
+class SessionEngine {
+ public:
+  // rescoring_executor, if any, is used by the sessions without their own.
+  // worker_init, if any, is called by each worker with its index first,
+  // e.g. to pin it and set its intra-op threads.
+  explicit SessionEngine(int num_workers,
+                         RescoringExecutor* rescoring_executor = nullptr,
+                         std::function<void(size_t)> worker_init = nullptr);
+  // waits for all the sessions to finish
+  ~SessionEngine();
+
+  void AddSession(const std::shared_ptr<AsrSession>& session);
+
+  // wait until all the added sessions are finished and their final results
+  // are reported
+  void WaitAll();
+
+  int num_live_sessions() const;
+  // live sessions waiting for audio, i.e. neither queued nor running
+  int num_idle_sessions() const;
+
+  // in bytes, <= 0 for no limit. An evicted session is finished with the
+  // result so far, its final callback is called as usual.
+  void set_memory_limit(int64_t max_bytes);
+  // bytes held by the live sessions as of their last steps
+  int64_t memory_bytes() const;
+  int64_t peak_memory_bytes() const;
+  int num_evicted() const;
+
+ private:
+  struct SessionSlot {
+    std::shared_ptr<AsrSession> session;
+    bool queued = false;
+    bool running = false;
+    int64_t memory_bytes = 0;
+    std::chrono::steady_clock::time_point last_active;
+  };
+
+  // The *Locked() methods only mark the sessions queued, the tasks are
+  // submitted by SubmitRun() and SubmitEvict() once mutex_ is released, as
+  // Submit() may wait for a worker or run the task inline, and the tasks
+  // take mutex_.
+
+  // queue the session, called by AsrSession once a chunk is ready
+  void Schedule(AsrSession* session);
+  // queue the session if a chunk is ready, else have it call Schedule()
+  // once it is, when it is neither queued nor running. True if queued.
+  bool ScheduleLocked(SessionSlot* slot);
+  void QueueLocked(SessionSlot* slot);
+  void SubmitRun(AsrSession* session);
+  void Run(AsrSession* session);
+  void SubmitEvict(const std::vector<AsrSession*>& sessions);
+  void Evict(AsrSession* session);
+  // set the memory of a slot after a step
+  void UpdateMemoryLocked(SessionSlot* slot, int64_t memory_bytes);
+  // queue the idle sessions to evict if over the memory limit, appended to
+  // evicted
+  void EvictLocked(std::vector<AsrSession*>* evicted);
+  // the session is released by the caller after the lock
+  std::shared_ptr<AsrSession> EraseLocked(AsrSession* session);
+
+  RescoringExecutor* rescoring_executor_;
+
+  mutable std::mutex mutex_;
+  std::condition_variable all_finished_;
+  std::unordered_map<AsrSession*, SessionSlot> sessions_;
+
+  int64_t memory_limit_ = 0;
+  int64_t memory_bytes_ = 0;
+  // of the sessions being evicted
+  int64_t evicting_bytes_ = 0;
+  int64_t peak_memory_bytes_ = 0;
+  int num_evicted_ = 0;
+  // the sessions queued to the workers, traced
+  int num_queued_ = 0;
+
+  // the last member, so workers are joined before the rest is destroyed
+  ThreadPool pool_;
+
+  friend class AsrSession;
+
+ public:
+  DISALLOW_COPY_AND_ASSIGN(SessionEngine);
+};
+
+}  // namespace ppspeech
@@ -0,0 +1,93 @@
+// Copyright (c) 2022 PaddlePaddle Authors. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "decoder/session_pool.h"
+
+#include <utility>
+
+#include "utils/log.h"
+
+namespace ppspeech {
+
+SessionPool::SessionPool(const FeaturePipelineConfig& feature_config,
+                         std::shared_ptr<DecodeResource> resource,
+                         const DecodeOptions& opts,
+                         int num_sessions,
+                         bool continuous_decoding)
+    : feature_config_(feature_config),
+      resource_(std::move(resource)),
+      opts_(opts),
+      continuous_decoding_(continuous_decoding) {
+  idle_.reserve(num_sessions);
+  for (int i = 0; i < num_sessions; ++i) {
+    idle_.push_back(NewSession());
+  }
+  num_sessions_ = num_sessions;
+}
+
+SessionPool::~SessionPool() {
+  std::lock_guard<std::mutex> lock(mutex_);
+  CHECK_EQ(static_cast<int>(idle_.size()), num_sessions_)
+      << "sessions outlive their pool";
+}
+
+std::unique_ptr<AsrSession> SessionPool::NewSession() const {
+  return std::unique_ptr<AsrSession>(new AsrSession(
+      "", feature_config_, resource_, opts_, continuous_decoding_));
+}
+
+std::shared_ptr<AsrSession> SessionPool::Acquire(const std::string& key) {
+  std::unique_ptr<AsrSession> session;
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    ++num_acquired_;
+    if (!idle_.empty()) {
+      session = std::move(idle_.back());
+      idle_.pop_back();
+    } else {
+      ++num_sessions_;
+    }
+  }
+  // built out of the lock, it reads the cmvn and copies the model
+  if (session == nullptr) {
+    VLOG(1) << "session pool is empty, new session for " << key;
+    session = NewSession();
+  }
+  session->Reset(key);
+  return std::shared_ptr<AsrSession>(
+      session.release(), [this](AsrSession* session) { Release(session); });
+}
+
+void SessionPool::Release(AsrSession* session) {
+  std::unique_ptr<AsrSession> idle(session);
+  std::lock_guard<std::mutex> lock(mutex_);
+  idle_.push_back(std::move(idle));
+}
+
+int SessionPool::num_idle() const {
+  std::lock_guard<std::mutex> lock(mutex_);
+  return idle_.size();
+}
+
+int SessionPool::num_sessions() const {
+  std::lock_guard<std::mutex> lock(mutex_);
+  return num_sessions_;
+}
+
+int SessionPool::num_acquired() const {
+  std::lock_guard<std::mutex> lock(mutex_);
+  return num_acquired_;
+}
+
+}  // namespace ppspeech
@@ -0,0 +1,76 @@
+// Copyright (c) 2022 PaddlePaddle Authors. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#pragma once
+
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include "decoder/asr_session.h"
+#include "utils/utils.h"
+
+namespace ppspeech {
+
+// SessionPool hands out AsrSessions that were used before and Reset(), so
+// a new stream does not build its feature pipeline (fbank tables, cmvn) and
+// decoder (model copy, searcher) again and the buffers grown by the former
+// streams are reused.
+//
+// A session goes back to the pool when its last reference is released, e.g.
+// by the SessionEngine once it is finished and by the rescoring executor
+// once its last segment is rescored. The pool must outlive its sessions.
+//
+//   SessionPool pool(feature_config, resource, opts, num_streams);
+//   std::shared_ptr<AsrSession> session = pool.Acquire(key);
+//   engine.AddSession(session);
+//   ...
+//   session.reset();
+class SessionPool {
+ public:
+  // num_sessions are built at once, more are built on demand
+  SessionPool(const FeaturePipelineConfig& feature_config,
+              std::shared_ptr<DecodeResource> resource,
+              const DecodeOptions& opts,
+              int num_sessions = 0,
+              bool continuous_decoding = false);
+  ~SessionPool();
+
+  std::shared_ptr<AsrSession> Acquire(const std::string& key);
+
+  int num_idle() const;
+  // sessions built so far, idle or not
+  int num_sessions() const;
+  int num_acquired() const;
+
+ private:
+  std::unique_ptr<AsrSession> NewSession() const;
+  void Release(AsrSession* session);
+
+  const FeaturePipelineConfig& feature_config_;
+  std::shared_ptr<DecodeResource> resource_;
+  const DecodeOptions& opts_;
+  bool continuous_decoding_;
+
+  mutable std::mutex mutex_;
+  std::vector<std::unique_ptr<AsrSession>> idle_;
+  int num_sessions_ = 0;
+  int num_acquired_ = 0;
+
+ public:
+  DISALLOW_COPY_AND_ASSIGN(SessionPool);
+};
+
+}  // namespace ppspeech
@@ -0,0 +1,284 @@
+// Copyright (c) 2022 PaddlePaddle Authors. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "decoder/synthetic_asr_model.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstring>
+
+#include "decoder/decode_latency.h"
+#include "utils/log.h"
+#include "utils/tracer.h"
+
+namespace ppspeech {
+
+namespace {
+
+// splitmix64, a seed per frame is cheap
+uint64_t NextRandom(uint64_t* state) {
+  uint64_t z = (*state += 0x9e3779b97f4a7c15ULL);
+  z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+  z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+  return z ^ (z >> 31);
+}
+
+// in [0, 1)
+float Uniform(uint64_t* state) {
+  return (NextRandom(state) >> 40) * (1.0f / (1 << 24));
+}
+
+// the unit of the simulated compute, a 32x32 by 32x32 GEMM
+const int kGemmDim = 32;
+
+float Gemm(int64_t num_gemms) {
+  float a[kGemmDim * kGemmDim], b[kGemmDim * kGemmDim], c[kGemmDim * kGemmDim];
+  std::fill(a, a + kGemmDim * kGemmDim, 1e-3f);
+  std::fill(b, b + kGemmDim * kGemmDim, 1e-3f);
+  std::fill(c, c + kGemmDim * kGemmDim, 0.0f);
+  for (int64_t n = 0; n < num_gemms; ++n) {
+    for (int i = 0; i < kGemmDim; ++i) {
+      for (int k = 0; k < kGemmDim; ++k) {
+        float a_ik = a[i * kGemmDim + k];
+        for (int j = 0; j < kGemmDim; ++j) {
+          c[i * kGemmDim + j] += a_ik * b[k * kGemmDim + j];
+        }
+      }
+    }
+  }
+  return c[0];
+}
+
+// keeps the compiler from dropping the compute
+volatile float g_sink = 0.0f;
+
+// the log prob of token at position of a hyp by the attention decoder
+float TokenLogp(int token, int position, uint64_t seed) {
+  uint64_t state = seed ^ (static_cast<uint64_t>(token) << 32) ^ position;
+  return std::log(0.5f + 0.5f * Uniform(&state));
+}
+
+// the dims of a conformer, for the memory usage
+const int kNumLayers = 12;
+const int kEncoderDim = 256;
+const int kCnnCacheFrames = 14;
+
+}  // namespace
+
+SyntheticAsrModel::SyntheticAsrModel(const SyntheticModelOptions& opts)
+    : opts_(opts) {
+  CHECK_GE(opts_.vocab_size, 4);
+  CHECK_GT(opts_.subsampling_rate, 0);
+  right_context_ = opts_.right_context;
+  subsampling_rate_ = opts_.subsampling_rate;
+  sos_ = opts_.vocab_size - 1;
+  eos_ = opts_.vocab_size - 1;
+  is_bidecoder_ = opts_.is_bidecoder;
+}
+
+double SyntheticAsrModel::GemmsPerMicrosecond() {
+  static const double gemms_per_us = []() {
+    const int64_t num_gemms = 2000;
+    g_sink = Gemm(num_gemms / 10);
+    auto start = std::chrono::steady_clock::now();
+    g_sink = Gemm(num_gemms);
+    double us = std::chrono::duration<double, std::micro>(
+                    std::chrono::steady_clock::now() - start)
+                    .count();
+    double rate = num_gemms / std::max(us, 1.0);
+    LOG(INFO) << "Synthetic model compute: " << rate << " gemms per us";
+    return rate;
+  }();
+  return gemms_per_us;
+}
+
+std::shared_ptr<fst::SymbolTable> SyntheticAsrModel::MakeUnitTable(
+    int vocab_size) {
+  auto table = std::make_shared<fst::SymbolTable>("synthetic");
+  table->AddSymbol("<blank>", 0);
+  table->AddSymbol("<unk>", 1);
+  for (int id = 2; id < vocab_size - 1; ++id) {
+    // utf-8 of the cjk unified ideographs from U+4E00, 3 bytes each
+    int code = 0x4E00 + (id - 2) % 0x5200;
+    std::string unit;
+    unit.push_back(static_cast<char>(0xE0 | (code >> 12)));
+    unit.push_back(static_cast<char>(0x80 | ((code >> 6) & 0x3F)));
+    unit.push_back(static_cast<char>(0x80 | (code & 0x3F)));
+    if (id - 2 >= 0x5200) unit += std::to_string(id);
+    table->AddSymbol(unit, id);
+  }
+  table->AddSymbol("<sos/eos>", vocab_size - 1);
+  return table;
+}
+
+void SyntheticAsrModel::Reset() {
+  offset_ = 0;
+  cached_feats_.clear();
+  last_token_ = 0;
+}
+
+std::shared_ptr<AsrModelItf> SyntheticAsrModel::Copy() const {
+  auto asr_model = std::make_shared<SyntheticAsrModel>(*this);
+  asr_model->Reset();
+  return asr_model;
+}
+
+std::shared_ptr<AsrModelItf> SyntheticAsrModel::CopyForRescoring() const {
+  return std::make_shared<SyntheticAsrModel>(*this);
+}
+
+void SyntheticAsrModel::GetMemoryUsage(MemoryUsage* usage) const {
+  const int64_t frame_bytes = kEncoderDim * sizeof(float);
+  int64_t cached_frames = offset_;
+  if (num_left_chunks_ >= 0 && chunk_size_ > 0) {
+    cached_frames = std::min<int64_t>(offset_, num_left_chunks_ * chunk_size_);
+  }
+  // keys and values of each layer
+  usage->att_cache = kNumLayers * 2 * cached_frames * frame_bytes;
+  usage->cnn_cache = kNumLayers * kCnnCacheFrames * frame_bytes;
+  usage->encoder_outs = offset_ * frame_bytes;
+}
+
+bool SyntheticAsrModel::SaveState(BinaryWriter* writer) const {
+  AsrModelItf::SaveState(writer);
+  writer->Write(last_token_);
+  return true;
+}
+
+bool SyntheticAsrModel::LoadState(BinaryReader* reader) {
+  return AsrModelItf::LoadState(reader) && reader->Read(&last_token_);
+}
+
+void SyntheticAsrModel::Compute(double us) const {
+  if (us <= 0) return;
+  g_sink = Gemm(std::llround(us * GemmsPerMicrosecond()));
+}
+
+void SyntheticAsrModel::FillFrame(uint64_t* rng,
+                                  int token,
+                                  std::vector<float>* logp) const {
+  const int vocab_size = opts_.vocab_size;
+  // most frames are confident, some are ambiguous
+  float peak_prob = Uniform(rng) < 0.8f ? 0.9f + 0.09f * Uniform(rng)
+                                        : 0.3f + 0.5f * Uniform(rng);
+  // below 0.5% of the mass all together
+  const float floor_prob = std::min(1e-6f, 0.005f / vocab_size);
+  const float log_floor = std::log(floor_prob);
+  logp->assign(vocab_size, log_floor);
+
+  // the probs of the ids added to are linear, i.e. positive, until all
+  // the mass is spread
+  int ids[5];
+  int num_ids = 0;
+  auto add = [logp, floor_prob, &ids, &num_ids](int id, float prob) {
+    float& value = (*logp)[id];
+    if (value < 0) value = floor_prob;
+    value += prob;
+    ids[num_ids++] = id;
+  };
+  float rest = 1.0f - peak_prob - floor_prob * vocab_size;
+  const int num_competitors = 4;
+  for (int i = 0; i < num_competitors; ++i) {
+    int id = i == 0 && token != 0 ? 0 : 2 + NextRandom(rng) % (vocab_size - 3);
+    float share = i + 1 < num_competitors ? rest * 0.5f : rest;
+    add(id, share);
+    rest -= share;
+  }
+  add(token, peak_prob);
+  for (int i = 0; i < num_ids; ++i) {
+    float& value = (*logp)[ids[i]];
+    if (value > 0) value = std::log(value);
+  }
+}
+
+void SyntheticAsrModel::ForwardEncoderChunkImpl(
+    const std::vector<std::vector<float>>& chunk_feats,
+    std::vector<std::vector<float>>* ctc_probs) {
+  TRACE_SCOPE("SyntheticAsrModel::ForwardEncoderChunk");
+  int num_frames = cached_feats_.size() + chunk_feats.size();
+  int num_out = (num_frames - context()) / subsampling_rate_ + 1;
+  {
+    LatencyStats::ScopedTimer stage(&DecodeLatency(), kStageEncoder);
+    Compute(opts_.encoder_us_per_frame * num_out);
+  }
+
+  LatencyStats::ScopedTimer stage(&DecodeLatency(), kStageCtc);
+  // the features seed the posteriors, as the audio drives a model
+  uint64_t seed = opts_.seed ^ 0xcbf29ce484222325ULL;
+  for (const auto& feat : chunk_feats) {
+    for (float value : feat) {
+      uint32_t bits = 0;
+      std::memcpy(&bits, &value, sizeof(bits));
+      seed = (seed ^ bits) * 0x100000001b3ULL;
+    }
+  }
+  // A non-blank frame after a blank one starts a new token, after a
+  // non-blank one it does with new_token_prob, so new tokens come at
+  // token_rate for 10ms feature frames, if the blanks allow it.
+  float non_blank = 1.0f - opts_.blank_ratio;
+  float tokens_per_frame = opts_.token_rate * subsampling_rate_ * 0.01f;
+  float new_token_prob = 1.0f;
+  if (non_blank > 0) {
+    new_token_prob = (tokens_per_frame / non_blank - opts_.blank_ratio) /
+                     non_blank;
+    new_token_prob = std::max(0.0f, std::min(new_token_prob, 1.0f));
+  }
+
+  ctc_probs->resize(num_out);
+  for (int t = 0; t < num_out; ++t) {
+    uint64_t rng = seed ^ (static_cast<uint64_t>(offset_ + t) << 20);
+    int token = 0;
+    if (Uniform(&rng) < non_blank) {
+      if (last_token_ != 0 && Uniform(&rng) >= new_token_prob) {
+        token = last_token_;
+      } else {
+        token = 2 + NextRandom(&rng) % (opts_.vocab_size - 3);
+      }
+    }
+    FillFrame(&rng, token, &(*ctc_probs)[t]);
+    last_token_ = token;
+  }
+  offset_ += num_out;
+}
+
+void SyntheticAsrModel::AttentionRescoring(
+    const std::vector<std::vector<int>>& hyps,
+    float reverse_weight,
+    std::vector<float>* rescoring_score) {
+  TRACE_SCOPE("SyntheticAsrModel::AttentionRescoring");
+  LatencyStats::ScopedTimer stage(&DecodeLatency(), kStageRescoring);
+  bool reverse = is_bidecoder_ && reverse_weight > 0;
+  int64_t num_tokens = 0;
+  for (const auto& hyp : hyps) num_tokens += hyp.size() + 1;
+  Compute(opts_.decoder_us_per_token * num_tokens * (reverse ? 2 : 1));
+
+  rescoring_score->resize(hyps.size());
+  for (size_t i = 0; i < hyps.size(); ++i) {
+    const std::vector<int>& hyp = hyps[i];
+    int len = hyp.size();
+    float score = TokenLogp(eos_, len, opts_.seed);
+    for (int j = 0; j < len; ++j) score += TokenLogp(hyp[j], j, opts_.seed);
+    if (reverse) {
+      float r_score = TokenLogp(eos_, len, ~opts_.seed);
+      for (int j = 0; j < len; ++j) {
+        r_score += TokenLogp(hyp[j], len - 1 - j, ~opts_.seed);
+      }
+      score = score * (1 - reverse_weight) + r_score * reverse_weight;
+    }
+    (*rescoring_score)[i] = score;
+  }
+}
+
+}  // namespace ppspeech
@@ -0,0 +1,103 @@
+// Copyright (c) 2022 PaddlePaddle Authors. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#pragma once
+
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "decoder/asr_itf.h"
+#include "fst/symbol-table.h"
+
+namespace ppspeech {
+
+struct SyntheticModelOptions {
+  // ids are blank 0, <unk> 1, tokens and sos/eos vocab_size - 1
+  int vocab_size = 5537;
+  // frames peaking on blank
+  float blank_ratio = 0.7f;
+  // new tokens per second of audio, the other non-blank frames repeat the
+  // token of the frame before. At least the non-blank frames after a blank
+  // one are new tokens, i.e. (1 - blank_ratio) * blank_ratio per frame.
+  float token_rate = 4.0f;
+  // a conformer with conv2d subsampling by 4 over 10ms frames
+  int subsampling_rate = 4;
+  int right_context = 6;
+  bool is_bidecoder = true;
+  // simulated compute of the encoder per output frame and of the
+  // attention decoder per rescored token, by a calibrated GEMM
+  float encoder_us_per_frame = 0.0f;
+  float decoder_us_per_token = 0.0f;
+  uint64_t seed = 0;
+};
+
+// An AsrModelItf without a model: deterministic CTC posteriors which look
+// like the output of a streaming conformer, and a busy GEMM in place of the
+// compute of the encoder and of the attention decoder. So the runtime
+// around the model, i.e. the frontend, queueing, search, endpointing,
+// rescoring and threading, is load tested without Paddle nor a model.
+//
+// The posteriors of a frame depend on the features of its chunk and on
+// its offset, so a stream decodes the same on every run and on restore
+// from a snapshot. The compute is a number of GEMMs calibrated once per
+// process, so it slows down with the cpu contention as a model does.
+class SyntheticAsrModel : public AsrModelItf {
+ public:
+  explicit SyntheticAsrModel(const SyntheticModelOptions& opts);
+
+  void Reset() override;
+
+  void AttentionRescoring(const std::vector<std::vector<int>>& hyps,
+                          float reverse_weight,
+                          std::vector<float>* rescoring_score) override;
+
+  std::shared_ptr<AsrModelItf> Copy() const override;
+  // the offset stands for the encoder outputs
+  std::shared_ptr<AsrModelItf> CopyForRescoring() const override;
+
+  // the caches and encoder outs a conformer of 12 layers of 256 dims would
+  // hold
+  void GetMemoryUsage(MemoryUsage* usage) const override;
+
+  bool SaveState(BinaryWriter* writer) const override;
+  bool LoadState(BinaryReader* reader) override;
+
+  const SyntheticModelOptions& options() const { return opts_; }
+
+  // GEMMs run per us of the simulated compute, measured on the first call
+  static double GemmsPerMicrosecond();
+
+  // Units named by a CJK char each, so the results read like those of a
+  // Mandarin model: <blank>, <unk>, vocab_size - 3 chars and <sos/eos>.
+  static std::shared_ptr<fst::SymbolTable> MakeUnitTable(int vocab_size);
+
+ protected:
+  void ForwardEncoderChunkImpl(
+      const std::vector<std::vector<float>>& chunk_feats,
+      std::vector<std::vector<float>>* ctc_probs) override;
+
+ private:
+  // the ctc log probs of frame, peaking on token
+  void FillFrame(uint64_t* rng, int token, std::vector<float>* logp) const;
+  // busy for us of compute
+  void Compute(double us) const;
+
+  SyntheticModelOptions opts_;
+  // token of the last frame, blank 0 for none
+  int last_token_ = 0;
+};
+
+}  // namespace ppspeech
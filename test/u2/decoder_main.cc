@@ -12,19 +12,31 @@
 // See the License for the specific language governing permissions and
 // limitations under the License.
 
+#include <algorithm>
+#include <chrono>
+#include <functional>
 #include <iomanip>
+#include <memory>
+#include <sstream>
 #include <thread>
+#include <unordered_map>
 #include <utility>
 
+#include "decoder/decode_latency.h"
 #include "decoder/params.h"
+#include "decoder/session_engine.h"
+#include "decoder/session_pool.h"
 #include "frontend/wav.h"
+#include "utils/cpu_affinity.h"
 #include "utils/flags.h"
 #include "utils/string.h"
 #include "utils/thread_pool.h"
 #include "utils/timer.h"
+#include "utils/tracer.h"
 #include "utils/utils.h"
 
-// profiler
+// the profiler of paddle, for the ops of the model, see --trace_file for
+// the decoder
 #ifdef USE_PROFILING
 #include "paddle/fluid/platform/profiler.h"
 #include "paddle/fluid/platform/profiler/profiler.h"
@@ -33,9 +45,6 @@ using paddle::platform::EnableHostEventRecorder;
 using paddle::platform::Profiler;
 using paddle::platform::ProfilerOptions;
 using paddle::platform::ProfilerResult;
-using paddle::platform::RecordEvent;
-using paddle::platform::RecordInstantEvent;
-using paddle::platform::TracerEventType;
 #endif
 
 DEFINE_bool(simulate_streaming, false, "simulate streaming input");
@@ -45,52 +54,337 @@ DEFINE_string(wav_scp, "", "input wav scp");
 DEFINE_string(result, "", "result output file");
 DEFINE_bool(continuous_decoding, false, "continuous decoding mode");
 DEFINE_int32(thread_num, 1, "num of decode thread");
+DEFINE_bool(session_engine,
+            false,
+            "decode by the session engine, thread_num workers serve all "
+            "the concurrent streams");
+DEFINE_int32(num_streams, 64, "num of concurrent streams of session engine");
+DEFINE_int32(packet_ms, 100, "audio packet size of session engine streams");
+DEFINE_bool(async_rescoring,
+            false,
+            "rescore on a dedicated executor in session engine mode");
+DEFINE_int32(rescoring_threads, 1, "num of threads of async rescoring");
+DEFINE_int32(rescoring_batch_size,
+             8,
+             "max num of sessions rescored by one call in async rescoring");
+DEFINE_int32(rescoring_max_wait_ms,
+             0,
+             "max time a request waits to fill the async rescoring batch");
+DEFINE_int32(max_memory_mb,
+             0,
+             "memory limit of the session engine streams, idle streams are "
+             "finished early above it, 0 for no limit");
+DEFINE_bool(eval_frame_reduction,
+            false,
+            "rescore each utterance with all the encoder frames and with the "
+            "blank frames dropped, report the error rates against ref_text "
+            "and the rescoring time of both");
+DEFINE_string(ref_text, "", "reference text, utt and text in each line");
+DEFINE_int32(report_first_utts,
+             0,
+             "report the latency of the first n utterances, decoded cold "
+             "unless the model is warmed up, against the later ones");
+DEFINE_bool(pin_workers,
+            false,
+            "pin each decode worker and its intra-op threads to num_threads "
+            "cpus of its own");
+DEFINE_string(sweep_threads,
+              "",
+              "comma separated workers x intra-op threads, e.g. 8x1,4x2, "
+              "decode all the waves with each and report the throughput "
+              "instead of the results");
+DEFINE_string(latency_report,
+              "",
+              "json file of the p50/p90/p99/max latency of each decoding "
+              "stage, and of the first partial and the final results, in us");
+DEFINE_string(trace_file,
+              "",
+              "chrome trace json file of the decoding scopes, viewed by "
+              "chrome://tracing or perfetto");
+DEFINE_int32(trace_events_per_thread,
+             1 << 16,
+             "the last events kept of each thread in the trace, a power of 2");
+DEFINE_bool(test_snapshot,
+            false,
+            "decode each utterance packet by packet twice, the second time "
+            "migrated to another session by a snapshot after each packet, "
+            "report the results that differ and the snapshot size and time");
 
 std::shared_ptr<ppspeech::DecodeOptions> g_decode_config;
 std::shared_ptr<ppspeech::FeaturePipelineConfig> g_feature_config;
 std::shared_ptr<ppspeech::DecodeResource> g_decode_resource;
+std::unique_ptr<ppspeech::SessionPool> g_session_pool;
 
 std::ofstream g_result;
 std::mutex g_mutex;
 int g_total_waves_dur = 0;
 int g_total_decode_time = 0;
 
+// --eval_frame_reduction
+std::unordered_map<std::string, std::string> g_ref_texts;
+struct FrameReductionEval {
+  std::string full_result;
+  std::string reduced_result;
+  int64_t full_us = 0;
+  int64_t reduced_us = 0;
+};
+FrameReductionEval g_eval_total;
+int g_eval_num_utts = 0;
+int g_eval_num_changed = 0;
+int g_eval_num_ref_chars = 0;
+int g_eval_full_errors = 0;
+int g_eval_reduced_errors = 0;
+
+// --report_first_utts, in the order the utterances are done
+struct UttLatency {
+  int64_t first_chunk_us = 0;
+  int decode_time = 0;
+  int wave_dur = 0;
+};
+std::vector<UttLatency> g_utt_latencies;
+
+// --latency_report, per utterance in us, -1 if not reached
+struct UttResultLatency {
+  std::string key;
+  int64_t first_partial_us = -1;
+  int64_t final_us = -1;
+};
+std::vector<UttResultLatency> g_result_latencies;
+
+// --test_snapshot
+int g_snapshot_num_utts = 0;
+int g_snapshot_num_mismatches = 0;
+int64_t g_snapshot_num = 0;
+int64_t g_snapshot_bytes = 0;
+int64_t g_snapshot_save_us = 0;
+int64_t g_snapshot_load_us = 0;
+
+// Rescoring, twice in --eval_frame_reduction, the result with the blank
+// frames dropped is kept. The full rescoring it is compared against is left
+// out of the stats, its time in us is returned to be left out of the
+// latencies too.
+int64_t Rescoring(ppspeech::AsrDecoder* decoder, FrameReductionEval* eval) {
+  if (!FLAGS_eval_frame_reduction) {
+    decoder->Rescoring();
+    return 0;
+  }
+  int64_t compared_us = 0;
+  ppspeech::FrameReductionOptions opts = g_decode_config->frame_reduction;
+  for (bool enable : {false, true}) {
+    opts.enable = enable;
+    decoder->set_frame_reduction(opts);
+    decoder->set_record_stats(enable);
+    auto start = std::chrono::steady_clock::now();
+    decoder->Rescoring();
+    int64_t us = std::chrono::duration_cast<std::chrono::microseconds>(
+                     std::chrono::steady_clock::now() - start)
+                     .count();
+    std::string sentence =
+        decoder->DecodedSomething() ? decoder->result()[0].sentence : "";
+    if (enable) {
+      eval->reduced_us += us;
+      eval->reduced_result.append(sentence);
+    } else {
+      compared_us = us;
+      eval->full_us += us;
+      eval->full_result.append(sentence);
+    }
+  }
+  return compared_us;
+}
+
+// chars without blanks, the error rate is a cer
+std::vector<std::string> EvalChars(const std::string& text) {
+  std::vector<std::string> chars;
+  ppspeech::SplitUTF8StringToChars(text, &chars);
+  chars.erase(std::remove(chars.begin(), chars.end(), " "), chars.end());
+  return chars;
+}
+
+void AddFrameReductionEval(const std::string& key,
+                           const FrameReductionEval& eval) {
+  std::lock_guard<std::mutex> lock(g_mutex);
+  ++g_eval_num_utts;
+  g_eval_total.full_us += eval.full_us;
+  g_eval_total.reduced_us += eval.reduced_us;
+  if (eval.full_result != eval.reduced_result) {
+    ++g_eval_num_changed;
+    LOG(INFO) << key << ": frame reduction changed " << eval.full_result
+              << " to " << eval.reduced_result;
+  }
+  auto it = g_ref_texts.find(key);
+  if (it == g_ref_texts.end()) return;
+  std::vector<std::string> ref = EvalChars(it->second);
+  g_eval_num_ref_chars += ref.size();
+  g_eval_full_errors +=
+      ppspeech::EditDistance(ref, EvalChars(eval.full_result));
+  g_eval_reduced_errors +=
+      ppspeech::EditDistance(ref, EvalChars(eval.reduced_result));
+}
+
+void ReportFrameReductionEval() {
+  LOG(INFO) << "Frame reduction eval: " << g_eval_num_utts << " utts, "
+            << g_eval_num_changed << " results changed.";
+  if (g_eval_num_ref_chars > 0) {
+    LOG(INFO) << "CER: all frames " << std::setprecision(4)
+              << 100.0 * g_eval_full_errors / g_eval_num_ref_chars
+              << "%, blank frames dropped "
+              << 100.0 * g_eval_reduced_errors / g_eval_num_ref_chars
+              << "% of " << g_eval_num_ref_chars << " chars.";
+  }
+  LOG(INFO) << "Rescoring time: all frames "
+            << g_eval_total.full_us / 1000.0 << "ms, blank frames dropped "
+            << g_eval_total.reduced_us / 1000.0 << "ms ("
+            << 100.0 * (g_eval_total.reduced_us - g_eval_total.full_us) /
+                   std::max<int64_t>(g_eval_total.full_us, 1)
+            << "%).";
+}
+
+int64_t MicrosSince(std::chrono::steady_clock::time_point start) {
+  return std::chrono::duration_cast<std::chrono::microseconds>(
+             std::chrono::steady_clock::now() - start)
+      .count();
+}
+
+void AddUttLatency(const UttLatency& latency) {
+  std::lock_guard<std::mutex> lock(g_mutex);
+  g_utt_latencies.push_back(latency);
+}
+
+void ReportUttLatencies(const char* name, size_t begin, size_t end) {
+  if (begin >= end) return;
+  int64_t first_chunk_us = 0, max_first_chunk_us = 0;
+  int64_t decode_time = 0, wave_dur = 0;
+  for (size_t i = begin; i < end; ++i) {
+    const UttLatency& latency = g_utt_latencies[i];
+    first_chunk_us += latency.first_chunk_us;
+    max_first_chunk_us = std::max(max_first_chunk_us, latency.first_chunk_us);
+    decode_time += latency.decode_time;
+    wave_dur += latency.wave_dur;
+  }
+  LOG(INFO) << name << " " << end - begin << " utts: first chunk "
+            << first_chunk_us / 1000.0 / (end - begin) << "ms on average, "
+            << max_first_chunk_us / 1000.0 << "ms max, RTF "
+            << std::setprecision(4)
+            << static_cast<float>(decode_time) /
+                   std::max<int64_t>(wave_dur, 1);
+}
+
+void AddResultLatency(const std::string& key,
+                      int64_t first_partial_us,
+                      int64_t final_us) {
+  if (FLAGS_latency_report.empty()) return;
+  UttResultLatency latency;
+  latency.key = key;
+  latency.first_partial_us = first_partial_us;
+  latency.final_us = final_us;
+  std::lock_guard<std::mutex> lock(g_mutex);
+  g_result_latencies.push_back(latency);
+}
+
+void WriteLatencyReport() {
+  std::ofstream report(FLAGS_latency_report);
+  report << "{\n\"stages\": " << ppspeech::DecodeLatency().ToJson()
+         << ",\n\"utts\": [";
+  for (size_t i = 0; i < g_result_latencies.size(); ++i) {
+    const UttResultLatency& latency = g_result_latencies[i];
+    std::string key;
+    for (char c : latency.key) {
+      if (c == '"' || c == '\\') key.push_back('\\');
+      key.push_back(c);
+    }
+    report << (i == 0 ? "" : ",") << "\n  {\"key\": \"" << key
+           << "\", \"first_partial_us\": " << latency.first_partial_us
+           << ", \"final_us\": " << latency.final_us << "}";
+  }
+  report << "\n]\n}\n";
+  LOG(INFO) << "Stage latencies written to " << FLAGS_latency_report;
+}
+
+void WriteResult(const std::string& key,
+                 const std::string& final_result,
+                 const std::vector<ppspeech::DecodeResult>& results,
+                 int wave_dur,
+                 int decode_time) {
+  std::lock_guard<std::mutex> lock(g_mutex);
+  g_total_waves_dur += wave_dur;
+  g_total_decode_time += decode_time;
+  if (!FLAGS_sweep_threads.empty()) return;
+
+  std::ostream& buffer = FLAGS_result.empty() ? std::cout : g_result;
+  if (!FLAGS_output_nbest) {
+    buffer << key << " " << final_result << std::endl;
+  } else {
+    buffer << "wav " << key << std::endl;
+    for (auto& r : results) {
+      if (r.sentence.empty()) continue;
+      buffer << "candidate " << r.score << " " << r.sentence << std::endl;
+    }
+  }
+}
+
 void decode(std::pair<std::string, std::string> wav) {
   ppspeech::WavReader wav_reader(wav.second);
   int num_samples = wav_reader.num_samples();
   CHECK_EQ(wav_reader.sample_rate(), FLAGS_sample_rate);
 
-  auto feature_pipeline =
-      std::make_shared<ppspeech::FeaturePipeline>(*g_feature_config);
-  feature_pipeline->AcceptWaveform(wav_reader.data(), num_samples);
+  // the session is driven directly, it goes back to the pool at return
+  std::shared_ptr<ppspeech::AsrSession> session =
+      g_session_pool->Acquire(wav.first);
+  ppspeech::Tracer& tracer = ppspeech::GlobalTracer();
+  if (tracer.enabled()) tracer.SetIdName(session->trace_id(), wav.first);
+  TRACE_SCOPE_ID("decode", session->trace_id());
+  ppspeech::FeaturePipeline* feature_pipeline = session->feature_pipeline();
+  auto decode_start = std::chrono::steady_clock::now();
+  {
+    ppspeech::LatencyStats::ScopedTimer stage(&ppspeech::DecodeLatency(),
+                                              ppspeech::kStageFeature);
+    feature_pipeline->AcceptWaveform(wav_reader.data(), num_samples);
+  }
   feature_pipeline->SetInputFinished();
   LOG(INFO) << "num frames " << feature_pipeline->num_frames();
 
-  ppspeech::AsrDecoder decoder(
-      feature_pipeline, g_decode_resource, *g_decode_config);
+  ppspeech::AsrDecoder& decoder = *session->decoder();
 
   int wave_dur = static_cast<int>(static_cast<float>(num_samples) /
                                   wav_reader.sample_rate() * 1000);
   int decode_time = 0;
+  UttLatency latency;
+  bool first_chunk = true;
+  int64_t first_partial_us = -1, final_us = -1;
   std::string final_result;
+  FrameReductionEval eval;
   while (true) {
     ppspeech::Timer timer;
+    auto start = std::chrono::steady_clock::now();
     ppspeech::DecodeState state = decoder.Decode();
+    if (first_chunk) latency.first_chunk_us = MicrosSince(start);
+    first_chunk = false;
 
+    int64_t compared_us = 0;
     if (state == ppspeech::DecodeState::kEndFeats) {
-      decoder.Rescoring();
+      compared_us = Rescoring(&decoder, &eval);
+      // all the audio is fed at once, the final latency is taken from the
+      // last chunk
+      final_us = MicrosSince(start) - compared_us;
+      ppspeech::DecodeLatency().Record(ppspeech::kStageFinal, final_us);
     }
 
-    int chunk_decode_time = timer.Elapsed();
+    int chunk_decode_time = timer.Elapsed() - compared_us / 1000;
     decode_time += chunk_decode_time;
     if (decoder.DecodedSomething()) {
       LOG(INFO) << "Partial result: " << decoder.result()[0].sentence;
+      if (first_partial_us < 0) {
+        first_partial_us = MicrosSince(decode_start);
+        ppspeech::DecodeLatency().Record(ppspeech::kStageFirstPartial,
+                                         first_partial_us);
+      }
     }
 
     if (FLAGS_continuous_decoding &&
         state == ppspeech::DecodeState::kEndpoint) {
       if (decoder.DecodedSomething()) {
-        decoder.Rescoring();
+        Rescoring(&decoder, &eval);
         LOG(INFO) << "Final result (continuous decoding): "
                   << decoder.result()[0].sentence;
         final_result.append(decoder.result()[0].sentence);
@@ -123,22 +417,268 @@ void decode(std::pair<std::string, std::string> wav) {
   LOG(INFO) << "Decoded " << wave_dur << "ms audio taken " << decode_time
             << "ms.";
 
-  g_mutex.lock();
-  std::ostream& buffer = FLAGS_result.empty() ? std::cout : g_result;
-  if (!FLAGS_output_nbest) {
-    buffer << wav.first << " " << final_result << std::endl;
+  WriteResult(
+      wav.first, final_result, decoder.result(), wave_dur, decode_time);
+  if (FLAGS_eval_frame_reduction) AddFrameReductionEval(wav.first, eval);
+  AddResultLatency(wav.first, first_partial_us, final_us);
+  if (FLAGS_report_first_utts > 0) {
+    latency.decode_time = decode_time;
+    latency.wave_dur = wave_dur;
+    AddUttLatency(latency);
+  }
+}
+
+// Feed the wav packet by packet and step the session after each. With
+// migrate, the stream goes on in a new session from a snapshot of the
+// former one after each packet. Returns the session holding the result.
+std::shared_ptr<ppspeech::AsrSession> StepByPackets(
+    const std::string& key,
+    const ppspeech::WavReader& wav_reader,
+    bool migrate) {
+  const int packet_samples = FLAGS_sample_rate / 1000 * FLAGS_packet_ms;
+  int num_samples = wav_reader.num_samples();
+  std::shared_ptr<ppspeech::AsrSession> session =
+      g_session_pool->Acquire(key);
+  std::string snapshot;
+  for (int offset = 0; offset < num_samples; offset += packet_samples) {
+    int size = std::min(packet_samples, num_samples - offset);
+    session->AcceptWaveform(wav_reader.data() + offset, size);
+    if (offset + size >= num_samples) session->SetInputFinished();
+    ppspeech::DecodeState state = ppspeech::DecodeState::kEndpoint;
+    while (state != ppspeech::DecodeState::kWaitFeats &&
+           state != ppspeech::DecodeState::kEndFeats) {
+      state = session->Step();
+    }
+    if (!migrate || state == ppspeech::DecodeState::kEndFeats) continue;
+
+    auto start = std::chrono::steady_clock::now();
+    CHECK(session->SaveState(&snapshot)) << key;
+    int64_t save_us = MicrosSince(start);
+    // acquired before the former session goes back to the pool
+    std::shared_ptr<ppspeech::AsrSession> next =
+        g_session_pool->Acquire(key);
+    start = std::chrono::steady_clock::now();
+    CHECK(next->LoadState(snapshot)) << key;
+    int64_t load_us = MicrosSince(start);
+    session = next;
+
+    std::lock_guard<std::mutex> lock(g_mutex);
+    ++g_snapshot_num;
+    g_snapshot_bytes += snapshot.size();
+    g_snapshot_save_us += save_us;
+    g_snapshot_load_us += load_us;
+  }
+  return session;
+}
+
+// --test_snapshot, the sessions rescore on this thread
+void TestSnapshot(std::pair<std::string, std::string> wav) {
+  ppspeech::WavReader wav_reader(wav.second);
+  CHECK_EQ(wav_reader.sample_rate(), FLAGS_sample_rate);
+  std::string expected =
+      StepByPackets(wav.first, wav_reader, false)->final_result();
+  std::shared_ptr<ppspeech::AsrSession> session =
+      StepByPackets(wav.first, wav_reader, true);
+  {
+    std::lock_guard<std::mutex> lock(g_mutex);
+    ++g_snapshot_num_utts;
+    if (session->final_result() != expected) {
+      ++g_snapshot_num_mismatches;
+      LOG(WARNING) << wav.first << ": migrated result "
+                   << session->final_result() << " differs from "
+                   << expected;
+    }
+  }
+  WriteResult(wav.first,
+              session->final_result(),
+              session->final_nbest(),
+              session->wave_dur(),
+              session->decode_time());
+}
+
+void ReportSnapshotTest() {
+  int64_t num = std::max<int64_t>(g_snapshot_num, 1);
+  LOG(INFO) << "Snapshot test: " << g_snapshot_num_utts << " utts, "
+            << g_snapshot_num_mismatches << " results differ after "
+            << g_snapshot_num << " migrations.";
+  LOG(INFO) << "Snapshot: " << g_snapshot_bytes / num << " bytes, save "
+            << g_snapshot_save_us / num << "us, load "
+            << g_snapshot_load_us / num << "us on average.";
+}
+
+// streams are fed packet by packet by this thread, in real time if
+// simulate_streaming, and decoded by the thread_num workers of the engine
+void DecodeBySessionEngine(
+    const std::vector<std::pair<std::string, std::string>>& waves,
+    int num_workers,
+    std::function<void(size_t)> worker_init) {
+  std::unique_ptr<ppspeech::RescoringExecutor> rescoring_executor;
+  if (FLAGS_async_rescoring) {
+    ppspeech::RescoringExecutorOptions opts;
+    opts.num_threads = FLAGS_rescoring_threads;
+    opts.max_batch_size = FLAGS_rescoring_batch_size;
+    opts.max_wait_ms = FLAGS_rescoring_max_wait_ms;
+    rescoring_executor.reset(new ppspeech::RescoringExecutor(opts));
+  }
+  ppspeech::SessionEngine engine(
+      num_workers, rescoring_executor.get(), std::move(worker_init));
+  engine.set_memory_limit(static_cast<int64_t>(FLAGS_max_memory_mb) << 20);
+  const int packet_samples = FLAGS_sample_rate / 1000 * FLAGS_packet_ms;
+
+  for (size_t begin = 0; begin < waves.size(); begin += FLAGS_num_streams) {
+    size_t end = std::min(waves.size(), begin + FLAGS_num_streams);
+    std::vector<std::unique_ptr<ppspeech::WavReader>> readers;
+    std::vector<std::shared_ptr<ppspeech::AsrSession>> sessions;
+    for (size_t i = begin; i < end; ++i) {
+      std::unique_ptr<ppspeech::WavReader> reader(
+          new ppspeech::WavReader(waves[i].second));
+      CHECK_EQ(reader->sample_rate(), FLAGS_sample_rate);
+      // a session never fed would never finish, WaitAll() would hang
+      if (reader->num_samples() == 0) {
+        LOG(WARNING) << waves[i].first << ": empty wav, skipped";
+        continue;
+      }
+      readers.push_back(std::move(reader));
+      std::shared_ptr<ppspeech::AsrSession> session =
+          g_session_pool->Acquire(waves[i].first);
+      session->set_partial_callback([](ppspeech::AsrSession* session) {
+        VLOG(1) << session->key()
+                << ": Partial result: " << session->result()[0].sentence;
+      });
+      session->set_final_callback([](ppspeech::AsrSession* session) {
+        LOG(INFO) << session->key()
+                  << ": Final result: " << session->final_result();
+        WriteResult(session->key(),
+                    session->final_result(),
+                    session->final_nbest(),
+                    session->wave_dur(),
+                    session->decode_time());
+        AddResultLatency(session->key(),
+                         session->first_partial_latency(),
+                         session->final_latency());
+      });
+      engine.AddSession(session);
+      sessions.push_back(session);
+    }
+
+    auto start = std::chrono::steady_clock::now();
+    for (int offset = 0, packet = 1;; offset += packet_samples, ++packet) {
+      bool fed = false;
+      for (size_t i = 0; i < sessions.size(); ++i) {
+        int num_samples = readers[i]->num_samples();
+        if (offset >= num_samples) continue;
+        int size = std::min(packet_samples, num_samples - offset);
+        sessions[i]->AcceptWaveform(readers[i]->data() + offset, size);
+        if (offset + size >= num_samples) sessions[i]->SetInputFinished();
+        fed = true;
+      }
+      if (!fed) break;
+      if (FLAGS_simulate_streaming) {
+        std::this_thread::sleep_until(
+            start + std::chrono::milliseconds(packet * FLAGS_packet_ms));
+      }
+    }
+    engine.WaitAll();
+  }
+
+  LOG(INFO) << "Session memory: peak " << (engine.peak_memory_bytes() >> 20)
+            << "MB, " << engine.num_evicted() << " streams evicted.";
+  if (rescoring_executor != nullptr) {
+    LOG(INFO) << "Async rescoring: " << rescoring_executor->num_requests()
+              << " requests in " << rescoring_executor->num_batches()
+              << " batches.";
+  }
+}
+
+// --pin_workers, each worker on cpus of its own for its intra-op threads
+std::function<void(size_t)> WorkerInit(int intra_op_threads) {
+  bool pin = FLAGS_pin_workers;
+  int cpus_per_worker = std::max(1, intra_op_threads);
+  return [pin, cpus_per_worker](size_t worker) {
+    ppspeech::Tracer::SetThreadName("worker " + std::to_string(worker));
+    if (!pin) return;
+    std::vector<int> cpus = ppspeech::WorkerCpus(worker, cpus_per_worker);
+    if (!ppspeech::PinCurrentThread(cpus)) {
+      LOG(WARNING) << "Failed to pin worker " << worker;
+      return;
+    }
+    VLOG(1) << "Worker " << worker << " pinned to cpus "
+            << cpus.front() << "..." << cpus.back();
+  };
+}
+
+void DecodeWaves(
+    const std::vector<std::pair<std::string, std::string>>& waves,
+    int num_workers,
+    int intra_op_threads) {
+  // the sessions copy the model with its threads
+  g_decode_resource->model->set_num_threads(intra_op_threads);
+  // a session per worker or stream, reused by the following utterances
+  int num_sessions = FLAGS_session_engine
+                         ? std::min<int>(FLAGS_num_streams, waves.size())
+                         : num_workers;
+  g_session_pool.reset(new ppspeech::SessionPool(*g_feature_config,
+                                                 g_decode_resource,
+                                                 *g_decode_config,
+                                                 num_sessions,
+                                                 FLAGS_continuous_decoding));
+
+  if (FLAGS_session_engine) {
+    DecodeBySessionEngine(waves, num_workers, WorkerInit(intra_op_threads));
   } else {
-    buffer << "wav " << wav.first << std::endl;
-    auto& results = decoder.result();
-    for (auto& r : results) {
-      if (r.sentence.empty()) continue;
-      buffer << "candidate " << r.score << " " << r.sentence << std::endl;
+    ThreadPool pool(num_workers, WorkerInit(intra_op_threads));
+    for (auto& wav : waves) {
+      if (FLAGS_test_snapshot) {
+        pool.enqueue(TestSnapshot, wav);
+      } else {
+        pool.enqueue(decode, wav);
+      }
     }
   }
+  LOG(INFO) << "Session pool: " << g_session_pool->num_sessions()
+            << " sessions for " << g_session_pool->num_acquired()
+            << " utterances.";
+  g_session_pool.reset();
+}
 
-  g_total_waves_dur += wave_dur;
-  g_total_decode_time += decode_time;
-  g_mutex.unlock();
+// --sweep_threads, the audio decoded per second of wall time by each
+// workers x intra-op threads
+void SweepThreads(
+    const std::vector<std::pair<std::string, std::string>>& waves) {
+  std::vector<std::string> configs;
+  ppspeech::SplitStringToVector(FLAGS_sweep_threads, ",", true, &configs);
+  std::vector<std::string> report;
+  for (const std::string& config : configs) {
+    std::vector<std::string> dims;
+    ppspeech::SplitStringToVector(config, "x", false, &dims);
+    CHECK_EQ(dims.size(), 2) << "bad sweep config " << config;
+    int num_workers = std::stoi(dims[0]);
+    int intra_op_threads = std::stoi(dims[1]);
+    CHECK_GT(num_workers, 0) << config;
+
+    {
+      std::lock_guard<std::mutex> lock(g_mutex);
+      g_total_waves_dur = 0;
+      g_total_decode_time = 0;
+    }
+    ppspeech::Timer timer;
+    DecodeWaves(waves, num_workers, intra_op_threads);
+    int wall_time = std::max(timer.Elapsed(), 1);
+
+    std::ostringstream line;
+    line << std::setw(3) << num_workers << " workers x " << std::setw(2)
+         << intra_op_threads << " threads: " << std::fixed
+         << std::setprecision(2)
+         << static_cast<float>(g_total_waves_dur) / wall_time
+         << "x realtime, RTF per stream " << std::setprecision(4)
+         << static_cast<float>(g_total_decode_time) /
+                std::max(g_total_waves_dur, 1);
+    LOG(INFO) << "Sweep " << line.str();
+    report.push_back(line.str());
+  }
+  LOG(INFO) << "Sweep of " << waves.size() << " utts on "
+            << ppspeech::AvailableCpus().size() << " cpus:";
+  for (const std::string& line : report) LOG(INFO) << line;
 }
 
 int main(int argc, char* argv[]) {
@@ -160,7 +700,7 @@ int main(int argc, char* argv[]) {
 
   g_decode_config = ppspeech::InitDecodeOptionsFromFlags();
   g_feature_config = ppspeech::InitFeaturePipelineConfigFromFlags();
-  g_decode_resource = ppspeech::InitDecodeResourceFromFlags();
+  g_decode_resource = ppspeech::InitDecodeResourceFromFlags(*g_decode_config);
 
   if (FLAGS_wav_path.empty() && FLAGS_wav_scp.empty()) {
     LOG(FATAL) << "Please provide the wave path or the wav scp.";
@@ -184,18 +724,56 @@ int main(int argc, char* argv[]) {
     g_result.open(FLAGS_result, std::ios::out);
   }
 
-  {
-    ThreadPool pool(FLAGS_thread_num);
-    for (auto& wav : waves) {
-      pool.enqueue(decode, wav);
+  CHECK(!FLAGS_test_snapshot || !FLAGS_session_engine)
+      << "test_snapshot is one by one";
+  CHECK(FLAGS_report_first_utts <= 0 || !FLAGS_session_engine)
+      << "report_first_utts is one by one";
+  if (FLAGS_eval_frame_reduction) {
+    CHECK(!FLAGS_session_engine) << "eval_frame_reduction is one by one";
+    if (!FLAGS_ref_text.empty()) {
+      std::ifstream ref_text(FLAGS_ref_text);
+      std::string line;
+      while (getline(ref_text, line)) {
+        std::vector<std::string> strs;
+        ppspeech::SplitString(line, &strs);
+        if (strs.empty()) continue;
+        g_ref_texts[strs[0]] = ppspeech::JoinString(
+            "", std::vector<std::string>(strs.begin() + 1, strs.end()));
+      }
     }
   }
-  // decode(waves[0]);
+
+  // after the warmup
+  ppspeech::DecodeLatency().set_enabled(!FLAGS_latency_report.empty());
+  if (!FLAGS_trace_file.empty()) {
+    ppspeech::GlobalTracer().Start(FLAGS_trace_events_per_thread);
+  }
+  if (FLAGS_sweep_threads.empty()) {
+    DecodeWaves(waves, FLAGS_thread_num, FLAGS_num_threads);
+  } else {
+    SweepThreads(waves);
+  }
 
   LOG(INFO) << "Total: decoded " << g_total_waves_dur << "ms audio taken "
             << g_total_decode_time << "ms.";
   LOG(INFO) << "RTF: " << std::setprecision(4)
             << static_cast<float>(g_total_decode_time) / g_total_waves_dur;
+  LOG(INFO) << ppspeech::RescoringGateStats::Global().Report();
+  if (FLAGS_eval_frame_reduction) ReportFrameReductionEval();
+  if (FLAGS_test_snapshot) ReportSnapshotTest();
+  if (FLAGS_report_first_utts > 0) {
+    size_t num_first =
+        std::min<size_t>(FLAGS_report_first_utts, g_utt_latencies.size());
+    ReportUttLatencies("First", 0, num_first);
+    ReportUttLatencies("Later", num_first, g_utt_latencies.size());
+  }
+  if (!FLAGS_latency_report.empty()) WriteLatencyReport();
+  if (!FLAGS_trace_file.empty()) {
+    ppspeech::GlobalTracer().Stop();
+    if (ppspeech::GlobalTracer().Dump(FLAGS_trace_file)) {
+      LOG(INFO) << "Trace written to " << FLAGS_trace_file;
+    }
+  }
 
   // profiler
 #ifdef USE_PROFILING
@@ -131,18 +131,29 @@ class Fbank {
     }
   }
 
-  // Compute fbank feat, return num frames
+  // number of frames Compute() returns for num_samples
+  int NumFrames(int num_samples) const {
+    if (num_samples < frame_length_) return 0;
+    return 1 + ((num_samples - frame_length_) / frame_shift_);
+  }
+
+  // Compute fbank feat, return num frames. The frames of feat are resized
+  // in place, so their buffers are reused when feat holds enough of them.
   int Compute(const std::vector<float>& wave,
               std::vector<std::vector<float>>* feat) {
-    int num_samples = wave.size();
-    if (num_samples < frame_length_) return 0;
-    int num_frames = 1 + ((num_samples - frame_length_) / frame_shift_);
+    int num_frames = NumFrames(wave.size());
+    if (num_frames == 0) return 0;
     feat->resize(num_frames);
-    std::vector<float> fft_real(fft_points_, 0), fft_img(fft_points_, 0);
-    std::vector<float> power(fft_points_ / 2);
+    std::vector<float>& fft_real = fft_real_;
+    std::vector<float>& fft_img = fft_img_;
+    std::vector<float>& power = power_;
+    std::vector<float>& data = frame_;
+    fft_real.resize(fft_points_);
+    fft_img.resize(fft_points_);
+    power.resize(fft_points_ / 2);
     for (int i = 0; i < num_frames; ++i) {
-      std::vector<float> data(wave.data() + i * frame_shift_,
-                              wave.data() + i * frame_shift_ + frame_length_);
+      data.assign(wave.data() + i * frame_shift_,
+                  wave.data() + i * frame_shift_ + frame_length_);
       // optional add noise
       if (dither_ != 0.0) {
         for (size_t j = 0; j < data.size(); ++j)
@@ -213,6 +224,9 @@ class Fbank {
   std::vector<int> bitrev_;
   // trigonometric function table
   std::vector<float> sintbl_;
+
+  // scratch of Compute(), kept over the calls
+  std::vector<float> fft_real_, fft_img_, power_, frame_;
 };
 
 }  // namespace ppspeech
\ No newline at end of file
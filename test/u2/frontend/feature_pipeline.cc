@@ -16,19 +16,15 @@
 #include <algorithm>
 #include <utility>
 
-#ifdef USE_PROFILING
-#include "paddle/fluid/platform/profiler.h"
-using paddle::platform::TracerEventType;
-using paddle::platform::RecordEvent;
-#endif
+#include "utils/tracer.h"
+#include "utils/utils.h"
 
 namespace ppspeech {
 
 FeaturePipeline::FeaturePipeline(const FeaturePipelineConfig& config)
     : config_(config),
       feature_dim_(config.num_bins),
-      num_frames_(0),
-      input_finished_(false) {
+      num_frames_(0) {
         config_.Info();
         if (config_.pipeline_type == "graph"){
             // force feature pipeline on cpu
@@ -44,22 +40,22 @@ FeaturePipeline::FeaturePipeline(const FeaturePipelineConfig& config)
       }
 
 void FeaturePipeline::AcceptWaveform(const float* pcm, const int& size) {
-#ifdef USE_PROFILING
-    RecordEvent event("AcceptWaveform", TracerEventType::UserDefined, 1);
-#endif
+  TRACE_SCOPE("FeaturePipeline::AcceptWaveform");
 
-  std::vector<std::vector<float>> feats;
+  // the frames are taken from those read before, see TakeFrames()
+  std::vector<std::vector<float>>& feats = feats_;
 
   // add wave cache
-  std::vector<float> waves;
-  waves.insert(waves.begin(), remained_wav_.begin(), remained_wav_.end());
+  std::vector<float>& waves = waves_;
+  waves.assign(remained_wav_.begin(), remained_wav_.end());
   waves.insert(waves.end(), pcm, pcm + size);
 
   // compute feature
   int num_frames;
   if (config_.pipeline_type == "kaldi"){
+      TakeFrames(fbank_->NumFrames(waves.size()), &feats);
       num_frames = fbank_->Compute(waves, &feats);
-      num_frames = cmvn_->Compute(feats);
+      if (num_frames > 0) num_frames = cmvn_->Compute(feats);
   } else if (config_.pipeline_type == "graph"){
       // waves to tensor
       size_t size = waves.size();
@@ -79,7 +75,7 @@ void FeaturePipeline::AcceptWaveform(const float* pcm, const int& size) {
       CHECK(feat_dim == feature_dim_);
       const float* feats_ptr = t_feats.data<float>();
 
-      feats.resize(num_frames);
+      TakeFrames(num_frames, &feats);
       for (int i = 0; i < num_frames; i ++) {
         feats[i].resize(feat_dim);
        
@@ -91,8 +87,9 @@ void FeaturePipeline::AcceptWaveform(const float* pcm, const int& size) {
     CHECK(false);
   }
 
-  feature_queue_.Push(std::move(feats));
+  // counted before the frames are published to the decoder
   num_frames_ += num_frames;
+  feature_queue_.Push(&feats);
 
   // update wave cache 
   int left_samples = waves.size() - config_.frame_shift * num_frames;
@@ -100,90 +97,100 @@ void FeaturePipeline::AcceptWaveform(const float* pcm, const int& size) {
   std::copy(waves.begin() + config_.frame_shift * num_frames,
             waves.end(),
             remained_wav_.begin());
-  // we are still adding wave, notify input is not finished
-  finish_condition_.notify_one();
 }
 
 void FeaturePipeline::AcceptWaveform(const int16_t* pcm, const int& size) {
-  auto* float_pcm = new float[size];
+  std::vector<float>& float_pcm = float_pcm_;
+  float_pcm.resize(size);
   for (size_t i = 0; i < size; i++) {
     // cast int16 to float
     float_pcm[i] = static_cast<float>(pcm[i]);
   }
-  this->AcceptWaveform(float_pcm, size);
-  delete[] float_pcm;
+  this->AcceptWaveform(float_pcm.data(), size);
+}
+
+// on the thread of AcceptWaveform(), frames is empty
+void FeaturePipeline::TakeFrames(int num_frames,
+                                 std::vector<std::vector<float>>* frames) {
+  size_t num_free = std::min<size_t>(num_frames, free_frames_.Size());
+  free_frames_.Pop(num_free, frames);
+  frames->resize(num_frames);
+}
+
+// on the decoder thread
+void FeaturePipeline::RecycleFrames(std::vector<std::vector<float>>* frames) {
+  free_frames_.Push(frames);
 }
 
 void FeaturePipeline::SetInputFinished() {
-  CHECK(!input_finished_);
-  {
-    std::lock_guard<std::mutex> lock(mutex_);
-    input_finished_ = true;
-  }
-  finish_condition_.notify_one();
+  CHECK(!input_finished());
+  feature_queue_.Close();
 }
 
 bool FeaturePipeline::ReadOne(std::vector<float>* feat) {
-  if (!feature_queue_.Empty()) {
-    *feat = std::move(feature_queue_.Pop());
-    return true;
-  } else {
-    // queue empty
-    std::unique_lock<std::mutex> lock(mutex_);
-    while (!input_finished_) {
-      // This will release the lock and wait for notify_one()
-      // from AcceptWaveform() or set_input_finished()
-      finish_condition_.wait(lock);
-      if (!feature_queue_.Empty()) {
-        *feat = std::move(feature_queue_.Pop());
-        return true;
-      }
-    }
-    CHECK(input_finished_);
-    // Double check queue.empty, see issue#893 for detailed discussions.
-    if (!feature_queue_.Empty()) {
-      *feat = std::move(feature_queue_.Pop());
-      return true;
-    } else {
-      return false;
-    }
+  if (feat->capacity() > 0) {
+    free_frames_.Push(std::move(*feat));
   }
+  // Wait() checks the queue again once the input is finished, see
+  // issue#893 for detailed discussions.
+  if (!feature_queue_.Wait(1)) return false;
+  *feat = feature_queue_.Pop();
+  return true;
 }
 
 bool FeaturePipeline::Read(int num_frames,
                            std::vector<std::vector<float>>* feats) {
-  feats->clear();
+  RecycleFrames(feats);
   if (feature_queue_.Size() >= num_frames) {
-    *feats = std::move(feature_queue_.Pop(num_frames));
+    feature_queue_.Pop(num_frames, feats);
     return true;
-  } else {
-    std::unique_lock<std::mutex> lock(mutex_);
-    while (!input_finished_) {
-      // This will release the lock and wait for notify_one()
-      // from AcceptWaveform() or set_input_finished()
-      finish_condition_.wait(lock);
-      if (feature_queue_.Size() >= num_frames) {
-        *feats = std::move(feature_queue_.Pop(num_frames));
-        return true;
-      }
-    }
-    CHECK(input_finished_);
-    // Double check queue.empty, see issue#893 for detailed discussions.
-    if (feature_queue_.Size() >= num_frames) {
-      *feats = std::move(feature_queue_.Pop(num_frames));
-      return true;
-    } else {
-      *feats = std::move(feature_queue_.Pop(feature_queue_.Size()));
-      return false;
-    }
   }
+  TRACE_SCOPE("FeaturePipeline::Read wait");
+  // woken once num_frames are queued or the input is finished
+  if (feature_queue_.Wait(num_frames)) {
+    feature_queue_.Pop(num_frames, feats);
+    return true;
+  }
+  feature_queue_.Pop(feature_queue_.Size(), feats);
+  return false;
 }
 
 void FeaturePipeline::Reset() {
-  input_finished_ = false;
   num_frames_ = 0;
   remained_wav_.clear();
-  feature_queue_.Clear();
+  // the queued frames go back to the pool
+  feature_queue_.Pop(feature_queue_.Size(), &feats_);
+  RecycleFrames(&feats_);
+  feature_queue_.Reopen();
+}
+
+void FeaturePipeline::SaveState(BinaryWriter* writer) const {
+  writer->Write(num_frames_);
+  writer->Write(input_finished());
+  writer->Write(remained_wav_);
+  writer->Write(feature_queue_.Items());
+}
+
+bool FeaturePipeline::LoadState(BinaryReader* reader) {
+  Reset();
+  int num_frames = 0;
+  bool input_finished = false;
+  std::vector<std::vector<float>> feats;
+  if (!reader->Read(&num_frames) || !reader->Read(&input_finished) ||
+      !reader->Read(&remained_wav_) || !reader->Read(&feats)) {
+    Reset();
+    return false;
+  }
+  for (const auto& feat : feats) {
+    if (static_cast<int>(feat.size()) != feature_dim_) {
+      Reset();
+      return false;
+    }
+  }
+  num_frames_ = num_frames;
+  feature_queue_.Push(&feats);
+  if (input_finished) feature_queue_.Close();
+  return true;
 }
 
 }  // namespace ppspeech
\ No newline at end of file
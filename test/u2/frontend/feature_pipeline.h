@@ -14,15 +14,16 @@
 
 #pragma once
 
-#include <mutex>
-#include <queue>
+#include <cstdint>
+#include <functional>
 #include <string>
 #include <vector>
 
 #include "frontend/cmvn.h"
 #include "frontend/fbank.h"
-#include "utils/block_queue.h"
+#include "utils/io.h"
 #include "utils/log.h"
+#include "utils/spsc_channel.h"
 
 #include "paddle/jit/all.h"
 #include "paddle/phi/api/all.h"
@@ -72,10 +73,12 @@ struct FeaturePipelineConfig {
 // Typically, FeaturePipeline is used in two threads: one thread A calls
 // AcceptWaveform() to add raw wav data and set_input_finished() to notice
 // the end of input wav, another thread B (decoder thread) calls Read() to
-// consume features. So a BlockingQueue is used to make this thread safe.
+// consume features. So a SpscChannel, which needs no lock for one producer
+// and one consumer, is used to make this thread safe.
 
-// The Read() is designed as a blocking method when there is no feature
-// in feature_queue_ and the input is not finished.
+// The Read() is designed as a blocking method when there are not enough
+// features in feature_queue_ and the input is not finished. The decoder
+// thread is only woken when the frames it reads are all there.
 
 class FeaturePipeline {
  public:
@@ -95,7 +98,7 @@ class FeaturePipeline {
   // The caller should call thie method when speech input is end.
   // Never call AcceptWaveform() after calling SetInputFinished()
   void SetInputFinished();
-  bool input_finished() const { return input_finished_; }
+  bool input_finished() const { return feature_queue_.closed(); }
 
   // Return False if input is finished and no feature could be read.
   // Return True if a feature is read.
@@ -109,14 +112,43 @@ class FeaturePipeline {
   // Return True if #num_frames features are read.
   // This function is a blocking method when there is no feature
   // in feature_queue_ and the input is not finished.
+  // The frames *feats holds are recycled for the next AcceptWaveform(), so
+  // a caller passing the same feats on each call keeps the steady state
+  // free of allocations.
   bool Read(int num_frames, std::vector<std::vector<float>>* feats);
 
   void Reset();
+
+  // Snapshot of the queued features and the residual samples, not to be
+  // taken while audio is fed.
+  void SaveState(BinaryWriter* writer) const;
+  bool LoadState(BinaryReader* reader);
+
   bool IsLastFrame(int frame) const {
-    return input_finished_ && (frame == num_frames_ - 1);
+    return input_finished() && (frame == num_frames_ - 1);
+  }
+
+  // Instead of blocking in Read(), a scheduler may ask to be notified when
+  // there are frames to read: callback is called once num_frames frames are
+  // queued or the input is finished, for each NotifyWhenReady() returning
+  // true. It runs on the thread of AcceptWaveform() or SetInputFinished(),
+  // so it should be short, e.g. queue a decoding step or write an eventfd.
+  // Set it before any audio is fed.
+  void set_ready_callback(std::function<void()> callback) {
+    feature_queue_.set_notify_callback(std::move(callback));
+  }
+  // On the thread reading. False, and no callback, if num_frames frames are
+  // already queued or the input is finished.
+  bool NotifyWhenReady(int num_frames) {
+    return feature_queue_.NotifyWhen(num_frames);
   }
 
   int NumQueuedFrames() const { return feature_queue_.Size(); }
+  // bytes of the queued features, safe to call while audio is fed
+  int64_t MemoryBytes() const {
+    return static_cast<int64_t>(NumQueuedFrames()) * feature_dim_ *
+           sizeof(float);
+  }
 
  private:
   const FeaturePipelineConfig& config_;
@@ -128,9 +160,9 @@ class FeaturePipeline {
   std::shared_ptr<PaddleLayer> model_{nullptr};
   paddle::jit::Function feature_pipeline_func_;
 
-  BlockingQueue<std::vector<float>> feature_queue_;
+  // closed by SetInputFinished()
+  SpscChannel<std::vector<float>> feature_queue_;
   int num_frames_;
-  bool input_finished_;
 
   // The feature extraction is done in AcceptWaveform().
   // This waveform sample points are consumed by frame size.
@@ -138,10 +170,15 @@ class FeaturePipeline {
   // kept to be used in next AcceptWaveform() calling.
   std::vector<float> remained_wav_;
 
-  // Used to block the Read when there is no feature in feature_queue_
-  // and the input is not finished.
-  mutable std::mutex mutex_;
-  std::condition_variable finish_condition_;
+  // Frames read by the decoder go back to AcceptWaveform() to be refilled,
+  // through free_frames_ the other way round of feature_queue_.
+  void TakeFrames(int num_frames, std::vector<std::vector<float>>* frames);
+  void RecycleFrames(std::vector<std::vector<float>>* frames);
+  SpscChannel<std::vector<float>> free_frames_;
+  // scratch of AcceptWaveform()
+  std::vector<float> waves_;
+  std::vector<float> float_pcm_;
+  std::vector<std::vector<float>> feats_;
 };
 
 }  // namespace ppspeech
\ No newline at end of file
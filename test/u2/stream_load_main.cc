@@ -0,0 +1,508 @@
+// Copyright (c) 2022 PaddlePaddle Authors. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+// Load generator of concurrent real-time streams. Each level opens N
+// virtual streams which feed the waves in packets at the wall-clock rate to
+// the session engine, and measures the latency from a packet to the partial
+// result covering it, from the end of an utterance to its final result, and
+// the cpu utilization. N ramps up until a latency SLO breaks, then the
+// max sustainable concurrency is bisected.
+//
+//   ./build/stream_load_main --model_path=... --wav_scp=wav.scp \
+//       --thread_num=8 --partial_slo_ms=500 --final_slo_ms=1000
+
+#include <sys/resource.h>
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <deque>
+#include <fstream>
+#include <iomanip>
+#include <memory>
+#include <mutex>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#include "decoder/params.h"
+#include "decoder/session_engine.h"
+#include "decoder/session_pool.h"
+#include "frontend/wav.h"
+#include "utils/cpu_affinity.h"
+#include "utils/flags.h"
+#include "utils/latency_stats.h"
+#include "utils/string.h"
+#include "utils/tracer.h"
+
+DEFINE_string(wav_path, "", "single wave path");
+DEFINE_string(wav_scp, "", "input wav scp, each stream loops over the waves");
+DEFINE_int32(thread_num, 4, "num of decode workers of the session engine");
+DEFINE_int32(packet_ms, 100, "audio packet size fed to each stream");
+DEFINE_int32(feeder_threads,
+             2,
+             "threads feeding the streams, the features are extracted on "
+             "them as by the threads of a server");
+DEFINE_int32(start_streams, 8, "concurrent streams of the first level");
+DEFINE_int32(max_streams, 1024, "concurrent streams of the last level");
+DEFINE_double(ramp_factor,
+              2.0,
+              "streams of the next level over those of a passed one until a "
+              "level fails");
+DEFINE_int32(stream_resolution,
+             4,
+             "the max sustainable streams are bisected between the last "
+             "passed and the first failed levels to within it");
+DEFINE_int32(level_seconds, 30, "wall time of each level");
+DEFINE_int32(level_warmup_seconds,
+             5,
+             "the start of each level is not measured, until the streams "
+             "are spread over their waves");
+DEFINE_double(slo_percentile, 99, "percentile of the latency SLOs");
+DEFINE_double(partial_slo_ms,
+              500,
+              "SLO of the latency from a packet fed to the partial result of "
+              "the chunk it completes");
+DEFINE_double(final_slo_ms,
+              1000,
+              "SLO of the latency from the end of an utterance to its final "
+              "result");
+DEFINE_string(load_report, "", "json file of the results of each level");
+
+using Clock = std::chrono::steady_clock;
+
+std::shared_ptr<ppspeech::DecodeOptions> g_decode_config;
+std::shared_ptr<ppspeech::FeaturePipelineConfig> g_feature_config;
+std::shared_ptr<ppspeech::DecodeResource> g_decode_resource;
+std::unique_ptr<ppspeech::SessionPool> g_session_pool;
+
+// utt, wav read in memory
+std::vector<std::pair<std::string, std::unique_ptr<ppspeech::WavReader>>>
+    g_waves;
+
+enum LoadStage {
+  kPacketToPartial = 0,
+  kEndToFinal,
+};
+
+// the packets fed of an utterance, shared by the feeder and the callbacks
+// of its session
+struct UttPackets {
+  std::mutex mutex;
+  // samples fed up to and including a packet, and when it was fed
+  std::deque<std::pair<int64_t, Clock::time_point>> packets;
+  // the input finished while the level was measured
+  bool measured = false;
+};
+
+struct Stream {
+  std::string name;
+  size_t wave = 0;
+  int offset = 0;
+  // samples fed to the session, which may start in the middle of the wave
+  int64_t num_fed = 0;
+  // of the first packet in the packet period, to spread the streams
+  Clock::duration phase{0};
+  std::shared_ptr<ppspeech::AsrSession> session;
+  std::shared_ptr<UttPackets> utt;
+};
+
+// one level of concurrency, the latencies are recorded while measuring
+struct Level {
+  explicit Level(int num_streams)
+      : num_streams(num_streams), latency({"packet_to_partial", "final"}) {
+    latency.set_enabled(true);
+  }
+
+  int num_streams;
+  ppspeech::LatencyStats latency;
+  std::atomic<bool> measuring{false};
+  std::atomic<int64_t> max_feed_lag_us{0};
+};
+
+struct LevelResult {
+  int num_streams = 0;
+  int64_t num_partials = 0;
+  int64_t num_finals = 0;
+  // in us
+  int64_t partial_p50 = 0;
+  int64_t partial_slo = 0;
+  int64_t partial_max = 0;
+  int64_t final_p50 = 0;
+  int64_t final_slo = 0;
+  int64_t final_max = 0;
+  int64_t max_feed_lag_us = 0;
+  // of all the cpus available
+  double cpu_util = 0.0;
+  bool passed = false;
+  std::string reason;
+};
+
+int64_t MicrosSince(Clock::time_point start) {
+  return std::chrono::duration_cast<std::chrono::microseconds>(Clock::now() -
+                                                               start)
+      .count();
+}
+
+// user and system time of the process
+double ProcessCpuSeconds() {
+  struct rusage usage;
+  getrusage(RUSAGE_SELF, &usage);
+  return usage.ru_utime.tv_sec + usage.ru_stime.tv_sec +
+         (usage.ru_utime.tv_usec + usage.ru_stime.tv_usec) / 1e6;
+}
+
+// on the decoding thread, the latency from the packet which completed the
+// audio of the frames decoded
+void RecordPartial(Level* level,
+                   UttPackets* utt,
+                   ppspeech::AsrSession* session) {
+  if (!level->measuring.load(std::memory_order_relaxed)) return;
+  int num_frames = session->decoder()->num_frames();
+  if (num_frames == 0) return;
+  int64_t samples =
+      static_cast<int64_t>(num_frames - 1) * g_feature_config->frame_shift +
+      g_feature_config->frame_length;
+  Clock::time_point fed;
+  {
+    std::lock_guard<std::mutex> lock(utt->mutex);
+    while (!utt->packets.empty() && utt->packets.front().first < samples) {
+      utt->packets.pop_front();
+    }
+    if (utt->packets.empty()) return;
+    fed = utt->packets.front().second;
+  }
+  level->latency.Record(kPacketToPartial, MicrosSince(fed));
+}
+
+void StartUtt(Level* level, Stream* stream) {
+  const std::string& key = g_waves[stream->wave].first;
+  stream->session = g_session_pool->Acquire(key + "/" + stream->name);
+  stream->utt = std::make_shared<UttPackets>();
+  stream->num_fed = 0;
+  std::shared_ptr<UttPackets> utt = stream->utt;
+  stream->session->set_partial_callback(
+      [level, utt](ppspeech::AsrSession* session) {
+        RecordPartial(level, utt.get(), session);
+      });
+  stream->session->set_final_callback(
+      [level, utt](ppspeech::AsrSession* session) {
+        VLOG(1) << session->key()
+                << ": Final result: " << session->final_result();
+        bool measured = false;
+        {
+          std::lock_guard<std::mutex> lock(utt->mutex);
+          measured = utt->measured;
+        }
+        if (measured && session->final_latency() >= 0) {
+          level->latency.Record(kEndToFinal, session->final_latency());
+        }
+      });
+}
+
+void FeedPacket(Level* level, ppspeech::SessionEngine* engine, Stream* stream) {
+  const ppspeech::WavReader& wav = *g_waves[stream->wave].second;
+  if (stream->session == nullptr) {
+    StartUtt(level, stream);
+    engine->AddSession(stream->session);
+  }
+  const int packet_samples = FLAGS_sample_rate / 1000 * FLAGS_packet_ms;
+  int size = std::min(packet_samples, wav.num_samples() - stream->offset);
+  stream->num_fed += size;
+  {
+    // before the audio is fed, it may be decoded at once
+    std::lock_guard<std::mutex> lock(stream->utt->mutex);
+    stream->utt->packets.emplace_back(stream->num_fed, Clock::now());
+  }
+  stream->session->AcceptWaveform(wav.data() + stream->offset, size);
+  stream->offset += size;
+  if (stream->offset < wav.num_samples()) return;
+
+  {
+    std::lock_guard<std::mutex> lock(stream->utt->mutex);
+    stream->utt->measured = level->measuring.load();
+  }
+  stream->session->SetInputFinished();
+  stream->session.reset();
+  stream->utt.reset();
+  stream->wave = (stream->wave + 1) % g_waves.size();
+  stream->offset = 0;
+}
+
+// feed the packets of streams in real time until end, then finish their
+// utterances
+void Feed(Level* level,
+          ppspeech::SessionEngine* engine,
+          const std::vector<Stream*>& streams,
+          Clock::time_point start,
+          Clock::time_point end) {
+  const auto packet = std::chrono::milliseconds(FLAGS_packet_ms);
+  bool done = streams.empty();
+  for (int64_t n = 0; !done; ++n) {
+    for (Stream* stream : streams) {
+      Clock::time_point due = start + stream->phase + n * packet;
+      if (due >= end) {
+        done = true;
+        break;
+      }
+      std::this_thread::sleep_until(due);
+      int64_t lag = MicrosSince(due);
+      int64_t max_lag = level->max_feed_lag_us.load();
+      while (lag > max_lag &&
+             !level->max_feed_lag_us.compare_exchange_weak(max_lag, lag)) {
+      }
+      FeedPacket(level, engine, stream);
+    }
+  }
+  for (Stream* stream : streams) {
+    if (stream->session == nullptr) continue;
+    stream->session->SetInputFinished();
+    stream->session.reset();
+  }
+}
+
+LevelResult RunLevel(ppspeech::SessionEngine* engine, int num_streams) {
+  Level level(num_streams);
+  const int packet_samples = FLAGS_sample_rate / 1000 * FLAGS_packet_ms;
+  std::vector<Stream> streams(num_streams);
+  for (int i = 0; i < num_streams; ++i) {
+    Stream& stream = streams[i];
+    stream.name = "stream" + std::to_string(i);
+    stream.wave = i % g_waves.size();
+    // the streams start at spread positions of their waves, so their
+    // utterances do not end at once
+    double position = std::fmod(i * 0.618034, 1.0);
+    int num_samples = g_waves[stream.wave].second->num_samples();
+    stream.offset =
+        static_cast<int>(position * num_samples) / packet_samples *
+        packet_samples;
+    stream.phase = std::chrono::microseconds(
+        static_cast<int64_t>(FLAGS_packet_ms) * 1000 * i / num_streams);
+  }
+  {
+    // the sessions are built before the level is measured, for the streams
+    // and the utterances still finishing
+    std::vector<std::shared_ptr<ppspeech::AsrSession>> sessions;
+    for (int i = 0; i < 2 * num_streams; ++i) {
+      sessions.push_back(g_session_pool->Acquire("warmup"));
+    }
+  }
+
+  Clock::time_point start = Clock::now();
+  Clock::time_point end = start + std::chrono::seconds(FLAGS_level_seconds);
+  int num_feeders = std::min(FLAGS_feeder_threads, num_streams);
+  std::vector<std::thread> feeders;
+  for (int f = 0; f < num_feeders; ++f) {
+    std::vector<Stream*> fed;
+    for (int i = f; i < num_streams; i += num_feeders) {
+      fed.push_back(&streams[i]);
+    }
+    feeders.emplace_back([&level, engine, fed, start, end, f]() {
+      ppspeech::Tracer::SetThreadName("feeder " + std::to_string(f));
+      Feed(&level, engine, fed, start, end);
+    });
+  }
+
+  std::this_thread::sleep_until(
+      start + std::chrono::seconds(FLAGS_level_warmup_seconds));
+  level.max_feed_lag_us = 0;
+  level.measuring = true;
+  Clock::time_point measure_start = Clock::now();
+  double cpu_start = ProcessCpuSeconds();
+  std::this_thread::sleep_until(end);
+  level.measuring = false;
+  double wall_seconds = MicrosSince(measure_start) / 1e6;
+  double cpu_seconds = ProcessCpuSeconds() - cpu_start;
+  for (auto& feeder : feeders) feeder.join();
+  engine->WaitAll();
+
+  LevelResult result;
+  result.num_streams = num_streams;
+  result.max_feed_lag_us = level.max_feed_lag_us;
+  result.cpu_util = cpu_seconds / std::max(wall_seconds, 1e-3) /
+                    std::max<size_t>(ppspeech::AvailableCpus().size(), 1);
+  ppspeech::LatencyHistogram partial_latency, final_latency;
+  level.latency.Merge(kPacketToPartial, &partial_latency);
+  level.latency.Merge(kEndToFinal, &final_latency);
+  result.num_partials = partial_latency.count();
+  result.partial_p50 = partial_latency.Percentile(50);
+  result.partial_slo = partial_latency.Percentile(FLAGS_slo_percentile);
+  result.partial_max = partial_latency.max();
+  result.num_finals = final_latency.count();
+  result.final_p50 = final_latency.Percentile(50);
+  result.final_slo = final_latency.Percentile(FLAGS_slo_percentile);
+  result.final_max = final_latency.max();
+
+  result.passed = false;
+  if (result.max_feed_lag_us > FLAGS_packet_ms * 1000) {
+    result.reason = "feeders behind real time, raise --feeder_threads";
+  } else if (result.num_partials == 0 && result.num_finals == 0) {
+    result.reason = "no result in the measured time";
+  } else if (result.partial_slo > FLAGS_partial_slo_ms * 1000) {
+    result.reason = "partial latency SLO broken";
+  } else if (result.final_slo > FLAGS_final_slo_ms * 1000) {
+    result.reason = "final latency SLO broken";
+  } else {
+    result.passed = true;
+  }
+  return result;
+}
+
+std::string LevelSummary(const LevelResult& result) {
+  std::ostringstream line;
+  line << std::setw(5) << result.num_streams << " streams: partial p50 "
+       << result.partial_p50 / 1000 << "ms p" << FLAGS_slo_percentile << " "
+       << result.partial_slo / 1000 << "ms, final p50 "
+       << result.final_p50 / 1000 << "ms p" << FLAGS_slo_percentile << " "
+       << result.final_slo / 1000 << "ms, cpu " << std::fixed
+       << std::setprecision(1) << 100 * result.cpu_util << "%, "
+       << (result.passed ? "passed" : "failed: " + result.reason);
+  return line.str();
+}
+
+void WriteLoadReport(const std::vector<LevelResult>& results,
+                     int max_streams) {
+  std::ofstream report(FLAGS_load_report);
+  report << "{\n\"cpus\": " << ppspeech::AvailableCpus().size()
+         << ",\n\"workers\": " << FLAGS_thread_num
+         << ",\n\"intra_op_threads\": " << FLAGS_num_threads
+         << ",\n\"packet_ms\": " << FLAGS_packet_ms
+         << ",\n\"slo_percentile\": " << FLAGS_slo_percentile
+         << ",\n\"max_sustainable_streams\": " << max_streams
+         << ",\n\"levels\": [";
+  for (size_t i = 0; i < results.size(); ++i) {
+    const LevelResult& r = results[i];
+    report << (i == 0 ? "" : ",") << "\n  {\"streams\": " << r.num_streams
+           << ", \"passed\": " << (r.passed ? "true" : "false")
+           << ", \"partials\": " << r.num_partials
+           << ", \"partial_p50_us\": " << r.partial_p50
+           << ", \"partial_slo_us\": " << r.partial_slo
+           << ", \"partial_max_us\": " << r.partial_max
+           << ", \"finals\": " << r.num_finals
+           << ", \"final_p50_us\": " << r.final_p50
+           << ", \"final_slo_us\": " << r.final_slo
+           << ", \"final_max_us\": " << r.final_max
+           << ", \"max_feed_lag_us\": " << r.max_feed_lag_us
+           << ", \"cpu_util\": " << r.cpu_util << "}";
+  }
+  report << "\n]\n}\n";
+  LOG(INFO) << "Load report written to " << FLAGS_load_report;
+}
+
+int main(int argc, char* argv[]) {
+  gflags::ParseCommandLineFlags(&argc, &argv, false);
+  google::InitGoogleLogging(argv[0]);
+  google::InstallFailureSignalHandler();
+  FLAGS_logtostderr = 1;
+
+  CHECK_GT(FLAGS_packet_ms, 0);
+  CHECK_GT(FLAGS_feeder_threads, 0);
+  CHECK_GT(FLAGS_start_streams, 0);
+  CHECK_GT(FLAGS_ramp_factor, 1.0);
+  CHECK_GT(FLAGS_stream_resolution, 0);
+  CHECK_LT(FLAGS_level_warmup_seconds, FLAGS_level_seconds);
+
+  g_decode_config = ppspeech::InitDecodeOptionsFromFlags();
+  g_feature_config = ppspeech::InitFeaturePipelineConfigFromFlags();
+  g_decode_resource = ppspeech::InitDecodeResourceFromFlags(*g_decode_config);
+  g_decode_resource->model->set_num_threads(FLAGS_num_threads);
+
+  if (FLAGS_wav_path.empty() && FLAGS_wav_scp.empty()) {
+    LOG(FATAL) << "Please provide the wave path or the wav scp.";
+  }
+  std::vector<std::pair<std::string, std::string>> waves;  // utt, wav
+  if (!FLAGS_wav_path.empty()) {
+    waves.emplace_back("test", FLAGS_wav_path);
+  } else {
+    std::ifstream wav_scp(FLAGS_wav_scp);
+    std::string line;
+    while (getline(wav_scp, line)) {
+      std::vector<std::string> strs;
+      ppspeech::SplitString(line, &strs);
+      CHECK_GE(strs.size(), 2);
+      waves.emplace_back(strs[0], strs[1]);
+    }
+  }
+  for (const auto& wav : waves) {
+    std::unique_ptr<ppspeech::WavReader> reader(
+        new ppspeech::WavReader(wav.second));
+    CHECK_EQ(reader->sample_rate(), FLAGS_sample_rate) << wav.first;
+    if (reader->num_samples() == 0) continue;
+    g_waves.emplace_back(wav.first, std::move(reader));
+  }
+  CHECK(!g_waves.empty()) << "no audio to feed";
+
+  g_session_pool.reset(new ppspeech::SessionPool(
+      *g_feature_config, g_decode_resource, *g_decode_config));
+  std::vector<LevelResult> results;
+  {
+    ppspeech::SessionEngine engine(
+        FLAGS_thread_num, nullptr, [](size_t worker) {
+          ppspeech::Tracer::SetThreadName("worker " + std::to_string(worker));
+        });
+    // ramp up by ramp_factor until a level fails, then bisect
+    int passed = 0;
+    int failed = FLAGS_max_streams + 1;
+    int num_streams = std::min(FLAGS_start_streams, FLAGS_max_streams);
+    while (true) {
+      LevelResult result = RunLevel(&engine, num_streams);
+      LOG(INFO) << "Level " << LevelSummary(result);
+      results.push_back(result);
+      if (result.passed) {
+        passed = num_streams;
+      } else {
+        failed = num_streams;
+      }
+      if (failed > FLAGS_max_streams) {
+        if (num_streams >= FLAGS_max_streams) break;
+        num_streams = std::min<int>(
+            FLAGS_max_streams,
+            std::max<int>(num_streams + 1,
+                          std::lround(num_streams * FLAGS_ramp_factor)));
+      } else {
+        if (failed - passed <= FLAGS_stream_resolution) break;
+        num_streams = passed + (failed - passed) / 2;
+      }
+    }
+
+    std::sort(results.begin(),
+              results.end(),
+              [](const LevelResult& a, const LevelResult& b) {
+                return a.num_streams < b.num_streams;
+              });
+    LOG(INFO) << "Levels on " << ppspeech::AvailableCpus().size()
+              << " cpus, " << FLAGS_thread_num << " workers x "
+              << FLAGS_num_threads << " intra-op threads:";
+    for (const LevelResult& result : results) {
+      LOG(INFO) << LevelSummary(result);
+    }
+    if (passed == 0) {
+      LOG(WARNING) << "No level met the SLOs, p" << FLAGS_slo_percentile
+                   << " partial <= " << FLAGS_partial_slo_ms
+                   << "ms and final <= " << FLAGS_final_slo_ms << "ms.";
+    } else {
+      LOG(INFO) << "Max sustainable concurrency: " << passed
+                << (failed > FLAGS_max_streams ? "+" : "") << " streams at p"
+                << FLAGS_slo_percentile << " partial <= "
+                << FLAGS_partial_slo_ms << "ms and final <= "
+                << FLAGS_final_slo_ms << "ms.";
+    }
+    if (!FLAGS_load_report.empty()) WriteLoadReport(results, passed);
+  }
+  g_session_pool.reset();
+  return 0;
+}
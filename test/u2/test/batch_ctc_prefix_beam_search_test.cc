@@ -0,0 +1,129 @@
+// Copyright (c) 2022 PaddlePaddle Authors. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "decoder/batch_ctc_prefix_beam_search.h"
+
+#include <algorithm>
+#include <cmath>
+#include <memory>
+#include <random>
+#include <vector>
+
+#include "decoder/ctc_prefix_beam_search.h"
+#include "gmock/gmock.h"
+#include "gtest/gtest.h"
+
+namespace {
+
+std::vector<std::vector<float>> RandomLogProbs(int num_frames,
+                                               int vocab_size,
+                                               unsigned int seed) {
+  std::mt19937 rng(seed);
+  std::exponential_distribution<float> dist(1.0f);
+  std::vector<std::vector<float>> logp(num_frames,
+                                       std::vector<float>(vocab_size));
+  for (auto& frame : logp) {
+    float sum = 0.0f;
+    for (auto& p : frame) {
+      // sharpen, so that hypotheses are rarely tied
+      p = std::pow(dist(rng), 4.0f);
+      sum += p;
+    }
+    for (auto& p : frame) {
+      p = std::log(p / sum);
+    }
+  }
+  return logp;
+}
+
+void ExpectSameResult(const ppspeech::SearchInterface& expected,
+                      const ppspeech::SearchInterface& actual) {
+  const auto& hyps = expected.Inputs();
+  ASSERT_EQ(hyps.size(), actual.Inputs().size());
+  for (size_t i = 0; i < hyps.size(); ++i) {
+    // tied hypotheses may be in different order
+    EXPECT_NEAR(expected.Likelihood()[i], actual.Likelihood()[i], 1e-4);
+    auto it = std::find(hyps.begin(), hyps.end(), actual.Inputs()[i]);
+    ASSERT_TRUE(it != hyps.end());
+    EXPECT_NEAR(expected.Likelihood()[it - hyps.begin()],
+                actual.Likelihood()[i],
+                1e-4);
+    EXPECT_EQ(actual.Inputs()[i].size(), actual.Times()[i].size());
+  }
+}
+
+}  // namespace
+
+TEST(BatchCtcPrefixBeamSearchTest, SameAsCtcPrefixBeamSearch) {
+  ppspeech::CtcPrefixBeamSearchOptions opts;
+  opts.first_beam_size = 4;
+  opts.second_beam_size = 4;
+  const int vocab_size = 6;
+  const int num_streams = 3;
+
+  ppspeech::BatchCtcPrefixBeamSearch batch_search(opts);
+  std::vector<std::unique_ptr<ppspeech::BatchSearchStream>> streams;
+  std::vector<std::unique_ptr<ppspeech::CtcPrefixBeamSearch>> searchers;
+  std::vector<std::vector<std::vector<float>>> logps;
+  for (int i = 0; i < num_streams; ++i) {
+    streams.emplace_back(batch_search.NewStream());
+    searchers.emplace_back(new ppspeech::CtcPrefixBeamSearch(opts));
+    // streams with different num of frames
+    logps.emplace_back(RandomLogProbs(5 + 3 * i, vocab_size, i));
+  }
+  EXPECT_EQ(batch_search.num_streams(), num_streams);
+
+  std::vector<ppspeech::BatchSearchStream*> batch;
+  std::vector<const std::vector<std::vector<float>>*> batch_logps;
+  for (int i = 0; i < num_streams; ++i) {
+    batch.push_back(streams[i].get());
+    batch_logps.push_back(&logps[i]);
+    searchers[i]->Search(logps[i]);
+  }
+  batch_search.Search(batch, batch_logps);
+  for (int i = 0; i < num_streams; ++i) {
+    ExpectSameResult(*searchers[i], *streams[i]);
+  }
+
+  // streaming, stream by stream
+  for (int i = 0; i < num_streams; ++i) {
+    streams[i]->Search(logps[i]);
+    searchers[i]->Search(logps[i]);
+    ExpectSameResult(*searchers[i], *streams[i]);
+  }
+
+  // reset and reuse a released slot
+  streams[1]->Reset();
+  EXPECT_EQ(streams[1]->Inputs().size(), 1);
+  EXPECT_TRUE(streams[1]->Inputs()[0].empty());
+  streams.pop_back();
+  EXPECT_EQ(batch_search.num_streams(), num_streams - 1);
+  streams.emplace_back(batch_search.NewStream());
+  EXPECT_EQ(batch_search.num_streams(), num_streams);
+}
+
+TEST(BatchCtcPrefixBeamSearchTest, LongStream) {
+  // long enough to compact the prefix tree
+  ppspeech::CtcPrefixBeamSearchOptions opts;
+  const int vocab_size = 50;
+  ppspeech::BatchCtcPrefixBeamSearch batch_search(opts);
+  auto stream = batch_search.NewStream();
+  ppspeech::CtcPrefixBeamSearch searcher(opts);
+  for (int chunk = 0; chunk < 20; ++chunk) {
+    auto logp = RandomLogProbs(16, vocab_size, 100 + chunk);
+    stream->Search(logp);
+    searcher.Search(logp);
+  }
+  ExpectSameResult(searcher, *stream);
+}
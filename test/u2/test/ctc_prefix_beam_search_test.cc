@@ -15,11 +15,24 @@
 #include "decoder/ctc_prefix_beam_search.h"
 
 #include <cmath>
+#include <random>
+#include <string>
 #include <vector>
 
 #include "gmock/gmock.h"
 #include "gtest/gtest.h"
 
+// the log of the probabilities of each frame
+static std::vector<std::vector<float>> LogProbs(
+    std::vector<std::vector<float>> probs) {
+  for (auto& frame : probs) {
+    for (auto& p : frame) {
+      p = std::log(p);
+    }
+  }
+  return probs;
+}
+
 TEST(CtcPrefixBeamSearchTest, CtcPrefixBeamSearchLogitsTest) {
   using ::testing::ElementsAre;
   // test case https://robin1001.github.io/2020/12/11/ctc-search
@@ -69,4 +82,152 @@ TEST(CtcPrefixBeamSearchTest, CtcPrefixBeamSearchLogitsTest) {
   //   EXPECT_THAT(times[0], ElementsAre(0, 2));
   //   EXPECT_THAT(times[1], ElementsAre(0, 2));
   //   EXPECT_THAT(times[2], ElementsAre(2));
-}
\ No newline at end of file
+}
+
+TEST(CtcPrefixBeamSearchTest, AdaptiveBeamTest) {
+  using ::testing::ElementsAre;
+  std::vector<std::vector<float>> data = LogProbs(
+      {{0.25, 0.40, 0.35}, {0.40, 0.35, 0.25}, {0.10, 0.50, 0.40}});
+
+  ppspeech::CtcPrefixBeamSearchOptions opts;
+  opts.first_beam_size = 3;
+  opts.second_beam_size = 3;
+  ppspeech::CtcPrefixBeamSearch fixed_search(opts);
+  fixed_search.Search(data);
+
+  // loose thresholds, same as the fixed beam
+  ppspeech::CtcPrefixBeamSearchOptions loose_opts = opts;
+  loose_opts.adaptive_beam = true;
+  loose_opts.token_prob_threshold = 1.0;
+  loose_opts.token_logp_floor = -ppspeech::kFloatMax;
+  loose_opts.hyp_logp_beam = ppspeech::kFloatMax;
+  ppspeech::CtcPrefixBeamSearch loose_search(loose_opts);
+  loose_search.Search(data);
+  EXPECT_EQ(loose_search.Outputs(), fixed_search.Outputs());
+  EXPECT_EQ(loose_search.Likelihood(), fixed_search.Likelihood());
+
+  // tight hypothesis beam, only the best survives
+  ppspeech::CtcPrefixBeamSearchOptions tight_opts = loose_opts;
+  tight_opts.hyp_logp_beam = 0.0;
+  ppspeech::CtcPrefixBeamSearch tight_search(tight_opts);
+  tight_search.Search(data);
+  EXPECT_EQ(tight_search.Outputs().size(), 1);
+
+  // confident frames only extend the top token
+  std::vector<std::vector<float>> peaky = LogProbs(
+      {{0.98, 0.01, 0.01}, {0.01, 0.98, 0.01}, {0.98, 0.01, 0.01}});
+  ppspeech::CtcPrefixBeamSearchOptions peaky_opts = opts;
+  peaky_opts.adaptive_beam = true;
+  peaky_opts.token_prob_threshold = 0.95;
+  ppspeech::CtcPrefixBeamSearch peaky_search(peaky_opts);
+  peaky_search.Search(peaky);
+  EXPECT_EQ(peaky_search.Outputs().size(), 1);
+  EXPECT_THAT(peaky_search.Outputs()[0], ElementsAre(1));
+}
+
+TEST(CtcPrefixBeamSearchTest, LogProbTest) {
+  using ::testing::ElementsAre;
+  using ::testing::FloatNear;
+  using ::testing::Pointwise;
+  // the same test case with log probabilities, the search accumulates them
+  // by FastLogSumExp, so the n-best and its scores must stay as in the table
+  std::vector<std::vector<float>> data = LogProbs(
+      {{0.25, 0.40, 0.35}, {0.40, 0.35, 0.25}, {0.10, 0.50, 0.40}});
+  ppspeech::CtcPrefixBeamSearchOptions opts;
+  opts.first_beam_size = 3;
+  opts.second_beam_size = 3;
+  ppspeech::CtcPrefixBeamSearch prefix_beam_search(opts);
+  prefix_beam_search.Search(data);
+
+  const auto& result = prefix_beam_search.Outputs();
+  ASSERT_EQ(result.size(), 3);
+  EXPECT_THAT(result[0], ElementsAre(2, 1));
+  EXPECT_THAT(result[1], ElementsAre(1, 2));
+  EXPECT_THAT(result[2], ElementsAre(1));
+
+  std::vector<float> likelihood;
+  for (float logp : prefix_beam_search.Likelihood()) {
+    likelihood.push_back(std::exp(logp));
+  }
+  EXPECT_THAT(likelihood, Pointwise(FloatNear(1e-5), {0.2185, 0.1550, 0.1525}));
+}
+
+TEST(CtcPrefixBeamSearchTest, NoTimestampTest) {
+  std::vector<std::vector<float>> data = LogProbs(
+      {{0.25, 0.40, 0.35}, {0.40, 0.35, 0.25}, {0.10, 0.50, 0.40}});
+  ppspeech::CtcPrefixBeamSearchOptions opts;
+  opts.first_beam_size = 3;
+  opts.second_beam_size = 3;
+  ppspeech::CtcPrefixBeamSearch with_times(opts);
+  ppspeech::CtcPrefixBeamSearch without_times(opts, nullptr, false);
+  with_times.Search(data);
+  without_times.Search(data);
+
+  // the n-best does not depend on timestamp tracking
+  EXPECT_EQ(without_times.Outputs(), with_times.Outputs());
+  EXPECT_EQ(without_times.Likelihood(), with_times.Likelihood());
+  ASSERT_EQ(without_times.Times().size(), 3);
+  for (const auto& times : without_times.Times()) {
+    EXPECT_TRUE(times.empty());
+  }
+}
+
+TEST(CtcPrefixBeamSearchTest, MemoryBytesTest) {
+  std::vector<std::vector<float>> data = LogProbs(
+      {{0.25, 0.40, 0.35}, {0.40, 0.35, 0.25}, {0.10, 0.50, 0.40}});
+  ppspeech::CtcPrefixBeamSearchOptions opts;
+  opts.first_beam_size = 3;
+  opts.second_beam_size = 3;
+  ppspeech::CtcPrefixBeamSearch prefix_beam_search(opts);
+  int64_t empty_bytes = prefix_beam_search.MemoryBytes();
+  EXPECT_GT(empty_bytes, 0);
+
+  // the hypotheses and their timestamps grow with the frames
+  for (int i = 0; i < 10; ++i) {
+    prefix_beam_search.Search(data);
+  }
+  EXPECT_GT(prefix_beam_search.MemoryBytes(), empty_bytes);
+}
+
+TEST(CtcPrefixBeamSearchTest, SnapshotTest) {
+  std::mt19937 rng(1234);
+  std::uniform_real_distribution<float> dist(0.0, 1.0);
+  auto random_logp = [&](int num_frames) {
+    std::vector<std::vector<float>> logp(num_frames, std::vector<float>(8));
+    for (auto& frame : logp) {
+      float sum = 0.0;
+      for (auto& p : frame) sum += (p = dist(rng));
+      for (auto& p : frame) p = std::log(p / sum);
+    }
+    return logp;
+  };
+  ppspeech::CtcPrefixBeamSearchOptions opts;
+  opts.first_beam_size = 4;
+  opts.second_beam_size = 4;
+  ppspeech::CtcPrefixBeamSearch search(opts);
+  search.Search(random_logp(30));
+
+  std::string snapshot;
+  ppspeech::BinaryWriter writer(&snapshot);
+  ASSERT_TRUE(search.SaveState(&writer));
+
+  // the restored search goes on exactly as the one it was taken from
+  ppspeech::CtcPrefixBeamSearch restored(opts);
+  ppspeech::BinaryReader reader(snapshot);
+  ASSERT_TRUE(restored.LoadState(&reader));
+  EXPECT_TRUE(reader.done());
+  EXPECT_EQ(restored.Outputs(), search.Outputs());
+  for (int i = 0; i < 5; ++i) {
+    std::vector<std::vector<float>> logp = random_logp(10);
+    search.Search(logp);
+    restored.Search(logp);
+    EXPECT_EQ(restored.Outputs(), search.Outputs());
+    EXPECT_EQ(restored.Likelihood(), search.Likelihood());
+    EXPECT_EQ(restored.Times(), search.Times());
+  }
+
+  // a truncated snapshot leaves the search reset
+  ppspeech::BinaryReader truncated(snapshot.data(), snapshot.size() - 1);
+  EXPECT_FALSE(restored.LoadState(&truncated));
+  EXPECT_EQ(restored.Outputs(), std::vector<std::vector<int>>(1));
+}
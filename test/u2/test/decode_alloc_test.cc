@@ -0,0 +1,159 @@
+// Copyright (c) 2022 PaddlePaddle Authors. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+// The steady state decode loop, i.e. AcceptWaveform() and Decode() of a
+// chunk once the buffers have grown on a first utterance, must not touch
+// the heap. Every allocation is counted on the decoding thread, by
+// replacing operator new and, under glibc, malloc.
+
+#include <atomic>
+#include <cstdint>
+#include <cstdlib>
+#include <memory>
+#include <new>
+#include <string>
+#include <vector>
+
+#include "decoder/asr_decoder.h"
+#include "frontend/feature_pipeline.h"
+#include "gmock/gmock.h"
+#include "gtest/gtest.h"
+#include "test/test_utils.h"
+
+namespace {
+
+thread_local bool g_counting = false;
+std::atomic<int64_t> g_num_allocs(0);
+
+inline void CountAlloc() {
+  if (g_counting) ++g_num_allocs;
+}
+
+// allocations of the calling thread within its scope
+class ScopedAllocCounter {
+ public:
+  ScopedAllocCounter() : start_(g_num_allocs.load()) { g_counting = true; }
+  ~ScopedAllocCounter() { g_counting = false; }
+  int64_t count() const { return g_num_allocs.load() - start_; }
+
+ private:
+  int64_t start_;
+};
+
+}  // namespace
+
+#ifdef __GLIBC__
+extern "C" {
+void* __libc_malloc(size_t size);
+void* __libc_calloc(size_t num, size_t size);
+void* __libc_realloc(void* ptr, size_t size);
+void __libc_free(void* ptr);
+
+void* malloc(size_t size) {
+  CountAlloc();
+  return __libc_malloc(size);
+}
+
+void* calloc(size_t num, size_t size) {
+  CountAlloc();
+  return __libc_calloc(num, size);
+}
+
+void* realloc(void* ptr, size_t size) {
+  CountAlloc();
+  return __libc_realloc(ptr, size);
+}
+}  // extern "C"
+
+// operator new goes around the malloc above, so it is counted once
+static void* RawAlloc(size_t size) { return __libc_malloc(size ? size : 1); }
+static void RawFree(void* ptr) { __libc_free(ptr); }
+#else
+static void* RawAlloc(size_t size) { return std::malloc(size ? size : 1); }
+static void RawFree(void* ptr) { std::free(ptr); }
+#endif
+
+void* operator new(size_t size) {
+  CountAlloc();
+  void* ptr = RawAlloc(size);
+  if (ptr == nullptr) throw std::bad_alloc();
+  return ptr;
+}
+
+void* operator new[](size_t size) { return operator new(size); }
+
+void* operator new(size_t size, const std::nothrow_t&) noexcept {
+  CountAlloc();
+  return RawAlloc(size);
+}
+
+void* operator new[](size_t size, const std::nothrow_t&) noexcept {
+  CountAlloc();
+  return RawAlloc(size);
+}
+
+void operator delete(void* ptr) noexcept { RawFree(ptr); }
+void operator delete[](void* ptr) noexcept { RawFree(ptr); }
+void operator delete(void* ptr, size_t) noexcept { RawFree(ptr); }
+void operator delete[](void* ptr, size_t) noexcept { RawFree(ptr); }
+
+namespace {
+
+using ppspeech::test::kSampleRate;
+using ppspeech::test::MakeAudio;
+
+// feeds audio packet by packet, decoding the chunks ready after each, and
+// returns the allocations of each packet
+std::vector<int64_t> DecodeUtterance(const std::vector<float>& audio,
+                                     int packet_samples,
+                                     ppspeech::FeaturePipeline* pipeline,
+                                     ppspeech::AsrDecoder* decoder) {
+  std::vector<int64_t> num_allocs;
+  num_allocs.reserve(audio.size() / packet_samples + 1);
+  for (size_t begin = 0; begin + packet_samples <= audio.size();
+       begin += packet_samples) {
+    ScopedAllocCounter counter;
+    pipeline->AcceptWaveform(audio.data() + begin, packet_samples);
+    while (decoder->Decode(false) != ppspeech::DecodeState::kWaitFeats) {
+    }
+    num_allocs.push_back(counter.count());
+  }
+  return num_allocs;
+}
+
+using DecodeAllocTest = ppspeech::test::SyntheticDecodeTest;
+
+}  // namespace
+
+TEST_F(DecodeAllocTest, SteadyStateTest) {
+  auto pipeline = std::make_shared<ppspeech::FeaturePipeline>(feature_config_);
+  ppspeech::AsrDecoder decoder(pipeline, resource_, opts_);
+
+  // 10s in packets of one chunk, 16 frames subsampled by 4 of 10ms
+  std::vector<float> audio = MakeAudio(10 * kSampleRate);
+  const int packet_samples = opts_.chunk_size * 4 * kSampleRate / 100;
+
+  // the buffers grow to their peak on a first utterance
+  DecodeUtterance(audio, packet_samples, pipeline.get(), &decoder);
+  decoder.Reset();
+
+  std::vector<int64_t> num_allocs =
+      DecodeUtterance(audio, packet_samples, pipeline.get(), &decoder);
+  ASSERT_GT(num_allocs.size(), 2);
+  EXPECT_FALSE(decoder.result().empty());
+  // The first chunk after Reset() refills the feature cache of the model,
+  // it is decoded on the second packet as it needs the right context.
+  num_allocs.erase(num_allocs.begin(), num_allocs.begin() + 2);
+  EXPECT_THAT(num_allocs, ::testing::Each(0));
+}
@@ -91,4 +91,46 @@ TEST(FeaturePipelineTest, PipelineTest) {
   ASSERT_FALSE(b);
   ASSERT_EQ(out_feats.size(), 0);
   ASSERT_EQ(feature_pipeline.NumQueuedFrames(), 0);
-}
\ No newline at end of file
+}
+TEST(FeaturePipelineTest, ReadyCallbackTest) {
+  ppspeech::FeaturePipelineConfig config(
+      80, 8000, "cmvn");  // 80 fbank, 8k sample rate
+  ppspeech::FeaturePipeline feature_pipeline(config);
+  int num_calls = 0;
+  int queued_frames = 0;
+  feature_pipeline.set_ready_callback([&]() {
+    ++num_calls;
+    queued_frames = feature_pipeline.NumQueuedFrames();
+  });
+  std::vector<float> pcm(8 * 55, 0);  // 4 frames
+  std::vector<float> packet(8 * 10, 0);  // one more frame
+  feature_pipeline.AcceptWaveform(pcm.data(), pcm.size());
+  // ready already
+  ASSERT_FALSE(feature_pipeline.NotifyWhenReady(4));
+
+  // called once, when the 6th frame is fed
+  ASSERT_TRUE(feature_pipeline.NotifyWhenReady(6));
+  feature_pipeline.AcceptWaveform(packet.data(), packet.size());
+  ASSERT_EQ(num_calls, 0);
+  feature_pipeline.AcceptWaveform(packet.data(), packet.size());
+  ASSERT_EQ(num_calls, 1);
+  ASSERT_EQ(queued_frames, 6);
+  feature_pipeline.AcceptWaveform(packet.data(), packet.size());
+  ASSERT_EQ(num_calls, 1);
+
+  // counted from the frames read, or the end of input
+  std::vector<std::vector<float>> out_feats;
+  ASSERT_TRUE(feature_pipeline.Read(6, &out_feats));
+  ASSERT_TRUE(feature_pipeline.NotifyWhenReady(2));
+  feature_pipeline.SetInputFinished();
+  ASSERT_EQ(num_calls, 2);
+  ASSERT_EQ(queued_frames, 1);
+  ASSERT_FALSE(feature_pipeline.NotifyWhenReady(2));
+
+  // dropped by Reset()
+  feature_pipeline.Reset();
+  ASSERT_TRUE(feature_pipeline.NotifyWhenReady(1));
+  feature_pipeline.Reset();
+  feature_pipeline.AcceptWaveform(pcm.data(), pcm.size());
+  ASSERT_EQ(num_calls, 2);
+}
@@ -0,0 +1,222 @@
+// Copyright (c) 2022 PaddlePaddle Authors. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "decoder/rescoring_batch.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <random>
+#include <vector>
+
+#include "gmock/gmock.h"
+#include "gtest/gtest.h"
+
+namespace {
+
+const int kSos = 9;
+const int kEos = 9;
+const int kVocabSize = 10;
+
+// A causal stand-in for the attention decoder: the log prob of each token
+// depends only on the tokens up to its position, not on the padding.
+std::vector<float> FakeDecoder(const std::vector<int64_t>& tokens,
+                               int num_rows,
+                               int max_len) {
+  std::vector<float> probs(num_rows * max_len * kVocabSize);
+  for (int row = 0; row < num_rows; ++row) {
+    uint32_t hash = 2166136261u;
+    for (int i = 0; i < max_len; ++i) {
+      hash = (hash ^ tokens[row * max_len + i]) * 16777619u;
+      for (int v = 0; v < kVocabSize; ++v) {
+        uint32_t h = (hash ^ v) * 16777619u;
+        probs[(row * max_len + i) * kVocabSize + v] =
+            -static_cast<float>(h % 10007) / 997.0f;
+      }
+    }
+  }
+  return probs;
+}
+
+// sos and the hyp padded by eos, reversed for the right-to-left decoder
+std::vector<int64_t> PadHyps(const std::vector<std::vector<int>>& hyps,
+                             int max_len,
+                             bool reverse) {
+  std::vector<int64_t> tokens(hyps.size() * max_len, kEos);
+  for (size_t i = 0; i < hyps.size(); ++i) {
+    tokens[i * max_len] = kSos;
+    for (size_t j = 0; j < hyps[i].size(); ++j) {
+      tokens[i * max_len + j + 1] =
+          reverse ? hyps[i][hyps[i].size() - 1 - j] : hyps[i][j];
+    }
+  }
+  return tokens;
+}
+
+// The one by one scoring: all the hyps padded to the longest, the output
+// split per hyp and the path of each summed.
+std::vector<float> ReferenceScores(const std::vector<std::vector<int>>& hyps,
+                                   float reverse_weight) {
+  int num_hyps = hyps.size();
+  int max_len = 0;
+  for (const auto& hyp : hyps) {
+    max_len = std::max(max_len, static_cast<int>(hyp.size()) + 1);
+  }
+  std::vector<float> probs =
+      FakeDecoder(PadHyps(hyps, max_len, false), num_hyps, max_len);
+  std::vector<float> r_probs =
+      FakeDecoder(PadHyps(hyps, max_len, true), num_hyps, max_len);
+
+  std::vector<float> scores(num_hyps);
+  for (int i = 0; i < num_hyps; ++i) {
+    std::vector<float> prob(probs.begin() + i * max_len * kVocabSize,
+                            probs.begin() + (i + 1) * max_len * kVocabSize);
+    std::vector<float> r_prob(
+        r_probs.begin() + i * max_len * kVocabSize,
+        r_probs.begin() + (i + 1) * max_len * kVocabSize);
+    const std::vector<int>& hyp = hyps[i];
+    std::vector<int> r_hyp(hyp.rbegin(), hyp.rend());
+    float score = 0.0f;
+    float r_score = 0.0f;
+    for (size_t j = 0; j < hyp.size(); ++j) {
+      score += prob[j * kVocabSize + hyp[j]];
+      r_score += r_prob[j * kVocabSize + r_hyp[j]];
+    }
+    score += prob[hyp.size() * kVocabSize + kEos];
+    r_score += r_prob[hyp.size() * kVocabSize + kEos];
+    scores[i] = score * (1 - reverse_weight) + r_score * reverse_weight;
+  }
+  return scores;
+}
+
+std::vector<float> BatchScores(const std::vector<std::vector<int>>& hyps,
+                               float reverse_weight,
+                               int max_bucket_padding) {
+  ppspeech::RescoringBatch batch(hyps, kSos, kEos, max_bucket_padding);
+  for (const auto& bucket : batch.buckets()) {
+    int num_rows = bucket.num_rows();
+    std::vector<int64_t> tokens(num_rows * bucket.max_len);
+    std::vector<int64_t> lens(num_rows);
+    batch.FillBucket(bucket, tokens.data(), lens.data());
+    for (int row = 0; row < num_rows; ++row) {
+      EXPECT_LE(lens[row], bucket.max_len);
+    }
+    std::vector<float> probs = FakeDecoder(tokens, num_rows, bucket.max_len);
+    batch.ScoreBucket(bucket, probs.data(), kVocabSize, false);
+
+    // the exported decoder reverses the hyps of the input by their lens
+    std::vector<int64_t> r_tokens = tokens;
+    for (int row = 0; row < num_rows; ++row) {
+      int64_t* first = r_tokens.data() + row * bucket.max_len + 1;
+      std::reverse(first, first + lens[row] - 1);
+    }
+    std::vector<float> r_probs =
+        FakeDecoder(r_tokens, num_rows, bucket.max_len);
+    batch.ScoreBucket(bucket, r_probs.data(), kVocabSize, true);
+  }
+  std::vector<float> scores;
+  batch.GetScores(reverse_weight, &scores);
+  return scores;
+}
+
+}  // namespace
+
+TEST(RescoringBatchTest, SameAsOneByOne) {
+  std::mt19937 rng(1234);
+  for (int trial = 0; trial < 50; ++trial) {
+    // an n-best with shared prefixes, different lengths and duplicates
+    std::vector<int> prefix(rng() % 20);
+    for (int& token : prefix) token = rng() % (kVocabSize - 1);
+    std::vector<std::vector<int>> hyps(1 + rng() % 10, prefix);
+    for (auto& hyp : hyps) {
+      hyp.resize(rng() % (prefix.size() + 1));
+      int num_extra = rng() % 8;
+      for (int i = 0; i < num_extra; ++i) {
+        hyp.push_back(rng() % (kVocabSize - 1));
+      }
+    }
+    hyps.push_back(hyps[rng() % hyps.size()]);
+
+    for (float reverse_weight : {0.0f, 0.3f}) {
+      std::vector<float> expected = ReferenceScores(hyps, reverse_weight);
+      for (int padding : {-1, 0, 2, 5}) {
+        EXPECT_EQ(BatchScores(hyps, reverse_weight, padding), expected)
+            << "trial " << trial << " padding " << padding;
+      }
+    }
+  }
+}
+
+TEST(RescoringBatchTest, DedupAndBuckets) {
+  std::vector<std::vector<int>> hyps = {
+      {1, 2, 3}, {1, 2}, {1, 2, 3}, {1, 2, 3, 4, 5, 6}, {}, {1, 2}};
+  ppspeech::RescoringBatch one_bucket(hyps, kSos, kEos);
+  EXPECT_EQ(one_bucket.num_hyps(), 6);
+  EXPECT_EQ(one_bucket.num_rows(), 4);
+  ASSERT_EQ(one_bucket.buckets().size(), 1);
+  EXPECT_EQ(one_bucket.buckets()[0].max_len, 7);
+  EXPECT_EQ(one_bucket.num_padded_tokens(), 4 * 7);
+
+  // lens 7, 4, 3, 1
+  ppspeech::RescoringBatch buckets(hyps, kSos, kEos, 1);
+  ASSERT_EQ(buckets.buckets().size(), 3);
+  EXPECT_EQ(buckets.buckets()[0].num_rows(), 1);
+  EXPECT_EQ(buckets.buckets()[1].num_rows(), 2);
+  EXPECT_EQ(buckets.buckets()[1].max_len, 4);
+  EXPECT_EQ(buckets.buckets()[2].max_len, 1);
+  EXPECT_EQ(buckets.num_padded_tokens(), 7 + 2 * 4 + 1);
+
+  std::vector<int64_t> tokens(2 * 4);
+  std::vector<int64_t> lens(2);
+  buckets.FillBucket(buckets.buckets()[1], tokens.data(), lens.data());
+  EXPECT_EQ(tokens, std::vector<int64_t>({kSos, 1, 2, 3, kSos, 1, 2, kEos}));
+  EXPECT_EQ(lens, std::vector<int64_t>({4, 3}));
+}
+
+TEST(RescoringBatchTest, SelectRescoringFrames) {
+  using ::testing::ElementsAre;
+  // blank probs, spikes at 2, 3 and 9
+  std::vector<float> blank_probs = {
+      0.999, 0.999, 0.1, 0.5, 0.999, 0.999, 0.999, 0.999, 0.999, 0.2};
+  std::vector<float> blank_logps;
+  for (float prob : blank_probs) blank_logps.push_back(std::log(prob));
+
+  ppspeech::FrameReductionOptions opts;
+  opts.enable = true;
+  opts.blank_threshold = 0.99;
+  opts.context = 1;
+  std::vector<int> frames;
+  ppspeech::SelectRescoringFrames(blank_logps, opts, &frames);
+  EXPECT_THAT(frames, ElementsAre(1, 2, 3, 4, 8, 9));
+
+  opts.context = 0;
+  ppspeech::SelectRescoringFrames(blank_logps, opts, &frames);
+  EXPECT_THAT(frames, ElementsAre(2, 3, 9));
+
+  // overlapping context, every frame once
+  opts.context = 4;
+  ppspeech::SelectRescoringFrames(blank_logps, opts, &frames);
+  EXPECT_THAT(frames, ElementsAre(0, 1, 2, 3, 4, 5, 6, 7, 8, 9));
+
+  // frame 3 is blank by a lower threshold
+  opts.context = 0;
+  opts.blank_threshold = 0.4;
+  ppspeech::SelectRescoringFrames(blank_logps, opts, &frames);
+  EXPECT_THAT(frames, ElementsAre(2, 9));
+
+  // all blank
+  ppspeech::SelectRescoringFrames(
+      std::vector<float>(5, std::log(0.999f)), opts, &frames);
+  EXPECT_TRUE(frames.empty());
+}
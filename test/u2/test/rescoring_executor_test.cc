@@ -0,0 +1,118 @@
+// Copyright (c) 2022 PaddlePaddle Authors. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "decoder/rescoring_executor.h"
+
+#include <algorithm>
+#include <atomic>
+#include <future>
+#include <memory>
+#include <thread>
+#include <vector>
+
+#include "gmock/gmock.h"
+#include "gtest/gtest.h"
+
+namespace {
+
+// score of a hyp is -(its length) * (frames of the model), so the result
+// tells which model rescored it
+class FakeAsrModel : public ppspeech::AsrModelItf {
+ public:
+  explicit FakeAsrModel(int num_frames) { offset_ = num_frames; }
+
+  void Reset() override {}
+
+  void AttentionRescoring(const std::vector<std::vector<int>>& hyps,
+                          float reverse_weight,
+                          std::vector<float>* rescoring_score) override {
+    rescoring_score->clear();
+    for (const auto& hyp : hyps) {
+      rescoring_score->push_back(-1.0f * hyp.size() * offset_);
+    }
+  }
+
+  void BatchAttentionRescoring(
+      const std::vector<ppspeech::AsrModelItf*>& models,
+      const std::vector<const std::vector<std::vector<int>>*>& hyps,
+      const std::vector<float>& reverse_weights,
+      std::vector<std::vector<float>>* rescoring_scores) override {
+    max_batch_size = std::max<int>(max_batch_size, models.size());
+    for (size_t i = 1; i < models.size(); ++i) {
+      // sorted by encoder length
+      EXPECT_LE(models[i - 1]->offset(), models[i]->offset());
+    }
+    AsrModelItf::BatchAttentionRescoring(
+        models, hyps, reverse_weights, rescoring_scores);
+  }
+
+  std::shared_ptr<ppspeech::AsrModelItf> Copy() const override {
+    return std::make_shared<FakeAsrModel>(offset_);
+  }
+  std::shared_ptr<ppspeech::AsrModelItf> CopyForRescoring() const override {
+    return std::make_shared<FakeAsrModel>(offset_);
+  }
+
+  static std::atomic<int> max_batch_size;
+
+ protected:
+  void ForwardEncoderChunkImpl(
+      const std::vector<std::vector<float>>& chunk_feats,
+      std::vector<std::vector<float>>* ctc_probs) override {}
+};
+
+std::atomic<int> FakeAsrModel::max_batch_size(0);
+
+}  // namespace
+
+TEST(RescoringExecutorTest, FutureTest) {
+  ppspeech::RescoringExecutorOptions opts;
+  ppspeech::RescoringExecutor executor(opts);
+  auto future = executor.Submit(
+      std::make_shared<FakeAsrModel>(10), {{1, 2}, {3}, {}}, 0.0f);
+  EXPECT_THAT(future.get(), ::testing::ElementsAre(-20.0f, -10.0f, 0.0f));
+}
+
+TEST(RescoringExecutorTest, BatchTest) {
+  ppspeech::RescoringExecutorOptions opts;
+  opts.num_threads = 2;
+  opts.max_batch_size = 8;
+  opts.max_wait_ms = 50;
+  ppspeech::RescoringExecutor executor(opts);
+  FakeAsrModel::max_batch_size = 0;
+
+  const int num_sessions = 64;
+  std::vector<std::promise<float>> scores(num_sessions);
+  std::vector<std::thread> threads;
+  for (int i = 0; i < num_sessions; ++i) {
+    threads.emplace_back([&executor, &scores, i]() {
+      executor.Submit(std::make_shared<FakeAsrModel>(num_sessions - i),
+                      {{1, 2, 3}},
+                      0.0f,
+                      [&scores, i](std::vector<float> rescoring_score) {
+                        scores[i].set_value(rescoring_score[0]);
+                      });
+    });
+  }
+  for (auto& thread : threads) thread.join();
+  executor.WaitIdle();
+
+  for (int i = 0; i < num_sessions; ++i) {
+    EXPECT_EQ(scores[i].get_future().get(), -3.0f * (num_sessions - i));
+  }
+  EXPECT_EQ(executor.num_requests(), num_sessions);
+  EXPECT_LT(executor.num_batches(), num_sessions);
+  EXPECT_GT(FakeAsrModel::max_batch_size, 1);
+  EXPECT_LE(FakeAsrModel::max_batch_size, opts.max_batch_size);
+}
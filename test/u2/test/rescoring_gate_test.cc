@@ -0,0 +1,241 @@
+// Copyright (c) 2022 PaddlePaddle Authors. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "decoder/asr_decoder.h"
+#include "frontend/feature_pipeline.h"
+#include "gmock/gmock.h"
+#include "gtest/gtest.h"
+#include "test/test_utils.h"
+
+namespace {
+
+using ppspeech::test::kSampleRate;
+using ppspeech::test::MakeAudio;
+
+// the counters of RescoringGateStats, to diff them around a rescoring
+struct GateCounts {
+  int64_t num_rescorings;
+  int64_t num_skip_empty;
+  int64_t num_skip_single;
+  int64_t num_skip_margin;
+  int64_t num_top_k;
+  int64_t num_tokens;
+  int64_t num_rescored_tokens;
+
+  static GateCounts Now() {
+    const ppspeech::RescoringGateStats& stats =
+        ppspeech::RescoringGateStats::Global();
+    return {stats.num_rescorings,
+            stats.num_skip_empty,
+            stats.num_skip_single,
+            stats.num_skip_margin,
+            stats.num_top_k,
+            stats.num_tokens,
+            stats.num_rescored_tokens};
+  }
+
+  GateCounts operator-(const GateCounts& other) const {
+    return {num_rescorings - other.num_rescorings,
+            num_skip_empty - other.num_skip_empty,
+            num_skip_single - other.num_skip_single,
+            num_skip_margin - other.num_skip_margin,
+            num_top_k - other.num_top_k,
+            num_tokens - other.num_tokens,
+            num_rescored_tokens - other.num_rescored_tokens};
+  }
+};
+
+class RescoringGateTest : public ppspeech::test::SyntheticDecodeTest {
+ protected:
+  // decodes seconds_ of audio and rescores it, counts gets the gate
+  // counters
+  std::vector<ppspeech::DecodeResult> Decode(GateCounts* counts) {
+    auto pipeline =
+        std::make_shared<ppspeech::FeaturePipeline>(feature_config_);
+    auto resource = ppspeech::test::MakeSyntheticResource(model_opts_);
+    ppspeech::AsrDecoder decoder(pipeline, resource, opts_);
+    decoder.set_record_stats(record_stats_);
+
+    std::vector<float> audio = MakeAudio(seconds_ * kSampleRate);
+    pipeline->AcceptWaveform(audio.data(), audio.size());
+    pipeline->SetInputFinished();
+    while (decoder.Decode() != ppspeech::DecodeState::kEndFeats) {
+    }
+    GateCounts before = GateCounts::Now();
+    decoder.Rescoring();
+    if (counts != nullptr) *counts = GateCounts::Now() - before;
+    return decoder.result();
+  }
+
+  // the ctc results, as with a skipped rescoring
+  std::vector<ppspeech::DecodeResult> DecodeWithoutRescoring() {
+    float rescoring_weight = opts_.rescoring_weight;
+    opts_.rescoring_weight = 0.0;
+    std::vector<ppspeech::DecodeResult> result = Decode(nullptr);
+    opts_.rescoring_weight = rescoring_weight;
+    return result;
+  }
+
+  float seconds_ = 2.0f;
+  bool record_stats_ = true;
+};
+
+void ExpectSameResults(const std::vector<ppspeech::DecodeResult>& a,
+                       const std::vector<ppspeech::DecodeResult>& b) {
+  ASSERT_EQ(a.size(), b.size());
+  for (size_t i = 0; i < a.size(); ++i) {
+    EXPECT_EQ(a[i].sentence, b[i].sentence) << i;
+    EXPECT_EQ(a[i].score, b[i].score) << i;
+  }
+}
+
+}  // namespace
+
+TEST_F(RescoringGateTest, DefaultRescoresAll) {
+  // the best hyp is empty on 1s of blank frames, still rescored by default
+  seconds_ = 1.0f;
+  model_opts_.blank_ratio = 1.0f;
+  std::vector<ppspeech::DecodeResult> ctc = DecodeWithoutRescoring();
+  ASSERT_TRUE(ctc[0].sentence.empty());
+  GateCounts counts;
+  std::vector<ppspeech::DecodeResult> result = Decode(&counts);
+  ASSERT_GT(result.size(), 1);
+  EXPECT_EQ(counts.num_rescorings, 1);
+  EXPECT_EQ(counts.num_skip_empty, 0);
+  EXPECT_EQ(counts.num_skip_single, 0);
+  EXPECT_EQ(counts.num_skip_margin, 0);
+  EXPECT_EQ(counts.num_top_k, 0);
+  EXPECT_GT(counts.num_tokens, 0);
+  EXPECT_EQ(counts.num_rescored_tokens, counts.num_tokens);
+  EXPECT_NE(result[0].score, ctc[0].score);
+}
+
+TEST_F(RescoringGateTest, SkipEmpty) {
+  seconds_ = 1.0f;
+  model_opts_.blank_ratio = 1.0f;
+  opts_.rescoring_skip_empty = true;
+  GateCounts counts;
+  std::vector<ppspeech::DecodeResult> result = Decode(&counts);
+  ASSERT_FALSE(result.empty());
+  EXPECT_TRUE(result[0].sentence.empty());
+  EXPECT_EQ(counts.num_rescorings, 1);
+  EXPECT_EQ(counts.num_skip_empty, 1);
+  EXPECT_EQ(counts.num_rescored_tokens, 0);
+  ExpectSameResults(result, DecodeWithoutRescoring());
+
+  // a best hyp with tokens is rescored
+  model_opts_.blank_ratio = 0.7f;
+  result = Decode(&counts);
+  ASSERT_FALSE(result[0].sentence.empty());
+  EXPECT_EQ(counts.num_skip_empty, 0);
+  EXPECT_EQ(counts.num_rescored_tokens, counts.num_tokens);
+}
+
+TEST_F(RescoringGateTest, SkipSingle) {
+  opts_.ctc_prefix_search_opts.second_beam_size = 1;
+  GateCounts counts;
+  std::vector<ppspeech::DecodeResult> result = Decode(&counts);
+  ASSERT_EQ(result.size(), 1);
+  EXPECT_EQ(counts.num_skip_single, 0);
+  EXPECT_EQ(counts.num_rescored_tokens, counts.num_tokens);
+
+  opts_.rescoring_skip_single = true;
+  result = Decode(&counts);
+  EXPECT_EQ(counts.num_rescorings, 1);
+  EXPECT_EQ(counts.num_skip_single, 1);
+  EXPECT_EQ(counts.num_rescored_tokens, 0);
+  ExpectSameResults(result, DecodeWithoutRescoring());
+}
+
+TEST_F(RescoringGateTest, SkipMargin) {
+  std::vector<ppspeech::DecodeResult> ctc = DecodeWithoutRescoring();
+  ASSERT_GT(ctc.size(), 1);
+  float margin = ctc[0].score - ctc[1].score;
+  ASSERT_GT(margin, 0.0f);
+
+  // above the margin of the best hyp, rescored
+  opts_.rescoring_skip_margin = 2 * margin;
+  GateCounts counts;
+  Decode(&counts);
+  EXPECT_EQ(counts.num_skip_margin, 0);
+  EXPECT_EQ(counts.num_rescored_tokens, counts.num_tokens);
+
+  opts_.rescoring_skip_margin = margin / 2;
+  std::vector<ppspeech::DecodeResult> result = Decode(&counts);
+  EXPECT_EQ(counts.num_rescorings, 1);
+  EXPECT_EQ(counts.num_skip_margin, 1);
+  EXPECT_EQ(counts.num_rescored_tokens, 0);
+  ExpectSameResults(result, ctc);
+}
+
+TEST_F(RescoringGateTest, SkipMarginSingle) {
+  // no second hyp to take the margin to, rescored
+  opts_.ctc_prefix_search_opts.second_beam_size = 1;
+  opts_.rescoring_skip_margin = 1.0f;
+  GateCounts counts;
+  std::vector<ppspeech::DecodeResult> result = Decode(&counts);
+  ASSERT_EQ(result.size(), 1);
+  EXPECT_EQ(counts.num_rescorings, 1);
+  EXPECT_EQ(counts.num_skip_margin, 0);
+  EXPECT_GT(counts.num_tokens, 0);
+  EXPECT_EQ(counts.num_rescored_tokens, counts.num_tokens);
+}
+
+TEST_F(RescoringGateTest, TopK) {
+  std::vector<ppspeech::DecodeResult> ctc = DecodeWithoutRescoring();
+  ASSERT_GT(ctc.size(), 2);
+
+  opts_.rescoring_top_k = 2;
+  GateCounts counts;
+  std::vector<ppspeech::DecodeResult> result = Decode(&counts);
+  EXPECT_EQ(counts.num_rescorings, 1);
+  EXPECT_EQ(counts.num_top_k, 1);
+  EXPECT_GT(counts.num_rescored_tokens, 0);
+  EXPECT_LT(counts.num_rescored_tokens, counts.num_tokens);
+  // the rest of the n-best is kept in ctc order, after the rescored hyps
+  ASSERT_EQ(result.size(), ctc.size());
+  std::vector<std::string> top = {ctc[0].sentence, ctc[1].sentence};
+  EXPECT_THAT(top,
+              ::testing::UnorderedElementsAre(result[0].sentence,
+                                              result[1].sentence));
+  for (size_t i = 2; i < ctc.size(); ++i) {
+    EXPECT_EQ(result[i].sentence, ctc[i].sentence) << i;
+    EXPECT_EQ(result[i].score, ctc[i].score) << i;
+  }
+
+  // a k above the n-best rescores all
+  opts_.rescoring_top_k = ctc.size();
+  result = Decode(&counts);
+  EXPECT_EQ(counts.num_top_k, 0);
+  EXPECT_EQ(result.size(), ctc.size());
+  EXPECT_EQ(counts.num_rescored_tokens, counts.num_tokens);
+}
+
+TEST_F(RescoringGateTest, NotRecorded) {
+  opts_.rescoring_top_k = 2;
+  std::vector<ppspeech::DecodeResult> recorded = Decode(nullptr);
+  record_stats_ = false;
+  GateCounts counts;
+  std::vector<ppspeech::DecodeResult> result = Decode(&counts);
+  EXPECT_EQ(counts.num_rescorings, 0);
+  EXPECT_EQ(counts.num_top_k, 0);
+  EXPECT_EQ(counts.num_tokens, 0);
+  EXPECT_EQ(counts.num_rescored_tokens, 0);
+  ExpectSameResults(result, recorded);
+}
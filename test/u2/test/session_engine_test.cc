@@ -0,0 +1,158 @@
+// Copyright (c) 2022 PaddlePaddle Authors. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "decoder/session_engine.h"
+
+#include <chrono>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "gmock/gmock.h"
+#include "gtest/gtest.h"
+#include "test/test_utils.h"
+
+namespace {
+
+using ppspeech::test::kSampleRate;
+using ppspeech::test::MakeAudio;
+
+// blocks until the engine has num_live sessions, all waiting for audio
+void WaitIdle(const ppspeech::SessionEngine& engine, int num_live) {
+  auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds(10);
+  while (engine.num_live_sessions() != num_live ||
+         engine.num_idle_sessions() != num_live) {
+    ASSERT_LT(std::chrono::steady_clock::now(), deadline);
+    std::this_thread::sleep_for(std::chrono::milliseconds(1));
+  }
+}
+
+class SessionEngineTest : public ppspeech::test::SyntheticDecodeTest {
+ protected:
+  // a session which records its key once it is finished
+  std::shared_ptr<ppspeech::AsrSession> NewSession(const std::string& key) {
+    auto session = std::make_shared<ppspeech::AsrSession>(
+        key, feature_config_, resource_, opts_);
+    session->set_final_callback([this](ppspeech::AsrSession* session) {
+      std::lock_guard<std::mutex> lock(mutex_);
+      finished_.push_back(session->key());
+    });
+    return session;
+  }
+
+  std::vector<std::string> finished() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return finished_;
+  }
+
+  std::mutex mutex_;
+  std::vector<std::string> finished_;
+};
+
+}  // namespace
+
+TEST_F(SessionEngineTest, EvictTest) {
+  ppspeech::SessionEngine engine(1);
+  std::vector<float> audio = MakeAudio(kSampleRate, 0);
+  std::shared_ptr<ppspeech::AsrSession> a = NewSession("a");
+  std::shared_ptr<ppspeech::AsrSession> b = NewSession("b");
+  std::shared_ptr<ppspeech::AsrSession> c = NewSession("c");
+  engine.AddSession(a);
+  engine.AddSession(b);
+  engine.AddSession(c);
+
+  // decoded in the order a, b, c, a, so b is the least recently decoded
+  for (auto* session : {a.get(), b.get(), c.get(), a.get()}) {
+    session->AcceptWaveform(audio.data(), audio.size());
+    WaitIdle(engine, 3);
+  }
+  // read on this thread as no session is decoding
+  int64_t a_bytes = a->memory_usage().total();
+  int64_t b_bytes = b->memory_usage().total();
+  int64_t c_bytes = c->memory_usage().total();
+  ASSERT_GT(b_bytes, 0);
+  int64_t memory_bytes = engine.memory_bytes();
+  EXPECT_EQ(memory_bytes, a_bytes + b_bytes + c_bytes);
+  EXPECT_EQ(engine.num_evicted(), 0);
+
+  // over the limit by less than b, which is enough to evict
+  int64_t limit = memory_bytes - b_bytes / 2;
+  engine.set_memory_limit(limit);
+  // b counts as gone while its eviction is queued, nothing more is evicted
+  engine.set_memory_limit(limit);
+  WaitIdle(engine, 2);
+  EXPECT_EQ(engine.num_evicted(), 1);
+  EXPECT_THAT(finished(), ::testing::ElementsAre("b"));
+  // finished early with the result so far
+  EXPECT_TRUE(b->evicted());
+  EXPECT_TRUE(b->finished());
+  EXPECT_FALSE(b->final_result().empty());
+  EXPECT_FALSE(a->finished());
+  EXPECT_FALSE(c->finished());
+  EXPECT_EQ(engine.memory_bytes(), a_bytes + c_bytes);
+
+  // the rest, least recently decoded first
+  engine.set_memory_limit(1);
+  WaitIdle(engine, 0);
+  EXPECT_EQ(engine.num_evicted(), 3);
+  EXPECT_THAT(finished(), ::testing::ElementsAre("b", "c", "a"));
+  EXPECT_TRUE(a->evicted());
+  EXPECT_TRUE(c->evicted());
+  EXPECT_EQ(engine.memory_bytes(), 0);
+  EXPECT_GE(engine.peak_memory_bytes(), memory_bytes);
+  engine.WaitAll();
+}
+
+TEST_F(SessionEngineTest, NoLimitTest) {
+  ppspeech::SessionEngine engine(2);
+  std::vector<float> audio = MakeAudio(2 * kSampleRate, 0);
+  std::vector<std::shared_ptr<ppspeech::AsrSession>> sessions;
+  for (int i = 0; i < 4; ++i) {
+    sessions.push_back(NewSession(std::to_string(i)));
+    engine.AddSession(sessions.back());
+  }
+  for (auto& session : sessions) {
+    session->AcceptWaveform(audio.data(), audio.size());
+    session->SetInputFinished();
+  }
+  engine.WaitAll();
+  EXPECT_EQ(engine.num_live_sessions(), 0);
+  EXPECT_EQ(engine.num_evicted(), 0);
+  EXPECT_EQ(engine.memory_bytes(), 0);
+  EXPECT_GT(engine.peak_memory_bytes(), 0);
+  EXPECT_THAT(finished(), ::testing::UnorderedElementsAre("0", "1", "2", "3"));
+  for (auto& session : sessions) {
+    EXPECT_FALSE(session->evicted());
+    EXPECT_EQ(session->final_result(), sessions[0]->final_result());
+  }
+}
+
+TEST_F(SessionEngineTest, FullQueueTest) {
+  // more sessions ready at once than the queue of a worker holds, so adding
+  // them waits for the worker, which takes the lock of the engine to run
+  const int num_sessions = 1500;
+  ppspeech::SessionEngine engine(1);
+  std::vector<float> audio = MakeAudio(kSampleRate / 2, 0);
+  std::vector<std::shared_ptr<ppspeech::AsrSession>> sessions;
+  for (int i = 0; i < num_sessions; ++i) {
+    sessions.push_back(NewSession(std::to_string(i)));
+    sessions.back()->AcceptWaveform(audio.data(), audio.size());
+    sessions.back()->SetInputFinished();
+  }
+  for (auto& session : sessions) engine.AddSession(session);
+  engine.WaitAll();
+  EXPECT_EQ(finished().size(), num_sessions);
+}
@@ -0,0 +1,116 @@
+// Copyright (c) 2022 PaddlePaddle Authors. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "decoder/session_pool.h"
+
+#include <algorithm>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "gmock/gmock.h"
+#include "gtest/gtest.h"
+#include "test/test_utils.h"
+
+namespace {
+
+using ppspeech::test::kSampleRate;
+using ppspeech::test::MakeAudio;
+
+// feeds audio in packets of 100ms and steps the session to its end
+void DecodeAudio(const std::vector<float>& audio,
+                 ppspeech::AsrSession* session) {
+  const int packet_samples = kSampleRate / 10;
+  for (size_t begin = 0; begin < audio.size(); begin += packet_samples) {
+    int size = std::min<size_t>(packet_samples, audio.size() - begin);
+    session->AcceptWaveform(audio.data() + begin, size);
+    if (begin + size == audio.size()) session->SetInputFinished();
+    ppspeech::DecodeState state = ppspeech::DecodeState::kEndBatch;
+    while (state != ppspeech::DecodeState::kWaitFeats &&
+           state != ppspeech::DecodeState::kEndFeats) {
+      state = session->Step();
+    }
+  }
+  ASSERT_TRUE(session->finished());
+}
+
+void ExpectSameResults(const ppspeech::AsrSession& a,
+                       const ppspeech::AsrSession& b) {
+  EXPECT_EQ(a.final_result(), b.final_result());
+  ASSERT_EQ(a.final_nbest().size(), b.final_nbest().size());
+  for (size_t i = 0; i < a.final_nbest().size(); ++i) {
+    EXPECT_EQ(a.final_nbest()[i].sentence, b.final_nbest()[i].sentence) << i;
+    EXPECT_EQ(a.final_nbest()[i].score, b.final_nbest()[i].score) << i;
+  }
+}
+
+using SessionPoolTest = ppspeech::test::SyntheticDecodeTest;
+
+}  // namespace
+
+TEST_F(SessionPoolTest, ReuseTest) {
+  ppspeech::SessionPool pool(feature_config_, resource_, opts_, 2);
+  EXPECT_EQ(pool.num_sessions(), 2);
+  EXPECT_EQ(pool.num_idle(), 2);
+  EXPECT_EQ(pool.num_acquired(), 0);
+
+  // a released session is handed out again
+  std::shared_ptr<ppspeech::AsrSession> session = pool.Acquire("a");
+  EXPECT_EQ(session->key(), "a");
+  EXPECT_EQ(pool.num_idle(), 1);
+  ppspeech::AsrSession* first = session.get();
+  session.reset();
+  EXPECT_EQ(pool.num_idle(), 2);
+  session = pool.Acquire("b");
+  EXPECT_EQ(session.get(), first);
+  EXPECT_EQ(session->key(), "b");
+
+  // more sessions are built once the idle ones are out
+  std::vector<std::shared_ptr<ppspeech::AsrSession>> sessions;
+  for (int i = 0; i < 3; ++i) sessions.push_back(pool.Acquire("c"));
+  EXPECT_EQ(pool.num_sessions(), 4);
+  EXPECT_EQ(pool.num_idle(), 0);
+  EXPECT_EQ(pool.num_acquired(), 5);
+
+  session.reset();
+  sessions.clear();
+  EXPECT_EQ(pool.num_sessions(), 4);
+  EXPECT_EQ(pool.num_idle(), 4);
+  EXPECT_EQ(pool.num_acquired(), 5);
+}
+
+TEST_F(SessionPoolTest, ResetTest) {
+  std::vector<float> former = MakeAudio(3 * kSampleRate, 1);
+  std::vector<float> audio = MakeAudio(2 * kSampleRate, 2);
+
+  ppspeech::AsrSession fresh("fresh", feature_config_, resource_, opts_);
+  DecodeAudio(audio, &fresh);
+  ASSERT_FALSE(fresh.final_result().empty());
+
+  ppspeech::SessionPool pool(feature_config_, resource_, opts_, 1);
+  std::shared_ptr<ppspeech::AsrSession> session = pool.Acquire("former");
+  DecodeAudio(former, session.get());
+  ASSERT_NE(session->final_result(), fresh.final_result());
+  ppspeech::AsrSession* used = session.get();
+  session.reset();
+
+  // decodes as a new session once Reset() by the pool
+  session = pool.Acquire("again");
+  ASSERT_EQ(session.get(), used);
+  EXPECT_FALSE(session->finished());
+  EXPECT_TRUE(session->final_result().empty());
+  EXPECT_TRUE(session->final_nbest().empty());
+  DecodeAudio(audio, session.get());
+  ExpectSameResults(*session, fresh);
+}
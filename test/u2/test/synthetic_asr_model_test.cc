@@ -0,0 +1,163 @@
+// Copyright (c) 2022 PaddlePaddle Authors. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "decoder/synthetic_asr_model.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <memory>
+#include <random>
+#include <string>
+#include <vector>
+
+#include "gmock/gmock.h"
+#include "gtest/gtest.h"
+#include "utils/io.h"
+
+namespace {
+
+using Frames = std::vector<std::vector<float>>;
+
+Frames RandomFeats(int num_frames, unsigned int seed) {
+  std::mt19937 rng(seed);
+  std::normal_distribution<float> feat(0.0f, 1.0f);
+  Frames feats(num_frames, std::vector<float>(80));
+  for (auto& frame : feats) {
+    for (float& value : frame) value = feat(rng);
+  }
+  return feats;
+}
+
+// the posteriors of feats fed chunk by chunk as the decoder does
+Frames Forward(ppspeech::AsrModelItf* model, const Frames& feats) {
+  Frames posteriors;
+  size_t begin = 0;
+  bool start = true;
+  while (begin < feats.size()) {
+    size_t end = std::min<size_t>(
+        feats.size(), begin + model->num_frames_for_chunk(!start));
+    Frames chunk(feats.begin() + begin, feats.begin() + end);
+    Frames ctc_probs;
+    model->ForwardEncoderChunk(chunk, &ctc_probs);
+    posteriors.insert(posteriors.end(), ctc_probs.begin(), ctc_probs.end());
+    begin = end;
+    start = false;
+  }
+  return posteriors;
+}
+
+ppspeech::SyntheticModelOptions SmallOptions() {
+  ppspeech::SyntheticModelOptions opts;
+  opts.vocab_size = 500;
+  return opts;
+}
+
+}  // namespace
+
+TEST(SyntheticAsrModelTest, PosteriorsTest) {
+  ppspeech::SyntheticModelOptions opts = SmallOptions();
+  ppspeech::SyntheticAsrModel model(opts);
+  model.set_chunk_size(16);
+  // 10s of features
+  Frames feats = RandomFeats(1000, 0);
+  Frames posteriors = Forward(&model, feats);
+  // subsampled by 4 with a right context of 6
+  EXPECT_EQ(posteriors.size(), (feats.size() - 7) / 4 + 1);
+  EXPECT_EQ(model.offset(), posteriors.size());
+
+  int num_blank = 0;
+  for (const auto& logp : posteriors) {
+    ASSERT_EQ(logp.size(), opts.vocab_size);
+    double sum = 0.0;
+    for (float value : logp) sum += std::exp(value);
+    EXPECT_NEAR(sum, 1.0, 1e-3);
+    int peak = std::max_element(logp.begin(), logp.end()) - logp.begin();
+    EXPECT_NE(peak, 1);
+    EXPECT_NE(peak, opts.vocab_size - 1);
+    if (peak == 0) ++num_blank;
+  }
+  EXPECT_NEAR(static_cast<float>(num_blank) / posteriors.size(),
+              opts.blank_ratio,
+              0.1);
+
+  // the same on another copy, different for other features
+  auto copy = model.Copy();
+  copy->set_chunk_size(16);
+  EXPECT_EQ(copy->offset(), 0);
+  EXPECT_EQ(Forward(copy.get(), feats), posteriors);
+  copy->Reset();
+  EXPECT_NE(Forward(copy.get(), RandomFeats(1000, 1)), posteriors);
+}
+
+TEST(SyntheticAsrModelTest, SnapshotTest) {
+  ppspeech::SyntheticAsrModel model(SmallOptions());
+  model.set_chunk_size(16);
+  Frames feats = RandomFeats(600, 0);
+  Frames head(feats.begin(), feats.begin() + 67);
+  Frames tail(feats.begin() + 67, feats.end());
+  Frames posteriors;
+  model.ForwardEncoderChunk(head, &posteriors);
+
+  std::string snapshot;
+  ppspeech::BinaryWriter writer(&snapshot);
+  ASSERT_TRUE(model.SaveState(&writer));
+  auto restored = model.Copy();
+  restored->set_chunk_size(16);
+  ppspeech::BinaryReader reader(snapshot);
+  ASSERT_TRUE(restored->LoadState(&reader));
+  EXPECT_TRUE(reader.done());
+  EXPECT_EQ(restored->offset(), model.offset());
+
+  EXPECT_EQ(Forward(restored.get(), tail), Forward(&model, tail));
+}
+
+TEST(SyntheticAsrModelTest, RescoringTest) {
+  ppspeech::SyntheticAsrModel model(SmallOptions());
+  std::vector<std::vector<int>> hyps = {{5, 6, 7}, {5, 6}, {}};
+  std::vector<float> scores, reverse_scores, again;
+  model.AttentionRescoring(hyps, 0.0f, &scores);
+  model.AttentionRescoring(hyps, 0.3f, &reverse_scores);
+  model.CopyForRescoring()->AttentionRescoring(hyps, 0.3f, &again);
+  ASSERT_EQ(scores.size(), hyps.size());
+  for (float score : scores) EXPECT_LT(score, 0.0f);
+  EXPECT_NE(scores, reverse_scores);
+  EXPECT_EQ(reverse_scores, again);
+}
+
+TEST(SyntheticAsrModelTest, ComputeTest) {
+  EXPECT_GT(ppspeech::SyntheticAsrModel::GemmsPerMicrosecond(), 0.0);
+  ppspeech::SyntheticModelOptions opts = SmallOptions();
+  opts.encoder_us_per_frame = 1000;
+  ppspeech::SyntheticAsrModel model(opts);
+  model.set_chunk_size(16);
+  Frames chunk = RandomFeats(67, 0), posteriors;
+  auto start = std::chrono::steady_clock::now();
+  model.ForwardEncoderChunk(chunk, &posteriors);
+  double ms = std::chrono::duration<double, std::milli>(
+                  std::chrono::steady_clock::now() - start)
+                  .count();
+  ASSERT_EQ(posteriors.size(), 16);
+  // 16ms of compute, slower on a busy machine
+  EXPECT_GT(ms, 8.0);
+}
+
+TEST(SyntheticAsrModelTest, UnitTableTest) {
+  auto table = ppspeech::SyntheticAsrModel::MakeUnitTable(500);
+  EXPECT_EQ(table->NumSymbols(), 500);
+  const int64_t blank = 0, first_char = 2, eos = 499;
+  EXPECT_EQ(table->Find(blank), "<blank>");
+  EXPECT_EQ(table->Find(first_char), "\xe4\xb8\x80");  // U+4E00
+  EXPECT_EQ(table->Find(eos), "<sos/eos>");
+}
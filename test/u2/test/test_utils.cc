@@ -0,0 +1,79 @@
+// Copyright (c) 2022 PaddlePaddle Authors. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "test/test_utils.h"
+
+#include <unistd.h>
+
+#include <cmath>
+#include <cstdio>
+#include <fstream>
+#include <random>
+
+#include "utils/log.h"
+
+namespace ppspeech {
+namespace test {
+
+std::string WriteCmvn(int num_bins) {
+  char path[] = "/tmp/u2_test_cmvn_XXXXXX";
+  int fd = mkstemp(path);
+  CHECK_GE(fd, 0);
+  close(fd);
+  std::ofstream stats(path);
+  const int num_frames = 100;
+  stats << "{\"frame_num\": " << num_frames << ", \"mean_stat\": [";
+  for (int i = 0; i < num_bins; ++i) stats << (i == 0 ? "" : ", ") << 0.0;
+  stats << "], \"var_stat\": [";
+  for (int i = 0; i < num_bins; ++i) {
+    stats << (i == 0 ? "" : ", ") << num_frames;
+  }
+  stats << "]}";
+  return path;
+}
+
+std::vector<float> MakeAudio(int num_samples, unsigned int seed) {
+  std::mt19937 rng(seed);
+  std::normal_distribution<float> noise(0.0f, 300.0f);
+  std::vector<float> audio(num_samples);
+  for (int i = 0; i < num_samples; ++i) {
+    audio[i] = 3000.0f * std::sin(i * 0.05f) + noise(rng);
+  }
+  return audio;
+}
+
+std::shared_ptr<DecodeResource> MakeSyntheticResource(
+    const SyntheticModelOptions& model_opts) {
+  auto resource = std::make_shared<DecodeResource>();
+  resource->model = std::make_shared<SyntheticAsrModel>(model_opts);
+  resource->unit_table =
+      SyntheticAsrModel::MakeUnitTable(model_opts.vocab_size);
+  resource->symbol_table = resource->unit_table;
+  return resource;
+}
+
+SyntheticDecodeTest::SyntheticDecodeTest()
+    : cmvn_path_(WriteCmvn()),
+      feature_config_(kNumBins, kSampleRate, cmvn_path_) {
+  model_opts_.vocab_size = 500;
+  resource_ = MakeSyntheticResource(model_opts_);
+  opts_.chunk_size = 16;
+}
+
+SyntheticDecodeTest::~SyntheticDecodeTest() {
+  std::remove(cmvn_path_.c_str());
+}
+
+}  // namespace test
+}  // namespace ppspeech
@@ -0,0 +1,63 @@
+// Copyright (c) 2022 PaddlePaddle Authors. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+// Inputs of the tests decoding with the SyntheticAsrModel, which needs no
+// model files: cmvn stats, audio and the decode resource.
+
+#pragma once
+
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "decoder/asr_decoder.h"
+#include "decoder/synthetic_asr_model.h"
+#include "frontend/feature_pipeline.h"
+#include "gtest/gtest.h"
+
+namespace ppspeech {
+namespace test {
+
+const int kSampleRate = 16000;
+const int kNumBins = 80;
+
+// Writes cmvn stats of zero mean and unit variance to a temporary file and
+// returns its path, for the caller to remove.
+std::string WriteCmvn(int num_bins = kNumBins);
+
+// a tone under noise, at the int16 scale of the decoder input
+std::vector<float> MakeAudio(int num_samples, unsigned int seed = 0);
+
+// a resource of a SyntheticAsrModel with its unit table as symbol table
+std::shared_ptr<DecodeResource> MakeSyntheticResource(
+    const SyntheticModelOptions& model_opts);
+
+// Fixture of the synthetic model with a small vocab, decoded in chunks of
+// 16 frames. resource_ is built from model_opts_ by the constructor, rebuild
+// it after changing them.
+class SyntheticDecodeTest : public ::testing::Test {
+ protected:
+  SyntheticDecodeTest();
+  ~SyntheticDecodeTest() override;
+
+  std::string cmvn_path_;
+  // the decoders and sessions keep references to the configs
+  FeaturePipelineConfig feature_config_;
+  SyntheticModelOptions model_opts_;
+  std::shared_ptr<DecodeResource> resource_;
+  DecodeOptions opts_;
+};
+
+}  // namespace test
+}  // namespace ppspeech
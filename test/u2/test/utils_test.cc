@@ -14,10 +14,27 @@
 
 #include "utils/utils.h"
 
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <cmath>
+#include <map>
+#include <mutex>
+#include <random>
+#include <set>
+#include <thread>
+#include <utility>
 #include <vector>
 
 #include "gmock/gmock.h"
 #include "gtest/gtest.h"
+#include "utils/arena.h"
+#include "utils/cpu_affinity.h"
+#include "utils/fp16.h"
+#include "utils/latency_stats.h"
+#include "utils/spsc_channel.h"
+#include "utils/thread_pool.h"
+#include "utils/tracer.h"
 
 TEST(UtilsTest, TopKTest) {
   using ::testing::ElementsAre;
@@ -30,4 +47,545 @@ TEST(UtilsTest, TopKTest) {
   ppspeech::TopK(data, 3, &values, &indices);
   EXPECT_THAT(values, Pointwise(FloatNear(1e-8), {10, 9, 8}));
   EXPECT_THAT(indices, ElementsAre(9, 4, 8));
-}
\ No newline at end of file
+}
+// reference top k by full sort, larger value then smaller index first
+static void SortTopK(const std::vector<float>& data,
+                     int k,
+                     std::vector<float>* values,
+                     std::vector<int>* indices) {
+  std::vector<int> order(data.size());
+  for (size_t i = 0; i < order.size(); ++i) order[i] = i;
+  std::stable_sort(order.begin(), order.end(), [&data](int a, int b) {
+    return data[a] > data[b];
+  });
+  order.resize(std::min<size_t>(k, order.size()));
+  indices->assign(order.begin(), order.end());
+  values->clear();
+  for (int i : order) values->push_back(data[i]);
+}
+
+TEST(UtilsTest, TopKRandomTest) {
+  std::mt19937 rng(7);
+  // few distinct values to have many ties
+  std::uniform_int_distribution<int> coarse(-20, 0);
+  std::normal_distribution<float> fine(-10.0f, 3.0f);
+  for (int n : {1, 7, 8, 9, 63, 1000, 5537}) {
+    for (int k : {1, 3, 10, 32, 100}) {
+      for (int trial = 0; trial < 2; ++trial) {
+        std::vector<float> data(n);
+        for (auto& x : data) x = trial == 0 ? coarse(rng) : fine(rng);
+        std::vector<float> ref_values, values(k);
+        std::vector<int> ref_indices, indices(k);
+        SortTopK(data, k, &ref_values, &ref_indices);
+        int num = ppspeech::TopK(data.data(), n, k, values.data(),
+                                 indices.data());
+        ASSERT_EQ(num, ref_values.size());
+        values.resize(num);
+        indices.resize(num);
+        EXPECT_EQ(values, ref_values) << n << " " << k;
+        EXPECT_EQ(indices, ref_indices) << n << " " << k;
+      }
+    }
+  }
+}
+
+TEST(UtilsTest, TopKFloat16Test) {
+  std::mt19937 rng(11);
+  std::normal_distribution<float> dist(-10.0f, 3.0f);
+  const int n = 5001, k = 10;
+  std::vector<ppspeech::float16> data(n);
+  std::vector<float> data_fp32(n);
+  for (int i = 0; i < n; ++i) {
+    data[i] = ppspeech::float16(dist(rng));
+    data_fp32[i] = static_cast<float>(data[i]);
+  }
+  std::vector<float> ref_values, values(k);
+  std::vector<int> ref_indices, indices(k);
+  SortTopK(data_fp32, k, &ref_values, &ref_indices);
+  ASSERT_EQ(ppspeech::TopK(data.data(), n, k, values.data(), indices.data()),
+            k);
+  EXPECT_EQ(values, ref_values);
+  EXPECT_EQ(indices, ref_indices);
+}
+
+TEST(UtilsTest, Float16Test) {
+  // every finite half survives the round trip through float
+  for (int h = 0; h < 65536; ++h) {
+    if ((h & 0x7c00) == 0x7c00) continue;
+    float f = ppspeech::float16::ToFloat(h);
+    EXPECT_EQ(ppspeech::float16::FromFloat(f), h);
+  }
+  EXPECT_EQ(static_cast<float>(ppspeech::float16(65504.0f)), 65504.0f);
+  EXPECT_EQ(static_cast<float>(ppspeech::float16(std::ldexp(1.0f, -24))),
+            std::ldexp(1.0f, -24));
+  EXPECT_EQ(static_cast<float>(ppspeech::float16(1e6f)),
+            std::numeric_limits<float>::infinity());
+  EXPECT_EQ(static_cast<float>(ppspeech::float16(1e-9f)), 0.0f);
+  // round to nearest even
+  EXPECT_EQ(static_cast<float>(ppspeech::float16(1.0f + 1.0f / 2048)), 1.0f);
+  EXPECT_EQ(static_cast<float>(ppspeech::float16(1.0f + 3.0f / 2048)),
+            1.0f + 4.0f / 2048);
+}
+
+TEST(UtilsTest, EditDistanceTest) {
+  std::vector<int> ref = {1, 2, 3, 4};
+  EXPECT_EQ(ppspeech::EditDistance(ref, ref), 0);
+  EXPECT_EQ(ppspeech::EditDistance(ref, std::vector<int>{}), 4);
+  EXPECT_EQ(ppspeech::EditDistance(std::vector<int>{}, ref), 4);
+  EXPECT_EQ(ppspeech::EditDistance(ref, std::vector<int>{1, 3, 4, 5}), 2);
+  EXPECT_EQ(ppspeech::EditDistance(ref, std::vector<int>{2, 2, 3, 4}), 1);
+}
+
+TEST(UtilsTest, FastLogSumExpTest) {
+  const float kMin = -ppspeech::kFloatMax;
+  for (float x = -40; x <= 0; x += 0.0371f) {
+    for (float y = -40; y <= 0; y += 0.53f) {
+      // table error plus the rounding of the result
+      float tolerance = 2e-6 + 2.5e-7 * std::max(-x, -y);
+      EXPECT_NEAR(ppspeech::FastLogSumExp(x, y),
+                  ppspeech::LogSumExp(x, y),
+                  tolerance);
+    }
+  }
+  EXPECT_EQ(ppspeech::FastLogSumExp(kMin, -3.0f), -3.0f);
+  EXPECT_EQ(ppspeech::FastLogSumExp(-3.0f, kMin), -3.0f);
+  EXPECT_EQ(ppspeech::FastLogSumExp(kMin, kMin), kMin);
+}
+
+TEST(UtilsTest, BatchLogSumExpTest) {
+  // odd size to cover the scalar tail of the vectorized loop
+  const int n = 1001;
+  std::vector<float> x(n), y(n), out(n);
+  for (int i = 0; i < n; ++i) {
+    x[i] = -0.05f * i;
+    y[i] = -0.03f * (n - i);
+  }
+  x[7] = -ppspeech::kFloatMax;
+  y[9] = -ppspeech::kFloatMax;
+  x[11] = y[11] = -ppspeech::kFloatMax;
+  ppspeech::LogSumExp(x.data(), y.data(), out.data(), n);
+  for (int i = 0; i < n; ++i) {
+    EXPECT_FLOAT_EQ(out[i], ppspeech::FastLogSumExp(x[i], y[i])) << i;
+  }
+  EXPECT_EQ(out[11], -ppspeech::kFloatMax);
+}
+
+// n-best of a plain ctc prefix beam search over the whole vocab, log-adding
+// by log_add, with the prefix scores in descending order
+static std::vector<std::pair<std::vector<int>, float>> PrefixBeamSearch(
+    const std::vector<std::vector<float>>& logp,
+    int beam,
+    float (*log_add)(float, float)) {
+  const float kMin = -ppspeech::kFloatMax;
+  using Beam = std::map<std::vector<int>, std::pair<float, float>>;  // b, nb
+  std::vector<std::pair<std::vector<int>, float>> nbest = {{{}, 0.0f}};
+  Beam hyps = {{{}, {0.0f, kMin}}};
+  for (const auto& frame : logp) {
+    Beam next;
+    const std::pair<float, float> empty(kMin, kMin);
+    auto get = [&next, &empty](const std::vector<int>& prefix) {
+      return &next.emplace(prefix, empty).first->second;
+    };
+    for (const auto& hyp : hyps) {
+      const std::vector<int>& prefix = hyp.first;
+      float b = hyp.second.first, nb = hyp.second.second;
+      float score = log_add(b, nb);
+      for (int id = 0; id < static_cast<int>(frame.size()); ++id) {
+        float p = frame[id];
+        if (id == 0) {
+          auto* next_score = get(prefix);
+          next_score->first = log_add(next_score->first, score + p);
+          continue;
+        }
+        std::vector<int> extended = prefix;
+        extended.push_back(id);
+        auto* extended_score = get(extended);
+        if (!prefix.empty() && prefix.back() == id) {
+          // a repeat without blank between stays the same prefix
+          auto* next_score = get(prefix);
+          next_score->second = log_add(next_score->second, nb + p);
+          extended_score->second = log_add(extended_score->second, b + p);
+        } else {
+          extended_score->second = log_add(extended_score->second, score + p);
+        }
+      }
+    }
+
+    nbest.clear();
+    for (const auto& hyp : next) {
+      nbest.emplace_back(hyp.first,
+                         log_add(hyp.second.first, hyp.second.second));
+    }
+    std::sort(nbest.begin(),
+              nbest.end(),
+              [](const std::pair<std::vector<int>, float>& a,
+                 const std::pair<std::vector<int>, float>& b) {
+                return a.second > b.second;
+              });
+    if (nbest.size() > static_cast<size_t>(beam)) nbest.resize(beam);
+    hyps.clear();
+    for (const auto& hyp : nbest) hyps[hyp.first] = next[hyp.first];
+  }
+  return nbest;
+}
+
+TEST(UtilsTest, FastLogSumExpSearchTest) {
+  // peaky frames over a small vocab, so the hyps differ by clear margins
+  // and the order of the n-best is decided by the search, not by rounding
+  const int num_frames = 40, vocab_size = 6, beam = 8;
+  std::mt19937 rng(7);
+  std::uniform_real_distribution<float> uniform(0.0f, 1.0f);
+  std::uniform_int_distribution<int> token(0, vocab_size - 1);
+  std::vector<std::vector<float>> logp(num_frames);
+  for (auto& frame : logp) {
+    std::vector<float> prob(vocab_size);
+    float sum = 0.0f;
+    for (auto& p : prob) sum += (p = 0.1f * uniform(rng));
+    int peak = uniform(rng) < 0.6f ? 0 : token(rng);
+    prob[peak] += 1.0f;
+    sum += 1.0f;
+    for (float p : prob) frame.push_back(std::log(p / sum));
+  }
+
+  auto exact = PrefixBeamSearch(logp, beam, ppspeech::LogSumExp);
+  auto fast = PrefixBeamSearch(logp, beam, ppspeech::FastLogSumExp);
+  ASSERT_EQ(fast.size(), beam);
+  ASSERT_EQ(fast.size(), exact.size());
+  for (size_t i = 0; i < exact.size(); ++i) {
+    EXPECT_EQ(fast[i].first, exact[i].first) << i;
+    EXPECT_NEAR(fast[i].second, exact[i].second, 1e-4) << i;
+  }
+}
+
+TEST(UtilsTest, ThreadPoolInitTest) {
+  std::mutex mutex;
+  std::vector<size_t> workers;
+  std::set<std::thread::id> init_threads;
+  std::set<std::thread::id> task_threads;
+  {
+    ThreadPool pool(4, [&](size_t worker) {
+      std::lock_guard<std::mutex> lock(mutex);
+      workers.push_back(worker);
+      init_threads.insert(std::this_thread::get_id());
+    });
+    for (int i = 0; i < 100; ++i) {
+      pool.enqueue([&]() {
+        std::lock_guard<std::mutex> lock(mutex);
+        task_threads.insert(std::this_thread::get_id());
+      });
+    }
+  }
+  std::sort(workers.begin(), workers.end());
+  EXPECT_THAT(workers, ::testing::ElementsAre(0, 1, 2, 3));
+  // the tasks run on the initialized workers only
+  for (const auto& id : task_threads) {
+    EXPECT_EQ(init_threads.count(id), 1);
+  }
+}
+
+TEST(UtilsTest, ThreadPoolSubmitTest) {
+  // tasks submitted by several threads, each submitting two more from the
+  // pool, a small one stored inline and a large one on the heap
+  const int num_producers = 4;
+  const int num_tasks = 5000;
+  std::vector<std::atomic<int>> runs(num_producers * num_tasks * 3);
+  for (auto& run : runs) run = 0;
+  {
+    ThreadPool pool(3);
+    std::vector<std::thread> producers;
+    for (int p = 0; p < num_producers; ++p) {
+      producers.emplace_back([&, p]() {
+        for (int i = 0; i < num_tasks; ++i) {
+          int task = (p * num_tasks + i) * 3;
+          pool.Submit([&runs, &pool, task]() {
+            ++runs[task];
+            pool.Submit([&runs, task]() { ++runs[task + 1]; });
+            std::array<int, 32> padding;
+            padding.fill(task + 2);
+            pool.Submit([&runs, padding]() { ++runs[padding.back()]; });
+          });
+        }
+      });
+    }
+    for (auto& producer : producers) producer.join();
+  }
+  for (size_t i = 0; i < runs.size(); ++i) {
+    ASSERT_EQ(runs[i], 1) << "task " << i;
+  }
+}
+
+TEST(UtilsTest, ThreadPoolFutureTest) {
+  ThreadPool pool(2);
+  std::vector<std::future<int>> results;
+  for (int i = 0; i < 100; ++i) {
+    results.push_back(pool.enqueue([](int x) { return x * x; }, i));
+  }
+  auto error = pool.enqueue([]() { throw std::runtime_error("task"); });
+  for (int i = 0; i < 100; ++i) {
+    EXPECT_EQ(results[i].get(), i * i);
+  }
+  EXPECT_THROW(error.get(), std::runtime_error);
+}
+
+TEST(UtilsTest, WorkerCpusTest) {
+  std::vector<int> available = ppspeech::AvailableCpus();
+  ASSERT_FALSE(available.empty());
+  EXPECT_TRUE(std::is_sorted(available.begin(), available.end()));
+
+  // disjoint while there are enough cpus, wrapped around after
+  int num_workers = std::max<int>(1, available.size() / 2);
+  std::set<int> used;
+  for (int worker = 0; worker < num_workers; ++worker) {
+    std::vector<int> cpus = ppspeech::WorkerCpus(worker, 2);
+    ASSERT_EQ(cpus.size(), 2);
+    if (available.size() < 2) continue;
+    for (int cpu : cpus) EXPECT_TRUE(used.insert(cpu).second) << cpu;
+  }
+  EXPECT_EQ(ppspeech::WorkerCpus(available.size(), 1),
+            ppspeech::WorkerCpus(0, 1));
+  EXPECT_TRUE(ppspeech::WorkerCpus(0, 0).empty());
+}
+
+TEST(UtilsTest, LatencyHistogramTest) {
+  using ppspeech::LatencyHistogram;
+  // the buckets are contiguous, each within 1/16 of its lower bound
+  for (int i = 0; i + 1 < LatencyHistogram::kNumBuckets; ++i) {
+    int64_t lower = LatencyHistogram::BucketLower(i);
+    int64_t upper = LatencyHistogram::BucketUpper(i);
+    ASSERT_EQ(upper, LatencyHistogram::BucketLower(i + 1));
+    ASSERT_LE(upper - lower, std::max<int64_t>(1, lower / 16));
+    ASSERT_EQ(LatencyHistogram::BucketOf(lower), i);
+    ASSERT_EQ(LatencyHistogram::BucketOf(upper - 1), i);
+  }
+
+  LatencyHistogram histogram;
+  EXPECT_EQ(histogram.Percentile(50), 0);
+  for (int64_t us = 1; us <= 10000; ++us) histogram.Add(us);
+  EXPECT_EQ(histogram.count(), 10000);
+  EXPECT_EQ(histogram.max(), 10000);
+  EXPECT_NEAR(histogram.mean(), 5000.5, 1e-6);
+  EXPECT_NEAR(histogram.Percentile(50), 5000, 5000 / 16);
+  EXPECT_NEAR(histogram.Percentile(90), 9000, 9000 / 16);
+  EXPECT_NEAR(histogram.Percentile(99), 9900, 9900 / 16);
+  EXPECT_LE(histogram.Percentile(100), histogram.max());
+}
+
+TEST(UtilsTest, LatencyStatsTest) {
+  ppspeech::LatencyStats stats({"encoder", "search", "unused"});
+  stats.Record(0, 100);
+  ppspeech::LatencyHistogram disabled;
+  stats.Merge(0, &disabled);
+  EXPECT_EQ(disabled.count(), 0);
+
+  stats.set_enabled(true);
+  const int kThreads = 4, kRecords = 1000;
+  std::vector<std::thread> threads;
+  for (int t = 0; t < kThreads; ++t) {
+    threads.emplace_back([&stats, t]() {
+      for (int i = 0; i < kRecords; ++i) {
+        stats.Record(0, t * kRecords + i);
+        stats.Record(1, 7);
+      }
+    });
+  }
+  for (auto& thread : threads) thread.join();
+
+  ppspeech::LatencyHistogram encoder, search;
+  stats.Merge(0, &encoder);
+  stats.Merge(1, &search);
+  EXPECT_EQ(encoder.count(), kThreads * kRecords);
+  EXPECT_EQ(encoder.max(), kThreads * kRecords - 1);
+  EXPECT_EQ(search.count(), kThreads * kRecords);
+  EXPECT_EQ(search.Percentile(50), 7);
+
+  std::string json = stats.ToJson();
+  EXPECT_THAT(json, ::testing::HasSubstr("\"encoder\": {\"count\": 4000"));
+  EXPECT_THAT(json, ::testing::HasSubstr("\"search\""));
+  // the stages not recorded are left out
+  EXPECT_THAT(json, ::testing::Not(::testing::HasSubstr("unused")));
+}
+
+TEST(UtilsTest, LatencyStatsPauseTest) {
+  ppspeech::LatencyStats stats({"rescoring"});
+  stats.set_enabled(true);
+  {
+    ppspeech::LatencyStats::ScopedPause pause;
+    EXPECT_TRUE(ppspeech::LatencyStats::ThreadPaused());
+    stats.Record(0, 100);
+    ppspeech::LatencyStats::ScopedTimer timer(&stats, 0);
+    // other threads still record
+    std::thread([&stats]() { stats.Record(0, 200); }).join();
+  }
+  EXPECT_FALSE(ppspeech::LatencyStats::ThreadPaused());
+  stats.Record(0, 300);
+
+  ppspeech::LatencyHistogram rescoring;
+  stats.Merge(0, &rescoring);
+  EXPECT_EQ(rescoring.count(), 2);
+  EXPECT_EQ(rescoring.max(), 300);
+}
+
+static int CountOf(const std::string& str, const std::string& pattern) {
+  int count = 0;
+  for (size_t pos = str.find(pattern); pos != std::string::npos;
+       pos = str.find(pattern, pos + 1)) {
+    ++count;
+  }
+  return count;
+}
+
+TEST(UtilsTest, TracerTest) {
+  using ::testing::HasSubstr;
+  ppspeech::Tracer& tracer = ppspeech::GlobalTracer();
+  { TRACE_SCOPE("stopped"); }
+
+  tracer.Start(64);
+  tracer.SetIdName(7, "utt\"7");
+  {
+    TRACE_SCOPE_ID("outer", 7);
+    EXPECT_EQ(ppspeech::Tracer::current_id(), 7);
+    TRACE_SCOPE("inner");
+    TRACE_COUNTER("queue", 3);
+  }
+  EXPECT_EQ(ppspeech::Tracer::current_id(), -1);
+  std::thread thread([]() {
+    ppspeech::Tracer::SetThreadName("other");
+    // only the last 64 are kept
+    for (int i = 0; i < 100; ++i) {
+      TRACE_SCOPE("loop");
+    }
+  });
+  thread.join();
+  tracer.Stop();
+  { TRACE_SCOPE("stopped"); }
+
+  std::string json = tracer.ToJson();
+  EXPECT_EQ(CountOf(json, "\"stopped\""), 0);
+  EXPECT_EQ(CountOf(json, "\"outer\""), 1);
+  EXPECT_EQ(CountOf(json, "\"loop\""), 64);
+  // inner takes the id of outer
+  EXPECT_EQ(CountOf(json, "\"args\": {\"id\": 7, \"key\": \"utt\\\"7\"}"),
+            2);
+  EXPECT_THAT(json, HasSubstr("\"name\": \"queue\", \"pid\": 1"));
+  EXPECT_THAT(json, HasSubstr("\"ph\": \"C\", \"args\": {\"value\": 3}"));
+  EXPECT_THAT(json, HasSubstr("\"args\": {\"name\": \"other\"}"));
+
+  // dropped by the next start
+  tracer.Start(64);
+  tracer.Stop();
+  EXPECT_EQ(CountOf(tracer.ToJson(), "\"ph\": \"X\""), 0);
+}
+
+TEST(UtilsTest, ArenaTest) {
+  ppspeech::Arena arena(1024);
+  // aligned, and bumped within a block
+  char* a = static_cast<char*>(arena.Allocate(3, 1));
+  int64_t* b = static_cast<int64_t*>(arena.Allocate(16, alignof(int64_t)));
+  EXPECT_EQ(reinterpret_cast<uintptr_t>(b) % alignof(int64_t), 0);
+  EXPECT_GT(reinterpret_cast<char*>(b), a);
+  EXPECT_EQ(arena.num_blocks(), 1);
+  // a large allocation takes a block of its own
+  arena.Allocate(4096);
+  EXPECT_EQ(arena.num_blocks(), 2);
+  EXPECT_GE(arena.MemoryBytes(), 1024 + 4096);
+
+  // the same round again reuses the blocks
+  arena.Reset();
+  EXPECT_EQ(arena.UsedBytes(), 0);
+  EXPECT_EQ(arena.Allocate(3, 1), a);
+  arena.Allocate(16, alignof(int64_t));
+  arena.Allocate(4096);
+  EXPECT_EQ(arena.num_blocks(), 2);
+
+  // aligned past the end of a block, the next block is taken
+  ppspeech::Arena small(100);
+  char* first = static_cast<char*>(small.Allocate(99, 1));
+  char* next = static_cast<char*>(small.Allocate(8, 8));
+  EXPECT_EQ(small.num_blocks(), 2);
+  EXPECT_EQ(reinterpret_cast<uintptr_t>(next) % 8, 0);
+  EXPECT_TRUE(next + 8 <= first || next >= first + 100);
+
+  // containers of an arena allocate from it, copies into them too
+  arena.Reset();
+  ppspeech::ArenaAllocator<int> allocator(&arena);
+  ppspeech::ArenaVector<int> values(allocator);
+  for (int i = 0; i < 100; ++i) values.push_back(i);
+  EXPECT_GE(arena.UsedBytes(), 100 * sizeof(int));
+  ppspeech::ArenaVector<int> heap_values;
+  heap_values = values;
+  EXPECT_EQ(heap_values.get_allocator().arena(), nullptr);
+  EXPECT_EQ(heap_values, values);
+}
+
+TEST(UtilsTest, SpscChannelTest) {
+  // values pushed in batches of random sizes by a producer thread, read in
+  // chunks by this one, over several segments
+  const int num_values = 10007;
+  const size_t chunk = 16;
+  ppspeech::SpscChannel<int> channel;
+  std::thread producer([&channel]() {
+    std::mt19937 rng(3);
+    std::uniform_int_distribution<int> batch_size(1, 40);
+    std::vector<int> batch;
+    for (int value = 0; value < num_values;) {
+      for (int n = batch_size(rng); n > 0 && value < num_values; --n) {
+        batch.push_back(value++);
+      }
+      channel.Push(&batch);
+      if (value % 7 == 0) std::this_thread::yield();
+    }
+    channel.Close();
+  });
+  std::vector<int> values;
+  while (channel.Wait(chunk)) {
+    ASSERT_GE(channel.Size(), chunk);
+    channel.Pop(chunk, &values);
+  }
+  producer.join();
+  EXPECT_TRUE(channel.closed());
+  EXPECT_EQ(channel.Size(), num_values % chunk);
+  EXPECT_EQ(channel.Items().size(), num_values % chunk);
+  channel.Pop(channel.Size(), &values);
+  ASSERT_EQ(values.size(), num_values);
+  for (int i = 0; i < num_values; ++i) ASSERT_EQ(values[i], i);
+
+  channel.Reopen();
+  EXPECT_FALSE(channel.closed());
+  channel.Push(7);
+  channel.Push(8);
+  EXPECT_THAT(channel.Items(), ::testing::ElementsAre(7, 8));
+  EXPECT_TRUE(channel.Wait(2));
+  EXPECT_EQ(channel.Pop(), 7);
+  EXPECT_EQ(channel.Pop(), 8);
+  EXPECT_TRUE(channel.Empty());
+}
+
+TEST(UtilsTest, SpscChannelNotifyTest) {
+  // the consumer asks to be notified of each chunk instead of blocking, a
+  // notification lost would hang it
+  const int num_values = 20000;
+  const size_t chunk = 7;
+  ppspeech::SpscChannel<int> channel;
+  std::atomic<int> num_calls(0);
+  channel.set_notify_callback([&num_calls]() { ++num_calls; });
+  std::thread producer([&channel]() {
+    for (int value = 0; value < num_values; ++value) channel.Push(value);
+    channel.Close();
+  });
+  std::vector<int> values;
+  int num_armed = 0;
+  for (;;) {
+    if (channel.NotifyWhen(chunk)) {
+      ++num_armed;
+      while (num_calls < num_armed) std::this_thread::yield();
+    }
+    if (channel.Size() < chunk) break;
+    channel.Pop(chunk, &values);
+  }
+  producer.join();
+  EXPECT_TRUE(channel.closed());
+  EXPECT_EQ(num_calls, num_armed);
+  channel.Pop(channel.Size(), &values);
+  ASSERT_EQ(values.size(), num_values);
+  for (int i = 0; i < num_values; ++i) ASSERT_EQ(values[i], i);
+}
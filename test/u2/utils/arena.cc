@@ -0,0 +1,67 @@
+// Copyright (c) 2022 PaddlePaddle Authors. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "utils/arena.h"
+
+#include <algorithm>
+
+namespace ppspeech {
+
+Arena::Arena(size_t block_size) : block_size_(block_size) {}
+
+// the first address from ptr aligned to align, a power of 2
+static char* AlignUp(char* ptr, size_t align) {
+  uintptr_t address = reinterpret_cast<uintptr_t>(ptr);
+  return reinterpret_cast<char*>((address + align - 1) & ~(align - 1));
+}
+
+void* Arena::Allocate(size_t size, size_t align) {
+  char* ptr = AlignUp(ptr_, align);
+  // the alignment may move ptr past the end of the block
+  if (ptr_ == nullptr || ptr > end_ ||
+      size > static_cast<size_t>(end_ - ptr)) {
+    NextBlock(size, align);
+    ptr = AlignUp(ptr_, align);
+  }
+  ptr_ = ptr + size;
+  used_bytes_ += size;
+  return ptr;
+}
+
+void Arena::NextBlock(size_t size, size_t align) {
+  size_t needed = size + align;
+  // the next blocks kept from the rounds before, too small ones are skipped
+  size_t next = ptr_ == nullptr ? 0 : block_ + 1;
+  while (next < blocks_.size() && blocks_[next].size < needed) ++next;
+  if (next == blocks_.size()) {
+    // a large allocation takes a block of its own
+    Block block;
+    block.size = std::max(block_size_, needed);
+    block.data.reset(new char[block.size]);
+    memory_bytes_ += block.size;
+    blocks_.push_back(std::move(block));
+  }
+  block_ = next;
+  ptr_ = blocks_[block_].data.get();
+  end_ = ptr_ + blocks_[block_].size;
+}
+
+void Arena::Reset() {
+  block_ = 0;
+  ptr_ = blocks_.empty() ? nullptr : blocks_[0].data.get();
+  end_ = blocks_.empty() ? nullptr : ptr_ + blocks_[0].size;
+  used_bytes_ = 0;
+}
+
+}  // namespace ppspeech
@@ -0,0 +1,115 @@
+// Copyright (c) 2022 PaddlePaddle Authors. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <new>
+#include <vector>
+
+#include "utils/utils.h"
+
+namespace ppspeech {
+
+// A bump allocator over blocks owned by one session, so the buffers of a
+// search do not go through the global heap shared by the worker threads.
+// Memory is not freed one by one, Reset() releases it all at once, e.g. at
+// the end of a frame, and keeps the blocks for the next round. The heap is
+// only hit when a round needs more than the blocks so far. Not thread safe.
+class Arena {
+ public:
+  explicit Arena(size_t block_size = 16 << 10);
+
+  void* Allocate(size_t size, size_t align = alignof(std::max_align_t));
+
+  // releases all the allocations, the blocks are kept
+  void Reset();
+
+  // bytes allocated since Reset()
+  int64_t UsedBytes() const { return used_bytes_; }
+  // bytes of the blocks
+  int64_t MemoryBytes() const { return memory_bytes_; }
+  // blocks taken from the heap so far
+  int num_blocks() const { return blocks_.size(); }
+
+ private:
+  struct Block {
+    std::unique_ptr<char[]> data;
+    size_t size;
+  };
+
+  // moves to the next block holding size bytes aligned, allocating it if
+  // there is none
+  void NextBlock(size_t size, size_t align);
+
+  size_t block_size_;
+  std::vector<Block> blocks_;
+  size_t block_ = 0;  // the block allocated from
+  char* ptr_ = nullptr;
+  char* end_ = nullptr;
+  int64_t used_bytes_ = 0;
+  int64_t memory_bytes_ = 0;
+
+ public:
+  DISALLOW_COPY_AND_ASSIGN(Arena);
+};
+
+// std allocator over an Arena, the heap if arena is nullptr. Deallocation
+// from an arena is a no-op. Containers keep their allocator on copy and
+// move assignment, so a copy into a container of an arena allocates from
+// that arena, and containers of different arenas must not be swapped.
+template <typename T>
+class ArenaAllocator {
+ public:
+  using value_type = T;
+
+  ArenaAllocator() = default;
+  explicit ArenaAllocator(Arena* arena) : arena_(arena) {}
+  template <typename U>
+  ArenaAllocator(const ArenaAllocator<U>& other)  // NOLINT
+      : arena_(other.arena()) {}
+
+  T* allocate(size_t n) {
+    if (arena_ == nullptr) {
+      return static_cast<T*>(::operator new(n * sizeof(T)));
+    }
+    return static_cast<T*>(arena_->Allocate(n * sizeof(T), alignof(T)));
+  }
+
+  void deallocate(T* ptr, size_t /*n*/) {
+    if (arena_ == nullptr) ::operator delete(ptr);
+  }
+
+  Arena* arena() const { return arena_; }
+
+ private:
+  Arena* arena_ = nullptr;
+};
+
+template <typename T, typename U>
+bool operator==(const ArenaAllocator<T>& a, const ArenaAllocator<U>& b) {
+  return a.arena() == b.arena();
+}
+
+template <typename T, typename U>
+bool operator!=(const ArenaAllocator<T>& a, const ArenaAllocator<U>& b) {
+  return a.arena() != b.arena();
+}
+
+template <typename T>
+using ArenaVector = std::vector<T, ArenaAllocator<T>>;
+
+}  // namespace ppspeech
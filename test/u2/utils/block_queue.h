@@ -14,10 +14,10 @@
 
 #pragma once
 
+#include <algorithm>
 #include <condition_variable>
 #include <limits>
 #include <mutex>
-#include <queue>
 #include <utility>
 #include <vector>
 
@@ -25,6 +25,8 @@
 
 namespace ppspeech {
 
+// A bounded FIFO over a ring buffer, which only grows, by doubling, so
+// the queue does not allocate once it has held its peak size.
 template <typename T>
 class BlockingQueue {
  public:
@@ -34,11 +36,11 @@ class BlockingQueue {
   void Push(const T& value) {
     {
       std::unique_lock<std::mutex> lock(mutex_);
-      while (queue_.size() >= capacity_) {
+      while (size_ >= capacity_) {
         // queue full, so wait not full
         not_full_condition_.wait(lock);
       }
-      queue_.push(value);
+      PushBack(T(value));
     }
     not_empty_condition_.notify_one();
   }
@@ -46,10 +48,10 @@ class BlockingQueue {
   void Push(T&& value) {
     {
       std::unique_lock<std::mutex> lock(mutex_);
-      while (queue_.size() >= capacity_) {
+      while (size_ >= capacity_) {
         not_full_condition_.wait(lock);
       }
-      queue_.push(std::move(value));
+      PushBack(std::move(value));
     }
     not_empty_condition_.notify_one();
   }
@@ -57,51 +59,67 @@ class BlockingQueue {
   void Push(std::vector<T>&& values) {
     std::unique_lock<std::mutex> lock(mutex_);
     for (auto& value : values) {
-      while (queue_.size() >= capacity_) {
+      while (size_ >= capacity_) {
         not_empty_condition_.notify_one();
         not_full_condition_.wait(lock);
       }
-      queue_.push(std::move(value));
+      PushBack(std::move(value));
     }
     not_empty_condition_.notify_one();
   }
 
   T Pop() {
     std::unique_lock<std::mutex> lock(mutex_);
-    while (queue_.empty()) {
+    while (size_ == 0) {
       not_empty_condition_.wait(lock);
     }
 
-    T t(std::move(queue_.front()));
-    queue_.pop();
+    T t(PopFront());
     not_full_condition_.notify_one();
     return t;
   }
 
   // num can be greater than capacity,but it needs to be used with care
   std::vector<T> Pop(size_t num) {
-    std::unique_lock<std::mutex> lock(mutex_);
     std::vector<T> block_data;
-    while (block_data.size() < num) {
-      while (queue_.empty()) {
+    block_data.reserve(num);
+    Pop(num, &block_data);
+    return block_data;
+  }
+
+  // As Pop(num), but the values are appended to values, e.g. a buffer kept
+  // by the caller.
+  void Pop(size_t num, std::vector<T>* values) {
+    std::unique_lock<std::mutex> lock(mutex_);
+    for (size_t i = 0; i < num; ++i) {
+      while (size_ == 0) {
         not_full_condition_.notify_one();
         not_empty_condition_.wait(lock);
       }
-      block_data.push_back(std::move(queue_.front()));
-      queue_.pop();
+      values->push_back(PopFront());
     }
     not_full_condition_.notify_one();
-    return block_data;
   }
 
   bool Empty() const {
     std::lock_guard<std::mutex> lock(mutex_);
-    return queue_.empty();
+    return size_ == 0;
   }
 
   size_t Size() const {
     std::lock_guard<std::mutex> lock(mutex_);
-    return queue_.size();
+    return size_;
+  }
+
+  // a copy of the queued values, front first
+  std::vector<T> Items() const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    std::vector<T> items;
+    items.reserve(size_);
+    for (size_t i = 0; i < size_; ++i) {
+      items.push_back(ring_[(head_ + i) & (ring_.size() - 1)]);
+    }
+    return items;
   }
 
   void Clear() {
@@ -111,8 +129,33 @@ class BlockingQueue {
   }
 
  private:
+  // with mutex_ held
+  void PushBack(T&& value) {
+    if (size_ == ring_.size()) {
+      // unwrapped into a ring of twice the size
+      std::vector<T> ring(std::max<size_t>(16, 2 * ring_.size()));
+      for (size_t i = 0; i < size_; ++i) {
+        ring[i] = std::move(ring_[(head_ + i) & (ring_.size() - 1)]);
+      }
+      ring_.swap(ring);
+      head_ = 0;
+    }
+    ring_[(head_ + size_) & (ring_.size() - 1)] = std::move(value);
+    ++size_;
+  }
+
+  T PopFront() {
+    T t(std::move(ring_[head_]));
+    head_ = (head_ + 1) & (ring_.size() - 1);
+    --size_;
+    return t;
+  }
+
   size_t capacity_;
-  std::queue<T> queue_;
+  // a power of 2 slots, size_ of them from head_ are queued
+  std::vector<T> ring_;
+  size_t head_ = 0;
+  size_t size_ = 0;
 
   mutable std::mutex mutex_;
   std::condition_variable not_full_condition_;
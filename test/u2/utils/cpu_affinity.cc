@@ -0,0 +1,116 @@
+// Copyright (c) 2022 PaddlePaddle Authors. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "utils/cpu_affinity.h"
+
+#include <thread>
+
+#ifdef __linux__
+#include <dlfcn.h>
+#include <pthread.h>
+#include <sched.h>
+#endif
+
+#include "utils/log.h"
+
+namespace ppspeech {
+
+namespace {
+
+// The OpenMP runtime loaded by the process, looked up rather than linked
+// in, as the threads of the inference are those of the runtime Paddle is
+// linked with, e.g. libiomp5 of mklml, not those of the compiler's.
+struct OpenMpRuntime {
+  void (*set_num_threads)(int) = nullptr;
+  int (*get_max_threads)() = nullptr;
+};
+
+const OpenMpRuntime& LoadedOpenMp() {
+  static const OpenMpRuntime runtime = []() {
+    OpenMpRuntime runtime;
+#ifdef __linux__
+    runtime.set_num_threads = reinterpret_cast<void (*)(int)>(
+        dlsym(RTLD_DEFAULT, "omp_set_num_threads"));
+    runtime.get_max_threads = reinterpret_cast<int (*)()>(
+        dlsym(RTLD_DEFAULT, "omp_get_max_threads"));
+#endif
+    if (runtime.set_num_threads == nullptr ||
+        runtime.get_max_threads == nullptr) {
+      LOG(WARNING) << "No OpenMP runtime is loaded, the intra-op threads "
+                      "are left to the inference library.";
+      runtime = OpenMpRuntime();
+    }
+    return runtime;
+  }();
+  return runtime;
+}
+
+}  // namespace
+
+std::vector<int> AvailableCpus() {
+  std::vector<int> cpus;
+#ifdef __linux__
+  cpu_set_t set;
+  CPU_ZERO(&set);
+  if (sched_getaffinity(0, sizeof(set), &set) == 0) {
+    for (int cpu = 0; cpu < CPU_SETSIZE; ++cpu) {
+      if (CPU_ISSET(cpu, &set)) cpus.push_back(cpu);
+    }
+  }
+#endif
+  if (cpus.empty()) {
+    int num_cpus = std::thread::hardware_concurrency();
+    for (int cpu = 0; cpu < num_cpus; ++cpu) cpus.push_back(cpu);
+  }
+  return cpus;
+}
+
+std::vector<int> WorkerCpus(int worker, int cpus_per_worker) {
+  static const std::vector<int> available = AvailableCpus();
+  std::vector<int> cpus;
+  if (available.empty() || cpus_per_worker <= 0) return cpus;
+  for (int i = 0; i < cpus_per_worker; ++i) {
+    cpus.push_back(
+        available[(worker * cpus_per_worker + i) % available.size()]);
+  }
+  return cpus;
+}
+
+bool PinCurrentThread(const std::vector<int>& cpus) {
+#ifdef __linux__
+  if (cpus.empty()) return false;
+  cpu_set_t set;
+  CPU_ZERO(&set);
+  for (int cpu : cpus) CPU_SET(cpu, &set);
+  return pthread_setaffinity_np(pthread_self(), sizeof(set), &set) == 0;
+#else
+  return false;
+#endif
+}
+
+int SetIntraOpThreads(int num_threads) {
+  const OpenMpRuntime& runtime = LoadedOpenMp();
+  if (runtime.set_num_threads == nullptr) return 0;
+  if (num_threads > 0) runtime.set_num_threads(num_threads);
+  int effective = runtime.get_max_threads();
+  thread_local int logged = 0;
+  if (effective != logged) {
+    LOG(INFO) << "Intra-op threads " << effective << " (asked "
+              << num_threads << ")";
+    logged = effective;
+  }
+  return effective;
+}
+
+}  // namespace ppspeech
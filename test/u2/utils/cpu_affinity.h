@@ -0,0 +1,40 @@
+// Copyright (c) 2022 PaddlePaddle Authors. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#pragma once
+
+#include <vector>
+
+namespace ppspeech {
+
+// cpus the process may run on, in ascending order
+std::vector<int> AvailableCpus();
+
+// The cpus of worker among num_workers, each taking cpus_per_worker of the
+// available cpus in turn, wrapped around when there are not enough of them.
+std::vector<int> WorkerCpus(int worker, int cpus_per_worker);
+
+// Pin the calling thread to cpus. The threads it creates after, e.g. the
+// OpenMP threads of its inference, inherit the cpus. False if pinning is
+// not supported or fails.
+bool PinCurrentThread(const std::vector<int>& cpus);
+
+// Threads of the parallel regions run by the calling thread, i.e. the
+// intra-op threads of the inference, set on the OpenMP runtime the process
+// has loaded, e.g. the one Paddle is linked with. num_threads <= 0 keeps
+// them. Returns the threads in effect, logged when they change on the
+// calling thread, or 0 if no OpenMP runtime is loaded.
+int SetIntraOpThreads(int num_threads);
+
+}  // namespace ppspeech
@@ -0,0 +1,90 @@
+// Copyright (c) 2022 PaddlePaddle Authors. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//   http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#pragma once
+
+#include <cstdint>
+#include <cstring>
+
+namespace ppspeech {
+
+// IEEE 754 half precision storage type, e.g. for fp16 model outputs. It has
+// the same layout as paddle's float16, arithmetic is done in float.
+struct float16 {
+  uint16_t x = 0;
+
+  float16() = default;
+  explicit float16(float f) : x(FromFloat(f)) {}
+  explicit operator float() const { return ToFloat(x); }
+
+  static float ToFloat(uint16_t h) {
+    uint32_t sign = static_cast<uint32_t>(h & 0x8000) << 16;
+    uint32_t exp = (h >> 10) & 0x1f;
+    uint32_t mant = h & 0x3ff;
+    uint32_t bits;
+    if (exp == 0x1f) {
+      // inf or nan
+      bits = sign | 0x7f800000 | (mant << 13);
+    } else if (exp != 0) {
+      bits = sign | ((exp + 112) << 23) | (mant << 13);
+    } else if (mant == 0) {
+      bits = sign;
+    } else {
+      // subnormal, normalize it
+      exp = 113;
+      while ((mant & 0x400) == 0) {
+        mant <<= 1;
+        --exp;
+      }
+      bits = sign | (exp << 23) | ((mant & 0x3ff) << 13);
+    }
+    float f;
+    std::memcpy(&f, &bits, sizeof(f));
+    return f;
+  }
+
+  // round to nearest even
+  static uint16_t FromFloat(float f) {
+    uint32_t bits;
+    std::memcpy(&bits, &f, sizeof(bits));
+    uint16_t sign = (bits >> 16) & 0x8000;
+    uint32_t abs = bits & 0x7fffffff;
+    if (abs >= 0x7f800000) {
+      // inf or nan
+      return sign | 0x7c00 | (abs > 0x7f800000 ? 0x200 : 0);
+    }
+    if (abs >= 0x477ff000) {
+      // overflow to inf
+      return sign | 0x7c00;
+    }
+    if (abs < 0x38800000) {
+      // subnormal or zero
+      if (abs < 0x33000000) return sign;
+      uint32_t exp = abs >> 23;
+      uint32_t mant = (abs & 0x7fffff) | 0x800000;
+      int shift = 126 - exp;
+      uint32_t half = mant >> shift;
+      uint32_t rem = mant & ((1u << shift) - 1);
+      uint32_t mid = 1u << (shift - 1);
+      if (rem > mid || (rem == mid && (half & 1))) ++half;
+      return sign | half;
+    }
+    uint32_t rounded = abs + 0xfff + ((abs >> 13) & 1);
+    return sign | ((rounded - 0x38000000) >> 13);
+  }
+};
+
+static_assert(sizeof(float16) == 2, "float16 must be 2 bytes");
+
+}  // namespace ppspeech
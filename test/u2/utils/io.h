@@ -0,0 +1,164 @@
+// Copyright (c) 2022 PaddlePaddle Authors. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#pragma once
+
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <type_traits>
+#include <vector>
+
+#include "utils/utils.h"
+
+namespace ppspeech {
+
+// Binary writer and reader of plain values, strings and vectors of them,
+// e.g. for the state snapshots of a stream. Values are in the native byte
+// order, a snapshot is read back on the same platform.
+//
+//   std::string buffer;
+//   BinaryWriter writer(&buffer);
+//   writer.Write(offset);
+//   writer.Write(hyps);
+//
+//   BinaryReader reader(buffer);
+//   if (!reader.Read(&offset) || !reader.Read(&hyps)) ...
+class BinaryWriter {
+ public:
+  explicit BinaryWriter(std::string* buffer) : buffer_(buffer) {}
+
+  void WriteBytes(const void* data, size_t size) {
+    buffer_->append(static_cast<const char*>(data), size);
+  }
+
+  template <typename T>
+  void Write(const T& value) {
+    static_assert(std::is_trivially_copyable<T>::value,
+                  "only plain values are written as is");
+    WriteBytes(&value, sizeof(T));
+  }
+
+  void Write(const std::string& str) {
+    Write<uint64_t>(str.size());
+    WriteBytes(str.data(), str.size());
+  }
+
+  template <typename T, typename A>
+  void Write(const std::vector<T, A>& values) {
+    Write<uint64_t>(values.size());
+    WriteItems(values, std::is_trivially_copyable<T>());
+  }
+
+  size_t size() const { return buffer_->size(); }
+
+ private:
+  template <typename T, typename A>
+  void WriteItems(const std::vector<T, A>& values, std::true_type) {
+    WriteBytes(values.data(), values.size() * sizeof(T));
+  }
+  template <typename T, typename A>
+  void WriteItems(const std::vector<T, A>& values, std::false_type) {
+    for (const T& value : values) Write(value);
+  }
+
+  std::string* buffer_;
+
+ public:
+  DISALLOW_COPY_AND_ASSIGN(BinaryWriter);
+};
+
+// Reads return false once the data runs out or a size is corrupted, and
+// the reader stays failed.
+class BinaryReader {
+ public:
+  BinaryReader(const char* data, size_t size) : data_(data), size_(size) {}
+  explicit BinaryReader(const std::string& buffer)
+      : BinaryReader(buffer.data(), buffer.size()) {}
+
+  bool ReadBytes(void* data, size_t size) {
+    if (!ok_ || size > size_ - pos_) {
+      ok_ = false;
+      return false;
+    }
+    std::memcpy(data, data_ + pos_, size);
+    pos_ += size;
+    return true;
+  }
+
+  template <typename T>
+  bool Read(T* value) {
+    static_assert(std::is_trivially_copyable<T>::value,
+                  "only plain values are read as is");
+    return ReadBytes(value, sizeof(T));
+  }
+
+  bool Read(std::string* str) {
+    uint64_t size = 0;
+    if (!ReadSize(1, &size)) return false;
+    str->assign(data_ + pos_, size);
+    pos_ += size;
+    return true;
+  }
+
+  template <typename T, typename A>
+  bool Read(std::vector<T, A>* values) {
+    // every item takes a byte at least
+    uint64_t size = 0;
+    if (!ReadSize(std::is_trivially_copyable<T>::value ? sizeof(T) : 1,
+                  &size)) {
+      return false;
+    }
+    values->resize(size);
+    return ReadItems(values, std::is_trivially_copyable<T>());
+  }
+
+  bool ok() const { return ok_; }
+  size_t remaining() const { return size_ - pos_; }
+  // all the data is read
+  bool done() const { return pos_ == size_; }
+
+ private:
+  // a size of items of at least item_size bytes each
+  bool ReadSize(size_t item_size, uint64_t* size) {
+    if (!Read(size)) return false;
+    if (*size > (size_ - pos_) / item_size) {
+      ok_ = false;
+      return false;
+    }
+    return true;
+  }
+
+  template <typename T, typename A>
+  bool ReadItems(std::vector<T, A>* values, std::true_type) {
+    return ReadBytes(values->data(), values->size() * sizeof(T));
+  }
+  template <typename T, typename A>
+  bool ReadItems(std::vector<T, A>* values, std::false_type) {
+    for (T& value : *values) {
+      if (!Read(&value)) return false;
+    }
+    return true;
+  }
+
+  const char* data_;
+  size_t size_;
+  size_t pos_ = 0;
+  bool ok_ = true;
+
+ public:
+  DISALLOW_COPY_AND_ASSIGN(BinaryReader);
+};
+
+}  // namespace ppspeech
@@ -0,0 +1,164 @@
+// Copyright (c) 2022 PaddlePaddle Authors. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "utils/latency_stats.h"
+
+#include <algorithm>
+#include <sstream>
+
+namespace ppspeech {
+
+const int LatencyHistogram::kSubBuckets;
+const int LatencyHistogram::kNumBuckets;
+
+LatencyHistogram::LatencyHistogram() {
+  for (auto& bucket : buckets_) bucket.store(0, std::memory_order_relaxed);
+}
+
+// Latencies below kSubBuckets have a bucket each. Above, the power of two
+// of the latency selects a group of kSubBuckets buckets and the next 4 bits
+// the bucket in it.
+int LatencyHistogram::BucketOf(int64_t us) {
+  if (us < kSubBuckets) return std::max<int64_t>(us, 0);
+  int exponent = 63 - __builtin_clzll(static_cast<uint64_t>(us));
+  int sub = (us >> (exponent - 4)) & (kSubBuckets - 1);
+  int bucket = kSubBuckets + (exponent - 4) * kSubBuckets + sub;
+  return std::min(bucket, kNumBuckets - 1);
+}
+
+int64_t LatencyHistogram::BucketLower(int bucket) {
+  if (bucket < kSubBuckets) return bucket;
+  int exponent = (bucket - kSubBuckets) / kSubBuckets + 4;
+  int sub = (bucket - kSubBuckets) % kSubBuckets;
+  return (static_cast<int64_t>(kSubBuckets + sub)) << (exponent - 4);
+}
+
+int64_t LatencyHistogram::BucketUpper(int bucket) {
+  return bucket + 1 < kNumBuckets ? BucketLower(bucket + 1)
+                                  : BucketLower(bucket) * 2;
+}
+
+void LatencyHistogram::Add(int64_t us) {
+  // one writer, no read-modify-write is needed
+  auto add = [](std::atomic<int64_t>* value, int64_t delta) {
+    value->store(value->load(std::memory_order_relaxed) + delta,
+                 std::memory_order_relaxed);
+  };
+  add(&buckets_[BucketOf(us)], 1);
+  add(&count_, 1);
+  add(&sum_, us);
+  if (us > max_.load(std::memory_order_relaxed)) {
+    max_.store(us, std::memory_order_relaxed);
+  }
+}
+
+void LatencyHistogram::Merge(const LatencyHistogram& other) {
+  for (int i = 0; i < kNumBuckets; ++i) {
+    buckets_[i].fetch_add(other.buckets_[i].load(std::memory_order_relaxed),
+                          std::memory_order_relaxed);
+  }
+  count_.fetch_add(other.count(), std::memory_order_relaxed);
+  sum_.fetch_add(other.sum_.load(std::memory_order_relaxed),
+                 std::memory_order_relaxed);
+  max_.store(std::max(max(), other.max()), std::memory_order_relaxed);
+}
+
+double LatencyHistogram::mean() const {
+  int64_t n = count();
+  return n == 0 ? 0.0
+                : static_cast<double>(sum_.load(std::memory_order_relaxed)) /
+                      n;
+}
+
+int64_t LatencyHistogram::Percentile(double p) const {
+  // the counts may be behind the buckets of a merged histogram being
+  // written, so the buckets are summed first
+  int64_t total = 0;
+  for (const auto& bucket : buckets_) {
+    total += bucket.load(std::memory_order_relaxed);
+  }
+  if (total == 0) return 0;
+  int64_t rank = std::max<int64_t>(1, static_cast<int64_t>(
+                                          p / 100.0 * total + 0.5));
+  int64_t seen = 0;
+  for (int i = 0; i < kNumBuckets; ++i) {
+    seen += buckets_[i].load(std::memory_order_relaxed);
+    if (seen >= rank) {
+      int64_t middle = (BucketLower(i) + BucketUpper(i) - 1) / 2;
+      return std::min(middle, max());
+    }
+  }
+  return max();
+}
+
+static int64_t NextStatsId() {
+  static std::atomic<int64_t> next_id{0};
+  return next_id.fetch_add(1);
+}
+
+LatencyStats::LatencyStats(const std::vector<std::string>& stage_names)
+    : id_(NextStatsId()), stage_names_(stage_names) {}
+
+int& LatencyStats::PauseDepth() {
+  thread_local int depth = 0;
+  return depth;
+}
+
+LatencyHistogram* LatencyStats::ThreadHistograms() {
+  // the histograms of the stats the thread recorded into last, by id as an
+  // address may be reused by another stats
+  thread_local int64_t cached_id = -1;
+  thread_local LatencyHistogram* cached = nullptr;
+  if (cached_id != id_) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    std::unique_ptr<LatencyHistogram[]>& histograms =
+        threads_[std::this_thread::get_id()];
+    if (histograms == nullptr) {
+      histograms.reset(new LatencyHistogram[stage_names_.size()]);
+    }
+    cached_id = id_;
+    cached = histograms.get();
+  }
+  return cached;
+}
+
+void LatencyStats::Merge(int stage, LatencyHistogram* histogram) const {
+  std::lock_guard<std::mutex> lock(mutex_);
+  for (const auto& thread : threads_) {
+    histogram->Merge(thread.second[stage]);
+  }
+}
+
+std::string LatencyStats::ToJson() const {
+  std::ostringstream json;
+  json << "{";
+  bool first = true;
+  for (int stage = 0; stage < num_stages(); ++stage) {
+    LatencyHistogram histogram;
+    Merge(stage, &histogram);
+    if (histogram.count() == 0) continue;
+    json << (first ? "" : ",") << "\n  \"" << stage_names_[stage]
+         << "\": {\"count\": " << histogram.count()
+         << ", \"mean_us\": " << static_cast<int64_t>(histogram.mean())
+         << ", \"p50_us\": " << histogram.Percentile(50)
+         << ", \"p90_us\": " << histogram.Percentile(90)
+         << ", \"p99_us\": " << histogram.Percentile(99)
+         << ", \"max_us\": " << histogram.max() << "}";
+    first = false;
+  }
+  json << "\n}\n";
+  return json.str();
+}
+
+}  // namespace ppspeech
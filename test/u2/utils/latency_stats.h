@@ -0,0 +1,164 @@
+// Copyright (c) 2022 PaddlePaddle Authors. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "utils/utils.h"
+
+namespace ppspeech {
+
+// Histogram of latencies in us, 16 buckets per power of two, so a
+// percentile is within 1/16 of the latency. Written by one thread, read by
+// any.
+class LatencyHistogram {
+ public:
+  static const int kSubBuckets = 16;
+  static const int kNumBuckets = kSubBuckets * 41;
+
+  LatencyHistogram();
+
+  void Add(int64_t us);
+  // adds the counts of other, which may be written meanwhile
+  void Merge(const LatencyHistogram& other);
+
+  int64_t count() const { return count_.load(std::memory_order_relaxed); }
+  int64_t max() const { return max_.load(std::memory_order_relaxed); }
+  double mean() const;
+  // the middle of the bucket of the p-th percentile, p in [0, 100]
+  int64_t Percentile(double p) const;
+
+  static int BucketOf(int64_t us);
+  // [lower, upper) of bucket
+  static int64_t BucketLower(int bucket);
+  static int64_t BucketUpper(int bucket);
+
+ private:
+  std::atomic<int64_t> buckets_[kNumBuckets];
+  std::atomic<int64_t> count_{0};
+  std::atomic<int64_t> sum_{0};
+  std::atomic<int64_t> max_{0};
+
+ public:
+  DISALLOW_COPY_AND_ASSIGN(LatencyHistogram);
+};
+
+// LatencyStats keeps a histogram per stage per thread, so recording takes
+// no lock and shares no cache line with the other threads. The histograms
+// of the threads are merged by Merge() and ToJson().
+//
+//   LatencyStats stats({"search", "rescoring"});
+//   stats.set_enabled(true);
+//   {
+//     LatencyStats::ScopedTimer timer(&stats, 0);
+//     searcher->Search(logp);
+//   }
+//   LOG(INFO) << stats.ToJson();
+class LatencyStats {
+ public:
+  explicit LatencyStats(const std::vector<std::string>& stage_names);
+
+  // records nothing until enabled, to keep the clock out of the decoding
+  void set_enabled(bool enabled) {
+    enabled_.store(enabled, std::memory_order_relaxed);
+  }
+  bool enabled() const { return enabled_.load(std::memory_order_relaxed); }
+
+  void Record(int stage, int64_t us) {
+    if (enabled() && !ThreadPaused()) ThreadHistograms()[stage].Add(us);
+  }
+
+  int num_stages() const { return stage_names_.size(); }
+  const std::string& stage_name(int stage) const {
+    return stage_names_[stage];
+  }
+  // the histogram of stage over all the threads
+  void Merge(int stage, LatencyHistogram* histogram) const;
+
+  // count, mean, p50, p90, p99 and max of each stage recorded, in us
+  std::string ToJson() const;
+
+  // records the lifetime of the timer into stage
+  class ScopedTimer {
+   public:
+    ScopedTimer(LatencyStats* stats, int stage)
+        : stats_(stats != nullptr && stats->enabled() && !ThreadPaused()
+                     ? stats
+                     : nullptr),
+          stage_(stage) {
+      if (stats_ != nullptr) start_ = std::chrono::steady_clock::now();
+    }
+    ~ScopedTimer() {
+      if (stats_ == nullptr) return;
+      stats_->Record(stage_,
+                     std::chrono::duration_cast<std::chrono::microseconds>(
+                         std::chrono::steady_clock::now() - start_)
+                         .count());
+    }
+
+   private:
+    LatencyStats* stats_;
+    int stage_;
+    std::chrono::steady_clock::time_point start_;
+
+   public:
+    DISALLOW_COPY_AND_ASSIGN(ScopedTimer);
+  };
+
+  // Nothing is recorded by the calling thread, into any stats, while a
+  // pause is alive, e.g. around a pass repeated for a comparison. A pause
+  // of false does nothing.
+  class ScopedPause {
+   public:
+    explicit ScopedPause(bool pause = true) : pause_(pause) {
+      if (pause_) ++PauseDepth();
+    }
+    ~ScopedPause() {
+      if (pause_) --PauseDepth();
+    }
+
+   private:
+    bool pause_;
+
+   public:
+    DISALLOW_COPY_AND_ASSIGN(ScopedPause);
+  };
+  static bool ThreadPaused() { return PauseDepth() > 0; }
+
+ private:
+  static int& PauseDepth();
+  // the histograms of the calling thread, registered on its first record
+  LatencyHistogram* ThreadHistograms();
+
+  const int64_t id_;
+  std::vector<std::string> stage_names_;
+  std::atomic<bool> enabled_{false};
+
+  mutable std::mutex mutex_;
+  std::map<std::thread::id, std::unique_ptr<LatencyHistogram[]>> threads_;
+
+ public:
+  DISALLOW_COPY_AND_ASSIGN(LatencyStats);
+};
+
+}  // namespace ppspeech
@@ -0,0 +1,330 @@
+// Copyright (c) 2022 PaddlePaddle Authors. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <utility>
+#include <vector>
+
+#ifdef __linux__
+#include <linux/futex.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#else
+#include <condition_variable>
+#include <mutex>
+#endif
+
+#include "utils/utils.h"
+
+namespace ppspeech {
+
+// A word a thread sleeps on until it changes, a futex under linux.
+class Futex {
+ public:
+  uint32_t value() const { return word_.load(std::memory_order_acquire); }
+
+  // sleeps while the word is value, may return spuriously
+  void Wait(uint32_t value) {
+#ifdef __linux__
+    syscall(SYS_futex,
+            reinterpret_cast<uint32_t*>(&word_),
+            FUTEX_WAIT_PRIVATE,
+            value,
+            nullptr,
+            nullptr,
+            0);
+#else
+    std::unique_lock<std::mutex> lock(mutex_);
+    condition_.wait(lock, [this, value] { return word_.load() != value; });
+#endif
+  }
+
+  // changes the word and wakes a thread waiting on it
+  void WakeOne() {
+#ifdef __linux__
+    word_.fetch_add(1, std::memory_order_release);
+    syscall(SYS_futex,
+            reinterpret_cast<uint32_t*>(&word_),
+            FUTEX_WAKE_PRIVATE,
+            1,
+            nullptr,
+            nullptr,
+            0);
+#else
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      word_.fetch_add(1, std::memory_order_release);
+    }
+    condition_.notify_one();
+#endif
+  }
+
+ private:
+  std::atomic<uint32_t> word_{0};
+#ifndef __linux__
+  std::mutex mutex_;
+  std::condition_variable condition_;
+#endif
+};
+
+// An unbounded FIFO between one producer thread and one consumer thread,
+// without locks. Values are kept in segments of a fixed size linked in a
+// list, the segments the consumer is done with go back to the producer, so
+// the channel does not allocate once it has held its peak size.
+//
+// The consumer blocks in Wait() until a given number of values is queued or
+// the channel is closed. The producer only makes a syscall to wake it when
+// that number is reached, not on each push. Instead of blocking, the
+// consumer may also ask for a callback then, by NotifyWhen().
+template <typename T>
+class SpscChannel {
+ public:
+  SpscChannel() : head_(new Segment()), tail_(head_) {}
+
+  ~SpscChannel() {
+    for (Segment* segment = head_; segment != nullptr;) {
+      Segment* next = segment->next.load(std::memory_order_relaxed);
+      delete segment;
+      segment = next;
+    }
+    for (Segment* segment = free_.load(); segment != nullptr;) {
+      Segment* next = segment->next.load(std::memory_order_relaxed);
+      delete segment;
+      segment = next;
+    }
+  }
+
+  // producer only
+  void Push(const T& value) {
+    PushBack(T(value));
+    Publish(1);
+  }
+
+  void Push(T&& value) {
+    PushBack(std::move(value));
+    Publish(1);
+  }
+
+  // producer only, the values are moved in at once and cleared
+  void Push(std::vector<T>* values) {
+    for (auto& value : *values) PushBack(std::move(value));
+    Publish(values->size());
+    values->clear();
+  }
+
+  // producer only, no value is pushed after it until Reopen()
+  void Close() {
+    closed_.store(true, std::memory_order_seq_cst);
+    if (wait_target_.exchange(0, std::memory_order_seq_cst) != 0) {
+      futex_.WakeOne();
+    }
+    if (notify_target_.exchange(0, std::memory_order_seq_cst) != 0) {
+      notify_callback_();
+    }
+  }
+
+  // Called by the producer, in Push() or Close(), once for each
+  // NotifyWhen() which returned true. Set it before any value is pushed.
+  void set_notify_callback(std::function<void()> callback) {
+    notify_callback_ = std::move(callback);
+  }
+
+  // consumer only, the notify callback is called once num values are
+  // queued or the channel is closed. Returns false, and the callback is not
+  // called, if that is already the case.
+  bool NotifyWhen(size_t num) {
+    size_t target = popped_.load(std::memory_order_relaxed) + num;
+    if (pushed_.load(std::memory_order_acquire) >= target || closed()) {
+      return false;
+    }
+    notify_target_.store(target, std::memory_order_seq_cst);
+    if (pushed_.load(std::memory_order_seq_cst) < target &&
+        !closed_.load(std::memory_order_seq_cst)) {
+      return true;
+    }
+    // raced with a push or the close, which calls the callback if it has
+    // seen the target
+    return !notify_target_.compare_exchange_strong(target, 0);
+  }
+
+  // consumer only, blocks until num values are queued or the channel is
+  // closed, returns whether num values are queued
+  bool Wait(size_t num) {
+    size_t target = popped_.load(std::memory_order_relaxed) + num;
+    if (pushed_.load(std::memory_order_acquire) >= target) return true;
+    while (!closed_.load(std::memory_order_acquire)) {
+      uint32_t value = futex_.value();
+      wait_target_.store(target, std::memory_order_seq_cst);
+      // a push after the store above sees the target and wakes this thread
+      if (pushed_.load(std::memory_order_seq_cst) >= target ||
+          closed_.load(std::memory_order_seq_cst)) {
+        break;
+      }
+      futex_.Wait(value);
+    }
+    wait_target_.store(0, std::memory_order_relaxed);
+    return pushed_.load(std::memory_order_acquire) >= target;
+  }
+
+  // consumer only, the front value, the channel is not empty
+  T Pop() {
+    if (head_index_ == kSegmentSize) NextHead();
+    T value(std::move(head_->values[head_index_++]));
+    popped_.store(popped_.load(std::memory_order_relaxed) + 1,
+                  std::memory_order_release);
+    return value;
+  }
+
+  // consumer only, appends num values to values, num is at most Size()
+  void Pop(size_t num, std::vector<T>* values) {
+    for (size_t i = 0; i < num; ++i) {
+      if (head_index_ == kSegmentSize) NextHead();
+      values->push_back(std::move(head_->values[head_index_++]));
+    }
+    popped_.store(popped_.load(std::memory_order_relaxed) + num,
+                  std::memory_order_release);
+  }
+
+  // consumer only, a copy of the queued values, front first
+  std::vector<T> Items() const {
+    std::vector<T> items;
+    size_t size = Size();
+    items.reserve(size);
+    const Segment* segment = head_;
+    size_t index = head_index_;
+    for (size_t i = 0; i < size; ++i) {
+      if (index == kSegmentSize) {
+        segment = segment->next.load(std::memory_order_acquire);
+        index = 0;
+      }
+      items.push_back(segment->values[index++]);
+    }
+    return items;
+  }
+
+  // once closed and drained, with neither thread using the channel, a
+  // notification asked for is dropped
+  void Reopen() {
+    closed_.store(false);
+    notify_target_.store(0);
+  }
+
+  // any thread, the values queued
+  size_t Size() const {
+    // popped_ first, as it never passes pushed_
+    size_t popped = popped_.load(std::memory_order_acquire);
+    return pushed_.load(std::memory_order_acquire) - popped;
+  }
+
+  bool Empty() const { return Size() == 0; }
+  bool closed() const { return closed_.load(std::memory_order_acquire); }
+
+ private:
+  static const size_t kSegmentSize = 64;
+
+  struct Segment {
+    T values[kSegmentSize];
+    // the next segment in the channel, or in the free list
+    std::atomic<Segment*> next{nullptr};
+  };
+
+  // producer only
+  void PushBack(T&& value) {
+    if (tail_index_ == kSegmentSize) {
+      Segment* segment = TakeFree();
+      tail_->next.store(segment, std::memory_order_release);
+      tail_ = segment;
+      tail_index_ = 0;
+    }
+    tail_->values[tail_index_++] = std::move(value);
+  }
+
+  void Publish(size_t num) {
+    if (num == 0) return;
+    size_t pushed = pushed_.load(std::memory_order_relaxed) + num;
+    pushed_.store(pushed, std::memory_order_seq_cst);
+    size_t target = wait_target_.load(std::memory_order_seq_cst);
+    // the consumer is woken once, when enough values are queued
+    if (target != 0 && pushed >= target &&
+        wait_target_.compare_exchange_strong(target, 0)) {
+      futex_.WakeOne();
+    }
+    target = notify_target_.load(std::memory_order_seq_cst);
+    if (target != 0 && pushed >= target &&
+        notify_target_.compare_exchange_strong(target, 0)) {
+      notify_callback_();
+    }
+  }
+
+  // producer only, a segment from the free list or the heap
+  Segment* TakeFree() {
+    Segment* segment = free_.load(std::memory_order_acquire);
+    // no ABA as the producer is the only one to take from the list
+    while (segment != nullptr &&
+           !free_.compare_exchange_weak(
+               segment,
+               segment->next.load(std::memory_order_relaxed),
+               std::memory_order_acquire,
+               std::memory_order_acquire)) {
+    }
+    if (segment == nullptr) return new Segment();
+    segment->next.store(nullptr, std::memory_order_relaxed);
+    return segment;
+  }
+
+  // consumer only, moves past the head segment, returned to the free list
+  void NextHead() {
+    Segment* done = head_;
+    head_ = head_->next.load(std::memory_order_acquire);
+    head_index_ = 0;
+    Segment* top = free_.load(std::memory_order_relaxed);
+    do {
+      done->next.store(top, std::memory_order_relaxed);
+    } while (!free_.compare_exchange_weak(
+        top, done, std::memory_order_release, std::memory_order_relaxed));
+  }
+
+  // The consumer and the producer sides on cache lines of their own,
+  // padded as new does not align to more than max_align_t before c++17.
+  char consumer_pad_[64];
+  // consumer side
+  Segment* head_;
+  size_t head_index_ = 0;
+  std::atomic<size_t> popped_{0};
+  // the pushed_ the consumer waits for, 0 if it is not waiting
+  std::atomic<size_t> wait_target_{0};
+  Futex futex_;
+  // the pushed_ to call notify_callback_ at, 0 if none
+  std::atomic<size_t> notify_target_{0};
+  std::function<void()> notify_callback_;
+
+  char producer_pad_[64];
+  // producer side
+  Segment* tail_;
+  size_t tail_index_ = 0;
+  std::atomic<size_t> pushed_{0};
+  std::atomic<bool> closed_{false};
+
+  std::atomic<Segment*> free_{nullptr};
+
+ public:
+  DISALLOW_COPY_AND_ASSIGN(SpscChannel);
+};
+
+}  // namespace ppspeech
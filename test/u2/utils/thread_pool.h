@@ -19,59 +19,436 @@
 //    3. This notice may not be removed or altered from any source
 //    distribution.
 
+// Altered: the single locked queue is replaced by work stealing, see
+// ThreadPool below.
+
 #pragma once
 
+#include <algorithm>
+#include <atomic>
 #include <condition_variable>
+#include <cstddef>
+#include <cstdint>
 #include <functional>
 #include <future>
 #include <memory>
 #include <mutex>
-#include <queue>
+#include <new>
 #include <stdexcept>
 #include <thread>
+#include <type_traits>
 #include <utility>
 #include <vector>
 
+namespace thread_pool_internal {
+
+// A move-only void() callable. Callables of up to kInlineSize bytes, e.g.
+// lambdas capturing a few pointers, are stored inline, larger ones on the
+// heap.
+class Task {
+ public:
+  static const size_t kInlineSize = 48;
+
+  Task() = default;
+  template <class F, class = typename std::enable_if<!std::is_same<
+                         typename std::decay<F>::type, Task>::value>::type>
+  explicit Task(F&& f) {
+    using Func = typename std::decay<F>::type;
+    Emplace<Func>(std::forward<F>(f),
+                  std::integral_constant<bool, IsInline<Func>()>());
+  }
+  Task(Task&& other) noexcept { MoveFrom(&other); }
+  Task& operator=(Task&& other) noexcept {
+    if (this != &other) {
+      Reset();
+      MoveFrom(&other);
+    }
+    return *this;
+  }
+  Task(const Task&) = delete;
+  Task& operator=(const Task&) = delete;
+  ~Task() { Reset(); }
+
+  void operator()() { ops->invoke(storage); }
+  explicit operator bool() const { return ops != nullptr; }
+
+  void Reset() {
+    if (ops != nullptr) ops->destroy(storage);
+    ops = nullptr;
+  }
+
+ private:
+  struct Ops {
+    void (*invoke)(void* storage);
+    // move constructs the callable of from into to, and destroys from
+    void (*relocate)(void* from, void* to);
+    void (*destroy)(void* storage);
+  };
+
+  template <class Func>
+  static constexpr bool IsInline() {
+    return sizeof(Func) <= kInlineSize &&
+           alignof(Func) <= alignof(std::max_align_t) &&
+           std::is_nothrow_move_constructible<Func>::value;
+  }
+
+  template <class Func, class F>
+  void Emplace(F&& f, std::true_type) {
+    static const Ops inline_ops = {
+        [](void* storage) { (*static_cast<Func*>(storage))(); },
+        [](void* from, void* to) {
+          new (to) Func(std::move(*static_cast<Func*>(from)));
+          static_cast<Func*>(from)->~Func();
+        },
+        [](void* storage) { static_cast<Func*>(storage)->~Func(); }};
+    new (storage) Func(std::forward<F>(f));
+    ops = &inline_ops;
+  }
+
+  template <class Func, class F>
+  void Emplace(F&& f, std::false_type) {
+    static const Ops heap_ops = {
+        [](void* storage) { (**static_cast<Func**>(storage))(); },
+        [](void* from, void* to) {
+          *static_cast<Func**>(to) = *static_cast<Func**>(from);
+        },
+        [](void* storage) { delete *static_cast<Func**>(storage); }};
+    *reinterpret_cast<Func**>(storage) = new Func(std::forward<F>(f));
+    ops = &heap_ops;
+  }
+
+  void MoveFrom(Task* other) {
+    ops = other->ops;
+    if (ops != nullptr) ops->relocate(other->storage, storage);
+    other->ops = nullptr;
+  }
+
+  alignas(std::max_align_t) unsigned char storage[kInlineSize];
+  const Ops* ops = nullptr;
+};
+
+// The tasks in flight, in nodes which are never freed but recycled through
+// a lock free stack, so a task is queued without touching the heap once
+// the pool has seen its peak number of tasks. Nodes are named by their
+// index, which the queues below hold.
+class TaskNodes {
+ public:
+  struct Node {
+    Task task;
+    std::atomic<uint32_t> next{0};
+  };
+
+  ~TaskNodes() {
+    for (uint32_t i = 0; i < num_chunks.load(); ++i) delete[] chunks[i];
+  }
+
+  Node& operator[](uint32_t index) {
+    return chunks[index / kChunkSize][index % kChunkSize];
+  }
+
+  uint32_t Alloc() {
+    uint64_t head = free_head.load(std::memory_order_acquire);
+    for (;;) {
+      // the index + 1 of the top node in the low half, 0 if none, and a tag
+      // bumped on each change in the high half against ABA
+      uint32_t top = static_cast<uint32_t>(head);
+      if (top == 0) return Grow();
+      uint32_t next = (*this)[top - 1].next.load(std::memory_order_relaxed);
+      uint64_t new_head = ((head >> 32) + 1) << 32 | next;
+      if (free_head.compare_exchange_weak(head,
+                                          new_head,
+                                          std::memory_order_acquire,
+                                          std::memory_order_acquire)) {
+        return top - 1;
+      }
+    }
+  }
+
+  void Free(uint32_t index) {
+    uint64_t head = free_head.load(std::memory_order_relaxed);
+    for (;;) {
+      (*this)[index].next.store(static_cast<uint32_t>(head),
+                                std::memory_order_relaxed);
+      uint64_t new_head = ((head >> 32) + 1) << 32 | (index + 1);
+      if (free_head.compare_exchange_weak(head,
+                                          new_head,
+                                          std::memory_order_release,
+                                          std::memory_order_relaxed)) {
+        return;
+      }
+    }
+  }
+
+ private:
+  static const uint32_t kChunkSize = 256;
+  static const uint32_t kMaxChunks = 1 << 12;
+
+  // a new chunk, all its nodes but the one returned are freed
+  uint32_t Grow() {
+    std::lock_guard<std::mutex> lock(grow_mutex);
+    uint32_t chunk = num_chunks.load(std::memory_order_relaxed);
+    if (chunk == kMaxChunks) {
+      throw std::runtime_error("too many tasks in flight in ThreadPool");
+    }
+    chunks[chunk] = new Node[kChunkSize];
+    num_chunks.store(chunk + 1, std::memory_order_release);
+    uint32_t first = chunk * kChunkSize;
+    for (uint32_t i = 1; i < kChunkSize; ++i) Free(first + i);
+    return first;
+  }
+
+  Node* chunks[kMaxChunks] = {};
+  std::atomic<uint32_t> num_chunks{0};
+  std::atomic<uint64_t> free_head{0};
+  std::mutex grow_mutex;
+};
+
+// Chase-Lev work stealing deque of a fixed capacity, see "Correct and
+// Efficient Work-Stealing for Weak Memory Models", Le et al. 2013. The
+// owner pushes and pops at the bottom, the others steal from the top.
+class WorkStealingDeque {
+ public:
+  explicit WorkStealingDeque(size_t capacity)
+      : mask(capacity - 1), buffer(new std::atomic<uint32_t>[capacity]) {}
+
+  // owner only, false if full
+  bool Push(uint32_t value) {
+    int64_t b = bottom.load(std::memory_order_relaxed);
+    int64_t t = top.load(std::memory_order_acquire);
+    if (b - t > static_cast<int64_t>(mask)) return false;
+    buffer[b & mask].store(value, std::memory_order_relaxed);
+    bottom.store(b + 1, std::memory_order_release);
+    return true;
+  }
+
+  // owner only, the last pushed
+  bool Pop(uint32_t* value) {
+    int64_t b = bottom.load(std::memory_order_relaxed) - 1;
+    bottom.store(b, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    int64_t t = top.load(std::memory_order_relaxed);
+    if (t > b) {
+      bottom.store(b + 1, std::memory_order_relaxed);
+      return false;
+    }
+    *value = buffer[b & mask].load(std::memory_order_relaxed);
+    if (t == b) {
+      // the last one, raced with the thieves
+      bool won = top.compare_exchange_strong(
+          t, t + 1, std::memory_order_seq_cst, std::memory_order_relaxed);
+      bottom.store(b + 1, std::memory_order_relaxed);
+      return won;
+    }
+    return true;
+  }
+
+  // any thread, the first pushed
+  bool Steal(uint32_t* value) {
+    int64_t t = top.load(std::memory_order_acquire);
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    int64_t b = bottom.load(std::memory_order_acquire);
+    if (t >= b) return false;
+    uint32_t stolen = buffer[t & mask].load(std::memory_order_relaxed);
+    if (!top.compare_exchange_strong(
+            t, t + 1, std::memory_order_seq_cst, std::memory_order_relaxed)) {
+      return false;
+    }
+    *value = stolen;
+    return true;
+  }
+
+  bool Empty() const {
+    return bottom.load(std::memory_order_relaxed) <=
+           top.load(std::memory_order_relaxed);
+  }
+
+ private:
+  const size_t mask;
+  std::unique_ptr<std::atomic<uint32_t>[]> buffer;
+  // on lines of their own, padded as new does not align to more than
+  // max_align_t before c++17
+  char pad0[64];
+  std::atomic<int64_t> top{0};
+  char pad1[64];
+  std::atomic<int64_t> bottom{0};
+  char pad2[64];
+};
+
+// Bounded multi producer multi consumer queue by D. Vyukov, the inbox of a
+// worker for the tasks submitted from outside the pool.
+class MpmcQueue {
+ public:
+  explicit MpmcQueue(size_t capacity)
+      : mask(capacity - 1), cells(new Cell[capacity]) {
+    for (size_t i = 0; i < capacity; ++i) {
+      cells[i].sequence.store(i, std::memory_order_relaxed);
+    }
+  }
+
+  // false if full
+  bool Push(uint32_t value) {
+    size_t pos = enqueue_pos.load(std::memory_order_relaxed);
+    Cell* cell;
+    for (;;) {
+      cell = &cells[pos & mask];
+      size_t sequence = cell->sequence.load(std::memory_order_acquire);
+      intptr_t diff =
+          static_cast<intptr_t>(sequence) - static_cast<intptr_t>(pos);
+      if (diff == 0) {
+        if (enqueue_pos.compare_exchange_weak(
+                pos, pos + 1, std::memory_order_relaxed)) {
+          break;
+        }
+      } else if (diff < 0) {
+        return false;
+      } else {
+        pos = enqueue_pos.load(std::memory_order_relaxed);
+      }
+    }
+    cell->value = value;
+    cell->sequence.store(pos + 1, std::memory_order_release);
+    return true;
+  }
+
+  // false if empty
+  bool Pop(uint32_t* value) {
+    size_t pos = dequeue_pos.load(std::memory_order_relaxed);
+    Cell* cell;
+    for (;;) {
+      cell = &cells[pos & mask];
+      size_t sequence = cell->sequence.load(std::memory_order_acquire);
+      intptr_t diff =
+          static_cast<intptr_t>(sequence) - static_cast<intptr_t>(pos + 1);
+      if (diff == 0) {
+        if (dequeue_pos.compare_exchange_weak(
+                pos, pos + 1, std::memory_order_relaxed)) {
+          break;
+        }
+      } else if (diff < 0) {
+        return false;
+      } else {
+        pos = dequeue_pos.load(std::memory_order_relaxed);
+      }
+    }
+    *value = cell->value;
+    cell->sequence.store(pos + mask + 1, std::memory_order_release);
+    return true;
+  }
+
+  bool Empty() const {
+    return dequeue_pos.load(std::memory_order_relaxed) >=
+           enqueue_pos.load(std::memory_order_relaxed);
+  }
+
+ private:
+  struct Cell {
+    std::atomic<size_t> sequence;
+    uint32_t value;
+  };
+
+  const size_t mask;
+  std::unique_ptr<Cell[]> cells;
+  // on lines of their own, see WorkStealingDeque
+  char pad0[64];
+  std::atomic<size_t> enqueue_pos{0};
+  char pad1[64];
+  std::atomic<size_t> dequeue_pos{0};
+  char pad2[64];
+};
+
+}  // namespace thread_pool_internal
+
+// A work stealing pool. Each worker has a Chase-Lev deque for the tasks
+// submitted by the tasks it runs, and an inbox for those submitted from
+// outside the pool, which go to the workers in turn. A worker runs its own
+// tasks first, newest first, then steals from the others, oldest first. So
+// there is no lock shared by the submitters and the workers, and tasks are
+// stored without heap allocation once the pool has warmed up; a mutex is
+// only taken to wake sleeping workers.
 class ThreadPool {
  public:
-  explicit ThreadPool(size_t);
+  // init, if any, is called by each worker with its index before it runs
+  // any task, e.g. to pin it to some cpus
+  explicit ThreadPool(size_t threads,
+                      std::function<void(size_t)> init = nullptr);
   ~ThreadPool();
 
+  // f(args...) is run by a worker, its result or exception is set to the
+  // future returned
   template <class F, class... Args>
   auto enqueue(F&& f, Args&&... args)
       -> std::future<typename std::result_of<F(Args...)>::type>;
 
+  // Fire and forget, without the shared state of a future. f must not
+  // throw. Blocks while all the inboxes are full, a task submitting to a
+  // full pool runs the new task inline instead.
+  template <class F>
+  void Submit(F&& f);
+
+  size_t size() const { return workers.size(); }
+
  private:
+  using Task = thread_pool_internal::Task;
+
+  static const size_t kDequeCapacity = 1024;
+  static const size_t kInboxCapacity = 1024;
+
+  struct Worker {
+    Worker()
+        : deque(kDequeCapacity), inbox(kInboxCapacity) {}
+    thread_pool_internal::WorkStealingDeque deque;
+    thread_pool_internal::MpmcQueue inbox;
+  };
+
+  // the worker of this pool the calling thread is, -1 if none
+  int CurrentWorker() const {
+    return current_pool() == this ? static_cast<int>(current_index()) : -1;
+  }
+  static const ThreadPool*& current_pool() {
+    static thread_local const ThreadPool* pool = nullptr;
+    return pool;
+  }
+  static size_t& current_index() {
+    static thread_local size_t index = 0;
+    return index;
+  }
+
+  void Push(Task task);
+  void WorkerLoop(size_t index);
+  bool FindTask(size_t index, uint32_t* node);
+  bool HasTask() const;
+  void RunTask(uint32_t node);
+  void WakeOne();
+
   // need to keep track of threads so we can join them
   std::vector<std::thread> workers;
-  // the task queue
-  std::queue<std::function<void()>> tasks;
+  std::vector<std::unique_ptr<Worker>> queues;
+  thread_pool_internal::TaskNodes nodes;
+  std::atomic<size_t> next_inbox{0};
 
-  // synchronization
-  std::mutex queue_mutex;
-  std::condition_variable condition;
-  bool stop;
+  // synchronization of the idle workers
+  std::mutex idle_mutex;
+  std::condition_variable idle_condition;
+  std::atomic<int> num_idle{0};
+  uint64_t wake_epoch = 0;  // under idle_mutex
+  std::atomic<bool> stop{false};
 };
 
 // the constructor just launches some amount of workers
-inline ThreadPool::ThreadPool(size_t threads) : stop(false) {
-  for (size_t i = 0; i < threads; ++i)
-    workers.emplace_back([this] {
-      for (;;) {
-        std::function<void()> task;
-
-        {
-          std::unique_lock<std::mutex> lock(this->queue_mutex);
-          this->condition.wait(
-              lock, [this] { return this->stop || !this->tasks.empty(); });
-          if (this->stop && this->tasks.empty()) return;
-          task = std::move(this->tasks.front());
-          this->tasks.pop();
-        }
-
-        task();
-      }
+inline ThreadPool::ThreadPool(size_t threads,
+                              std::function<void(size_t)> init) {
+  threads = std::max<size_t>(threads, 1);
+  for (size_t i = 0; i < threads; ++i) {
+    queues.emplace_back(new Worker());
+  }
+  for (size_t i = 0; i < threads; ++i) {
+    workers.emplace_back([this, i, init] {
+      current_pool() = this;
+      current_index() = i;
+      if (init) init(i);
+      WorkerLoop(i);
     });
+  }
 }
 
 // add new work item to the pool
@@ -80,31 +457,122 @@ auto ThreadPool::enqueue(F&& f, Args&&... args)
     -> std::future<typename std::result_of<F(Args...)>::type> {
   using return_type = typename std::result_of<F(Args...)>::type;
 
-  auto task = std::make_shared<std::packaged_task<return_type()>>(
+  std::packaged_task<return_type()> task(
       std::bind(std::forward<F>(f), std::forward<Args>(args)...));
+  std::future<return_type> res = task.get_future();
+
+  // don't allow enqueueing after stopping the pool, but from the tasks
+  // drained by the workers
+  if (stop.load() && CurrentWorker() < 0) {
+    throw std::runtime_error("enqueue on stopped ThreadPool");
+  }
+  Push(Task(std::move(task)));
+  return res;
+}
+
+template <class F>
+void ThreadPool::Submit(F&& f) {
+  if (stop.load() && CurrentWorker() < 0) {
+    throw std::runtime_error("submit on stopped ThreadPool");
+  }
+  Push(Task(std::forward<F>(f)));
+}
+
+inline void ThreadPool::Push(Task task) {
+  uint32_t node = nodes.Alloc();
+  nodes[node].task = std::move(task);
+
+  int worker = CurrentWorker();
+  if (worker < 0 || !queues[worker]->deque.Push(node)) {
+    // to the inboxes in turn, from the next one if full
+    size_t num_queues = queues.size();
+    size_t first = next_inbox.fetch_add(1, std::memory_order_relaxed);
+    bool pushed = false;
+    while (!pushed) {
+      for (size_t i = 0; i < num_queues && !pushed; ++i) {
+        pushed = queues[(first + i) % num_queues]->inbox.Push(node);
+      }
+      if (pushed) break;
+      if (worker >= 0) {
+        // a worker waiting for room may wait for itself
+        RunTask(node);
+        return;
+      }
+      std::this_thread::yield();
+    }
+  }
+  // the task is visible before num_idle is read, see WorkerLoop()
+  std::atomic_thread_fence(std::memory_order_seq_cst);
+  WakeOne();
+}
 
-  std::future<return_type> res = task->get_future();
+inline void ThreadPool::WakeOne() {
+  if (num_idle.load(std::memory_order_relaxed) == 0) return;
   {
-    std::unique_lock<std::mutex> lock(queue_mutex);
+    std::lock_guard<std::mutex> lock(idle_mutex);
+    ++wake_epoch;
+  }
+  idle_condition.notify_one();
+}
 
-    // don't allow enqueueing after stopping the pool
-    if (stop) {
-      throw std::runtime_error("enqueue on stopped ThreadPool");
+inline bool ThreadPool::FindTask(size_t index, uint32_t* node) {
+  Worker& own = *queues[index];
+  if (own.deque.Pop(node) || own.inbox.Pop(node)) return true;
+  size_t num_queues = queues.size();
+  for (size_t i = 1; i < num_queues; ++i) {
+    Worker& victim = *queues[(index + i) % num_queues];
+    if (victim.deque.Steal(node) || victim.inbox.Pop(node)) return true;
+  }
+  return false;
+}
+
+inline bool ThreadPool::HasTask() const {
+  for (const auto& queue : queues) {
+    if (!queue->deque.Empty() || !queue->inbox.Empty()) return true;
+  }
+  return false;
+}
+
+inline void ThreadPool::RunTask(uint32_t node) {
+  Task& task = nodes[node].task;
+  task();
+  task.Reset();
+  nodes.Free(node);
+}
+
+inline void ThreadPool::WorkerLoop(size_t index) {
+  uint32_t node = 0;
+  for (;;) {
+    if (FindTask(index, &node)) {
+      RunTask(node);
+      continue;
     }
 
-    tasks.emplace([task]() { (*task)(); });
+    std::unique_lock<std::mutex> lock(idle_mutex);
+    uint64_t epoch = wake_epoch;
+    num_idle.fetch_add(1);
+    // a task pushed before num_idle is raised is found here, one pushed
+    // after sees num_idle and bumps the epoch
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    if (!HasTask()) {
+      if (stop.load()) {
+        num_idle.fetch_sub(1);
+        return;
+      }
+      idle_condition.wait(
+          lock, [this, epoch] { return wake_epoch != epoch || stop.load(); });
+    }
+    num_idle.fetch_sub(1);
   }
-  condition.notify_one();
-  return res;
 }
 
-// the destructor joins all threads
+// the destructor joins all threads, once the tasks queued have run
 inline ThreadPool::~ThreadPool() {
   {
-    std::unique_lock<std::mutex> lock(queue_mutex);
+    std::unique_lock<std::mutex> lock(idle_mutex);
     stop = true;
   }
-  condition.notify_all();
+  idle_condition.notify_all();
   for (std::thread& worker : workers) {
     worker.join();
   }
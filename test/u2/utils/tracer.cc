@@ -0,0 +1,234 @@
+// Copyright (c) 2022 PaddlePaddle Authors. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "utils/tracer.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <fstream>
+#include <sstream>
+
+#include "utils/log.h"
+
+namespace ppspeech {
+
+static thread_local int64_t g_current_id = -1;
+static thread_local std::string g_thread_name;
+
+static int64_t NextTracerId() {
+  static std::atomic<int64_t> next_id{0};
+  return next_id.fetch_add(1);
+}
+
+Tracer::ThreadBuffer::ThreadBuffer(int capacity,
+                                   int tid,
+                                   const std::string& name)
+    : events(capacity), tid(tid), name(name) {}
+
+Tracer::Tracer() : id_(NextTracerId()), origin_ns_(NowNs()) {}
+
+int64_t Tracer::NowNs() {
+  return std::chrono::duration_cast<std::chrono::nanoseconds>(
+             std::chrono::steady_clock::now().time_since_epoch())
+      .count();
+}
+
+int64_t Tracer::current_id() { return g_current_id; }
+
+void Tracer::set_current_id(int64_t id) { g_current_id = id; }
+
+void Tracer::SetThreadName(const std::string& name) { g_thread_name = name; }
+
+void Tracer::Start(int events_per_thread) {
+  CHECK_GT(events_per_thread, 0);
+  CHECK_EQ(events_per_thread & (events_per_thread - 1), 0)
+      << "events_per_thread is a power of two";
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    events_per_thread_ = events_per_thread;
+    for (auto& item : buffers_) {
+      ThreadBuffer* buffer = item.second.get();
+      buffer->begin.store(buffer->head.load(std::memory_order_acquire),
+                          std::memory_order_relaxed);
+    }
+    id_names_.clear();
+  }
+  origin_ns_.store(NowNs(), std::memory_order_relaxed);
+  enabled_.store(true, std::memory_order_relaxed);
+}
+
+Tracer::ThreadBuffer* Tracer::GetThreadBuffer() {
+  // the buffer of the tracer the thread recorded into last, by id as an
+  // address may be reused by another tracer
+  thread_local int64_t cached_id = -1;
+  thread_local ThreadBuffer* cached = nullptr;
+  if (cached_id != id_) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    std::unique_ptr<ThreadBuffer>& buffer =
+        buffers_[std::this_thread::get_id()];
+    if (buffer == nullptr) {
+      buffer.reset(new ThreadBuffer(
+          events_per_thread_, buffers_.size(), g_thread_name));
+    }
+    cached_id = id_;
+    cached = buffer.get();
+  }
+  return cached;
+}
+
+void Tracer::Record(const TraceEvent& event) {
+  ThreadBuffer* buffer = GetThreadBuffer();
+  // one writer, the readers see the event once head is published
+  uint64_t head = buffer->head.load(std::memory_order_relaxed);
+  buffer->events[head & (buffer->events.size() - 1)] = event;
+  buffer->head.store(head + 1, std::memory_order_release);
+}
+
+void Tracer::Complete(const char* name,
+                      int64_t begin_ns,
+                      int64_t end_ns,
+                      int64_t id) {
+  TraceEvent event;
+  event.name = name;
+  event.begin_ns = begin_ns;
+  event.dur_ns = end_ns - begin_ns;
+  event.arg = id;
+  Record(event);
+}
+
+void Tracer::Counter(const char* name, int64_t value) {
+  TraceEvent event;
+  event.name = name;
+  event.begin_ns = NowNs();
+  event.dur_ns = -1;
+  event.arg = value;
+  Record(event);
+}
+
+void Tracer::SetIdName(int64_t id, const std::string& name) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  id_names_[id] = name;
+}
+
+static void WriteString(const std::string& str, std::ostream* out) {
+  *out << '"';
+  for (char c : str) {
+    if (c == '"' || c == '\\') {
+      *out << '\\' << c;
+    } else if (static_cast<unsigned char>(c) < 0x20) {
+      char escaped[8];
+      snprintf(escaped, sizeof(escaped), "\\u%04x", c);
+      *out << escaped;
+    } else {
+      *out << c;
+    }
+  }
+  *out << '"';
+}
+
+// in us with the ns as decimals, as the trace event format has it
+static void WriteMicros(int64_t ns, std::ostream* out) {
+  if (ns < 0) {
+    *out << '-';
+    ns = -ns;
+  }
+  char decimals[8];
+  snprintf(decimals, sizeof(decimals), ".%03d", static_cast<int>(ns % 1000));
+  *out << ns / 1000 << decimals;
+}
+
+std::string Tracer::ToJson() const {
+  std::lock_guard<std::mutex> lock(mutex_);
+  int64_t origin_ns = origin_ns_.load(std::memory_order_relaxed);
+  std::ostringstream json;
+  json << "{\"displayTimeUnit\": \"ns\", \"traceEvents\": [";
+  bool first = true;
+  auto next = [&json, &first]() {
+    json << (first ? "\n" : ",\n");
+    first = false;
+  };
+
+  std::vector<TraceEvent> events;
+  for (const auto& item : buffers_) {
+    const ThreadBuffer& buffer = *item.second;
+    if (!buffer.name.empty()) {
+      next();
+      json << "{\"ph\": \"M\", \"pid\": 1, \"tid\": " << buffer.tid
+           << ", \"name\": \"thread_name\", \"args\": {\"name\": ";
+      WriteString(buffer.name, &json);
+      json << "}}";
+    }
+
+    uint64_t size = buffer.events.size();
+    uint64_t head = buffer.head.load(std::memory_order_acquire);
+    uint64_t begin = buffer.begin.load(std::memory_order_relaxed);
+    begin = std::max(begin, head > size ? head - size : 0);
+    events.clear();
+    for (uint64_t i = begin; i < head; ++i) {
+      events.push_back(buffer.events[i & (size - 1)]);
+    }
+    // drop the events overwritten while they were copied
+    uint64_t written = buffer.head.load(std::memory_order_acquire);
+    size_t overwritten =
+        written > size + begin ? std::min<uint64_t>(written - size - begin,
+                                                    events.size())
+                               : 0;
+
+    for (size_t i = overwritten; i < events.size(); ++i) {
+      const TraceEvent& event = events[i];
+      next();
+      json << "{\"name\": ";
+      WriteString(event.name, &json);
+      json << ", \"pid\": 1, \"tid\": " << buffer.tid << ", \"ts\": ";
+      WriteMicros(event.begin_ns - origin_ns, &json);
+      if (event.dur_ns < 0) {
+        json << ", \"ph\": \"C\", \"args\": {\"value\": " << event.arg
+             << "}}";
+        continue;
+      }
+      json << ", \"ph\": \"X\", \"dur\": ";
+      WriteMicros(event.dur_ns, &json);
+      if (event.arg >= 0) {
+        json << ", \"args\": {\"id\": " << event.arg;
+        auto it = id_names_.find(event.arg);
+        if (it != id_names_.end()) {
+          json << ", \"key\": ";
+          WriteString(it->second, &json);
+        }
+        json << "}";
+      }
+      json << "}";
+    }
+  }
+  json << "\n]}\n";
+  return json.str();
+}
+
+bool Tracer::Dump(const std::string& path) const {
+  std::ofstream file(path);
+  if (!file) {
+    LOG(ERROR) << "failed to open " << path;
+    return false;
+  }
+  file << ToJson();
+  return static_cast<bool>(file);
+}
+
+Tracer& GlobalTracer() {
+  static Tracer tracer;
+  return tracer;
+}
+
+}  // namespace ppspeech
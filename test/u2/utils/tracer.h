@@ -0,0 +1,165 @@
+// Copyright (c) 2022 PaddlePaddle Authors. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+#include "utils/utils.h"
+
+namespace ppspeech {
+
+// A scope or a counter value recorded by a thread.
+struct TraceEvent {
+  // a string literal
+  const char* name = nullptr;
+  int64_t begin_ns = 0;
+  // -1 for a counter
+  int64_t dur_ns = 0;
+  // the id of the scope, e.g. of a session, or the counter value
+  int64_t arg = 0;
+};
+
+// Tracer of scopes into the Chrome trace event format, to be viewed by
+// chrome://tracing or Perfetto, independent of the profiler of Paddle.
+//
+// Each thread records into a ring buffer of its own without a lock, so the
+// oldest events of a thread are overwritten once its buffer is full. A
+// scope records nothing while the tracer is stopped but reading an atomic.
+//
+//   GlobalTracer().Start();
+//   {
+//     TRACE_SCOPE_ID("Step", session_id);
+//     ...
+//     TRACE_SCOPE("Search");  // of session_id as well
+//   }
+//   GlobalTracer().Stop();
+//   GlobalTracer().Dump("trace.json");
+class Tracer {
+ public:
+  Tracer();
+
+  // The events recorded before are dropped. events_per_thread, a power of
+  // two, is for the threads recording for the first time.
+  void Start(int events_per_thread = 1 << 16);
+  void Stop() { enabled_.store(false, std::memory_order_relaxed); }
+  bool enabled() const { return enabled_.load(std::memory_order_relaxed); }
+
+  void Complete(const char* name, int64_t begin_ns, int64_t end_ns,
+                int64_t id);
+  void Counter(const char* name, int64_t value);
+  // the name shown with the events of id, e.g. the key of an utterance
+  void SetIdName(int64_t id, const std::string& name);
+
+  // Call them when stopped, the events being recorded meanwhile may be
+  // dropped.
+  std::string ToJson() const;
+  bool Dump(const std::string& path) const;
+
+  static int64_t NowNs();
+  // the id of the innermost scope with an id on the calling thread, -1 if
+  // none
+  static int64_t current_id();
+  static void set_current_id(int64_t id);
+  // the name shown for the calling thread, set it before the thread
+  // records
+  static void SetThreadName(const std::string& name);
+
+ private:
+  struct ThreadBuffer {
+    ThreadBuffer(int capacity, int tid, const std::string& name);
+
+    std::vector<TraceEvent> events;
+    // the number of events written, only the last events.size() are kept
+    std::atomic<uint64_t> head{0};
+    // the first event since Start()
+    std::atomic<uint64_t> begin{0};
+    int tid;
+    std::string name;
+  };
+
+  void Record(const TraceEvent& event);
+  ThreadBuffer* GetThreadBuffer();
+
+  const int64_t id_;
+  std::atomic<bool> enabled_{false};
+  std::atomic<int64_t> origin_ns_;
+  int events_per_thread_ = 1 << 16;
+
+  mutable std::mutex mutex_;
+  std::map<std::thread::id, std::unique_ptr<ThreadBuffer>> buffers_;
+  std::unordered_map<int64_t, std::string> id_names_;
+
+ public:
+  DISALLOW_COPY_AND_ASSIGN(Tracer);
+};
+
+// the tracer of the decoder
+Tracer& GlobalTracer();
+
+// Records its lifetime. With an id >= 0 it is the id of the nested scopes
+// too, otherwise the scope takes the id of the enclosing one.
+class TraceScope {
+ public:
+  explicit TraceScope(const char* name, int64_t id = -1) {
+    Tracer& tracer = GlobalTracer();
+    if (!tracer.enabled()) return;
+    tracer_ = &tracer;
+    name_ = name;
+    parent_id_ = Tracer::current_id();
+    id_ = id >= 0 ? id : parent_id_;
+    Tracer::set_current_id(id_);
+    begin_ns_ = Tracer::NowNs();
+  }
+  ~TraceScope() {
+    if (tracer_ == nullptr) return;
+    tracer_->Complete(name_, begin_ns_, Tracer::NowNs(), id_);
+    Tracer::set_current_id(parent_id_);
+  }
+
+ private:
+  Tracer* tracer_ = nullptr;
+  const char* name_ = nullptr;
+  int64_t id_ = -1;
+  int64_t parent_id_ = -1;
+  int64_t begin_ns_ = 0;
+
+ public:
+  DISALLOW_COPY_AND_ASSIGN(TraceScope);
+};
+
+}  // namespace ppspeech
+
+#define TRACE_CONCAT_IMPL(a, b) a##b
+#define TRACE_CONCAT(a, b) TRACE_CONCAT_IMPL(a, b)
+
+// name is a string literal
+#define TRACE_SCOPE(name) \
+  ppspeech::TraceScope TRACE_CONCAT(trace_scope_, __LINE__)(name)
+#define TRACE_SCOPE_ID(name, id) \
+  ppspeech::TraceScope TRACE_CONCAT(trace_scope_, __LINE__)(name, id)
+#define TRACE_COUNTER(name, value)                               \
+  do {                                                           \
+    if (ppspeech::GlobalTracer().enabled()) {                    \
+      ppspeech::GlobalTracer().Counter(name, value);             \
+    }                                                            \
+  } while (0)
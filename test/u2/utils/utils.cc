@@ -17,10 +17,17 @@
 #include <algorithm>
 #include <cmath>
 #include <cstdint>
-#include <queue>
+#include <string>
 #include <utility>
 #include <vector>
 
+#include "utils/fp16.h"
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#include <immintrin.h>
+#define PPS_HAVE_AVX2_TARGET 1
+#endif
+
 namespace ppspeech {
 
 float LogSumExp(float x, float y) {
@@ -30,50 +37,255 @@ float LogSumExp(float x, float y) {
   return max + std::log(std::exp(x - max) + std::exp(y - max));
 }
 
-template <typename T>
-struct ValueComp {
-  bool operator()(const std::pair<T, int32_t>& lhs,
-                  const std::pair<T, int32_t>& rhs) const {
-    return lhs.first > rhs.first ||
-           (lhs.first == rhs.first && lhs.second < rhs.second);
+namespace internal {
+
+static const float* InitLogAddTable() {
+  static float table[kLogAddTableSize];
+  for (int i = 0; i < kLogAddTableSize; ++i) {
+    double d = static_cast<double>(i) / kLogAddTableScale;
+    table[i] = i < kLogAddMaxDiff * kLogAddTableScale
+                   ? static_cast<float>(std::log1p(std::exp(-d)))
+                   : 0.0f;
+  }
+  return table;
+}
+
+const float* const kLogAddTable = InitLogAddTable();
+
+}  // namespace internal
+
+static void LogSumExpScalar(const float* x, const float* y, float* out, int n) {
+  for (int i = 0; i < n; ++i) {
+    out[i] = FastLogSumExp(x[i], y[i]);
+  }
+}
+
+#ifdef PPS_HAVE_AVX2_TARGET
+__attribute__((target("avx2,fma"))) static void LogSumExpAvx2(const float* x,
+                                                              const float* y,
+                                                              float* out,
+                                                              int n) {
+  const float* table = internal::kLogAddTable;
+  const __m256 sign_mask = _mm256_set1_ps(-0.0f);
+  const __m256 scale = _mm256_set1_ps(internal::kLogAddTableScale);
+  // clamp d to the last entry, whose value and slope are both 0
+  const __m256 max_d = _mm256_set1_ps(internal::kLogAddMaxDiff *
+                                      internal::kLogAddTableScale);
+  int i = 0;
+  for (; i + 8 <= n; i += 8) {
+    __m256 vx = _mm256_loadu_ps(x + i);
+    __m256 vy = _mm256_loadu_ps(y + i);
+    __m256 vmax = _mm256_max_ps(vx, vy);
+    __m256 d = _mm256_andnot_ps(sign_mask, _mm256_sub_ps(vx, vy));
+    d = _mm256_min_ps(_mm256_mul_ps(d, scale), max_d);
+    __m256 fl = _mm256_floor_ps(d);
+    __m256i idx = _mm256_cvttps_epi32(fl);
+    __m256 lo = _mm256_i32gather_ps(table, idx, 4);
+    __m256 hi = _mm256_i32gather_ps(table + 1, idx, 4);
+    __m256 frac = _mm256_sub_ps(d, fl);
+    __m256 v = _mm256_fmadd_ps(frac, _mm256_sub_ps(hi, lo), lo);
+    _mm256_storeu_ps(out + i, _mm256_add_ps(vmax, v));
+  }
+  // avoid the avx-sse transition penalty in the scalar code after
+  _mm256_zeroupper();
+  LogSumExpScalar(x + i, y + i, out + i, n - i);
+}
+#endif
+
+void LogSumExp(const float* x, const float* y, float* out, int n) {
+#ifdef PPS_HAVE_AVX2_TARGET
+  static const bool has_avx2 =
+      __builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma");
+  if (has_avx2) {
+    LogSumExpAvx2(x, y, out, n);
+    return;
+  }
+#endif
+  LogSumExpScalar(x, y, out, n);
+}
+
+namespace {
+
+struct TopKCandidate {
+  float value;
+  int index;
+};
+
+// larger value first, smaller index first on ties
+inline bool TopKBetter(const TopKCandidate& lhs, const TopKCandidate& rhs) {
+  return lhs.value > rhs.value ||
+         (lhs.value == rhs.value && lhs.index < rhs.index);
+}
+
+// Candidates of TopK above the current threshold. Once it is full, it is
+// shrunk to the best k and the threshold is raised to the k-th value, so
+// the size stays bounded whatever the input is.
+class TopKCandidates {
+ public:
+  void Init(int k) {
+    k_ = k;
+    capacity_ = std::max(4 * k, 64);
+    if (static_cast<int>(buf_.size()) < capacity_) buf_.resize(capacity_);
+    size_ = 0;
+    threshold_ = -std::numeric_limits<float>::infinity();
+  }
+
+  // the first k values, threshold is the worst of them
+  void Seed(int index, float value) {
+    buf_[size_++] = {value, index};
+    if (size_ == k_) {
+      threshold_ = buf_[0].value;
+      for (int i = 1; i < size_; ++i) {
+        threshold_ = std::min(threshold_, buf_[i].value);
+      }
+    }
+  }
+
+  // only called for value > threshold, so any later value equal to the
+  // threshold loses the tie by index
+  void Push(int index, float value) {
+    buf_[size_++] = {value, index};
+    if (size_ == capacity_) Shrink();
+  }
+
+  float threshold() const { return threshold_; }
+
+  int Output(float* values, int* indices) {
+    int num = std::min(k_, size_);
+    std::partial_sort(
+        buf_.begin(), buf_.begin() + num, buf_.begin() + size_, TopKBetter);
+    for (int i = 0; i < num; ++i) {
+      values[i] = buf_[i].value;
+      indices[i] = buf_[i].index;
+    }
+    return num;
   }
+
+ private:
+  void Shrink() {
+    std::nth_element(
+        buf_.begin(), buf_.begin() + k_ - 1, buf_.begin() + size_, TopKBetter);
+    threshold_ = buf_[k_ - 1].value;
+    size_ = k_;
+  }
+
+  int k_ = 0;
+  int capacity_ = 0;
+  int size_ = 0;
+  float threshold_ = 0.0f;
+  std::vector<TopKCandidate> buf_;
 };
 
+inline float ToFloat(float x) { return x; }
+inline float ToFloat(float16 x) { return static_cast<float>(x); }
+
 template <typename T>
-void TopK(const std::vector<T>& data,
-          int32_t k,
-          std::vector<T>* values,
-          std::vector<int>* indices) {
-  // k laggest T
-  std::vector<std::pair<T, int32_t>> heap_data;  // (val, idx), smallest heap
-  int n = data.size();
+int TopKScalar(const T* data, int begin, int n, TopKCandidates* cands) {
+  for (int i = begin; i < n; ++i) {
+    float value = ToFloat(data[i]);
+    if (value > cands->threshold()) cands->Push(i, value);
+  }
+  return n;
+}
 
-  for (int32_t i = 0; i < k && i < n; ++i) {
-    heap_data.emplace_back(data[i], i);
+#ifdef PPS_HAVE_AVX2_TARGET
+// 8 values per compare, the candidate path is rare since the threshold
+// quickly reaches the k-th largest value
+__attribute__((target("avx2"))) inline void TopKPushMask(
+    int mask, int base, const float* values, TopKCandidates* cands) {
+  while (mask != 0) {
+    int lane = __builtin_ctz(mask);
+    mask &= mask - 1;
+    // the threshold may have been raised by a previous lane
+    if (values[lane] > cands->threshold()) {
+      cands->Push(base + lane, values[lane]);
+    }
   }
+}
 
-  std::priority_queue<std::pair<T, int32_t>,
-                      std::vector<std::pair<T, int32_t>>,
-                      ValueComp<T>>
-      pq(ValueComp<T>(), std::move(heap_data));
+__attribute__((target("avx2"))) void TopKAvx2(const float* data,
+                                              int begin,
+                                              int n,
+                                              TopKCandidates* cands) {
+  int i = begin;
+  __m256 threshold = _mm256_set1_ps(cands->threshold());
+  for (; i + 8 <= n; i += 8) {
+    __m256 v = _mm256_loadu_ps(data + i);
+    int mask = _mm256_movemask_ps(_mm256_cmp_ps(v, threshold, _CMP_GT_OQ));
+    if (mask != 0) {
+      TopKPushMask(mask, i, data + i, cands);
+      threshold = _mm256_set1_ps(cands->threshold());
+    }
+  }
+  _mm256_zeroupper();
+  TopKScalar(data, i, n, cands);
+}
 
-  for (int32_t i = k; i < n; ++i) {
-    if (pq.top().first < data[i]) {
-      pq.pop();
-      pq.emplace(data[i], i);
+__attribute__((target("avx2,f16c"))) void TopKAvx2(const float16* data,
+                                                   int begin,
+                                                   int n,
+                                                   TopKCandidates* cands) {
+  int i = begin;
+  float values[8];
+  __m256 threshold = _mm256_set1_ps(cands->threshold());
+  for (; i + 8 <= n; i += 8) {
+    __m256 v = _mm256_cvtph_ps(
+        _mm_loadu_si128(reinterpret_cast<const __m128i*>(data + i)));
+    int mask = _mm256_movemask_ps(_mm256_cmp_ps(v, threshold, _CMP_GT_OQ));
+    if (mask != 0) {
+      _mm256_storeu_ps(values, v);
+      TopKPushMask(mask, i, values, cands);
+      threshold = _mm256_set1_ps(cands->threshold());
     }
   }
+  _mm256_zeroupper();
+  TopKScalar(data, i, n, cands);
+}
+
+bool HasAvx2() {
+  static const bool has_avx2 =
+      __builtin_cpu_supports("avx2") && __builtin_cpu_supports("f16c");
+  return has_avx2;
+}
+#endif
+
+}  // namespace
+
+template <typename T>
+int TopK(const T* data, int n, int k, float* values, int* indices) {
+  if (k <= 0 || n <= 0) return 0;
+  // thread local, so the steady state allocates nothing
+  static thread_local TopKCandidates cands;
+  cands.Init(k);
 
-  values->resize(std::min(k, n));
-  indices->resize(std::min(k, n));
-  int32_t cur = values->size() - 1;
-  while (!pq.empty()) {
-    const auto& item = pq.top();
-    (*values)[cur] = item.first;
-    (*indices)[cur] = item.second;
-    pq.pop();
-    cur -= 1;
+  int seed = std::min(k, n);
+  for (int i = 0; i < seed; ++i) {
+    cands.Seed(i, ToFloat(data[i]));
   }
+#ifdef PPS_HAVE_AVX2_TARGET
+  if (HasAvx2()) {
+    TopKAvx2(data, seed, n, &cands);
+    return cands.Output(values, indices);
+  }
+#endif
+  TopKScalar(data, seed, n, &cands);
+  return cands.Output(values, indices);
+}
+
+template int TopK<float>(
+    const float* data, int n, int k, float* values, int* indices);
+template int TopK<float16>(
+    const float16* data, int n, int k, float* values, int* indices);
+
+template <typename T>
+void TopK(const std::vector<T>& data,
+          int32_t k,
+          std::vector<T>* values,
+          std::vector<int>* indices) {
+  int n = data.size();
+  values->resize(std::max(std::min(k, n), 0));
+  indices->resize(values->size());
+  TopK(data.data(), n, k, values->data(), indices->data());
 }
 
 template void TopK<float>(const std::vector<float>& data,
@@ -81,4 +293,29 @@ template void TopK<float>(const std::vector<float>& data,
                           std::vector<float>* values,
                           std::vector<int>* indices);
 
+template <typename T>
+int EditDistance(const std::vector<T>& ref, const std::vector<T>& hyp) {
+  // one row of the dp table
+  std::vector<int> dist(hyp.size() + 1);
+  for (size_t j = 0; j <= hyp.size(); ++j) {
+    dist[j] = j;
+  }
+  for (size_t i = 1; i <= ref.size(); ++i) {
+    int prev = dist[0];  // dist[i-1][j-1]
+    dist[0] = i;
+    for (size_t j = 1; j <= hyp.size(); ++j) {
+      int cur = dist[j];  // dist[i-1][j]
+      int sub = prev + (ref[i - 1] == hyp[j - 1] ? 0 : 1);
+      dist[j] = std::min(sub, std::min(dist[j - 1], cur) + 1);
+      prev = cur;
+    }
+  }
+  return dist[hyp.size()];
+}
+
+template int EditDistance<int>(const std::vector<int>& ref,
+                               const std::vector<int>& hyp);
+template int EditDistance<std::string>(const std::vector<std::string>& ref,
+                                       const std::vector<std::string>& hyp);
+
 }  // namespace ppspeech
\ No newline at end of file
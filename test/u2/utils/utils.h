@@ -1,7 +1,10 @@
 #pragma once
 
+#include <cmath>
 #include <cstdint>
 #include <limits>
+#include <string>
+#include <utility>
 #include <vector>
 
 namespace ppspeech {
@@ -30,10 +33,71 @@ const char kSpaceSymbol[] = "\xe2\x96\x81";
 // sum of two probabilities in log scale
 float LogSumExp(float x, float y);
 
+namespace internal {
+// log(1 + exp(-d)) sampled every 1 / kLogAddTableScale for d in
+// [0, kLogAddMaxDiff], the entries beyond kLogAddMaxDiff are 0.
+const int kLogAddTableScale = 128;
+const int kLogAddMaxDiff = 16;
+const int kLogAddTableSize = kLogAddMaxDiff * kLogAddTableScale + 2;
+extern const float* const kLogAddTable;
+}  // namespace internal
+
+// LogSumExp by table lookup with linear interpolation, the error of the
+// log(1 + exp(-d)) term is below 2e-6, which is under the float resolution
+// of typical prefix scores. -kFloatMax is treated as log(0) like LogSumExp.
+inline float FastLogSumExp(float x, float y) {
+  const float* table = internal::kLogAddTable;
+  float max = x > y ? x : y;
+  float d = std::fabs(x - y) * internal::kLogAddTableScale;
+  if (!(d < internal::kLogAddMaxDiff * internal::kLogAddTableScale)) {
+    return max;
+  }
+  int i = static_cast<int>(d);
+  float frac = d - i;
+  return max + table[i] + frac * (table[i + 1] - table[i]);
+}
+
+// out[i] = FastLogSumExp(x[i], y[i]) for i in [0, n), uses AVX2 when the
+// cpu supports it. out may alias x or y.
+void LogSumExp(const float* x, const float* y, float* out, int n);
+
+// k largest values of data[0, n) and their indices in descending order,
+// ties are broken by the smaller index. values and indices are caller
+// buffers of capacity k, the number written, min(k, n), is returned.
+// Instantiated for float and float16. A threshold pass filters the input
+// (8 values per compare with AVX2), only values above the current k-th
+// largest are kept as candidates.
+template <typename T>
+int TopK(const T* data, int n, int k, float* values, int* indices);
+
 template <typename T>
 void TopK(const std::vector<T>& data,
           int32_t k,
           std::vector<T>* values,
           std::vector<int>* indices);
 
+// Resizes v to n as resize() does, but the elements dropped are moved to
+// spare and the elements added are taken from it, so the buffers they have
+// grown, e.g. of vectors or strings, are reused instead of reallocated. The
+// elements taken from spare keep their former values.
+template <typename T>
+void ResizeReusing(std::vector<T>* v, size_t n, std::vector<T>* spare) {
+  while (v->size() > n) {
+    spare->push_back(std::move(v->back()));
+    v->pop_back();
+  }
+  while (v->size() < n) {
+    if (spare->empty()) {
+      v->emplace_back();
+    } else {
+      v->push_back(std::move(spare->back()));
+      spare->pop_back();
+    }
+  }
+}
+
+// levenshtein distance between two sequences, e.g. for wer/cer
+template <typename T>
+int EditDistance(const std::vector<T>& ref, const std::vector<T>& hyp);
+
 }  // namespace ppspeech
\ No newline at end of file